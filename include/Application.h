@@ -39,6 +39,18 @@ public:
 	 */
 	void LockFPS(int nFPS);
 
+	/**
+	 * Block in network reactor instead of sleeping between frames. Must be called in OnInit.
+	 *
+	 * Without LockFPS, a frame only runs after some socket is ready, some network
+	 * deadline (reconnect, connect timeout, retransmission) arrives or some Timer
+	 * is due, so OnBreath is NOT called while idle. With LockFPS, frames keep their rate.
+	 *
+	 * \param	bBetweenFrames	With LockFPS, handle network events as soon as they arrive
+	 *							instead of at the next frame. OnBreath is not called for them.
+	 **/
+	void EnableEventLoop(bool bBetweenFrames = false);
+
 	/**
 	 * Initialization for this application.
 	 *
@@ -63,6 +75,8 @@ private:
 	std::atomic<bool>							_bRun;
 	int											_nExit;
 	double										_nPerFrame;
+	bool										_bEventLoop;
+	bool										_bBetweenFrames;
 	std::map<int, std::function<void (int)>>	_mSignalHanders;
 
 	friend struct AppSignalDispatcher;
@@ -2,8 +2,12 @@
 #define		__ENGINE_NETWORK_H_INCLUDED__
 
 #include	<cstdint>
+#include	<cstring>
+#include	<functional>
 #include	<string>
 
+class ThreadPool;
+
 namespace ENet {
 
 	/**
@@ -27,19 +31,146 @@ namespace ENet {
 	enum Close {
 		Local,
 		Remote,
-		BadData
+		BadData,
+		TimedOut,	//! Silent for longer than SetTimeout() allows.
+		Limited		//! Exceeded IServerSocket::SetRateLimit() with ENet::Disconnect.
+	};
+
+	/**
+	 * Number of close reasons. Keep it with the last one of ENet::Close.
+	 **/
+	const int CloseReasons = Limited + 1;
+
+	/**
+	 * Action on a client that exceeds its rate limit.
+	 **/
+	enum Limit {
+		Throttle,	//! Stop reading it until tokens are refilled. Data waits in kernel and TCP slows sender down.
+		Drop,		//! Discard its messages until tokens are refilled.
+		Disconnect	//! Close it with ENet::Limited.
+	};
+
+	/**
+	 * Length field format of built-in framing.
+	 **/
+	enum Length {
+		Stream = 0,	//! No framing. Data is delivered by OnReceive() as it arrives.
+		U16,		//! 2 bytes unsigned integer.
+		U32,		//! 4 bytes unsigned integer.
+		VarInt		//! Unsigned LEB128, 1 ~ 5 bytes.
 	};
 }
 
+/**
+ * Built-in framing. Each frame is [length][message id][body], where length
+ * counts body bytes only.
+ **/
+struct FrameOption {
+	ENet::Length	emLength;	//! Length field format. ENet::Stream disables framing.
+	int				nIdSize;	//! Size of message id field. 0, 2 or 4.
+	bool			bBigEndian;	//! Byte order of U16/U32 length and message id.
+	size_t			nMaxSize;	//! Max body size. Larger frame closes connection with ENet::BadData.
+
+	FrameOption(ENet::Length emLength = ENet::Stream, int nIdSize = 0, bool bBigEndian = false, size_t nMaxSize = 1048576)
+		: emLength(emLength), nIdSize(nIdSize), bBigEndian(bBigEndian), nMaxSize(nMaxSize) {}
+};
+
+#define		NET_MAXSLICES	64
+
+/**
+ * One piece of a message for scatter-gather Send(), so a header and a body built
+ * in different buffers are sent without being joined first.
+ **/
+struct NetSlice {
+	const char *	pData;
+	size_t			nSize;
+};
+
+/**
+ * Token bucket : holds up to dBurst tokens and gains dRate tokens per second.
+ * Each message takes its tokens, and an empty bucket triggers emAction.
+ **/
+struct RateLimit {
+	double		dRate;		//! Tokens per second. 0 disables the limit.
+	double		dBurst;		//! Size of bucket. 0 for one second of dRate.
+	ENet::Limit	emAction;	//! What to do while bucket is empty.
+
+	RateLimit(double dRate = 0, double dBurst = 0, ENet::Limit emAction = ENet::Throttle)
+		: dRate(dRate), dBurst(dBurst), emAction(emAction) {}
+};
+
+/**
+ * Options of reliable-ordered channel over UDP. See IReliableSocket.
+ **/
+struct ArqOption {
+	uint32_t	nMtu;			//! Max datagram size in bytes, 64 ~ 1472.
+	uint32_t	nSendWindow;	//! Max segments in flight.
+	uint32_t	nRecvWindow;	//! Max segments buffered by receiver.
+	uint32_t	nMinRto;		//! Lower bound of retransmission timeout in milliseconds.
+	uint32_t	nMaxRto;		//! Upper bound of retransmission timeout in milliseconds.
+	uint32_t	nFastResend;	//! Retransmit a segment skipped by this many later ACKs. 0 disables.
+	uint32_t	nDeadLink;		//! Close peer after one segment is sent this many times.
+	uint32_t	nSendQueue;		//! Max segments queued or in flight per peer, 255 at least.
+	bool		bCongestion;	//! Slow start and congestion window. Disable for a fixed-rate stream.
+
+	ArqOption()
+		: nMtu(1200), nSendWindow(256), nRecvWindow(256), nMinRto(30), nMaxRto(3000)
+		, nFastResend(2), nDeadLink(20), nSendQueue(8192), bCongestion(true) {}
+};
+
+/**
+ * Counters of one client, maintained by IServerSocket on main thread.
+ **/
+struct ConnectionStats {
+	uint64_t	nBytesIn;	//! Bytes received. Only message bodies with I/O threads and framing.
+	uint64_t	nBytesOut;	//! Bytes given to Send(), SendFrame(), Broadcast() and so on
+	uint64_t	nMsgsIn;	//! Frames delivered by OnMessage()
+	uint64_t	nMsgsOut;	//! Frames queued by SendFrame(), BroadcastFrame() and MulticastFrame()
+	size_t		nQueuedMax;	//! High-water mark of send queue in bytes
+
+	ConnectionStats() : nBytesIn(0), nBytesOut(0), nMsgsIn(0), nMsgsOut(0), nQueuedMax(0) {}
+};
+
+#define		NET_LATENCY_BUCKETS		24
+
+/**
+ * Counters of one server. They only grow, so rates come from the difference of two
+ * snapshots taken by IServerSocket::Stats() (eg. once per second).
+ **/
+struct ServerStats {
+	uint64_t	nAccepted;		//! Clients accepted
+	size_t		nAlive;			//! Clients connected now
+	uint64_t	nBytesIn;		//! Bytes received
+	uint64_t	nBytesOut;		//! Bytes given to send functions
+	uint64_t	nMsgsIn;		//! Frames received
+	uint64_t	nMsgsOut;		//! Frames sent
+	uint64_t	nRecvCalls;		//! recv() calls or io_uring recv completions
+	uint64_t	nSendCalls;		//! sendmsg() calls or io_uring sends
+	uint64_t	nWouldBlock;	//! Writes stopped by a full socket buffer (EAGAIN)
+	uint64_t	nPostDropped;	//! PostSend() to closed clients or full send queues
+	uint64_t	nReadDeferred;	//! Reads stopped by SetReadBudget() and continued in a later Breath()
+	uint64_t	nThrottled;		//! Times a client stopped being read by SetRateLimit()
+	uint64_t	nLimitDropped;	//! Messages discarded by SetRateLimit()
+	uint64_t	nRefused;		//! Clients closed on accept by SetAcceptLimit()
+	size_t		nQueuedMax;		//! High-water mark of any client's send queue in bytes
+	uint64_t	pCloses[ENet::CloseReasons];	//! Closed clients by ENet::Close
+	uint64_t	nBreaths;		//! Calls of Breath()
+	double		dBreathMax;		//! Slowest Breath() in milliseconds
+	uint64_t	pBreathLatency[NET_LATENCY_BUCKETS];	//! [0] < 1us, [i] in [2^(i-1), 2^i) us, last one is open
+
+	ServerStats() { memset(this, 0, sizeof(ServerStats)); }
+};
+
 /**
  * TCP Connection information.
  **/
 struct Connection {
-	uint64_t	nId;		//! Client identifier
-	int			nSocket;	//! Socket fd
-	uint32_t	nIP;		//! IP address
-	int			nPort;		//! Port
-	void *		pData;		//! User data
+	uint64_t		nId;		//! Client identifier
+	int				nSocket;	//! Socket fd
+	uint32_t		nIP;		//! IP address, 0 for a Unix domain socket client
+	int				nPort;		//! Port, 0 for a Unix domain socket client
+	void *			pData;		//! User data
+	ConnectionStats	iStats;		//! Traffic counters (IServerSocket only)
 
 	std::string	IP() const;
 };
@@ -53,12 +184,17 @@ public:
 	virtual ~ISocket();
 
 	/**
-	 * Connect to TCP server.
+	 * Start connecting to TCP server. Never blocks. Result is reported from Breath()
+	 * by OnConnected() or OnConnectFail().
+	 *
+	 * With auto-reconnect, a failed attempt or a connection closed by remote is
+	 * retried after a delay that doubles on every failure. See SetReconnect().
 	 *
-	 * \param	sIP		IP address of remote server.
-	 * \param	nPort	Port to connect to.
+	 * \param	sIP		IP address of remote server, or "unix:/path" for a Unix domain socket
+	 *					("unix:@name" for abstract namespace). (Linux only)
+	 * \param	nPort	Port to connect to. Ignored for a Unix domain socket.
 	 * \param	bAutoReconnect	Set 'true' to enable auto-reconnect.
-	 * \return	Connect status. See ENet::Error for detail information.
+	 * \return	ENet::Success if connecting started, ENet::Running if already started.
 	 **/
 	int Connect(const std::string & sIP, int nPort, bool bAutoReconnect = false);
 
@@ -68,19 +204,128 @@ public:
 	bool IsConnected();
 
 	/**
-	 * Disconnect from server.
+	 * Set delay bounds of auto-reconnect. Default is 1 ~ 30 seconds. Each retry is
+	 * delayed by a random time between half and all of current delay, so many clients
+	 * losing the same server do not come back at once.
+	 *
+	 * \param	nMinDelay	First delay in milliseconds.
+	 * \param	nMaxDelay	Max delay in milliseconds.
+	 **/
+	void SetReconnect(uint32_t nMinDelay, uint32_t nMaxDelay);
+
+	/**
+	 * Disconnect from server. Also cancels connecting and auto-reconnect.
 	 **/
 	void Close();
 
 	/**
-	 * Send data to server.
+	 * Send data to server. Never blocks. Data can NOT be written immediately is queued
+	 * and flushed in Breath() once the socket becomes writable.
+	 * In coalescing mode, data is always queued until Flush(). See SetCoalesce().
+	 * Data sent while connecting is written once connected, or dropped if that fails.
 	 *
 	 * \param	pData	Pointer to data buffer.
 	 * \param	nSize	Size of data to be sent.
-	 * \return	Failed to send data will return false.
+	 * \return	False when not connected or the send queue would exceed its limit.
 	 **/
 	bool Send(const char * pData, size_t nSize);
 
+	/**
+	 * Get bytes queued but not written to socket yet. Useful to detect back-pressure.
+	 **/
+	size_t Pending();
+
+	/**
+	 * Set max bytes allowed in send queue. Default is 64M.
+	 *
+	 * \param	nLimit	Send() fails when queued bytes would exceed this.
+	 **/
+	void SetSendLimit(size_t nLimit);
+
+	/**
+	 * Enable built-in framing. Should be called before Connect().
+	 *
+	 * \param	rOpt	Frame format. See FrameOption.
+	 * \return	False for bad option.
+	 **/
+	bool SetFrame(const FrameOption & rOpt);
+
+	/**
+	 * Send one frame with header built by the format given to SetFrame().
+	 *
+	 * \param	nMsgId	Message id. Ignored when format has no id field.
+	 * \param	pData	Pointer to message body.
+	 * \param	nSize	Size of message body.
+	 * \return	Same as Send().
+	 **/
+	bool SendFrame(uint32_t nMsgId, const char * pData, size_t nSize);
+
+	/**
+	 * Send a message made of many pieces as if they were one buffer. Pieces go to
+	 * writev() or into send queue directly, without being joined first.
+	 *
+	 * \param	pSlices	Pieces in order.
+	 * \param	nCount	Number of pieces, at most NET_MAXSLICES.
+	 * \return	Same as Send(). Also false if nCount is out of range.
+	 **/
+	bool Send(const NetSlice * pSlices, int nCount);
+
+	/**
+	 * Send one frame whose body is made of many pieces. See Send() and SendFrame().
+	 **/
+	bool SendFrame(uint32_t nMsgId, const NetSlice * pSlices, int nCount);
+
+	/**
+	 * Reserve space for a message at the tail of send queue, with room for frame
+	 * header in front, so it can be serialized in place without a temporary buffer.
+	 * Finish it with Commit() before sending anything else or calling Breath().
+	 *
+	 * \param	nCapacity	Max size of message body.
+	 * \return	Where to write message body. nullptr when not connected or the send
+	 *			queue would exceed its limit.
+	 **/
+	char * Prepare(size_t nCapacity);
+
+	/**
+	 * Send the message written into space returned by Prepare(). Frame header is
+	 * filled in front of it when framing is enabled.
+	 *
+	 * \param	nMsgId	Message id. Ignored when format has no id field or without framing.
+	 * \param	nSize	Bytes written, no more than capacity given to Prepare().
+	 * \return	False if nothing is prepared or nSize is too large.
+	 **/
+	bool Commit(uint32_t nMsgId, size_t nSize);
+
+	/**
+	 * Send data from any thread (eg. a ThreadPool job). Data is copied into a lock-free
+	 * queue and sent by the thread calling Breath(), which is woken up if it is waiting
+	 * in the event loop. Dropped if Send() fails by then (eg. not connected).
+	 *
+	 * \param	pData	Pointer to data buffer.
+	 * \param	nSize	Size of data to be sent.
+	 **/
+	void PostSend(const char * pData, size_t nSize);
+
+	/**
+	 * Send one frame from any thread. See PostSend() and SendFrame().
+	 **/
+	void PostSendFrame(uint32_t nMsgId, const char * pData, size_t nSize);
+
+	/**
+	 * Coalesce writes. When enabled, Send() and SendFrame() only append to send queue,
+	 * and everything queued in a frame is written by one writev at Flush(). Default is off.
+	 *
+	 * \param	bEnable	True to enable.
+	 **/
+	void SetCoalesce(bool bEnable);
+
+	/**
+	 * Write data queued by coalescing mode now. Application calls this at the end of
+	 * every frame. Call it yourself for latency-critical messages, or after your own
+	 * frame when not using Application.
+	 **/
+	void Flush();
+
 	/**
 	 * Process all received data at once. This may invoke OnReceive() many times.
 	 * NOTE : Except using Application, you should call this in you main event loop.
@@ -93,12 +338,29 @@ public:
 	virtual void OnConnected() {}
 
 	/**
-	 * Action to do when received message from server.
+	 * Action to do when a connect attempt failed. Socket is already waiting for
+	 * next retry when auto-reconnect is enabled. Call Close() to give up.
+	 *
+	 * \param	nError	ENet::Timeout, or system error code like ECONNREFUSED.
+	 **/
+	virtual void OnConnectFail(int nError) {}
+
+	/**
+	 * Action to do when received data from server without framing.
 	 *
 	 * \param	pData	Pointer to message.
 	 * \param	nSize	Size of this message in bytes.
 	 **/
-	virtual void OnReceive(char * pData, size_t nSize) = 0;
+	virtual void OnReceive(char * pData, size_t nSize) {}
+
+	/**
+	 * Action to do for each complete frame when framing is enabled by SetFrame().
+	 *
+	 * \param	nMsgId	Message id. 0 when format has no id field.
+	 * \param	pData	Pointer to message body. Points into receive buffer, valid only in this call.
+	 * \param	nSize	Size of message body.
+	 **/
+	virtual void OnMessage(uint32_t nMsgId, char * pData, size_t nSize) {}
 
 	/**
 	 * Action to do when disconnect from server. Detail info will output to logs.
@@ -108,8 +370,8 @@ public:
 	virtual void OnClose(ENet::Close emCode) {}
 
 private:
+	friend class NetworkBreather;
 	class SocketContext *	_pCtx;
-	class SocketGuard *		_pGuard;
 };
 
 /**
@@ -123,38 +385,351 @@ public:
 	/**
 	 * Listen for connections.
 	 *
-	 * \param	sIP		Listen IP.
-	 * \param	nPort	Port to listen on.
+	 * \param	sIP			Listen IP, or "unix:/path" for a Unix domain socket ("unix:@name" for
+	 *						abstract namespace). A socket file left by a dead process is replaced, and
+	 *						Shutdown() removes it. (Linux only)
+	 * \param	nPort		Port to listen on. Ignored for a Unix domain socket.
+	 * \param	nIOThreads	Number of I/O threads. 0 means accept and receive in Breath(). Otherwise
+	 *						each thread owns an epoll and a SO_REUSEPORT listener, and received data
+	 *						is still delivered by OnReceive() in Breath(). (Linux only)
+	 *						With 0 and a build with URING=1, io_uring is used instead of epoll.
 	 * \return	Listen status. See ENet::Error.
 	 **/
-	int Listen(const std::string & sIP, int nPort);
+	int Listen(const std::string & sIP, int nPort, int nIOThreads = 0);
 
 	/**
 	 * Get connection info.
 	 *
 	 * \param	nConnId	Client identifier generated by OnAccept().
-	 * \return	Connection pointer.
+	 * \return	Connection pointer. nullptr if that client has been closed, even when its slot is reused.
 	 **/
 	Connection * Find(uint64_t nConnId);
 
 	/**
-	 * Send data to special client.
+	 * Send data to special client. Never blocks. Data can NOT be written immediately
+	 * is queued and flushed in Breath() once the socket becomes writable.
+	 * In coalescing mode, data is always queued until Flush(). See SetCoalesce().
 	 *
 	 * \param	pConn	Client connection;
 	 * \param	pData	Pointer to data buffer.
 	 * \param	nSize	Size of data.
-	 * \return	if successfully send.
+	 * \return	False when connection is broken or its send queue would exceed the limit.
 	 **/
 	bool Send(Connection * pConn, const char * pData, size_t nSize);
 
 	/**
-	 * Broadcast message to all connected clients.
+	 * Get bytes queued for a client but not written to socket yet.
+	 *
+	 * \param	pConn	Client connection.
+	 * \return	Pending bytes. Useful to detect slow clients.
+	 **/
+	size_t Pending(Connection * pConn);
+
+	/**
+	 * Set max bytes allowed in each client's send queue. Default is 64M.
+	 *
+	 * \param	nLimit	Send() fails when queued bytes would exceed this.
+	 **/
+	void SetSendLimit(size_t nLimit);
+
+	/**
+	 * Enable built-in framing for all clients. Should be called before Listen().
+	 *
+	 * \param	rOpt	Frame format. See FrameOption.
+	 * \return	False for bad option.
+	 **/
+	bool SetFrame(const FrameOption & rOpt);
+
+	/**
+	 * Send one frame with header built by the format given to SetFrame().
+	 *
+	 * \param	pConn	Client connection.
+	 * \param	nMsgId	Message id. Ignored when format has no id field.
+	 * \param	pData	Pointer to message body.
+	 * \param	nSize	Size of message body.
+	 * \return	Same as Send().
+	 **/
+	bool SendFrame(Connection * pConn, uint32_t nMsgId, const char * pData, size_t nSize);
+
+	/**
+	 * Send a message made of many pieces as if they were one buffer. Pieces go to
+	 * writev() or into send queue directly, without being joined first.
+	 *
+	 * \param	pConn	Client connection.
+	 * \param	pSlices	Pieces in order.
+	 * \param	nCount	Number of pieces, at most NET_MAXSLICES.
+	 * \return	Same as Send(). Also false if nCount is out of range.
+	 **/
+	bool Send(Connection * pConn, const NetSlice * pSlices, int nCount);
+
+	/**
+	 * Send one frame whose body is made of many pieces. See Send() and SendFrame().
+	 **/
+	bool SendFrame(Connection * pConn, uint32_t nMsgId, const NetSlice * pSlices, int nCount);
+
+	/**
+	 * Reserve space for a message at the tail of client's send queue, with room for
+	 * frame header in front, so it can be serialized in place without a temporary
+	 * buffer. Finish it with Commit() before sending anything else to this client or
+	 * calling Breath()/Flush().
+	 *
+	 * Usage:
+	 *
+	 *	char * pBody = Prepare(pConn, 256);
+	 *	if (pBody) Commit(pConn, MSG_LOGIN, WriteLoginReply(pBody, 256));
+	 *
+	 * \param	pConn		Client connection.
+	 * \param	nCapacity	Max size of message body.
+	 * \return	Where to write message body. nullptr if send queue would exceed its limit.
+	 **/
+	char * Prepare(Connection * pConn, size_t nCapacity);
+
+	/**
+	 * Send the message written into space returned by Prepare(). Frame header is
+	 * filled in front of it when framing is enabled.
+	 *
+	 * \param	pConn	Client connection.
+	 * \param	nMsgId	Message id. Ignored when format has no id field or without framing.
+	 * \param	nSize	Bytes written, no more than capacity given to Prepare().
+	 * \return	False if nothing is prepared or nSize is too large.
+	 **/
+	bool Commit(Connection * pConn, uint32_t nMsgId, size_t nSize);
+
+	/**
+	 * Send a range of file. It waits in send queue as a file descriptor and is
+	 * written by sendfile() whenever socket is writable, so a file of any size is
+	 * neither copied nor read into memory at once, and never blocks this thread.
+	 * Without sendfile() (io_uring, Windows) it is read 256KB at a time.
+	 *
+	 * Data is written by Flush() or at the end of Breath(). File content must NOT
+	 * change until it is sent.
+	 *
+	 * \param	pConn	Client connection.
+	 * \param	sPath	Path of a regular file.
+	 * \param	nOffset	Offset of the first byte.
+	 * \param	nSize	Bytes to send. 0 sends everything after nOffset.
+	 * \return	False if file can NOT be opened, range is out of file, or send queue is full.
+	 **/
+	bool SendFile(Connection * pConn, const std::string & sPath, uint64_t nOffset = 0, uint64_t nSize = 0);
+
+	/**
+	 * Send a range of an opened file. The descriptor is duplicated, so caller may
+	 * close it right after this returns. See SendFile().
+	 **/
+	bool SendFile(Connection * pConn, int nFile, uint64_t nOffset, uint64_t nSize);
+
+	/**
+	 * Send a range of file as the body of one frame. See SendFile() and SendFrame().
+	 **/
+	bool SendFileFrame(Connection * pConn, uint32_t nMsgId, const std::string & sPath, uint64_t nOffset = 0, uint64_t nSize = 0);
+
+	/**
+	 * Send a large buffer without copying it. On Linux servers using epoll, buffers
+	 * of 16KB and more are sent with MSG_ZEROCOPY, so kernel reads them in place
+	 * until it reports completion. Other buffers are copied as Send() does.
+	 *
+	 * The buffer must NOT be modified or freed until fDone is invoked on main
+	 * thread, which happens when kernel reports completion, after a copy (maybe
+	 * before this returns), or when connection is closed before it was sent.
+	 * Once kernel took the buffer, closing the connection does NOT free it: the
+	 * socket stays open until completion is reported, for at most 30 seconds
+	 * after which it is reset, or until this server is destroyed.
+	 *
+	 * Data is written by Flush() or at the end of Breath().
+	 *
+	 * \param	pConn	Client connection.
+	 * \param	pData	Pointer to data buffer.
+	 * \param	nSize	Size of data.
+	 * \param	fDone	Invoked once the buffer is free again. It may send or close.
+	 * \return	False if send queue is full. fDone is NOT invoked then.
+	 **/
+	bool SendZeroCopy(Connection * pConn, const char * pData, size_t nSize, std::function<void ()> fDone);
+
+	/**
+	 * Send a large buffer without copying it as the body of one frame. See SendZeroCopy().
+	 **/
+	bool SendZeroCopyFrame(Connection * pConn, uint32_t nMsgId, const char * pData, size_t nSize, std::function<void ()> fDone);
+
+	/**
+	 * Send data from any thread (eg. a ThreadPool job) without touching Connection,
+	 * which only lives on main thread. Data is copied into a lock-free queue and sent
+	 * in next Breath(), which is woken up if main thread waits in the event loop.
+	 * Posts to a closed client are dropped, even if its slot was reused by a new one.
+	 *
+	 * \param	nConnId	Connection::nId of client.
+	 * \param	pData	Pointer to data buffer.
+	 * \param	nSize	Size of data.
+	 **/
+	void PostSend(uint64_t nConnId, const char * pData, size_t nSize);
+
+	/**
+	 * Send one frame from any thread. See PostSend() and SendFrame().
+	 **/
+	void PostSendFrame(uint64_t nConnId, uint32_t nMsgId, const char * pData, size_t nSize);
+
+	/**
+	 * Broadcast message to all connected clients. Data is copied once and shared by
+	 * all send queues, then written to sockets together in next Breath(). Clients
+	 * whose queue exceeds the send limit are skipped.
 	 *
 	 * \param	pData	Pointer to data buffer.
 	 * \param	nSize	Size of data.
 	 **/
 	void Broadcast(const char * pData, size_t nSize);
 
+	/**
+	 * Broadcast one frame to all connected clients. See SetFrame().
+	 *
+	 * \param	nMsgId	Message id. Ignored when format has no id field.
+	 * \param	pData	Pointer to message body.
+	 * \param	nSize	Size of message body.
+	 **/
+	void BroadcastFrame(uint32_t nMsgId, const char * pData, size_t nSize);
+
+	/**
+	 * Add client into a broadcast group (eg. chat channel, zone). A client can be in
+	 * many groups and leaves all of them when closed.
+	 *
+	 * \param	pConn	Client connection.
+	 * \param	nGroup	Group identifier defined by user.
+	 * \return	False if client is already in that group.
+	 **/
+	bool Join(Connection * pConn, uint32_t nGroup);
+
+	/**
+	 * Remove client from a broadcast group.
+	 *
+	 * \param	pConn	Client connection.
+	 * \param	nGroup	Group identifier.
+	 * \return	False if client is not in that group.
+	 **/
+	bool Leave(Connection * pConn, uint32_t nGroup);
+
+	/**
+	 * Send message to all clients in a group. Works like Broadcast().
+	 *
+	 * \param	nGroup	Group identifier.
+	 * \param	pData	Pointer to data buffer.
+	 * \param	nSize	Size of data.
+	 * \return	Number of clients the message was queued to.
+	 **/
+	size_t Multicast(uint32_t nGroup, const char * pData, size_t nSize);
+
+	/**
+	 * Send one frame to all clients in a group. See SetFrame().
+	 *
+	 * \param	nGroup	Group identifier.
+	 * \param	nMsgId	Message id. Ignored when format has no id field.
+	 * \param	pData	Pointer to message body.
+	 * \param	nSize	Size of message body.
+	 * \return	Number of clients the message was queued to.
+	 **/
+	size_t MulticastFrame(uint32_t nGroup, uint32_t nMsgId, const char * pData, size_t nSize);
+
+	/**
+	 * Coalesce writes for all clients. When enabled, Send() and SendFrame() only append
+	 * to send queue, and each client with new data gets one writev at Flush(). Chatty
+	 * protocols save most of their syscalls and small packets. Default is off.
+	 *
+	 * \param	bEnable	True to enable.
+	 **/
+	void SetCoalesce(bool bEnable);
+
+	/**
+	 * Write data queued for one client now. Use it for latency-critical messages in
+	 * coalescing mode.
+	 *
+	 * \param	pConn	Client connection.
+	 **/
+	void Flush(Connection * pConn);
+
+	/**
+	 * Write data queued for all clients now. Application calls this at the end of every
+	 * frame. Call it yourself after your own frame when not using Application.
+	 **/
+	void Flush();
+
+	/**
+	 * Close clients that stay silent too long with ENet::TimedOut. Breath() only looks at
+	 * the clients that expired, never scans all of them. 0 disables. Default is 0.
+	 *
+	 * \param	nRead	Milliseconds a client may send nothing. Catches half-open connections.
+	 * \param	nIdle	Milliseconds a client may neither send nor receive anything.
+	 **/
+	void SetTimeout(uint32_t nRead, uint32_t nIdle = 0);
+
+	/**
+	 * Application level heartbeat. OnHeartbeat() is invoked every nInterval milliseconds
+	 * while a client sends nothing, so a live client can be pinged into answering before
+	 * its read timeout. 0 disables. Default is 0.
+	 *
+	 * \param	nInterval	Milliseconds of silence before each heartbeat.
+	 **/
+	void SetHeartbeat(uint32_t nInterval);
+
+	/**
+	 * Bound the reading done by one Breath(), so a client flooding data can NOT hold
+	 * the whole frame while others wait. A client that reaches its budget keeps the
+	 * rest (in kernel or in its receive buffer) for next Breath(), where it is read
+	 * after clients that became readable before it. Clients not reached before the
+	 * time budget runs out are read first in next Breath(). 0 disables any of them.
+	 * Default is no budget.
+	 *
+	 * Byte and message budgets apply to servers reading on main thread with epoll
+	 * (or select on Windows). With I/O threads or io_uring, only the time budget
+	 * applies, to handling received data on main thread.
+	 *
+	 * \param	nBytes		Bytes read from one client per Breath().
+	 * \param	nMessages	Frames delivered for one client per Breath(). Only with framing.
+	 * \param	dMillis		Milliseconds one Breath() may spend on received data.
+	 **/
+	void SetReadBudget(size_t nBytes, uint32_t nMessages = 0, double dMillis = 0);
+
+	/**
+	 * Limit what each client may send, checked in O(1) per message without allocation.
+	 * Bytes count message bodies (or received chunks without framing), and messages
+	 * count frames (or chunks). Buckets of connected clients are refilled at once.
+	 * Default is no limit.
+	 *
+	 * ENet::Throttle only stops reading on servers reading on main thread with epoll
+	 * (or select on Windows). With I/O threads or io_uring data is read already, so
+	 * it discards messages like ENet::Drop.
+	 *
+	 * \param	rBytes	Limit of received bytes.
+	 * \param	rMsgs	Limit of received messages.
+	 **/
+	void SetRateLimit(const RateLimit & rBytes, const RateLimit & rMsgs = RateLimit());
+
+	/**
+	 * Limit connections per second from one IP, so a client reconnecting in a loop
+	 * costs one accept() and close() each time. Extra connections are closed before
+	 * OnAccept() whatever emAction says. IPs share a fixed table of 4096 buckets, and
+	 * the IP seen least recently gives its bucket away when the table is crowded.
+	 * Default is no limit.
+	 *
+	 * \param	rLimit	Connections allowed per second and burst. Rate 0 disables.
+	 **/
+	void SetAcceptLimit(const RateLimit & rLimit);
+
+	/**
+	 * Take a snapshot of counters. Per client counters are in Connection::iStats.
+	 *
+	 * \param	rStats	Output.
+	 **/
+	void Stats(ServerStats & rStats);
+
+	/**
+	 * Run OnWork() on ThreadPool workers instead of OnReceive()/OnMessage() on main
+	 * thread, for stateless services (eg. login validation). Each connection gets a
+	 * strand : its messages run one after another in order, while different
+	 * connections run in parallel. Reply with PostSend() or PostSendFrame().
+	 * Should be called before Listen(). Shutdown() drops waiting messages and waits
+	 * for running OnWork() to return, so call it before destroying this object.
+	 *
+	 * \param	pPool	Workers to run on. Must outlive this server. nullptr disables.
+	 **/
+	void SetDispatch(ThreadPool * pPool);
+
 	/**
 	 * Manually close a connection with special client.
 	 *
@@ -181,13 +756,23 @@ public:
 	virtual void OnAccept(Connection * pConn) {}
 
 	/**
-	 * Invoked by OnTick(). Jobs to with message received from client.
+	 * Invoked by Breath(). Jobs to with data received from client without framing.
 	 *
 	 * \param	pConn	Client information.
 	 * \param	pData	Pointer to message data buffer.
 	 * \param	nSize	Message size.
 	 **/
-	virtual void OnReceive(Connection * pConn, char * pData, size_t nSize) = 0;
+	virtual void OnReceive(Connection * pConn, char * pData, size_t nSize) {}
+
+	/**
+	 * Invoked by Breath() for each complete frame when framing is enabled by SetFrame().
+	 *
+	 * \param	pConn	Client information.
+	 * \param	nMsgId	Message id. 0 when format has no id field.
+	 * \param	pData	Pointer to message body. Points into receive buffer, valid only in this call.
+	 * \param	nSize	Size of message body.
+	 **/
+	virtual void OnMessage(Connection * pConn, uint32_t nMsgId, char * pData, size_t nSize) {}
 
 	/**
 	 * Invoked after a client disconnect with this server.
@@ -197,13 +782,567 @@ public:
 	 **/
 	virtual void OnClose(Connection * pConn, ENet::Close emCode) {}
 
+	/**
+	 * Invoked by Breath() when a client has been silent for the interval given to
+	 * SetHeartbeat(). Send your ping message here.
+	 *
+	 * \param	pConn	Client information.
+	 **/
+	virtual void OnHeartbeat(Connection * pConn) {}
+
+	/**
+	 * Invoked by a ThreadPool worker for each complete frame (or each received chunk
+	 * without framing) when SetDispatch() is enabled. Connection may already be closed.
+	 *
+	 * \param	nConnId	Connection::nId of client.
+	 * \param	nMsgId	Message id. 0 without framing or when format has no id field.
+	 * \param	pData	Pointer to message. Valid only in this call.
+	 * \param	nSize	Size of message.
+	 **/
+	virtual void OnWork(uint64_t nConnId, uint32_t nMsgId, char * pData, size_t nSize) {}
+
 	/**
 	 * Action to do before server shutdown.
 	 **/
 	virtual void OnShutdown() {}
 
 private:
+	friend class NetworkBreather;
 	class ServerSocketContext *	_pCtx;
 };
 
+/**
+ * UDP endpoint working as both client and server. Remote addresses are tracked
+ * as peers with Connection-style identifiers. Datagrams are received in batches
+ * by Breath() and sent in batches by Flush(), which Application calls at the end
+ * of every frame.
+ **/
+class IUdpSocket {
+public:
+	IUdpSocket();
+	virtual ~IUdpSocket();
+
+	/**
+	 * Open socket on local address.
+	 *
+	 * \param	sIP		Local IP. "0.0.0.0" for all interfaces.
+	 * \param	nPort	Local port. 0 lets system pick one, which is usual for clients.
+	 * \return	Bind status. See ENet::Error.
+	 **/
+	int Bind(const std::string & sIP, int nPort);
+
+	/**
+	 * Get peer of a remote address, creating it if unknown. OnAccept() is NOT invoked
+	 * for peers created by this.
+	 *
+	 * \param	sIP		Remote IP.
+	 * \param	nPort	Remote port.
+	 * \return	Peer information. nullptr if socket is not opened or address is bad.
+	 **/
+	Connection * Peer(const std::string & sIP, int nPort);
+
+	/**
+	 * Get peer info.
+	 *
+	 * \param	nPeerId	Peer identifier.
+	 * \return	Peer pointer. nullptr if that peer has been closed, even when its slot is reused.
+	 **/
+	Connection * Find(uint64_t nPeerId);
+
+	/**
+	 * Limit peers kept at once. Source addresses are easy to forge, so while the
+	 * limit is reached, datagrams from unknown addresses are ignored without calling
+	 * OnAccept(). Peer() is NOT limited. Default is 65536.
+	 *
+	 * \param	nLimit	Max peers.
+	 **/
+	void SetPeerLimit(size_t nLimit);
+
+	/**
+	 * Queue one datagram to peer. Never blocks. Queued datagrams are written together
+	 * by Flush() or next Breath(). Consecutive datagrams of the same size to one peer
+	 * are handed to kernel as one message when UDP GSO is available.
+	 *
+	 * \param	pPeer	Remote peer.
+	 * \param	pData	Pointer to data buffer.
+	 * \param	nSize	Size of data. At most 65507 bytes.
+	 * \return	False when socket is not opened, or too many bytes are queued.
+	 **/
+	bool Send(Connection * pPeer, const char * pData, size_t nSize);
+
+	/**
+	 * Write all queued datagrams now.
+	 **/
+	void Flush();
+
+	/**
+	 * Forget a peer. Datagrams from its address will create a new one.
+	 *
+	 * \param	pPeer	Remote peer.
+	 **/
+	void Close(Connection * pPeer);
+
+	/**
+	 * Close socket and forget all peers.
+	 **/
+	void Shutdown();
+
+	/**
+	 * Process all received datagrams at once. This may invoke OnReceive() many times.
+	 * NOTE : Except using Application, you should call this in you main event loop.
+	 **/
+	void Breath();
+
+	/**
+	 * Invoked when a datagram comes from an unknown address. Close() the peer here to
+	 * ignore it. Peers are kept until Close(), so also Close() those gone silent, or
+	 * forged addresses fill up SetPeerLimit().
+	 *
+	 * \param	pPeer	Peer information.
+	 **/
+	virtual void OnAccept(Connection * pPeer) {}
+
+	/**
+	 * Invoked by Breath() for each datagram.
+	 *
+	 * \param	pPeer	Peer information.
+	 * \param	pData	Pointer to datagram. Valid only in this call.
+	 * \param	nSize	Datagram size.
+	 **/
+	virtual void OnReceive(Connection * pPeer, char * pData, size_t nSize) {}
+
+	/**
+	 * Invoked when a peer is forgotten.
+	 *
+	 * \param	pPeer	Peer information.
+	 * \param	emCode	Close reason. See ENet::Close.
+	 **/
+	virtual void OnClose(Connection * pPeer, ENet::Close emCode) {}
+
+	/**
+	 * Action to do before socket is closed.
+	 **/
+	virtual void OnShutdown() {}
+
+private:
+	friend class NetworkBreather;
+	class UdpSocketContext *	_pCtx;
+};
+
+/**
+ * Reliable, ordered messages over UDP (ARQ). Lost datagrams are found by selective
+ * ACKs and fast retransmit instead of waiting for timeout, and one lost datagram
+ * does NOT block other peers. Works like IServerSocket, except both sides Bind()
+ * and the client side gets its server by Connect().
+ **/
+class IReliableSocket {
+public:
+	IReliableSocket();
+	virtual ~IReliableSocket();
+
+	/**
+	 * Set channel options. Only affects peers created after this.
+	 *
+	 * \param	rOpt	See ArqOption.
+	 * \return	False for bad option.
+	 **/
+	bool SetOption(const ArqOption & rOpt);
+
+	/**
+	 * Open socket on local address.
+	 *
+	 * \param	sIP		Local IP. "0.0.0.0" for all interfaces.
+	 * \param	nPort	Local port. 0 lets system pick one, which is usual for clients.
+	 * \return	Bind status. See ENet::Error.
+	 **/
+	int Bind(const std::string & sIP, int nPort);
+
+	/**
+	 * Start a session with remote socket. Nothing is sent until the first Send().
+	 *
+	 * \param	sIP		Remote IP.
+	 * \param	nPort	Remote port.
+	 * \return	Peer information. nullptr if socket is not opened or address is bad.
+	 **/
+	Connection * Connect(const std::string & sIP, int nPort);
+
+	/**
+	 * Get peer info.
+	 *
+	 * \param	nPeerId	Peer identifier.
+	 * \return	Peer pointer. nullptr if that peer has been closed, even when its slot is reused.
+	 **/
+	Connection * Find(uint64_t nPeerId);
+
+	/**
+	 * Limit remote addresses kept at once, see IUdpSocket::SetPeerLimit(). While the
+	 * limit is reached, new sessions from remote are ignored. Default is 65536.
+	 *
+	 * \param	nLimit	Max peers.
+	 **/
+	void SetPeerLimit(size_t nLimit);
+
+	/**
+	 * Queue one message. Never blocks. Message is split into segments and delivered
+	 * to remote OnReceive() in whole and in order.
+	 *
+	 * \param	pPeer	Remote peer.
+	 * \param	pData	Pointer to message.
+	 * \param	nSize	Size of message. At most 255 segments.
+	 * \return	False when peer is closed, message is too large or ArqOption::nSendQueue is reached.
+	 **/
+	bool Send(Connection * pPeer, const char * pData, size_t nSize);
+
+	/**
+	 * Get segments queued or in flight for a peer. Useful to detect back-pressure.
+	 **/
+	size_t Pending(Connection * pPeer);
+
+	/**
+	 * Run timers, then send ACKs, retransmissions and new segments of all peers.
+	 * Application calls this in every Breath() and at the end of every frame.
+	 **/
+	void Flush();
+
+	/**
+	 * Close session with a peer. Remote side is told about it once, without retry.
+	 *
+	 * \param	pPeer	Remote peer.
+	 **/
+	void Close(Connection * pPeer);
+
+	/**
+	 * Close all sessions and the socket.
+	 **/
+	void Shutdown();
+
+	/**
+	 * Receive datagrams and then Flush(). This may invoke OnReceive() many times.
+	 * NOTE : Except using Application, you should call this in you main event loop.
+	 **/
+	void Breath();
+
+	/**
+	 * Test facility : outgoing datagrams are dropped with given probability, and the
+	 * rest are delayed by nDelay + random(0, nJitter) milliseconds, which reorders
+	 * them. Use it on loopback to try a lossy link in one process.
+	 *
+	 * \param	fLoss	Drop probability, 0 ~ 1. 0 with no delay disables simulation.
+	 * \param	nDelay	Fixed delay in milliseconds.
+	 * \param	nJitter	Max random extra delay in milliseconds.
+	 **/
+	void Simulate(double fLoss, uint32_t nDelay = 0, uint32_t nJitter = 0);
+
+	/**
+	 * Invoked when a new session comes from remote. A session that never gets any
+	 * message to send is NOT closed by dead link detection, so Close() those gone
+	 * silent, or forged addresses fill up SetPeerLimit().
+	 *
+	 * \param	pPeer	Peer information.
+	 **/
+	virtual void OnAccept(Connection * pPeer) {}
+
+	/**
+	 * Invoked for each complete message, in the order they were sent.
+	 *
+	 * \param	pPeer	Peer information.
+	 * \param	pData	Pointer to message. Valid only in this call.
+	 * \param	nSize	Message size.
+	 **/
+	virtual void OnReceive(Connection * pPeer, char * pData, size_t nSize) {}
+
+	/**
+	 * Invoked when a session is closed.
+	 *
+	 * \param	pPeer	Peer information.
+	 * \param	emCode	ENet::Local, ENet::Remote when remote closed or stopped answering,
+	 *					ENet::BadData for a broken segment.
+	 **/
+	virtual void OnClose(Connection * pPeer, ENet::Close emCode) {}
+
+	/**
+	 * Action to do before socket is closed.
+	 **/
+	virtual void OnShutdown() {}
+
+private:
+	class ArqContext *	_pCtx;
+};
+
+/**
+ * Messages between processes on the same host through shared memory. Each link
+ * maps a pair of single-producer single-consumer rings, one per direction, so a
+ * message is handed over by two memory copies, without system call while both
+ * sides are busy. An idle side sleeps in Application and is woken by eventfd.
+ *
+ * A Unix domain socket carries the rings at connect time and then tells each
+ * side when the other one closes or dies. Works like IReliableSocket : server
+ * side Listen(), client side gets its server by Connect(). (Linux only)
+ **/
+class ISharedMemorySocket {
+public:
+	ISharedMemorySocket();
+	virtual ~ISharedMemorySocket();
+
+	/**
+	 * Accept links on a Unix domain socket.
+	 *
+	 * \param	sPath	Endpoint like "unix:/path" or "unix:@name". See IServerSocket::Listen().
+	 * \return	Listen status. See ENet::Error.
+	 **/
+	int Listen(const std::string & sPath);
+
+	/**
+	 * Create rings and hand them to a listening process. Never blocks.
+	 *
+	 * \param	sPath		Endpoint given to Listen().
+	 * \param	nCapacity	Bytes of each ring, power of 2 from 4KB to 1GB.
+	 * \return	Peer information. nullptr if server is NOT there or capacity is bad.
+	 **/
+	Connection * Connect(const std::string & sPath, size_t nCapacity = 1048576);
+
+	/**
+	 * Get peer info.
+	 *
+	 * \param	nPeerId	Peer identifier.
+	 * \return	Peer pointer. nullptr if that peer has been closed, even when its slot is reused.
+	 **/
+	Connection * Find(uint64_t nPeerId);
+
+	/**
+	 * Write one message into peer's ring. When the ring is full, message waits in
+	 * a local queue for next Breath(). Delivered to remote OnReceive() in whole
+	 * and in order.
+	 *
+	 * \param	pPeer	Remote peer.
+	 * \param	pData	Pointer to message.
+	 * \param	nSize	Size of message. At most half of ring capacity.
+	 * \return	False when peer is closed, message is too large or local queue is full.
+	 **/
+	bool Send(Connection * pPeer, const char * pData, size_t nSize);
+
+	/**
+	 * Get bytes waiting in local queue for a full ring. Useful to detect back-pressure.
+	 **/
+	size_t Pending(Connection * pPeer);
+
+	/**
+	 * Close a link. Messages already in rings are dropped.
+	 *
+	 * \param	pPeer	Remote peer.
+	 **/
+	void Close(Connection * pPeer);
+
+	/**
+	 * Close all links and stop listening.
+	 **/
+	void Shutdown();
+
+	/**
+	 * Accept links, move queued messages into rings and read all rings. This may
+	 * invoke OnReceive() many times.
+	 * NOTE : Except using Application, you should call this in you main event loop.
+	 **/
+	void Breath();
+
+	/**
+	 * Invoked when a new link comes from remote.
+	 *
+	 * \param	pPeer	Peer information. nIP and nPort are 0.
+	 **/
+	virtual void OnAccept(Connection * pPeer) {}
+
+	/**
+	 * Invoked for each message, in the order they were sent.
+	 *
+	 * \param	pPeer	Peer information.
+	 * \param	pData	Pointer to message in shared memory. Valid only in this call.
+	 * \param	nSize	Message size.
+	 **/
+	virtual void OnReceive(Connection * pPeer, char * pData, size_t nSize) {}
+
+	/**
+	 * Invoked when a link is closed.
+	 *
+	 * \param	pPeer	Peer information.
+	 * \param	emCode	ENet::Local, ENet::Remote when remote closed or died, ENet::BadData
+	 *					for a broken ring.
+	 **/
+	virtual void OnClose(Connection * pPeer, ENet::Close emCode) {}
+
+	/**
+	 * Action to do before socket is closed.
+	 **/
+	virtual void OnShutdown() {}
+
+private:
+	friend class NetworkBreather;
+	class ShmContext *	_pCtx;
+};
+
+/**
+ * Message bus between server nodes, built on IServerSocket and ISocket. Every
+ * node has a non-zero id. Nodes given by AddNode() are dialed and redialed after
+ * failure, and links from other nodes are accepted by Start(). Nodes without a
+ * link of their own are reached through relays given by AddRoute().
+ *
+ * Messages for the same destination are batched until Flush(), so routing header
+ * goes once per frame and many small messages cost one write. Messages to a node
+ * whose link is down wait for it to come back, up to 16MB per destination. Those
+ * already written to a link that breaks are lost : use Request() when an answer
+ * matters.
+ *
+ * Usage:
+ *
+ *	class GameBus : public IMessageBus {
+ *		virtual void OnMessage(uint32_t nSrc, uint32_t nMsgId, uint32_t nCorrId, char * pData, size_t nSize) override {
+ *			if (nCorrId) Reply(nSrc, nCorrId, "pong", 4);
+ *		}
+ *	};
+ *
+ *	bus.Start(1, "0.0.0.0", 7001);
+ *	bus.AddNode(2, "10.0.0.2", 7001);
+ *	bus.Request(2, MSG_PING, nullptr, 0, [](bool bOk, char * pData, size_t nSize) { ... });
+ **/
+class IMessageBus {
+public:
+	typedef std::function<void (bool bOk, char * pData, size_t nSize)>	ReplyHandler;
+
+public:
+	IMessageBus();
+	virtual ~IMessageBus();
+
+	/**
+	 * Set keep-alive of links. Should be called before Start(). Default is 1000 / 5000.
+	 *
+	 * \param	nInterval	Milliseconds between pings sent by dialing side.
+	 * \param	nTimeout	Milliseconds without any frame before a link is closed and redialed.
+	 **/
+	void SetKeepAlive(uint32_t nInterval, uint32_t nTimeout);
+
+	/**
+	 * Start this node.
+	 *
+	 * \param	nNode	Id of this node, NOT 0.
+	 * \param	sIP		IP to accept links on. Empty for a node that only dials.
+	 * \param	nPort	Port to accept links on.
+	 * \return	Listen status. See ENet::Error.
+	 **/
+	int Start(uint32_t nNode, const std::string & sIP = "", int nPort = 0);
+
+	/**
+	 * Id given to Start(), 0 before that.
+	 **/
+	uint32_t Node();
+
+	/**
+	 * Link to a node directly. It is dialed now, and again after every failure.
+	 * When two nodes dial each other, the link dialed by the smaller id is used.
+	 *
+	 * \param	nNode	Id of remote node.
+	 * \param	sIP		IP of remote node.
+	 * \param	nPort	Port remote node accepts links on.
+	 * \return	False before Start(), or for a bad or known node.
+	 **/
+	bool AddNode(uint32_t nNode, const std::string & sIP, int nPort);
+
+	/**
+	 * Reach a node through another one, when it has no link of its own. Nodes that
+	 * sent us messages through a relay are reached back through it without this.
+	 *
+	 * \param	nDest	Final destination.
+	 * \param	nVia	Node with a link, which forwards messages to nDest.
+	 * \return	False for a bad node.
+	 **/
+	bool AddRoute(uint32_t nDest, uint32_t nVia);
+
+	/**
+	 * Close links to a node and forget its address, routes through it and messages
+	 * waiting for it.
+	 **/
+	void RemoveNode(uint32_t nNode);
+
+	/**
+	 * Is there a live link to this node, or to the relay routing to it?
+	 **/
+	bool IsReachable(uint32_t nNode);
+
+	/**
+	 * Queue one message. Written by Flush(), together with all other messages to
+	 * the same destination.
+	 *
+	 * \param	nDest	Destination node.
+	 * \param	nMsgId	Message id given to remote OnMessage().
+	 * \param	pData	Pointer to message.
+	 * \param	nSize	Size of message, less than 1MB.
+	 * \return	False for an unknown destination, or when too much is waiting for it.
+	 **/
+	bool Send(uint32_t nDest, uint32_t nMsgId, const char * pData, size_t nSize);
+
+	/**
+	 * Queue one message expecting an answer by remote Reply(). fReply is invoked on
+	 * main thread exactly once : with the answer, or with bOk = false after nTimeout
+	 * or Shutdown().
+	 *
+	 * \param	nTimeout	Milliseconds to wait for answer.
+	 * \return	Same as Send(). fReply is NOT invoked when this fails.
+	 **/
+	bool Request(uint32_t nDest, uint32_t nMsgId, const char * pData, size_t nSize, ReplyHandler fReply, uint32_t nTimeout = 5000);
+
+	/**
+	 * Answer a request received by OnMessage(). When nSrc has no link or route of its
+	 * own, it goes back through the relay the request came from.
+	 *
+	 * \param	nSrc	Node that sent the request.
+	 * \param	nCorrId	Correlation id of the request.
+	 **/
+	bool Reply(uint32_t nSrc, uint32_t nCorrId, const char * pData, size_t nSize);
+
+	/**
+	 * Write queued messages, ping links and expire requests. Application calls this
+	 * in every Breath() and at the end of every frame.
+	 **/
+	void Flush();
+
+	/**
+	 * Close all links, fail waiting requests and stop accepting.
+	 **/
+	void Shutdown();
+
+	/**
+	 * Receive on all links and then Flush(). This may invoke OnMessage() many times.
+	 * NOTE : Except using Application, you should call this in you main event loop.
+	 **/
+	void Breath();
+
+	/**
+	 * Invoked when first link to a node is ready, including nodes that dialed us.
+	 **/
+	virtual void OnNodeUp(uint32_t nNode) {}
+
+	/**
+	 * Invoked when last link to a node is closed. Dialed nodes are redialed.
+	 **/
+	virtual void OnNodeDown(uint32_t nNode) {}
+
+	/**
+	 * Invoked for each message to this node, in the order sent by its source.
+	 *
+	 * \param	nSrc	Node that sent it.
+	 * \param	nMsgId	Message id.
+	 * \param	nCorrId	Non-zero for a request, which should be answered by Reply().
+	 * \param	pData	Pointer to message. Valid only in this call.
+	 * \param	nSize	Message size.
+	 **/
+	virtual void OnMessage(uint32_t nSrc, uint32_t nMsgId, uint32_t nCorrId, char * pData, size_t nSize) {}
+
+	/**
+	 * Action to do before links are closed.
+	 **/
+	virtual void OnShutdown() {}
+
+private:
+	class BusContext *	_pCtx;
+};
+
 #endif//!	__ENGINE_NETWORK_H_INCLUDED__
\ No newline at end of file
@@ -32,6 +32,7 @@ public:
 		Clear();
 		for (auto pMem : _lMem) delete[] pMem;
 		_lMem.clear();
+		delete _pHead;
 	}
 
 	/**
@@ -0,0 +1,378 @@
+#ifndef		__ENGINE_RPC_H_INCLUDED__
+#define		__ENGINE_RPC_H_INCLUDED__
+
+#include	<Network.h>
+#include	<cstdint>
+#include	<cstring>
+#include	<functional>
+#include	<memory>
+#include	<string>
+
+#define		RPC_MAXFRAME	16777216
+#define		RPC_MAXDEPTH	32
+
+namespace ERpc {
+
+	/**
+	 * Result of a call.
+	 **/
+	enum Status {
+		Ok = 0,
+		Failed,		//! Handler failed. Result may hold a reason.
+		NoMethod,	//! Method is NOT registered on server.
+		BadArgs,	//! Handler read arguments of wrong type, or arguments are too large.
+		Timeout,	//! No result before timeout.
+		Closed		//! Not connected, or connection closed before result came back.
+	};
+
+	/**
+	 * Type of a value in RpcArgs.
+	 **/
+	enum Type {
+		Nil = 0,
+		False,
+		True,
+		Int,		//! Zigzag varint
+		Double,		//! 8 bytes, little endian
+		String,		//! Varint length then bytes. Binary safe.
+		Array,		//! Varint count then values
+		Map,		//! Varint count then key and value pairs
+		End = 0xFE,	//! Nothing left to read
+		Bad = 0xFF	//! Broken data
+	};
+}
+
+/**
+ * Compact binary encoding of call arguments and results : a sequence of values,
+ * each one a type byte followed by its payload. Small integers take 2 bytes.
+ *
+ * Usage:
+ *
+ *	RpcArgs iArgs;
+ *	iArgs.Add(10001).Add("nick").Array(2).Add(1.5).Add(true);
+ **/
+class RpcArgs {
+public:
+	RpcArgs() : _sData() {}
+
+	RpcArgs &	Nil();
+	RpcArgs &	Add(bool b);
+	RpcArgs &	Add(int32_t n) { return Add((int64_t)n); }
+	RpcArgs &	Add(uint32_t n) { return Add((int64_t)n); }
+	RpcArgs &	Add(int64_t n);
+	RpcArgs &	Add(uint64_t n) { return Add((int64_t)n); }
+	RpcArgs &	Add(double d);
+	RpcArgs &	Add(const char * s) { return Add(s, strlen(s)); }
+	RpcArgs &	Add(const std::string & s) { return Add(s.data(), s.size()); }
+	RpcArgs &	Add(const char * pData, size_t nSize);
+
+	/**
+	 * Start an array. Next nCount values are its elements.
+	 **/
+	RpcArgs &	Array(uint32_t nCount);
+
+	/**
+	 * Start a map. Next nCount pairs of values are its keys and values.
+	 **/
+	RpcArgs &	Map(uint32_t nCount);
+
+	inline const char *	Data() const { return _sData.data(); }
+	inline size_t		Size() const { return _sData.size(); }
+	inline void			Clear() { _sData.clear(); }
+
+private:
+	void	__Varint(uint64_t n);
+
+private:
+	std::string	_sData;
+};
+
+/**
+ * Read values written by RpcArgs in order. Reading a value of another type, or
+ * past the end, returns a default and marks this reader bad, so a handler may
+ * read everything first and check IsBad() once.
+ **/
+class RpcReader {
+public:
+	RpcReader(const char * pData, size_t nSize) : _pData(pData), _nSize(nSize), _nOffset(0), _bBad(false) {}
+
+	/**
+	 * Type of next value. ERpc::End when nothing is left.
+	 **/
+	ERpc::Type	Type() const;
+
+	bool		GetBool();
+	int64_t		GetInt();
+	double		GetDouble();	//! Integers are converted
+	std::string	GetString();
+
+	/**
+	 * Get a string without copying it. Data points into the buffer being read.
+	 **/
+	bool		GetString(const char *& pData, size_t & nSize);
+
+	/**
+	 * Number of elements of an array, which follow it.
+	 **/
+	uint32_t	GetArray();
+
+	/**
+	 * Number of pairs of a map, which follow it.
+	 **/
+	uint32_t	GetMap();
+
+	/**
+	 * Skip next value, including all elements of an array or a map.
+	 **/
+	bool		Skip();
+
+	inline bool	IsEnd() const { return _nOffset >= _nSize; }
+	inline bool	IsBad() const { return _bBad; }
+
+private:
+	bool		__Varint(uint64_t & n);
+	bool		__Skip(int nDepth);
+
+private:
+	const char *	_pData;
+	size_t			_nSize;
+	size_t			_nOffset;
+	bool			_bBad;
+};
+
+/**
+ * Result of an asynchronous call. Completes on main thread, from Breath() when
+ * result comes back, from Timer when it times out, or at once when call can NOT
+ * be sent. Copies share the same result.
+ **/
+class RpcFuture {
+public:
+	typedef std::function<void (int nStatus, RpcReader & rResult)>	Handler;
+
+public:
+	RpcFuture() : _pState() {}
+
+	/**
+	 * Has result come?
+	 **/
+	bool	IsDone() const;
+
+	/**
+	 * See ERpc::Status. Valid once IsDone().
+	 **/
+	int		Status() const;
+
+	/**
+	 * Run fDone with the result. At once if it has come already, otherwise when it
+	 * comes. Only the last handler given is kept.
+	 **/
+	void	Then(Handler fDone);
+
+private:
+	friend class RpcClientContext;
+	struct State;
+	std::shared_ptr<State>	_pState;
+};
+
+/**
+ * Client side of RPC over a TCP connection. Calls are pipelined : any number may
+ * be in flight, each matched to its result by a call id, and all calls made in
+ * one frame are written together by Flush().
+ *
+ * Wire format uses built-in framing (U32 length, 4 bytes message id, little endian).
+ * A call is a frame whose message id is the method, with body [call id:4][args].
+ * Call id 0 expects no result. A result is a frame with message id 0, with body
+ * [call id:4][status:1][results].
+ *
+ * Usage:
+ *
+ *	RpcClient iClient;
+ *	iClient.Connect("127.0.0.1", 7001, true);
+ *	iClient.Call(RPC_LOGIN, RpcArgs().Add(10001).Add("token")).Then([](int nStatus, RpcReader & rResult) {
+ *		if (nStatus == ERpc::Ok) LOG_INFO("Level %lld", rResult.GetInt());
+ *	});
+ *
+ * In Lua (after RpcClient::Export() and GLua.Set<RpcClient *>("login", &iClient)) :
+ *
+ *	login:Call(RPC_LOGIN, { 10001, 'token' }, function(status, level) print(status, level) end, 3000)
+ **/
+class RpcClient {
+public:
+	RpcClient();
+	virtual ~RpcClient();
+
+	/**
+	 * Start connecting to server. See ISocket::Connect().
+	 **/
+	int Connect(const std::string & sIP, int nPort, bool bAutoReconnect = false);
+
+	/**
+	 * Delay range of auto-reconnect. See ISocket::SetReconnect().
+	 **/
+	void SetReconnect(uint32_t nMinDelay, uint32_t nMaxDelay);
+
+	/**
+	 * Close connection and cancel auto-reconnect. Calls in flight fail with ERpc::Closed.
+	 **/
+	void Close();
+
+	/**
+	 * Is it connected?
+	 **/
+	bool IsConnected();
+
+	/**
+	 * Call a method on server.
+	 *
+	 * \param	nMethod		Method id, NOT 0.
+	 * \param	rArgs		Arguments.
+	 * \param	nTimeout	Milliseconds to wait for result. 0 waits until connection closes.
+	 * \return	Future of the result. Fails at once with ERpc::Closed when not connected.
+	 **/
+	RpcFuture Call(uint32_t nMethod, const RpcArgs & rArgs, uint32_t nTimeout = 5000);
+
+	/**
+	 * Call a method without waiting for any result.
+	 *
+	 * \return	False when not connected or arguments are too large.
+	 **/
+	bool Notify(uint32_t nMethod, const RpcArgs & rArgs);
+
+	/**
+	 * Number of calls waiting for result.
+	 **/
+	size_t Pending();
+
+	/**
+	 * Write calls made since last flush now. Application calls it every frame.
+	 **/
+	void Flush();
+
+	/**
+	 * Process received results. Application calls it every frame.
+	 **/
+	void Breath();
+
+	/**
+	 * Register class into Lua with methods Call, Notify, IsConnected and Pending.
+	 * Push clients with GLua.Set<RpcClient *>().
+	 *
+	 * \param	sClass	Class name in Lua.
+	 **/
+	static void Export(const std::string & sClass = "RpcClient");
+
+	/**
+	 * Invoked after connected to server.
+	 **/
+	virtual void OnConnected() {}
+
+	/**
+	 * Invoked when connecting failed. See ISocket::OnConnectFail().
+	 **/
+	virtual void OnConnectFail(int nError) {}
+
+	/**
+	 * Invoked after connection closed, once calls in flight have failed.
+	 **/
+	virtual void OnClose(ENet::Close emCode) {}
+
+private:
+	class RpcClientContext *	_pCtx;
+};
+
+/**
+ * Handler of a method. Runs on main thread, or on a ThreadPool worker when one is
+ * given to RpcServer::Register().
+ *
+ * \param	nConnId		Connection::nId of caller.
+ * \param	rArgs		Arguments. Valid only in this call.
+ * \param	rResult		Results to send back.
+ * \return	See ERpc::Status. Usually ERpc::Ok or ERpc::Failed.
+ **/
+typedef std::function<int (uint64_t nConnId, RpcReader & rArgs, RpcArgs & rResult)>	RpcHandler;
+
+/**
+ * Server side of RPC. Results of one frame go out in one write per client (see
+ * IServerSocket::SetCoalesce()), and results of methods run on ThreadPool are
+ * posted back to main thread, so slow methods never block other calls.
+ *
+ * Usage:
+ *
+ *	RpcServer iServer;
+ *	iServer.Register(RPC_LOGIN, [](uint64_t nConnId, RpcReader & rArgs, RpcArgs & rResult) {
+ *		int64_t nUser = rArgs.GetInt();
+ *		std::string sToken = rArgs.GetString();
+ *		rResult.Add(CheckToken(nUser, sToken));
+ *		return ERpc::Ok;
+ *	}, &iPool);
+ *	iServer.Listen("0.0.0.0", 7001);
+ *
+ * In Lua (after RpcServer::Export() and GLua.Set<RpcServer *>("rpc", &iServer)) :
+ *
+ *	rpc:Register(RPC_ECHO, function(conn, ...) return ... end)
+ **/
+class RpcServer {
+public:
+	RpcServer();
+	virtual ~RpcServer();
+
+	/**
+	 * Add or replace a method.
+	 *
+	 * \param	nMethod		Method id, NOT 0.
+	 * \param	fHandler	Handler. See RpcHandler.
+	 * \param	pPool		Workers to run it on. Must outlive this server. nullptr runs on main thread.
+	 * \return	False for a bad method id.
+	 **/
+	bool Register(uint32_t nMethod, RpcHandler fHandler, ThreadPool * pPool = nullptr);
+
+	/**
+	 * Remove a method. Calls already dispatched to ThreadPool still run.
+	 **/
+	void Unregister(uint32_t nMethod);
+
+	/**
+	 * Start accepting clients. See IServerSocket::Listen().
+	 **/
+	int Listen(const std::string & sIP, int nPort);
+
+	/**
+	 * Drop calls waiting for ThreadPool, wait for running handlers to return, then
+	 * close all clients. Call it before destroying pools given to Register().
+	 **/
+	void Shutdown();
+
+	/**
+	 * Write results queued since last flush now. Application calls it every frame.
+	 **/
+	void Flush();
+
+	/**
+	 * Process received calls. Application calls it every frame.
+	 **/
+	void Breath();
+
+	/**
+	 * Register class into Lua with methods Register and Unregister. Lua handlers
+	 * run on main thread : they get caller's connection id and arguments, and return
+	 * results. An error in handler fails the call with its message as result.
+	 *
+	 * \param	sClass	Class name in Lua.
+	 **/
+	static void Export(const std::string & sClass = "RpcServer");
+
+	/**
+	 * Invoked after a client connected.
+	 **/
+	virtual void OnAccept(Connection * pConn) {}
+
+	/**
+	 * Invoked after a client disconnected.
+	 **/
+	virtual void OnClose(Connection * pConn, ENet::Close emCode) {}
+
+private:
+	class RpcServerContext *	_pCtx;
+};
+
+#endif//!	__ENGINE_RPC_H_INCLUDED__
\ No newline at end of file
@@ -0,0 +1,122 @@
+#ifndef		__ENGINE_TIMER_H_INCLUDED__
+#define		__ENGINE_TIMER_H_INCLUDED__
+
+#include	<cstdint>
+#include	<deque>
+#include	<functional>
+#include	<string>
+#include	<vector>
+
+#define		TIMER_NEAR_BITS		8
+#define		TIMER_LEVEL_BITS	6
+#define		TIMER_LEVELS		4
+#define		TIMER_NONE			0xFFFFFFFF
+
+/**
+ * Hierarchical timing wheel with millisecond resolution.
+ *
+ * Adding and cancelling are O(1). Timers due in next 256ms sit in the near
+ * wheel, others wait in coarser wheels and move down every 256ms, so Breath()
+ * never scans timers that are not due. Application drives it every frame, and
+ * callbacks always run on main thread.
+ *
+ * Identifiers work like Connection::nId : a cancelled or finished timer never
+ * matches a later one reusing its slot, so cancelling a stale id is harmless.
+ *
+ * Usage:
+ *
+ *	uint64_t nId = Timer::Instance().Add(3000, 0, []() { LOG_INFO("Once after 3s"); });
+ *	Timer::Instance().Add(0, 1000, []() { LOG_INFO("Every second"); });
+ *	Timer::Instance().Cancel(nId);
+ *
+ * In Lua (after Timer::Instance().Export()) :
+ *
+ *	local id = Timer.Add(3000, 0, function() print('Once after 3s') end)
+ *	Timer.Cancel(id)
+ **/
+class Timer {
+	struct Node {
+		uint32_t				nPrev;
+		uint32_t				nNext;
+		uint32_t				nSlot;		//! Slot holding this node, TIMER_NONE when free
+		uint32_t				nGen;
+		uint64_t				nExpire;
+		uint32_t				nInterval;
+		std::function<void ()>	fOpt;
+	};
+
+public:
+	static Timer &	Instance();
+	virtual ~Timer() {}
+
+	/**
+	 * Add a timer.
+	 *
+	 * \param	nDelay		Milliseconds before first run.
+	 * \param	nInterval	Milliseconds between runs. 0 runs only once.
+	 * \param	fOpt		Callback. It may add or cancel timers, including itself.
+	 * \return	Timer identifier, never 0.
+	 **/
+	uint64_t	Add(uint32_t nDelay, uint32_t nInterval, std::function<void ()> fOpt);
+
+	/**
+	 * Cancel a timer.
+	 *
+	 * \param	nId		Identifier returned by Add().
+	 * \return	False if it has finished or been cancelled.
+	 **/
+	bool		Cancel(uint64_t nId);
+
+	/**
+	 * Is this timer still waiting?
+	 **/
+	bool		IsActive(uint64_t nId) const;
+
+	/**
+	 * Number of waiting timers.
+	 **/
+	size_t		Count() const { return _nCount; }
+
+	/**
+	 * Run due timers. Called by Application every frame.
+	 **/
+	void		Breath();
+
+	/**
+	 * Earliest time (in Tick()) Breath() may have something to run. It may be
+	 * earlier than the real due time of timers waiting in coarse wheels.
+	 *
+	 * \return	HUGE_VAL if there is no timer.
+	 **/
+	double		Next() const;
+
+	/**
+	 * Register Add/Cancel/IsActive into Lua.
+	 *
+	 * \param	sNamespace	Name of namespace(table) in Lua.
+	 **/
+	void		Export(const std::string & sNamespace = "Timer");
+
+private:
+	Timer();
+	Timer(const Timer &) = delete;
+	Timer & operator=(const Timer &) = delete;
+
+	void		__Link(uint32_t nIdx);
+	void		__Unlink(uint32_t nIdx);
+	void		__Cascade(int nLevel);
+	void		__Free(uint32_t nIdx);
+	Node *		__Find(uint64_t nId);
+
+private:
+	std::deque<Node>		_vNodes;	//! Deque, so a running callback is never moved by Add()
+	std::vector<uint32_t>	_vFree;
+	std::vector<uint32_t>	_vSlots;	//! Near wheel, coarse wheels, then list being run
+	uint64_t				_nNext;		//! Next millisecond to run
+	size_t					_nCount;
+	size_t					_nNear;		//! Timers in near wheel
+	uint32_t				_nRunning;	//! Node whose callback is running
+	bool					_bBreathing;
+};
+
+#endif//!	__ENGINE_TIMER_H_INCLUDED__
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include	<Path.h>
 #include	<DateTime.h>
 #include	<Logger.h>
+#include	<Timer.h>
 
 #include	<csignal>
 #include	<thread>
@@ -13,6 +14,9 @@
 #endif
 
 extern void AutoNetworkBreath();
+extern void AutoNetworkFlush();
+extern bool AutoNetworkWait(double dDeadline);
+extern void AutoNetworkWake();
 
 struct AppSignalDispatcher {
 	static Application * pIns;
@@ -29,7 +33,7 @@ void AppSignalDispatcher::OnSignal(int nSig) {
 	it->second(nSig);
 }
 
-Application::Application() : _bRun(false), _nExit(0), _nPerFrame(0) {
+Application::Application() : _bRun(false), _nExit(0), _nPerFrame(0), _bEventLoop(false), _bBetweenFrames(false) {
 	if (!AppSignalDispatcher::pIns)
 		AppSignalDispatcher::pIns = this;
 	else
@@ -70,6 +74,7 @@ void Application::Start(int nArgc, char * pArgv[]) {
 	auto iExiter = [this](int nSig) {
 		_nExit = nSig;
 		_bRun = false;
+		AutoNetworkWake();
 	};
 
 	Signal(SIGINT, iExiter);
@@ -81,21 +86,43 @@ void Application::Start(int nArgc, char * pArgv[]) {
 		double nNext = Tick() + _nPerFrame;
 		while (_bRun) {
 			AutoNetworkBreath();
+			Timer::Instance().Breath();
 			OnBreath();
+			AutoNetworkFlush();
 
 			double nLeft = nNext - Tick();
-			if (nLeft > 0) {
+			if (nLeft <= 0) {
+				LOG_WARN("Frame delay : %.4lf", nLeft);
+			} else if (!_bEventLoop) {
 				std::this_thread::sleep_for(std::chrono::milliseconds((int)nLeft + 1));
+			} else if (!_bBetweenFrames) {
+				std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(nLeft));
 			} else {
-				LOG_WARN("Frame delay : %.4lf", nLeft);
+				while (_bRun && Tick() < nNext) {
+					AutoNetworkWait(nNext);
+					if (Tick() >= nNext) break;
+
+					AutoNetworkBreath();
+					AutoNetworkFlush();
+				}
 			}
 
 			nNext += _nPerFrame;
 		}
+	} else if (_bEventLoop) {
+		while (_bRun) {
+			AutoNetworkBreath();
+			Timer::Instance().Breath();
+			OnBreath();
+			AutoNetworkFlush();
+			AutoNetworkWait(Timer::Instance().Next());
+		}
 	} else {
 		while (_bRun) {
 			AutoNetworkBreath();
+			Timer::Instance().Breath();
 			OnBreath();
+			AutoNetworkFlush();
 			std::this_thread::sleep_for(std::chrono::milliseconds(1));
 		}
 	}
@@ -107,3 +134,8 @@ void Application::LockFPS(int nFPS) {
 	if (nFPS <= 0) return;
 	_nPerFrame = 1000.0 / nFPS;
 }
+
+void Application::EnableEventLoop(bool bBetweenFrames) {
+	_bEventLoop = true;
+	_bBetweenFrames = bBetweenFrames;
+}
\ No newline at end of file
@@ -0,0 +1,634 @@
+#include	"Network.Arq.h"
+#include	<DateTime.h>
+
+#include	<chrono>
+#include	<random>
+#include	<string>
+
+#include	"Network.Pool.h"
+
+using namespace std;
+
+extern void AutoNetworkAdd(IReliableSocket * p);
+extern void AutoNetworkDel(IReliableSocket * p);
+extern void AutoNetworkDue(double dTime);
+
+ArqSession::ArqSession()
+	: _pPool(nullptr)
+	, _iOpt()
+	, _nToken(0)
+	, _nSndUna(0)
+	, _nSndNxt(0)
+	, _nRcvNxt(0)
+	, _nRmtWnd(0)
+	, _nCwnd(0)
+	, _nSsthresh(0)
+	, _nCwndAcked(0)
+	, _nRecover(0)
+	, _nSrtt(0)
+	, _nRttVar(0)
+	, _nRto(0)
+	, _nPartial(0)
+	, _bClosed(false)
+	, _bDead(false) {}
+
+ArqSession::~ArqSession() {
+	for (auto p : _qSend) __Free(p);
+	for (auto p : _qFlight) __Free(p);
+	for (auto p : _qOrder) __Free(p);
+	for (auto p : _qReady) __Free(p);
+}
+
+void ArqSession::Setup(Pool<ArqSegment> * pPool, const ArqOption & rOpt, uint32_t nToken) {
+	_pPool		= pPool;
+	_iOpt		= rOpt;
+	_nToken		= nToken;
+	_nRmtWnd	= rOpt.nRecvWindow;
+	_nCwnd		= 4;
+	_nSsthresh	= rOpt.nSendWindow;
+	_nRto		= std::max(rOpt.nMinRto, (uint32_t)200);
+	_nRto		= std::min(_nRto, rOpt.nMaxRto);
+}
+
+bool ArqSession::Send(const char * pData, size_t nSize) {
+	size_t nMss = _iOpt.nMtu - ARQ_HEADER;
+	size_t nCount = nSize == 0 ? 1 : (nSize + nMss - 1) / nMss;
+	if (nCount > ARQ_MAXFRAGS || Pending() + nCount > _iOpt.nSendQueue) return false;
+
+	/// Allocated first, so receiver never joins half of this message with the next one.
+	ArqSegment * pSegments[ARQ_MAXFRAGS];
+	for (size_t i = 0; i < nCount; ++i) {
+		pSegments[i] = _pPool->Alloc();
+		if (pSegments[i]) continue;
+
+		while (i > 0) __Free(pSegments[--i]);
+		return false;
+	}
+
+	for (size_t i = 0; i < nCount; ++i) {
+		ArqSegment * p = pSegments[i];
+		p->nLen = (uint32_t)std::min(nMss, nSize);
+		p->nFrg = (uint32_t)(nCount - i - 1);
+		memcpy(p->pData, pData, p->nLen);
+
+		pData += p->nLen;
+		nSize -= p->nLen;
+		_qSend.push_back(p);
+	}
+
+	return true;
+}
+
+bool ArqSession::Input(const char * pData, size_t nSize, uint32_t nNow) {
+	uint32_t nPrevUna = _nSndUna;
+	uint32_t nMaxAck = 0;
+	bool bAcked = false;
+	Header iHeader;
+
+	while (nSize > 0) {
+		if (!Decode(pData, nSize, iHeader) || iHeader.nToken != _nToken) return false;
+
+		const char * pBody = pData + ARQ_HEADER;
+		pData += ARQ_HEADER + iHeader.nLen;
+		nSize -= ARQ_HEADER + iHeader.nLen;
+
+		_nRmtWnd = iHeader.nWnd;
+		__Una(iHeader.nUna);
+
+		if (iHeader.nCmd == CmdAck) {
+			int32_t nRtt = (int32_t)(nNow - iHeader.nTs);
+			if (nRtt >= 0) __UpdateRtt(nRtt);
+
+			__Acked(iHeader.nSn);
+			if (!bAcked || (int32_t)(iHeader.nSn - nMaxAck) > 0) nMaxAck = iHeader.nSn;
+			bAcked = true;
+		} else if (iHeader.nCmd == CmdData) {
+			/// Beyond receive window, which an unfinished message in _qReady takes from too.
+			/// Dropped without ACK, so sender will try again. The next segment always fits,
+			/// as sender probes a full window with it.
+			uint32_t nRoom = _iOpt.nRecvWindow > _qReady.size() ? _iOpt.nRecvWindow - (uint32_t)_qReady.size() : 1;
+			if ((int32_t)(iHeader.nSn - (_nRcvNxt + nRoom)) >= 0) continue;
+			if (iHeader.nLen > _iOpt.nMtu - ARQ_HEADER) return false;
+
+			/// Duplicates are acknowledged again, their first ACK may be lost.
+			_vAcks.push_back(make_pair(iHeader.nSn, iHeader.nTs));
+			if ((int32_t)(iHeader.nSn - _nRcvNxt) < 0) continue;
+
+			auto it = _qOrder.end();
+			while (it != _qOrder.begin() && (int32_t)((*(it - 1))->nSn - iHeader.nSn) > 0) --it;
+			if (it != _qOrder.begin() && (*(it - 1))->nSn == iHeader.nSn) continue;
+
+			ArqSegment * p = _pPool->Alloc();
+			if (!p) return false;
+
+			p->nSn	= iHeader.nSn;
+			p->nFrg	= iHeader.nFrg;
+			p->nLen	= iHeader.nLen;
+			memcpy(p->pData, pBody, iHeader.nLen);
+			_qOrder.insert(it, p);
+
+			while (!_qOrder.empty() && _qOrder.front()->nSn == _nRcvNxt) {
+				_nPartial = _qOrder.front()->nFrg == 0 ? 0 : _nPartial + 1;
+				_qReady.push_back(_qOrder.front());
+				_qOrder.pop_front();
+				++_nRcvNxt;
+			}
+
+			/// No message has this many fragments. Peer ignores the window.
+			if (_nPartial >= ARQ_MAXFRAGS) return false;
+		} else if (iHeader.nCmd == CmdClose) {
+			_bClosed = true;
+		} else {
+			return false;
+		}
+	}
+
+	if (bAcked) __FastAck(nMaxAck);
+
+	_nSndUna = _qFlight.empty() ? _nSndNxt : _qFlight.front()->nSn;
+
+	/// Slow start below threshold, then one more segment per window of ACKs.
+	for (int32_t nAcked = (int32_t)(_nSndUna - nPrevUna); nAcked > 0; --nAcked) {
+		if (_nCwnd < _nSsthresh) {
+			++_nCwnd;
+		} else if (++_nCwndAcked >= _nCwnd) {
+			++_nCwnd;
+			_nCwndAcked = 0;
+		}
+	}
+
+	_nCwnd = std::min(_nCwnd, _iOpt.nSendWindow);
+	return true;
+}
+
+bool ArqSession::Check(uint32_t & rDue) const {
+	if (_qFlight.empty()) return false;
+
+	rDue = _qFlight.front()->nResendTs;
+	for (auto p : _qFlight) {
+		if ((int32_t)(p->nResendTs - rDue) < 0) rDue = p->nResendTs;
+	}
+
+	return true;
+}
+
+void ArqSession::Encode(char * pOut, const Header & rHeader) {
+	auto fPut = [&pOut](uint32_t nValue, int nBytes) {
+		for (int i = 0; i < nBytes; ++i) *pOut++ = (char)((nValue >> (i * 8)) & 0xFF);
+	};
+
+	fPut(rHeader.nToken, 4);
+	fPut(rHeader.nCmd, 1);
+	fPut(rHeader.nFrg, 1);
+	fPut(rHeader.nWnd, 2);
+	fPut(rHeader.nTs, 4);
+	fPut(rHeader.nSn, 4);
+	fPut(rHeader.nUna, 4);
+	fPut(rHeader.nLen, 2);
+}
+
+bool ArqSession::Decode(const char * pData, size_t nSize, Header & rHeader) {
+	if (nSize < ARQ_HEADER) return false;
+
+	const unsigned char * p = (const unsigned char *)pData;
+	auto fGet = [&p](int nBytes) {
+		uint32_t nValue = 0;
+		for (int i = 0; i < nBytes; ++i) nValue |= (uint32_t)(*p++) << (i * 8);
+		return nValue;
+	};
+
+	rHeader.nToken	= fGet(4);
+	rHeader.nCmd	= (uint8_t)fGet(1);
+	rHeader.nFrg	= (uint8_t)fGet(1);
+	rHeader.nWnd	= (uint16_t)fGet(2);
+	rHeader.nTs		= fGet(4);
+	rHeader.nSn		= fGet(4);
+	rHeader.nUna	= fGet(4);
+	rHeader.nLen	= (uint16_t)fGet(2);
+
+	return ARQ_HEADER + (size_t)rHeader.nLen <= nSize;
+}
+
+void ArqSession::__UpdateRtt(int32_t nRtt) {
+	/// RFC 6298.
+	if (_nSrtt == 0) {
+		_nSrtt = std::max(nRtt, 1);
+		_nRttVar = nRtt / 2;
+	} else {
+		int32_t nDelta = nRtt > _nSrtt ? nRtt - _nSrtt : _nSrtt - nRtt;
+		_nRttVar = (3 * _nRttVar + nDelta) / 4;
+		_nSrtt = std::max((7 * _nSrtt + nRtt) / 8, 1);
+	}
+
+	uint32_t nRto = (uint32_t)(_nSrtt + std::max(4 * _nRttVar, 1));
+	_nRto = std::min(std::max(nRto, _iOpt.nMinRto), _iOpt.nMaxRto);
+}
+
+void ArqSession::__Acked(uint32_t nSn) {
+	if ((int32_t)(nSn - _nSndUna) < 0 || (int32_t)(nSn - _nSndNxt) >= 0) return;
+
+	for (auto it = _qFlight.begin(); it != _qFlight.end(); ++it) {
+		if ((*it)->nSn == nSn) {
+			__Free(*it);
+			_qFlight.erase(it);
+			return;
+		}
+
+		if ((int32_t)((*it)->nSn - nSn) > 0) return;
+	}
+}
+
+void ArqSession::__Una(uint32_t nUna) {
+	while (!_qFlight.empty() && (int32_t)(_qFlight.front()->nSn - nUna) < 0) {
+		__Free(_qFlight.front());
+		_qFlight.pop_front();
+	}
+}
+
+void ArqSession::__FastAck(uint32_t nMaxAck) {
+	for (auto p : _qFlight) {
+		if ((int32_t)(p->nSn - nMaxAck) >= 0) break;
+		++p->nFastAck;
+	}
+}
+
+uint16_t ArqSession::__Window() const {
+	size_t nUsed = _qOrder.size() + _qReady.size();
+	size_t nFree = nUsed >= _iOpt.nRecvWindow ? 0 : _iOpt.nRecvWindow - nUsed;
+	return (uint16_t)std::min(nFree, (size_t)0xFFFF);
+}
+
+void ArqSession::__Write(vector<char> & rBuf, const Header & rHeader, const char * pData) {
+	size_t nOffset = rBuf.size();
+	rBuf.resize(nOffset + ARQ_HEADER + rHeader.nLen);
+	Encode(&rBuf[nOffset], rHeader);
+	if (rHeader.nLen > 0) memcpy(&rBuf[nOffset + ARQ_HEADER], pData, rHeader.nLen);
+}
+
+void ArqSession::__Free(ArqSegment * p) {
+	_pPool->Free(p);
+}
+
+/**
+ * Internal state of a peer of IReliableSocket.
+ **/
+struct ArqPeer : public Connection {
+	ArqSession	iSession;
+	uint64_t	nLinkId;	//! Peer identifier in the UDP link
+};
+
+/**
+ * UDP socket carrying segments. Its peers keep the ArqPeer in pData.
+ **/
+class ArqLink : public IUdpSocket {
+public:
+	ArqLink(class ArqContext * pCtx) : _pCtx(pCtx) {}
+
+	virtual void	OnReceive(Connection * pLink, char * pData, size_t nSize) override;
+
+private:
+	class ArqContext *	_pCtx;
+};
+
+class ArqContext {
+	/// Datagram held back by the lossy link simulator.
+	struct Delayed {
+		uint64_t	nLinkId;
+		uint32_t	nDue;
+		string		sData;
+	};
+
+public:
+	ArqContext(IReliableSocket * pOwner);
+	virtual ~ArqContext() {}
+
+	bool			SetOption(const ArqOption & rOpt);
+	int				Bind(const string & sIP, int nPort) { return _iLink.Bind(sIP, nPort); }
+	Connection *	Connect(const string & sIP, int nPort);
+	Connection *	Find(uint64_t nPeerId) { return _iPeers.Find(nPeerId); }
+	void			SetPeerLimit(size_t nLimit) { _iLink.SetPeerLimit(nLimit); }
+	bool			Send(Connection * pPeer, const char * pData, size_t nSize);
+	size_t			Pending(Connection * pPeer) { return pPeer ? ((ArqPeer *)pPeer)->iSession.Pending() : 0; }
+	void			Flush();
+	void			Close(Connection * pPeer, ENet::Close emCode);
+	void			Shutdown();
+	void			Breath();
+	void			Simulate(double fLoss, uint32_t nDelay, uint32_t nJitter);
+	void			Input(Connection * pLink, char * pData, size_t nSize);
+
+private:
+	ArqPeer *		__Open(Connection * pLink, uint32_t nToken);
+	void			__Output(Connection * pLink, const char * pData, size_t nSize, uint32_t nNow);
+	void			__Release(uint32_t nNow);
+	void			__Remove(ArqPeer * pPeer, bool bKeepLink);
+
+	static inline uint32_t	__Now() { return (uint32_t)(uint64_t)Tick(); }
+
+private:
+	IReliableSocket *		_pOwner;
+	ArqOption				_iOpt;
+	Pool<ArqSegment>		_iSegments;
+	ConnectionPool<ArqPeer>	_iPeers;
+	ArqLink					_iLink;
+	vector<char>			_vScratch;
+	vector<uint64_t>		_vIds;	//! Peers walked by Flush(), capacity kept between calls
+	double					_fLoss;
+	uint32_t				_nDelay;
+	uint32_t				_nJitter;
+	vector<Delayed>			_vDelayed;
+	mt19937					_iRandom;
+};
+
+void ArqLink::OnReceive(Connection * pLink, char * pData, size_t nSize) {
+	_pCtx->Input(pLink, pData, nSize);
+}
+
+ArqContext::ArqContext(IReliableSocket * pOwner)
+	: _pOwner(pOwner)
+	, _iOpt()
+	, _iSegments(64)
+	, _iPeers(true)
+	, _iLink(this)
+	, _vScratch()
+	, _vIds()
+	, _fLoss(0)
+	, _nDelay(0)
+	, _nJitter(0)
+	, _vDelayed()
+	, _iRandom((uint32_t)chrono::steady_clock::now().time_since_epoch().count() ^ random_device()()) {}
+
+bool ArqContext::SetOption(const ArqOption & rOpt) {
+	if (rOpt.nMtu < 64 || rOpt.nMtu > ARQ_MAXMTU) return false;
+	if (rOpt.nSendWindow == 0 || rOpt.nRecvWindow == 0 || rOpt.nRecvWindow > 0xFFFF) return false;
+	if (rOpt.nMinRto == 0 || rOpt.nMinRto > rOpt.nMaxRto || rOpt.nDeadLink == 0) return false;
+	if (rOpt.nSendQueue < ARQ_MAXFRAGS) return false;
+
+	_iOpt = rOpt;
+	return true;
+}
+
+Connection * ArqContext::Connect(const string & sIP, int nPort) {
+	Connection * pLink = _iLink.Peer(sIP, nPort);
+	if (!pLink) return nullptr;
+	if (pLink->pData) return (ArqPeer *)pLink->pData;
+
+	uint32_t nToken = 0;
+	while (nToken == 0) nToken = _iRandom();
+	return __Open(pLink, nToken);
+}
+
+bool ArqContext::Send(Connection * pPeer, const char * pData, size_t nSize) {
+	if (!pPeer) return false;
+	return ((ArqPeer *)pPeer)->iSession.Send(pData, nSize);
+}
+
+void ArqContext::Flush() {
+	uint32_t nNow = __Now();
+	int32_t nWait = INT32_MAX;
+	uint32_t nDue;
+
+	__Release(nNow);
+
+	/// OnClose() may close other peers or call Flush() again, so peers are found by id.
+	vector<uint64_t> vIds;
+	vIds.swap(_vIds);
+	for (auto p : _iPeers.Alive()) vIds.push_back(p->nId);
+
+	for (auto nId : vIds) {
+		ArqPeer * pPeer = _iPeers.Find(nId);
+		if (!pPeer) continue;
+
+		Connection * pLink = _iLink.Find(pPeer->nLinkId);
+
+		pPeer->iSession.Flush(nNow, [this, pLink, nNow](const char * pData, size_t nSize) {
+			__Output(pLink, pData, nSize, nNow);
+		});
+
+		if (pPeer->iSession.Dead()) {
+			Close(pPeer, ENet::Remote);
+		} else if (pPeer->iSession.Check(nDue)) {
+			nWait = std::min(nWait, (int32_t)(nDue - nNow));
+		}
+	}
+
+	vIds.clear();
+	_vIds.swap(vIds);
+
+	for (auto & r : _vDelayed) nWait = std::min(nWait, (int32_t)(r.nDue - nNow));
+
+	/// Event loop must wake for retransmission even if nothing arrives.
+	if (nWait != INT32_MAX) AutoNetworkDue(Tick() + std::max(nWait, 0));
+
+	_iLink.Flush();
+}
+
+void ArqContext::Close(Connection * pPeer, ENet::Close emCode) {
+	if (!pPeer) return;
+
+	ArqPeer * pCtx = (ArqPeer *)pPeer;
+
+	if (emCode == ENet::Local) {
+		/// Best effort, remote side finds out by dead link otherwise.
+		ArqSession::Header iHeader;
+		memset(&iHeader, 0, sizeof(iHeader));
+		iHeader.nToken	= pCtx->iSession.Token();
+		iHeader.nCmd	= ArqSession::CmdClose;
+
+		char pBuf[ARQ_HEADER];
+		ArqSession::Encode(pBuf, iHeader);
+		__Output(_iLink.Find(pCtx->nLinkId), pBuf, ARQ_HEADER, __Now());
+	}
+
+	_pOwner->OnClose(pPeer, emCode);
+	__Remove(pCtx, false);
+}
+
+void ArqContext::Shutdown() {
+	while (_iPeers.Size() > 0) Close(_iPeers[_iPeers.Size() - 1], ENet::Local);
+
+	_iLink.Flush();
+	_iLink.Shutdown();
+	_vDelayed.clear();
+}
+
+void ArqContext::Breath() {
+	_iLink.Breath();
+	Flush();
+}
+
+void ArqContext::Simulate(double fLoss, uint32_t nDelay, uint32_t nJitter) {
+	_fLoss		= std::min(std::max(fLoss, 0.0), 1.0);
+	_nDelay		= nDelay;
+	_nJitter	= nJitter;
+}
+
+void ArqContext::Input(Connection * pLink, char * pData, size_t nSize) {
+	ArqSession::Header iHeader;
+	ArqPeer * pPeer = (ArqPeer *)pLink->pData;
+
+	if (!ArqSession::Decode(pData, nSize, iHeader)) {
+		if (!pPeer) _iLink.Close(pLink);
+		return;
+	}
+
+	bool bStart = iHeader.nCmd == ArqSession::CmdData && iHeader.nSn == 0;
+
+	if (pPeer && pPeer->iSession.Token() != iHeader.nToken) {
+		/// Late datagram of an old session, or remote restarted on the same address.
+		if (!bStart) return;
+
+		_pOwner->OnClose(pPeer, ENet::Remote);
+		__Remove(pPeer, true);
+		pPeer = nullptr;
+	}
+
+	if (!pPeer) {
+		if (!bStart) {
+			_iLink.Close(pLink);
+			return;
+		}
+
+		pPeer = __Open(pLink, iHeader.nToken);
+
+		/// OnAccept() may reject this peer by closing it.
+		uint64_t nPeerId = pPeer->nId;
+		_pOwner->OnAccept(pPeer);
+		if (!_iPeers.Find(nPeerId)) return;
+	}
+
+	if (!pPeer->iSession.Input(pData, nSize, __Now())) {
+		Close(pPeer, ENet::BadData);
+		return;
+	}
+
+	uint64_t nPeerId = pPeer->nId;
+	pPeer->iSession.Receive(_vScratch, [this, pPeer, nPeerId](char * pMsg, size_t nMsg) {
+		_pOwner->OnReceive(pPeer, pMsg, nMsg);
+		return _iPeers.Find(nPeerId) != nullptr;
+	});
+
+	pPeer = _iPeers.Find(nPeerId);
+	if (pPeer && pPeer->iSession.Closed()) Close(pPeer, ENet::Remote);
+}
+
+ArqPeer * ArqContext::__Open(Connection * pLink, uint32_t nToken) {
+	ArqPeer * pPeer = _iPeers.Alloc();
+	pPeer->nSocket	= pLink->nSocket;
+	pPeer->nIP		= pLink->nIP;
+	pPeer->nPort	= pLink->nPort;
+	pPeer->pData	= nullptr;
+	pPeer->nLinkId	= pLink->nId;
+	pPeer->iSession.Setup(&_iSegments, _iOpt, nToken);
+
+	pLink->pData = pPeer;
+	return pPeer;
+}
+
+void ArqContext::__Output(Connection * pLink, const char * pData, size_t nSize, uint32_t nNow) {
+	if (!pLink) return;
+
+	if (_fLoss <= 0 && _nDelay == 0 && _nJitter == 0) {
+		_iLink.Send(pLink, pData, nSize);
+		return;
+	}
+
+	if (uniform_real_distribution<double>(0, 1)(_iRandom) < _fLoss) return;
+
+	Delayed iDelayed;
+	iDelayed.nLinkId	= pLink->nId;
+	iDelayed.nDue		= nNow + _nDelay + (_nJitter > 0 ? _iRandom() % (_nJitter + 1) : 0);
+	iDelayed.sData.assign(pData, nSize);
+	_vDelayed.push_back(iDelayed);
+}
+
+void ArqContext::__Release(uint32_t nNow) {
+	if (_vDelayed.empty()) return;
+
+	size_t nKeep = 0;
+	for (size_t i = 0; i < _vDelayed.size(); ++i) {
+		Delayed & r = _vDelayed[i];
+
+		if ((int32_t)(nNow - r.nDue) >= 0) {
+			Connection * pLink = _iLink.Find(r.nLinkId);
+			if (pLink) _iLink.Send(pLink, r.sData.data(), r.sData.size());
+		} else {
+			if (nKeep != i) _vDelayed[nKeep] = std::move(r);
+			++nKeep;
+		}
+	}
+
+	_vDelayed.resize(nKeep);
+}
+
+void ArqContext::__Remove(ArqPeer * pPeer, bool bKeepLink) {
+	Connection * pLink = _iLink.Find(pPeer->nLinkId);
+
+	if (pLink) {
+		pLink->pData = nullptr;
+		if (!bKeepLink) _iLink.Close(pLink);
+	}
+
+	_iPeers.Free(pPeer);
+}
+
+IReliableSocket::IReliableSocket() : _pCtx(nullptr) {
+	_pCtx = new ArqContext(this);
+	AutoNetworkAdd(this);
+}
+
+IReliableSocket::~IReliableSocket() {
+	AutoNetworkDel(this);
+	Shutdown();
+	if (_pCtx) delete _pCtx;
+}
+
+bool IReliableSocket::SetOption(const ArqOption & rOpt) {
+	return _pCtx->SetOption(rOpt);
+}
+
+int IReliableSocket::Bind(const std::string & sIP, int nPort) {
+	if (sIP.empty() || nPort < 0) return ENet::BadParam;
+	return _pCtx->Bind(sIP, nPort);
+}
+
+Connection * IReliableSocket::Connect(const std::string & sIP, int nPort) {
+	if (sIP.empty() || nPort <= 0) return nullptr;
+	return _pCtx->Connect(sIP, nPort);
+}
+
+Connection * IReliableSocket::Find(uint64_t nPeerId) {
+	return _pCtx->Find(nPeerId);
+}
+
+void IReliableSocket::SetPeerLimit(size_t nLimit) {
+	_pCtx->SetPeerLimit(nLimit);
+}
+
+bool IReliableSocket::Send(Connection * pPeer, const char * pData, size_t nSize) {
+	if (!pData && nSize > 0) return false;
+	return _pCtx->Send(pPeer, pData, nSize);
+}
+
+size_t IReliableSocket::Pending(Connection * pPeer) {
+	return _pCtx->Pending(pPeer);
+}
+
+void IReliableSocket::Flush() {
+	_pCtx->Flush();
+}
+
+void IReliableSocket::Close(Connection * pPeer) {
+	_pCtx->Close(pPeer, ENet::Local);
+}
+
+void IReliableSocket::Shutdown() {
+	_pCtx->Shutdown();
+}
+
+void IReliableSocket::Breath() {
+	_pCtx->Breath();
+}
+
+void IReliableSocket::Simulate(double fLoss, uint32_t nDelay, uint32_t nJitter) {
+	_pCtx->Simulate(fLoss, nDelay, nJitter);
+}
@@ -0,0 +1,303 @@
+#ifndef		__ENGINE_NETWORK_ARQ_H_INCLUDED__
+#define		__ENGINE_NETWORK_ARQ_H_INCLUDED__
+
+#include	<Network.h>
+#include	<Pool.h>
+#include	<algorithm>
+#include	<cstdint>
+#include	<cstring>
+#include	<deque>
+#include	<vector>
+
+#define		ARQ_HEADER		22
+#define		ARQ_MAXMTU		1472
+#define		ARQ_MAXFRAGS	255
+
+/**
+ * One segment. Wire format (little endian) :
+ *
+ *	[token:4][cmd:1][frg:1][wnd:2][ts:4][sn:4][una:4][len:2][data:len]
+ *
+ * token identifies the session, so a restarted client on the same address is
+ * NOT mistaken for the old one. frg counts the fragments left in a message.
+ **/
+struct ArqSegment {
+	uint32_t	nSn;
+	uint32_t	nFrg;
+	uint32_t	nTs;		//! Time of last transmission
+	uint32_t	nResendTs;	//! Time to retransmit
+	uint32_t	nRto;
+	uint32_t	nFastAck;	//! Times skipped by ACKs of later segments
+	uint32_t	nXmit;		//! Times transmitted
+	uint32_t	nLen;
+	char		pData[ARQ_MAXMTU];
+};
+
+/**
+ * Protocol state of one peer. Knows nothing about sockets : Input() takes one
+ * datagram and Flush() produces datagrams through a callback.
+ **/
+class ArqSession {
+public:
+	enum Cmd { CmdData = 1, CmdAck, CmdClose };
+
+	struct Header {
+		uint32_t	nToken;
+		uint8_t		nCmd;
+		uint8_t		nFrg;
+		uint16_t	nWnd;
+		uint32_t	nTs;
+		uint32_t	nSn;
+		uint32_t	nUna;
+		uint16_t	nLen;
+	};
+
+public:
+	ArqSession();
+	virtual ~ArqSession();
+
+	/**
+	 * Initialize before use.
+	 *
+	 * \param	pPool	Segment pool shared by all sessions of one socket.
+	 * \param	rOpt	Channel options.
+	 * \param	nToken	Session token.
+	 **/
+	void		Setup(Pool<ArqSegment> * pPool, const ArqOption & rOpt, uint32_t nToken);
+	uint32_t	Token() const { return _nToken; }
+
+	/**
+	 * Split a message into segments and queue them. Nothing is queued on failure.
+	 *
+	 * \return	False if message needs more than ARQ_MAXFRAGS segments, or send queue is full.
+	 **/
+	bool		Send(const char * pData, size_t nSize);
+
+	/**
+	 * Segments queued or in flight.
+	 **/
+	size_t		Pending() const { return _qSend.size() + _qFlight.size(); }
+
+	/**
+	 * Process one datagram.
+	 *
+	 * \return	False if datagram is broken.
+	 **/
+	bool		Input(const char * pData, size_t nSize, uint32_t nNow);
+
+	/**
+	 * Remote side sent CmdClose.
+	 **/
+	bool		Closed() const { return _bClosed; }
+
+	/**
+	 * Some segment was sent nDeadLink times without ACK.
+	 **/
+	bool		Dead() const { return _bDead; }
+
+	/**
+	 * Time of next retransmission. Nothing else happens without new input.
+	 *
+	 * \return	False if nothing is in flight.
+	 **/
+	bool		Check(uint32_t & rDue) const;
+
+	/**
+	 * Send ACKs, timed-out and fast retransmissions, then new segments allowed by window.
+	 *
+	 * \param	nNow	Current time in milliseconds.
+	 * \param	fOutput	void(const char * pData, size_t nSize), invoked for each datagram.
+	 **/
+	template<typename F>
+	void		Flush(uint32_t nNow, F fOutput);
+
+	/**
+	 * Hand complete messages to fDeliver in order.
+	 *
+	 * \param	rScratch	Buffer to join fragments.
+	 * \param	fDeliver	bool(char * pData, size_t nSize). Return false if this session
+	 *						was destroyed by the callback, so it is NOT touched again.
+	 **/
+	template<typename F>
+	void		Receive(std::vector<char> & rScratch, F fDeliver);
+
+	/**
+	 * Encode and parse segment header.
+	 **/
+	static void	Encode(char * pOut, const Header & rHeader);
+	static bool	Decode(const char * pData, size_t nSize, Header & rHeader);
+
+private:
+	void		__UpdateRtt(int32_t nRtt);
+	void		__Acked(uint32_t nSn);
+	void		__Una(uint32_t nUna);
+	void		__FastAck(uint32_t nMaxAck);
+	uint16_t	__Window() const;
+	void		__Write(std::vector<char> & rBuf, const Header & rHeader, const char * pData);
+	void		__Free(ArqSegment * p);
+
+private:
+	Pool<ArqSegment> *		_pPool;
+	ArqOption				_iOpt;
+	uint32_t				_nToken;
+	uint32_t				_nSndUna;
+	uint32_t				_nSndNxt;
+	uint32_t				_nRcvNxt;
+	uint32_t				_nRmtWnd;
+	uint32_t				_nCwnd;
+	uint32_t				_nSsthresh;
+	uint32_t				_nCwndAcked;
+	uint32_t				_nRecover;	//! Window is not shrunk again until this is acknowledged
+	int32_t					_nSrtt;
+	int32_t					_nRttVar;
+	uint32_t				_nRto;
+	uint32_t				_nPartial;	//! Segments at the end of _qReady before a last fragment
+	bool					_bClosed;
+	bool					_bDead;
+	std::deque<ArqSegment *>	_qSend;		//! Waiting for window
+	std::deque<ArqSegment *>	_qFlight;	//! Sent, waiting for ACK, ordered by sn
+	std::deque<ArqSegment *>	_qOrder;	//! Received out of order, ordered by sn
+	std::deque<ArqSegment *>	_qReady;	//! Received in order, waiting for last fragment
+	std::vector<std::pair<uint32_t, uint32_t>>	_vAcks;	//! (sn, ts) to acknowledge
+	std::vector<char>		_vOut;
+};
+
+template<typename F>
+void ArqSession::Flush(uint32_t nNow, F fOutput) {
+	Header iHeader;
+	iHeader.nToken	= _nToken;
+	iHeader.nFrg	= 0;
+	iHeader.nWnd	= __Window();
+	iHeader.nUna	= _nRcvNxt;
+	iHeader.nLen	= 0;
+
+	_vOut.clear();
+
+	iHeader.nCmd = CmdAck;
+	for (auto & rAck : _vAcks) {
+		if (_vOut.size() + ARQ_HEADER > _iOpt.nMtu) {
+			fOutput(_vOut.data(), _vOut.size());
+			_vOut.clear();
+		}
+
+		iHeader.nSn	= rAck.first;
+		iHeader.nTs	= rAck.second;
+		__Write(_vOut, iHeader, nullptr);
+	}
+
+	_vAcks.clear();
+
+	/// Window is never 0, so a full remote buffer is probed by the next segment.
+	uint32_t nWindow = std::min(_iOpt.nSendWindow, _nRmtWnd);
+	if (_iOpt.bCongestion) nWindow = std::min(nWindow, _nCwnd);
+	if (nWindow == 0) nWindow = 1;
+
+	while (!_qSend.empty() && (int32_t)(_nSndNxt - (_nSndUna + nWindow)) < 0) {
+		ArqSegment * p = _qSend.front();
+		_qSend.pop_front();
+
+		p->nSn			= _nSndNxt++;
+		p->nXmit		= 0;
+		p->nFastAck		= 0;
+		p->nRto			= _nRto;
+		p->nResendTs	= nNow;
+		_qFlight.push_back(p);
+	}
+
+	bool bLost = false;
+	bool bFast = false;
+
+	iHeader.nCmd = CmdData;
+	for (auto p : _qFlight) {
+		bool bSend = false;
+
+		if (p->nXmit == 0) {
+			bSend = true;
+			p->nResendTs = nNow + p->nRto;
+		} else if ((int32_t)(nNow - p->nResendTs) >= 0) {
+			bSend = bLost = true;
+			p->nRto = std::min(p->nRto + p->nRto / 2, _iOpt.nMaxRto);
+			p->nResendTs = nNow + p->nRto;
+		} else if (_iOpt.nFastResend > 0 && p->nFastAck >= _iOpt.nFastResend) {
+			bSend = bFast = true;
+			p->nFastAck = 0;
+			p->nResendTs = nNow + p->nRto;
+		}
+
+		if (!bSend) continue;
+
+		p->nTs = nNow;
+		if (++p->nXmit >= _iOpt.nDeadLink) _bDead = true;
+
+		if (_vOut.size() + ARQ_HEADER + p->nLen > _iOpt.nMtu) {
+			fOutput(_vOut.data(), _vOut.size());
+			_vOut.clear();
+		}
+
+		iHeader.nFrg	= (uint8_t)p->nFrg;
+		iHeader.nTs		= p->nTs;
+		iHeader.nSn		= p->nSn;
+		iHeader.nLen	= (uint16_t)p->nLen;
+		__Write(_vOut, iHeader, p->pData);
+	}
+
+	if (!_vOut.empty()) fOutput(_vOut.data(), _vOut.size());
+
+	/// Shrink window at most once per flight, like NewReno. Reordering by jitter
+	/// would otherwise keep it near 1.
+	if ((bFast || bLost) && (int32_t)(_nSndUna - _nRecover) >= 0) {
+		_nRecover = _nSndNxt;
+
+		if (bLost) {
+			_nSsthresh = std::max(_nCwnd / 2, (uint32_t)2);
+			_nCwnd = 1;
+		} else {
+			uint32_t nInFlight = _nSndNxt - _nSndUna;
+			_nSsthresh = std::max(nInFlight / 2, (uint32_t)2);
+			_nCwnd = _nSsthresh + _iOpt.nFastResend;
+		}
+	}
+}
+
+template<typename F>
+void ArqSession::Receive(std::vector<char> & rScratch, F fDeliver) {
+	while (!_qReady.empty()) {
+		size_t nCount = 0;
+		size_t nTotal = 0;
+
+		for (auto p : _qReady) {
+			++nCount;
+			nTotal += p->nLen;
+			if (p->nFrg == 0) break;
+		}
+
+		if (_qReady[nCount - 1]->nFrg != 0) return;
+
+		Pool<ArqSegment> * pPool = _pPool;
+
+		if (nCount == 1) {
+			ArqSegment * p = _qReady.front();
+			_qReady.pop_front();
+
+			bool bAlive = fDeliver(p->pData, (size_t)p->nLen);
+			pPool->Free(p);
+			if (!bAlive) return;
+		} else {
+			rScratch.resize(nTotal);
+			char * pCur = rScratch.data();
+
+			for (size_t i = 0; i < nCount; ++i) {
+				ArqSegment * p = _qReady.front();
+				_qReady.pop_front();
+
+				memcpy(pCur, p->pData, p->nLen);
+				pCur += p->nLen;
+				pPool->Free(p);
+			}
+
+			if (!fDeliver(rScratch.data(), nTotal)) return;
+		}
+	}
+}
+
+#endif//!	__ENGINE_NETWORK_ARQ_H_INCLUDED__
@@ -0,0 +1,622 @@
+#include	"Network.Buffer.h"
+
+#include	<algorithm>
+#include	<cerrno>
+#include	<cstdlib>
+#include	<cstring>
+#include	<new>
+
+#if defined(_WIN32)
+#	include	<io.h>
+#else
+#	include	<unistd.h>
+#endif
+
+/**
+ * Read file at an offset without blocking other readers of the same descriptor.
+ *
+ * \return	Bytes read, 0 at end of file, -1 on failure.
+ **/
+static int64_t ReadAt(int nFile, char * pOut, size_t nSize, uint64_t nOffset) {
+#if defined(_WIN32)
+	if (_lseeki64(nFile, (__int64)nOffset, SEEK_SET) < 0) return -1;
+	return _read(nFile, pOut, (unsigned int)std::min(nSize, (size_t)0x40000000));
+#else
+	while (true) {
+		ssize_t nRead = pread(nFile, pOut, nSize, (off_t)nOffset);
+		if (nRead >= 0 || errno != EINTR) return nRead;
+	}
+#endif
+}
+
+static void CloseFile(int nFile) {
+#if defined(_WIN32)
+	_close(nFile);
+#else
+	close(nFile);
+#endif
+}
+
+SharedPayload * SharedPayload::New(size_t nSize) {
+	SharedPayload * p = (SharedPayload *)malloc(sizeof(SharedPayload) + nSize);
+	p->_nRef	= 1;
+	p->_nSize	= nSize;
+	return p;
+}
+
+SendQueue::SendQueue()
+	: _pHead(nullptr)
+	, _pTail(nullptr)
+	, _nSize(0)
+	, _nFileBytes(0)
+	, _pSpare(nullptr)
+	, _pReserved(nullptr)
+	, _nReserved(0)
+	, _pPinned(nullptr)
+	, _pPinnedTail(nullptr)
+	, _nNextSeq(0)
+	, _nDoneSeq(0)
+	, _vReports()
+	, _vDone() {}
+
+SendQueue::~SendQueue() {
+	Abandon();
+
+	/// Owner never popped them. Memory must still be given back to its owner.
+	for (auto & fDone : _vDone) fDone();
+}
+
+void SendQueue::Append(const char * pData, size_t nSize) {
+	if (nSize == 0) return;
+	_pReserved = nullptr;
+	_nSize += nSize;
+
+	if (_pTail && _pTail->nCapacity > _pTail->nEnd) {
+		size_t nCopy = std::min(nSize, _pTail->nCapacity - _pTail->nEnd);
+		memcpy((char *)(_pTail + 1) + _pTail->nEnd, pData, nCopy);
+		_pTail->nEnd += nCopy;
+		pData += nCopy;
+		nSize -= nCopy;
+		if (nSize == 0) return;
+	}
+
+	Block * pBlock = __New(std::max(nSize, (size_t)SENDQUEUE_BLOCK));
+	pBlock->nEnd = nSize;
+	memcpy(pBlock + 1, pData, nSize);
+
+	__Link(pBlock);
+}
+
+void SendQueue::Append(SharedPayload * pPayload) {
+	if (pPayload->Size() == 0) return;
+	_pReserved = nullptr;
+	_nSize += pPayload->Size();
+	pPayload->Retain();
+
+	/// Capacity equals end, so Append(pData, nSize) never writes into it.
+	Block * pBlock = __New(0);
+	pBlock->pShared		= pPayload;
+	pBlock->nCapacity	= pPayload->Size();
+	pBlock->nEnd		= pPayload->Size();
+
+	__Link(pBlock);
+}
+
+void SendQueue::Append(const char * pData, size_t nSize, std::function<void ()> fDone) {
+	_pReserved = nullptr;
+	_nSize += nSize;
+
+	/// Linked even if empty, so fDone is handed out in order with others.
+	Block * pBlock = __New(0);
+	pBlock->pExtern		= pData;
+	pBlock->pDone		= fDone ? new std::function<void ()>(std::move(fDone)) : nullptr;
+	pBlock->nCapacity	= nSize;
+	pBlock->nEnd		= nSize;
+
+	if (nSize == 0) {
+		__Free(pBlock);
+	} else {
+		__Link(pBlock);
+	}
+}
+
+void SendQueue::AppendFile(int nFile, uint64_t nOffset, size_t nSize) {
+	_pReserved = nullptr;
+	_nSize += nSize;
+	_nFileBytes += nSize;
+
+	Block * pBlock = __New(0);
+	pBlock->nFile		= nFile;
+	pBlock->nOffset		= nOffset;
+	pBlock->nCapacity	= nSize;
+	pBlock->nEnd		= nSize;
+
+	if (nSize == 0) {
+		__Free(pBlock);
+	} else {
+		__Link(pBlock);
+	}
+}
+
+bool SendQueue::Load(size_t nMax) {
+	Block * pFile = _pHead;
+	if (!pFile || !pFile->IsFile()) return true;
+
+	size_t nRead = std::min(nMax, pFile->Size());
+	Block * pBlock = __New(nRead);
+
+	int64_t nGot = ReadAt(pFile->nFile, (char *)(pBlock + 1), nRead, pFile->nOffset + pFile->nBegin);
+	if (nGot <= 0) {
+		free(pBlock);
+		return false;
+	}
+
+	/// Loaded bytes stay in Size(). They only move from file to memory.
+	pBlock->nEnd = (size_t)nGot;
+	pFile->nBegin += (size_t)nGot;
+	_nFileBytes -= (size_t)nGot;
+
+	if (pFile->Size() > 0) {
+		pBlock->pNext = pFile;
+	} else {
+		pBlock->pNext = pFile->pNext;
+		if (_pTail == pFile) _pTail = pBlock;
+		__Free(pFile);
+	}
+
+	_pHead = pBlock;
+	return true;
+}
+
+char * SendQueue::Reserve(size_t nSize) {
+	if (_pTail && _pTail->IsInline() && _pTail->nCapacity - _pTail->nEnd >= nSize) {
+		_pReserved = _pTail;
+	} else {
+		if (_pSpare && _pSpare->nCapacity < nSize) {
+			free(_pSpare);
+			_pSpare = nullptr;
+		}
+
+		if (!_pSpare) _pSpare = __New(std::max(nSize, (size_t)SENDQUEUE_BLOCK));
+
+		_pSpare->nBegin	= 0;
+		_pSpare->nEnd	= 0;
+		_pReserved		= _pSpare;
+	}
+
+	_nReserved = nSize;
+	return (char *)(_pReserved + 1) + _pReserved->nEnd;
+}
+char * SendQueue::Commit(size_t nSize) {
+	if (!_pReserved || nSize > _nReserved) return nullptr;
+
+	Block * pBlock = _pReserved;
+	char * pData = (char *)(pBlock + 1) + pBlock->nEnd;
+	_pReserved = nullptr;
+	if (nSize == 0) return pData;
+
+	if (pBlock == _pSpare) {
+		_pSpare = nullptr;
+		__Link(pBlock);
+	}
+
+	pBlock->nEnd += nSize;
+	_nSize += nSize;
+	return pData;
+}
+
+void SendQueue::Consume(size_t nSize, bool bZeroCopy) {
+	uint32_t nSeq = bZeroCopy ? _nNextSeq++ : 0;
+
+	nSize = std::min(nSize, _nSize);
+	_nSize -= nSize;
+
+	while (nSize > 0 && _pHead) {
+		size_t nDrop = std::min(nSize, _pHead->Size());
+		_pHead->nBegin += nDrop;
+		nSize -= nDrop;
+
+		if (_pHead->IsFile()) _nFileBytes -= nDrop;
+
+		if (bZeroCopy) {
+			_pHead->bPinned	= true;
+			_pHead->nSeq	= nSeq;
+		}
+
+		if (_pHead->Size() == 0) {
+			Block * pNext = _pHead->pNext;
+			if (_pHead == _pReserved) _pReserved = nullptr;
+			__Release(_pHead);
+			_pHead = pNext;
+		}
+	}
+
+	if (!_pHead) _pTail = nullptr;
+}
+
+void SendQueue::Complete(uint32_t nFirst, uint32_t nLast) {
+	if ((int32_t)(nLast - _nDoneSeq) < 0) return;
+	_vReports.push_back(std::make_pair(nFirst, nLast));
+
+	/// Advance through every report that joins the reported range.
+	bool bMoved = true;
+	while (bMoved) {
+		bMoved = false;
+
+		for (size_t i = 0; i < _vReports.size(); ++i) {
+			if ((int32_t)(_vReports[i].first - _nDoneSeq) > 0) continue;
+
+			if ((int32_t)(_vReports[i].second + 1 - _nDoneSeq) > 0) _nDoneSeq = _vReports[i].second + 1;
+			_vReports[i] = _vReports.back();
+			_vReports.pop_back();
+			bMoved = true;
+			break;
+		}
+	}
+
+	while (_pPinned && (int32_t)(_pPinned->nSeq - _nDoneSeq) < 0) {
+		Block * pNext = _pPinned->pNext;
+		__Free(_pPinned);
+		_pPinned = pNext;
+	}
+
+	if (!_pPinned) _pPinnedTail = nullptr;
+}
+
+bool SendQueue::PopDone(std::vector<std::function<void ()>> & rDone) {
+	if (_vDone.empty()) return false;
+
+	if (rDone.empty()) {
+		rDone.swap(_vDone);
+	} else {
+		for (auto & fDone : _vDone) rDone.push_back(std::move(fDone));
+		_vDone.clear();
+	}
+
+	return true;
+}
+
+void SendQueue::Clear() {
+	/// Partly sent head may be pinned too. __Release() keeps it like a sent block.
+	while (_pHead) {
+		Block * pNext = _pHead->pNext;
+		__Release(_pHead);
+		_pHead = pNext;
+	}
+
+	free(_pSpare);
+
+	_pTail		= nullptr;
+	_nSize		= 0;
+	_nFileBytes	= 0;
+	_pSpare		= nullptr;
+	_pReserved	= nullptr;
+}
+
+void SendQueue::Abandon() {
+	Clear();
+
+	while (_pPinned) {
+		Block * pNext = _pPinned->pNext;
+		__Free(_pPinned);
+		_pPinned = pNext;
+	}
+
+	_pPinnedTail	= nullptr;
+	_nNextSeq		= 0;
+	_nDoneSeq		= 0;
+	_vReports.clear();
+}
+
+void SendQueue::Swap(SendQueue & rOther) {
+	std::swap(_pHead, rOther._pHead);
+	std::swap(_pTail, rOther._pTail);
+	std::swap(_nSize, rOther._nSize);
+	std::swap(_nFileBytes, rOther._nFileBytes);
+	std::swap(_pSpare, rOther._pSpare);
+	std::swap(_pReserved, rOther._pReserved);
+	std::swap(_nReserved, rOther._nReserved);
+	std::swap(_pPinned, rOther._pPinned);
+	std::swap(_pPinnedTail, rOther._pPinnedTail);
+	std::swap(_nNextSeq, rOther._nNextSeq);
+	std::swap(_nDoneSeq, rOther._nDoneSeq);
+	_vReports.swap(rOther._vReports);
+	_vDone.swap(rOther._vDone);
+}
+
+SendQueue::Block * SendQueue::__New(size_t nCapacity) {
+	Block * pBlock = (Block *)malloc(sizeof(Block) + nCapacity);
+	pBlock->pNext		= nullptr;
+	pBlock->pShared		= nullptr;
+	pBlock->pExtern		= nullptr;
+	pBlock->pDone		= nullptr;
+	pBlock->nFile		= -1;
+	pBlock->bPinned		= false;
+	pBlock->nSeq		= 0;
+	pBlock->nOffset		= 0;
+	pBlock->nCapacity	= nCapacity;
+	pBlock->nBegin		= 0;
+	pBlock->nEnd		= 0;
+	return pBlock;
+}
+
+void SendQueue::__Link(Block * pBlock) {
+	pBlock->pNext = nullptr;
+
+	if (_pTail) {
+		_pTail->pNext = pBlock;
+	} else {
+		_pHead = pBlock;
+	}
+
+	_pTail = pBlock;
+}
+
+void SendQueue::__Release(Block * pBlock) {
+	if (!pBlock->bPinned || (int32_t)(pBlock->nSeq - _nDoneSeq) < 0) {
+		__Free(pBlock);
+		return;
+	}
+
+	/// Kernel may still read it. Keep until Complete() covers its last send.
+	pBlock->pNext = nullptr;
+
+	if (_pPinnedTail) {
+		_pPinnedTail->pNext = pBlock;
+	} else {
+		_pPinned = pBlock;
+	}
+
+	_pPinnedTail = pBlock;
+}
+
+void SendQueue::__Free(Block * pBlock) {
+	if (pBlock->pShared) pBlock->pShared->Release();
+	if (pBlock->nFile >= 0) CloseFile(pBlock->nFile);
+
+	if (pBlock->pDone) {
+		_vDone.push_back(std::move(*pBlock->pDone));
+		delete pBlock->pDone;
+	}
+
+	free(pBlock);
+}
+
+RecvBuffer::RecvBuffer() : _pMem(nullptr), _nCapacity(0), _nHead(0), _nSize(0) {}
+
+RecvBuffer::~RecvBuffer() {
+	Clear();
+}
+
+void RecvBuffer::Append(const char * pData, size_t nSize) {
+	if (nSize == 0) return;
+
+	if (_nSize + nSize > _nCapacity) {
+		size_t nCapacity = _nCapacity > 0 ? _nCapacity : RECVBUFFER_MIN;
+		while (nCapacity < _nSize + nSize) nCapacity <<= 1;
+
+		char * pMem = (char *)malloc(nCapacity);
+		Copy(0, pMem, _nSize);
+		free(_pMem);
+
+		_pMem		= pMem;
+		_nCapacity	= nCapacity;
+		_nHead		= 0;
+	}
+
+	size_t nTail = (_nHead + _nSize) & (_nCapacity - 1);
+	size_t nFirst = std::min(nSize, _nCapacity - nTail);
+	memcpy(_pMem + nTail, pData, nFirst);
+	memcpy(_pMem, pData + nFirst, nSize - nFirst);
+	_nSize += nSize;
+}
+
+void RecvBuffer::Peek(char ** pFirst, size_t & nFirst, char ** pSecond, size_t & nSecond) {
+	nFirst	= std::min(_nSize, _nCapacity - _nHead);
+	nSecond	= _nSize - nFirst;
+	*pFirst	= _pMem + _nHead;
+	*pSecond = _pMem;
+}
+
+void RecvBuffer::Copy(size_t nOffset, char * pOut, size_t nSize) const {
+	if (nSize == 0) return;
+
+	size_t nStart = (_nHead + nOffset) & (_nCapacity - 1);
+	size_t nFirst = std::min(nSize, _nCapacity - nStart);
+	memcpy(pOut, _pMem + nStart, nFirst);
+	memcpy(pOut + nFirst, _pMem, nSize - nFirst);
+}
+
+char * RecvBuffer::Data(size_t nOffset, size_t nSize) {
+	if (_nCapacity == 0) return nullptr;
+
+	size_t nStart = (_nHead + nOffset) & (_nCapacity - 1);
+	if (nStart + nSize > _nCapacity) return nullptr;
+	return _pMem + nStart;
+}
+
+void RecvBuffer::Linearize() {
+	if (_nHead + _nSize <= _nCapacity) return;
+
+	char * pMem = (char *)malloc(_nCapacity);
+	Copy(0, pMem, _nSize);
+	free(_pMem);
+
+	_pMem	= pMem;
+	_nHead	= 0;
+}
+
+void RecvBuffer::Consume(size_t nSize) {
+	if (nSize >= _nSize) {
+		Clear();
+	} else {
+		_nHead = (_nHead + nSize) & (_nCapacity - 1);
+		_nSize -= nSize;
+	}
+}
+
+void RecvBuffer::Swap(RecvBuffer & r) {
+	std::swap(_pMem, r._pMem);
+	std::swap(_nCapacity, r._nCapacity);
+	std::swap(_nHead, r._nHead);
+	std::swap(_nSize, r._nSize);
+}
+
+void RecvBuffer::Clear() {
+	free(_pMem);
+	_pMem		= nullptr;
+	_nCapacity	= 0;
+	_nHead		= 0;
+	_nSize		= 0;
+}
+
+bool FrameCodec::Setup(const FrameOption & rOpt) {
+	if (rOpt.emLength < ENet::Stream || rOpt.emLength > ENet::VarInt) return false;
+	if (rOpt.nIdSize != 0 && rOpt.nIdSize != 2 && rOpt.nIdSize != 4) return false;
+	if (rOpt.emLength == ENet::U16 && rOpt.nMaxSize > 0xFFFF) return false;
+	if (rOpt.nMaxSize > 0xFFFFFFFF) return false;
+
+	_iOpt = rOpt;
+	return true;
+}
+
+size_t FrameCodec::Encode(char * pHeader, uint32_t nMsgId, size_t nBody, size_t nWidth) const {
+	unsigned char * p = (unsigned char *)pHeader;
+	size_t n = 0;
+	size_t nPad = nWidth > (size_t)_iOpt.nIdSize ? nWidth - _iOpt.nIdSize : 0;
+	int nFixed = 0;
+
+	if (nBody > _iOpt.nMaxSize) return 0;
+
+	switch (_iOpt.emLength) {
+	case ENet::U16: nFixed = 2; break;
+	case ENet::U32: nFixed = 4; break;
+	case ENet::VarInt:
+		do {
+			p[n] = (unsigned char)(nBody & 0x7F);
+			nBody >>= 7;
+			if (nBody || n + 1 < nPad) p[n] |= 0x80;
+			++n;
+		} while (nBody || n < nPad);
+		break;
+	default: return 0;
+	}
+
+	for (int i = 0; i < nFixed; ++i, ++n)
+		p[n] = (unsigned char)(nBody >> ((_iOpt.bBigEndian ? nFixed - 1 - i : i) * 8));
+
+	for (int i = 0; i < _iOpt.nIdSize; ++i, ++n)
+		p[n] = (unsigned char)(nMsgId >> ((_iOpt.bBigEndian ? _iOpt.nIdSize - 1 - i : i) * 8));
+
+	return n;
+}
+
+size_t FrameCodec::HeaderSize() const {
+	switch (_iOpt.emLength) {
+	case ENet::U16: return 2 + _iOpt.nIdSize;
+	case ENet::U32: return 4 + _iOpt.nIdSize;
+	case ENet::VarInt: {
+		/// Decode() accepts at most 5 bytes.
+		size_t n = 1;
+		for (size_t nMax = _iOpt.nMaxSize >> 7; nMax && n < 5; nMax >>= 7) ++n;
+		return n + _iOpt.nIdSize;
+	}
+	default: return 0;
+	}
+}
+
+int FrameCodec::Decode(const char * pData, size_t nSize, uint32_t & nMsgId, size_t & nBody) const {
+	const unsigned char * p = (const unsigned char *)pData;
+	size_t n = 0;
+	int nFixed = 0;
+
+	nBody = 0;
+	nMsgId = 0;
+
+	switch (_iOpt.emLength) {
+	case ENet::U16: nFixed = 2; break;
+	case ENet::U32: nFixed = 4; break;
+	case ENet::VarInt:
+		while (true) {
+			if (n >= 5) return -1;
+			if (n >= nSize) return 0;
+
+			nBody |= (size_t)(p[n] & 0x7F) << (7 * n);
+			if (!(p[n++] & 0x80)) break;
+		}
+		break;
+	default: return -1;
+	}
+
+	if (nSize < n + nFixed + _iOpt.nIdSize) return 0;
+
+	for (int i = 0; i < nFixed; ++i, ++n)
+		nBody |= (size_t)p[n] << ((_iOpt.bBigEndian ? nFixed - 1 - i : i) * 8);
+
+	for (int i = 0; i < _iOpt.nIdSize; ++i, ++n)
+		nMsgId |= (uint32_t)p[n] << ((_iOpt.bBigEndian ? _iOpt.nIdSize - 1 - i : i) * 8);
+
+	if (nBody > _iOpt.nMaxSize) return -1;
+	return (int)n;
+}
+
+PostBox::PostBox() : _iStub(), _pHead(&_iStub), _pTail(&_iStub), _bSignaled(false) {
+	_iStub.pNext.store(nullptr);
+}
+
+PostBox::~PostBox() {
+	Clear();
+}
+
+bool PostBox::Push(uint64_t nId, uint32_t nMsgId, bool bFrame, const char * pData, size_t nSize) {
+	Post * p = new (malloc(sizeof(Post) + nSize)) Post;
+	p->nId		= nId;
+	p->nMsgId	= nMsgId;
+	p->bFrame	= bFrame;
+	p->nSize	= nSize;
+	if (nSize > 0) memcpy(p->Data(), pData, nSize);
+
+	__Link(p);
+	return !_bSignaled.exchange(true);
+}
+
+PostBox::Post * PostBox::__Pop() {
+	Post * pTail = _pTail;
+	Post * pNext = pTail->pNext.load(std::memory_order_acquire);
+
+	if (pTail == &_iStub) {
+		if (!pNext) return nullptr;
+		_pTail = pTail = pNext;
+		pNext = pNext->pNext.load(std::memory_order_acquire);
+	}
+
+	if (pNext) {
+		_pTail = pNext;
+		return pTail;
+	}
+
+	if (pTail != _pHead.load(std::memory_order_acquire)) {
+		/// A producer swapped head but has NOT linked its node yet. It is between two
+		/// instructions, so wait for it instead of leaving the post behind.
+		while (!(pNext = pTail->pNext.load(std::memory_order_acquire))) std::this_thread::yield();
+		_pTail = pNext;
+		return pTail;
+	}
+
+	/// Last node can only be popped with stub behind it.
+	__Link(&_iStub);
+	pNext = pTail->pNext.load(std::memory_order_acquire);
+	while (!pNext) {
+		std::this_thread::yield();
+		pNext = pTail->pNext.load(std::memory_order_acquire);
+	}
+
+	_pTail = pNext;
+	return pTail;
+}
+
+void PostBox::__Link(Post * p) {
+	p->pNext.store(nullptr, std::memory_order_relaxed);
+	Post * pPrev = _pHead.exchange(p, std::memory_order_acq_rel);
+	pPrev->pNext.store(p, std::memory_order_release);
+}
\ No newline at end of file
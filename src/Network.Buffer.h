@@ -0,0 +1,498 @@
+#ifndef		__ENGINE_NETWORK_BUFFER_H_INCLUDED__
+#define		__ENGINE_NETWORK_BUFFER_H_INCLUDED__
+
+#include	<Network.h>
+#include	<algorithm>
+#include	<atomic>
+#include	<cstddef>
+#include	<cstdint>
+#include	<cstdlib>
+#include	<functional>
+#include	<thread>
+#include	<utility>
+#include	<vector>
+
+#define		SENDQUEUE_BLOCK	16384
+#define		SENDQUEUE_LIMIT	67108864
+#define		SENDQUEUE_CHUNK	262144
+#define		SENDQUEUE_ZEROCOPY	16384
+#define		SENDQUEUE_LINGER	30000
+#define		RECVBUFFER_MIN	1024
+
+/**
+ * Immutable bytes shared by many send queues (eg. broadcast), so the message is
+ * built once no matter how many clients receive it. Freed with the last reference.
+ * Only used from the thread that owns the sockets, so the counter is NOT atomic.
+ **/
+class SharedPayload {
+public:
+	/**
+	 * Allocate a payload with one reference held by caller.
+	 **/
+	static SharedPayload *	New(size_t nSize);
+
+	inline void		Retain() { ++_nRef; }
+	inline void		Release() { if (--_nRef == 0) free(this); }
+	inline char *	Data() { return (char *)(this + 1); }
+	inline size_t	Size() const { return _nSize; }
+
+private:
+	SharedPayload() {}
+
+private:
+	size_t	_nRef;
+	size_t	_nSize;
+};
+
+/**
+ * Outbound data that can NOT be written to socket immediately. Kept in a chain
+ * of blocks so flushing can hand them to kernel in one writev().
+ *
+ * Besides copied bytes, a block may reference caller's memory or a range of an
+ * open file, so large payloads are never copied into this queue. Memory sent by
+ * MSG_ZEROCOPY is still read by kernel after it leaves this queue. Such blocks
+ * wait in a second chain until Complete() reports their sends, and callbacks of
+ * finished blocks are handed out by PopDone() instead of being invoked here.
+ **/
+class SendQueue {
+public:
+	struct Block {
+		Block *			pNext;
+		SharedPayload *	pShared;	//! Referenced payload instead of inline bytes
+		const char *	pExtern;	//! Caller's memory referenced in place
+		std::function<void ()> *	pDone;	//! Invoked once pExtern is no longer used
+		int				nFile;		//! Owned file sent from nOffset + nBegin, -1 for memory
+		bool			bPinned;	//! Some bytes went out by MSG_ZEROCOPY
+		uint32_t		nSeq;		//! Zero-copy send that took the last pinned byte
+		uint64_t		nOffset;
+		size_t			nCapacity;
+		size_t			nBegin;
+		size_t			nEnd;
+
+		inline char *	Data() { return (pShared ? pShared->Data() : pExtern ? (char *)pExtern : (char *)(this + 1)) + nBegin; }
+		inline size_t	Size() const { return nEnd - nBegin; }
+		inline bool		IsFile() const { return nFile >= 0; }
+		inline bool		IsInline() const { return !pShared && !pExtern && nFile < 0; }
+	};
+
+public:
+	SendQueue();
+	virtual ~SendQueue();
+
+	/**
+	 * Bytes waiting to be sent.
+	 **/
+	inline size_t	Size() const { return _nSize; }
+	inline bool		Empty() const { return _nSize == 0; }
+
+	/**
+	 * Bytes waiting in memory. Unlike Size(), file ranges are NOT counted, so
+	 * limits checked with it are not exhausted by a queued file.
+	 **/
+	inline size_t	Buffered() const { return _nSize - _nFileBytes; }
+
+	/**
+	 * Kernel has NOT reported every MSG_ZEROCOPY send yet, so it may still read
+	 * memory of this queue, even after Clear().
+	 **/
+	inline bool		Pinning() const { return _nDoneSeq != _nNextSeq; }
+
+	/**
+	 * First block in the chain. Use Block::pNext to walk through.
+	 **/
+	inline Block *	Head() { return _pHead; }
+
+	/**
+	 * Copy data to the tail of this queue.
+	 *
+	 * \param	pData	Pointer to data.
+	 * \param	nSize	Size of data in bytes.
+	 **/
+	void	Append(const char * pData, size_t nSize);
+
+	/**
+	 * Reference a shared payload at the tail of this queue without copying.
+	 *
+	 * \param	pPayload	Shared payload. One more reference is taken.
+	 **/
+	void	Append(SharedPayload * pPayload);
+
+	/**
+	 * Reference caller's memory at the tail of this queue without copying.
+	 *
+	 * \param	pData	Memory that must NOT change until fDone is handed out.
+	 * \param	nSize	Size of data in bytes.
+	 * \param	fDone	Callback handed out by PopDone() once pData is no longer used.
+	 **/
+	void	Append(const char * pData, size_t nSize, std::function<void ()> fDone);
+
+	/**
+	 * Queue a range of file at the tail. The file is closed by this queue once
+	 * sent or dropped.
+	 *
+	 * \param	nFile	File descriptor owned by this queue from now on.
+	 * \param	nOffset	Offset of the first byte.
+	 * \param	nSize	Bytes to send. Must NOT reach past end of file.
+	 **/
+	void	AppendFile(int nFile, uint64_t nOffset, size_t nSize);
+
+	/**
+	 * Read the next part of a file range at head into memory, for senders that
+	 * can NOT hand a file to kernel. Does nothing if head is NOT a file.
+	 *
+	 * \param	nMax	Most bytes to read.
+	 * \return	False if file can NOT be read.
+	 **/
+	bool	Load(size_t nMax);
+
+	/**
+	 * Get writable space at the tail without adding it to this queue, so a message
+	 * can be serialized in place. Append(), Clear() and sending the tail block cancel
+	 * the reservation.
+	 *
+	 * \param	nSize	Bytes to reserve.
+	 * \return	Start of reserved space.
+	 **/
+	char *	Reserve(size_t nSize);
+
+	/**
+	 * Add the first nSize bytes of reserved space to this queue.
+	 *
+	 * \return	Start of committed bytes. nullptr if nothing reserved or nSize is too large.
+	 **/
+	char *	Commit(size_t nSize);
+
+	/**
+	 * Drop bytes from head after they were written to socket.
+	 *
+	 * \param	nSize		Size of data written.
+	 * \param	bZeroCopy	Written by one sendmsg() with MSG_ZEROCOPY. Blocks keep
+	 *						their memory until Complete() covers this send.
+	 **/
+	void	Consume(size_t nSize, bool bZeroCopy = false);
+
+	/**
+	 * Kernel finished zero-copy sends nFirst to nLast (inclusive), numbered from 0
+	 * by Consume(). Reports may arrive out of order.
+	 **/
+	void	Complete(uint32_t nFirst, uint32_t nLast);
+
+	/**
+	 * Append callbacks of finished referenced memory to rDone. Callers invoke them
+	 * after they stop touching this queue, because callbacks may send again.
+	 *
+	 * \return	False if there is nothing.
+	 **/
+	bool	PopDone(std::vector<std::function<void ()>> & rDone);
+
+	/**
+	 * Drop all pending data. Blocks kernel may still read stay until Complete()
+	 * covers them, so keep reporting while Pinning().
+	 **/
+	void	Clear();
+
+	/**
+	 * Drop all data including blocks kernel has NOT reported. Only when socket was
+	 * reset or never took a zero-copy send, so kernel no longer reads them.
+	 **/
+	void	Abandon();
+
+	/**
+	 * Exchange content with another queue.
+	 **/
+	void	Swap(SendQueue & rOther);
+
+private:
+	static Block *	__New(size_t nCapacity);
+	void	__Link(Block * pBlock);
+	void	__Release(Block * pBlock);
+	void	__Free(Block * pBlock);
+
+private:
+	Block *	_pHead;
+	Block *	_pTail;
+	size_t	_nSize;
+	size_t	_nFileBytes;
+	Block *	_pSpare;		//! Block for a reservation that does NOT fit tail, linked by Commit()
+	Block *	_pReserved;		//! Block holding reservation, tail or spare
+	size_t	_nReserved;
+	Block *	_pPinned;		//! Sent blocks waiting for zero-copy reports, ordered by nSeq
+	Block *	_pPinnedTail;
+	uint32_t	_nNextSeq;	//! Number of the next zero-copy send
+	uint32_t	_nDoneSeq;	//! Every send before this one is reported
+	std::vector<std::pair<uint32_t, uint32_t>>	_vReports;	//! Reports beyond _nDoneSeq
+	std::vector<std::function<void ()>>			_vDone;
+};
+
+/**
+ * Received bytes that were not consumed yet (eg. the first half of a message).
+ * Ring buffer that grows by doubling and releases its memory once drained, so
+ * an idle connection holds nothing but this object.
+ **/
+class RecvBuffer {
+public:
+	RecvBuffer();
+	virtual ~RecvBuffer();
+
+	/**
+	 * Bytes kept in this buffer.
+	 **/
+	inline size_t	Size() const { return _nSize; }
+	inline bool		Empty() const { return _nSize == 0; }
+	inline size_t	Capacity() const { return _nCapacity; }
+
+	/**
+	 * Copy data to the tail of this buffer. Grows when needed.
+	 *
+	 * \param	pData	Pointer to data.
+	 * \param	nSize	Size of data in bytes.
+	 **/
+	void	Append(const char * pData, size_t nSize);
+
+	/**
+	 * Get readable data without copy.
+	 *
+	 * \param	pFirst	Out pointer to the first part.
+	 * \param	nFirst	Size of the first part.
+	 * \param	pSecond	Out pointer to the part wrapped to the front of ring.
+	 * \param	nSecond	Size of the second part. 0 if data does NOT wrap.
+	 **/
+	void	Peek(char ** pFirst, size_t & nFirst, char ** pSecond, size_t & nSecond);
+
+	/**
+	 * Copy data out without consuming it.
+	 *
+	 * \param	nOffset	Offset from the first readable byte.
+	 * \param	pOut	Destination.
+	 * \param	nSize	Bytes to copy.
+	 **/
+	void	Copy(size_t nOffset, char * pOut, size_t nSize) const;
+
+	/**
+	 * Get pointer to a range of data.
+	 *
+	 * \param	nOffset	Offset from the first readable byte.
+	 * \param	nSize	Size of this range.
+	 * \return	nullptr if this range spans the wrap point. See Linearize().
+	 **/
+	char *	Data(size_t nOffset, size_t nSize);
+
+	/**
+	 * Move data so all of it is contiguous.
+	 **/
+	void	Linearize();
+
+	/**
+	 * Drop bytes from head. Memory is released when nothing left.
+	 *
+	 * \param	nSize	Bytes to drop.
+	 **/
+	void	Consume(size_t nSize);
+
+	/**
+	 * Exchange content with another buffer.
+	 **/
+	void	Swap(RecvBuffer & r);
+
+	/**
+	 * Drop all data and release memory.
+	 **/
+	void	Clear();
+
+private:
+	char *	_pMem;
+	size_t	_nCapacity;
+	size_t	_nHead;
+	size_t	_nSize;
+};
+
+/**
+ * Encoder & decoder of built-in framing. See FrameOption.
+ **/
+class FrameCodec {
+public:
+	enum { MaxHeader = 9 };
+
+	FrameCodec() : _iOpt() {}
+	virtual ~FrameCodec() {}
+
+	/**
+	 * Set frame format.
+	 *
+	 * \return	False for bad option.
+	 **/
+	bool	Setup(const FrameOption & rOpt);
+
+	/**
+	 * Is framing enabled?
+	 **/
+	inline bool	Enabled() const { return _iOpt.emLength != ENet::Stream; }
+
+	/**
+	 * Build frame header.
+	 *
+	 * \param	pHeader	Output. Must hold at least MaxHeader bytes.
+	 * \param	nMsgId	Message id.
+	 * \param	nBody	Size of message body.
+	 * \param	nWidth	Pad VarInt length with continuation bytes, so header takes exactly
+	 *					this size. 0 for the shortest form.
+	 * \return	Size of header. 0 if framing disabled or body too large.
+	 **/
+	size_t	Encode(char * pHeader, uint32_t nMsgId, size_t nBody, size_t nWidth = 0) const;
+
+	/**
+	 * Size of header able to hold any body up to max size. Space reserved before
+	 * body size is known. 0 if framing disabled.
+	 **/
+	size_t	HeaderSize() const;
+
+	/**
+	 * Parse frame header.
+	 *
+	 * \param	pData	Received data.
+	 * \param	nSize	Size of received data.
+	 * \param	nMsgId	Output message id.
+	 * \param	nBody	Output size of message body.
+	 * \return	Size of header. 0 if more data needed, -1 for bad data or body too large.
+	 **/
+	int		Decode(const char * pData, size_t nSize, uint32_t & nMsgId, size_t & nBody) const;
+
+	/**
+	 * Cut complete frames out of received data. A partial frame is kept in rBuf until
+	 * more data arrives. Frame body is passed to fOpt without copy unless it spans the
+	 * wrap point of rBuf.
+	 *
+	 * \param	rBuf	Receive buffer of this connection.
+	 * \param	pData	Newly received data.
+	 * \param	nSize	Size of newly received data.
+	 * \param	fOpt	bool (uint32_t nMsgId, char * pBody, size_t nBody). Returns false to stop at
+	 *					once (eg. connection closed in callback) and rBuf will NOT be touched again.
+	 * \param	pBudget	Frames that may still be delivered, decreased for each one. At 0 the
+	 *					rest is kept in rBuf, so call again with no data to continue.
+	 *					nullptr for no limit.
+	 * \return	False for bad data.
+	 **/
+	template<typename F>
+	bool	Split(RecvBuffer & rBuf, char * pData, size_t nSize, F fOpt, uint32_t * pBudget = nullptr) const;
+
+private:
+	FrameOption	_iOpt;
+};
+
+template<typename F>
+bool FrameCodec::Split(RecvBuffer & rBuf, char * pData, size_t nSize, F fOpt, uint32_t * pBudget) const {
+	uint32_t	nMsgId	= 0;
+	size_t		nBody	= 0;
+
+	if (rBuf.Empty()) {
+		while (nSize > 0 && !(pBudget && *pBudget == 0)) {
+			int nHeader = Decode(pData, nSize, nMsgId, nBody);
+			if (nHeader < 0) return false;
+			if (nHeader == 0 || nHeader + nBody > nSize) break;
+			if (pBudget) --*pBudget;
+			if (!fOpt(nMsgId, pData + nHeader, nBody)) return true;
+
+			pData += nHeader + nBody;
+			nSize -= nHeader + nBody;
+		}
+
+		rBuf.Append(pData, nSize);
+		return true;
+	}
+
+	rBuf.Append(pData, nSize);
+
+	while (!rBuf.Empty() && !(pBudget && *pBudget == 0)) {
+		char	pHeader[MaxHeader];
+		size_t	nPeek = std::min(rBuf.Size(), (size_t)MaxHeader);
+		rBuf.Copy(0, pHeader, nPeek);
+
+		int nHeader = Decode(pHeader, nPeek, nMsgId, nBody);
+		if (nHeader < 0) return false;
+		if (nHeader == 0 || nHeader + nBody > rBuf.Size()) break;
+
+		char * pBody = rBuf.Data(nHeader, nBody);
+		if (!pBody) {
+			rBuf.Linearize();
+			pBody = rBuf.Data(nHeader, nBody);
+		}
+
+		if (pBudget) --*pBudget;
+		if (!fOpt(nMsgId, pBody, nBody)) return true;
+		rBuf.Consume(nHeader + nBody);
+	}
+
+	return true;
+}
+
+/**
+ * Sends posted by other threads, drained by the thread owning the socket.
+ * Unbounded intrusive MPSC queue (Vyukov) : Push() is one atomic exchange and never
+ * blocks, Drain() takes no lock. Payload is copied into the node, so caller's
+ * buffer may be reused at once.
+ **/
+class PostBox {
+public:
+	struct Post {
+		std::atomic<Post *>	pNext;
+		uint64_t			nId;		//! Connection identifier. 0 for client socket.
+		uint32_t			nMsgId;
+		bool				bFrame;		//! Send as frame, nMsgId is meaningful
+		size_t				nSize;
+
+		inline char *	Data() { return (char *)(this + 1); }
+	};
+
+public:
+	PostBox();
+	virtual ~PostBox();
+
+	/**
+	 * Queue a copy of data. Thread-safe.
+	 *
+	 * \return	True if consumer was idle and should be woken up.
+	 **/
+	bool	Push(uint64_t nId, uint32_t nMsgId, bool bFrame, const char * pData, size_t nSize);
+
+	/**
+	 * Hand every queued post to fOpt in order of Push(), then free it. Owner thread only.
+	 *
+	 * \param	fOpt	void(Post & rPost)
+	 * \return	Number of posts handled.
+	 **/
+	template<typename F>
+	size_t	Drain(F fOpt);
+
+	/**
+	 * Drop all queued posts. Owner thread only.
+	 **/
+	void	Clear() { Drain([](Post &) {}); }
+
+private:
+	Post *	__Pop();
+	void	__Link(Post * p);
+
+private:
+	Post					_iStub;
+	std::atomic<Post *>		_pHead;		//! Last pushed, written by producers
+	Post *					_pTail;		//! Next to pop, owned by consumer
+	std::atomic<bool>		_bSignaled;
+};
+
+template<typename F>
+size_t PostBox::Drain(F fOpt) {
+	/// Cleared first, so a post this loop misses always wakes consumer again.
+	_bSignaled.store(false);
+
+	size_t nCount = 0;
+	while (Post * p = __Pop()) {
+		fOpt(*p);
+		p->~Post();
+		free(p);
+		++nCount;
+	}
+
+	return nCount;
+}
+
+#endif//!	__ENGINE_NETWORK_BUFFER_H_INCLUDED__
@@ -0,0 +1,743 @@
+#include	"Network.Bus.h"
+#include	<DateTime.h>
+#include	<Logger.h>
+
+#include	<algorithm>
+#include	<cmath>
+#include	<map>
+#include	<memory>
+#include	<string>
+#include	<unordered_map>
+
+using namespace std;
+
+extern void AutoNetworkAdd(IMessageBus * p);
+extern void AutoNetworkDel(IMessageBus * p);
+extern void AutoNetworkDue(double dTime);
+
+/**
+ * Frame types, carried in message id field of built-in framing.
+ **/
+enum BusFrame {
+	BusHello = 1,	//! [magic:4][node:4], first frame each side sends on a link
+	BusData,		//! One BusBatch
+	BusPing,		//! Sent by dialing side every keep-alive interval
+	BusPong,		//! Answer of accepting side
+};
+
+class BusContext;
+
+/**
+ * Accepts links from other nodes. Their Connection::pData keeps the node id
+ * once hello is received.
+ **/
+class BusServer : public IServerSocket {
+public:
+	BusServer(BusContext * pCtx) : _pCtx(pCtx) {}
+
+	virtual void	OnMessage(Connection * pConn, uint32_t nMsgId, char * pData, size_t nSize) override;
+	virtual void	OnClose(Connection * pConn, ENet::Close emCode) override;
+
+private:
+	BusContext *	_pCtx;
+};
+
+/**
+ * Link dialed to a node given by AddNode().
+ **/
+class BusClient : public ISocket {
+public:
+	BusClient(BusContext * pCtx, uint32_t nNode) : nNode(nNode), dRecv(0), dPing(0), _pCtx(pCtx) {}
+
+	virtual void	OnConnected() override;
+	virtual void	OnMessage(uint32_t nMsgId, char * pData, size_t nSize) override;
+	virtual void	OnClose(ENet::Close emCode) override;
+
+public:
+	uint32_t	nNode;
+	double		dRecv;		//! Last frame received
+	double		dPing;		//! Last ping sent
+
+private:
+	BusContext *	_pCtx;
+};
+
+class BusContext {
+	/// Links to one node. Either or both may exist when two nodes dial each other.
+	struct Peer {
+		unique_ptr<BusClient>	pClient;	//! Dialed link, nullptr if we do NOT dial this node
+		string		sIP;
+		int			nPort;
+		bool		bDialed;	//! pClient got hello back
+		uint64_t	nAccepted;	//! Accepted link with hello, 0 if none
+		bool		bUp;		//! Reported by OnNodeUp()
+
+		Peer() : pClient(), sIP(), nPort(0), bDialed(false), nAccepted(0), bUp(false) {}
+	};
+
+	struct Pending {
+		IMessageBus::ReplyHandler		fReply;
+		multimap<double, uint32_t>::iterator	itDeadline;
+	};
+
+	enum Link { None, Dialed, Accepted };
+
+public:
+	BusContext(IMessageBus * pOwner);
+	virtual ~BusContext() {}
+
+	void		SetKeepAlive(uint32_t nInterval, uint32_t nTimeout);
+	int			Start(uint32_t nNode, const string & sIP, int nPort);
+	uint32_t	Node() const { return _nNode; }
+	bool		AddNode(uint32_t nNode, const string & sIP, int nPort);
+	bool		AddRoute(uint32_t nDest, uint32_t nVia);
+	void		RemoveNode(uint32_t nNode);
+	bool		IsReachable(uint32_t nNode) { return __NextHop(nNode) != 0; }
+	bool		Send(uint32_t nDest, uint8_t nKind, uint32_t nMsgId, uint32_t nCorrId, const char * pData, size_t nSize);
+	bool		Request(uint32_t nDest, uint32_t nMsgId, const char * pData, size_t nSize, IMessageBus::ReplyHandler fReply, uint32_t nTimeout);
+	void		Flush();
+	void		Shutdown();
+	void		Breath();
+
+	/// Wrap callbacks of links. Dialed links closed meanwhile are freed after them.
+	inline void	Enter() { ++_nDepth; }
+	inline void	Leave() { --_nDepth; }
+
+	void		OnDialed(BusClient * pClient);
+	void		OnDialedFrame(BusClient * pClient, uint32_t nType, char * pData, size_t nSize);
+	void		OnDialedClose(BusClient * pClient);
+	void		OnAcceptedFrame(Connection * pConn, uint32_t nType, char * pData, size_t nSize);
+	void		OnAcceptedClose(Connection * pConn);
+
+private:
+	Link		__Link(uint32_t nNode, Peer & rNode);
+	bool		__Known(uint32_t nDest) const { return _mNodes.count(nDest) || _mRoutes.count(nDest) || _mLearned.count(nDest); }
+	uint32_t	__NextHop(uint32_t nDest);
+	bool		__SendFrame(uint32_t nHop, uint32_t nType, const NetSlice * pSlices, int nCount);
+	bool		__Write(BusBatch & rBatch);
+	BusBatch &	__Batch(uint32_t nSrc, uint32_t nDst);
+	void		__Input(uint32_t nFrom, char * pData, size_t nSize);
+	void		__Update(uint32_t nNode);
+	void		__KeepAlive(double dNow);
+	void		__Expire(double dNow);
+	void		__Hello(char * pOut);
+
+	static inline uint64_t	__Key(uint32_t nSrc, uint32_t nDst) { return ((uint64_t)nSrc << 32) | nDst; }
+
+private:
+	IMessageBus *		_pOwner;
+	uint32_t			_nNode;
+	uint32_t			_nInterval;
+	uint32_t			_nTimeout;
+	uint32_t			_nNextCorr;
+	int					_nDepth;	//! Callbacks running, which may still use a removed link
+	BusServer			_iServer;
+	map<uint32_t, Peer>	_mNodes;
+	unordered_map<uint32_t, uint32_t>	_mRoutes;	//! Destination -> relay
+	unordered_map<uint32_t, uint32_t>	_mLearned;	//! Source -> link its last relayed frame came in on
+	unordered_map<uint64_t, BusBatch>	_mBatches;
+	vector<uint64_t>	_vDirty;	//! Batches with records, including those waiting for a link
+	unordered_map<uint32_t, Pending>	_mPending;
+	multimap<double, uint32_t>			_mDeadlines;
+	vector<unique_ptr<BusClient>>		_vRetired;	//! Closed links freed when no callback runs
+};
+
+void BusServer::OnMessage(Connection * pConn, uint32_t nMsgId, char * pData, size_t nSize) {
+	_pCtx->Enter();
+	_pCtx->OnAcceptedFrame(pConn, nMsgId, pData, nSize);
+	_pCtx->Leave();
+}
+
+void BusServer::OnClose(Connection * pConn, ENet::Close emCode) {
+	_pCtx->Enter();
+	_pCtx->OnAcceptedClose(pConn);
+	_pCtx->Leave();
+}
+
+void BusClient::OnConnected() {
+	_pCtx->Enter();
+	_pCtx->OnDialed(this);
+	_pCtx->Leave();
+}
+
+void BusClient::OnMessage(uint32_t nMsgId, char * pData, size_t nSize) {
+	_pCtx->Enter();
+	_pCtx->OnDialedFrame(this, nMsgId, pData, nSize);
+	_pCtx->Leave();
+}
+
+void BusClient::OnClose(ENet::Close emCode) {
+	_pCtx->Enter();
+	_pCtx->OnDialedClose(this);
+	_pCtx->Leave();
+}
+
+BusContext::BusContext(IMessageBus * pOwner)
+	: _pOwner(pOwner)
+	, _nNode(0)
+	, _nInterval(1000)
+	, _nTimeout(5000)
+	, _nNextCorr(0)
+	, _nDepth(0)
+	, _iServer(this)
+	, _mNodes()
+	, _mRoutes()
+	, _mLearned()
+	, _mBatches()
+	, _vDirty()
+	, _mPending()
+	, _mDeadlines()
+	, _vRetired() {}
+
+void BusContext::SetKeepAlive(uint32_t nInterval, uint32_t nTimeout) {
+	_nInterval	= std::max(nInterval, (uint32_t)1);
+	_nTimeout	= std::max(nTimeout, _nInterval);
+}
+
+int BusContext::Start(uint32_t nNode, const string & sIP, int nPort) {
+	if (_nNode != 0) return ENet::Running;
+
+	_iServer.SetFrame(FrameOption(ENet::U32, 4, false, BUS_MAXFRAME));
+	_iServer.SetTimeout(_nTimeout);
+
+	if (!sIP.empty()) {
+		int n = _iServer.Listen(sIP, nPort);
+		if (n != 0) return n;
+	}
+
+	_nNode = nNode;
+	return 0;
+}
+
+bool BusContext::AddNode(uint32_t nNode, const string & sIP, int nPort) {
+	if (_nNode == 0 || nNode == _nNode) return false;
+
+	Peer & rNode = _mNodes[nNode];
+	if (rNode.pClient) return false;
+
+	BusClient * pClient = new BusClient(this, nNode);
+	pClient->SetFrame(FrameOption(ENet::U32, 4, false, BUS_MAXFRAME));
+	pClient->SetReconnect(100, _nTimeout);
+
+	rNode.pClient.reset(pClient);
+	rNode.sIP	= sIP;
+	rNode.nPort	= nPort;
+
+	if (pClient->Connect(sIP, nPort, true) != 0) {
+		_vRetired.push_back(std::move(rNode.pClient));
+		if (rNode.nAccepted == 0) _mNodes.erase(nNode);
+		return false;
+	}
+
+	return true;
+}
+
+bool BusContext::AddRoute(uint32_t nDest, uint32_t nVia) {
+	if (_nNode == 0 || nDest == 0 || nVia == 0 || nDest == _nNode || nVia == _nNode || nDest == nVia) return false;
+	_mRoutes[nDest] = nVia;
+	return true;
+}
+
+void BusContext::RemoveNode(uint32_t nNode) {
+	for (auto pRoutes : { &_mRoutes, &_mLearned }) {
+		pRoutes->erase(nNode);
+		for (auto it = pRoutes->begin(); it != pRoutes->end();) {
+			if (it->second == nNode) {
+				it = pRoutes->erase(it);
+			} else {
+				++it;
+			}
+		}
+	}
+
+	/// Dirty list is checked against _mBatches when flushing.
+	for (auto it = _mBatches.begin(); it != _mBatches.end();) {
+		if (it->second.nDst == nNode) {
+			it = _mBatches.erase(it);
+		} else {
+			++it;
+		}
+	}
+
+	auto it = _mNodes.find(nNode);
+	if (it == _mNodes.end()) return;
+
+	Peer & rNode = it->second;
+	bool bUp = rNode.bUp;
+
+	/// Taken out first, so its OnClose() finds nothing to report.
+	if (rNode.pClient) {
+		_vRetired.push_back(std::move(rNode.pClient));
+		_vRetired.back()->Close();
+	}
+
+	Connection * pConn = rNode.nAccepted ? _iServer.Find(rNode.nAccepted) : nullptr;
+	_mNodes.erase(it);
+
+	if (pConn) {
+		pConn->pData = nullptr;
+		_iServer.Close(pConn);
+	}
+
+	if (bUp) _pOwner->OnNodeDown(nNode);
+}
+
+bool BusContext::Send(uint32_t nDest, uint8_t nKind, uint32_t nMsgId, uint32_t nCorrId, const char * pData, size_t nSize) {
+	if (_nNode == 0 || nDest == 0 || nDest == _nNode) return false;
+	if (nSize > BUS_MAXFRAME - BUS_BATCH - BUS_RECORD) return false;
+	if (!__Known(nDest)) return false;
+
+	BusBatch & rBatch = __Batch(_nNode, nDest);
+	if (rBatch.Bytes() + BUS_RECORD + nSize > BUS_QUEUELIMIT) return false;
+
+	rBatch.Push(nKind, nMsgId, nCorrId, pData, nSize);
+	return true;
+}
+
+bool BusContext::Request(uint32_t nDest, uint32_t nMsgId, const char * pData, size_t nSize, IMessageBus::ReplyHandler fReply, uint32_t nTimeout) {
+	if (!fReply) return false;
+
+	if (++_nNextCorr == 0) _nNextCorr = 1;
+	uint32_t nCorrId = _nNextCorr;
+	if (_mPending.count(nCorrId) || !Send(nDest, BusBatch::Request, nMsgId, nCorrId, pData, nSize)) return false;
+
+	Pending & rPending = _mPending[nCorrId];
+	rPending.fReply		= std::move(fReply);
+	rPending.itDeadline	= _mDeadlines.insert(make_pair(Tick() + nTimeout, nCorrId));
+	return true;
+}
+
+void BusContext::Flush() {
+	if (_nDepth == 0) _vRetired.clear();
+	if (_nNode == 0) return;
+
+	double dNow = Tick();
+	__KeepAlive(dNow);
+
+	/// Batches without a link stay listed, and go out once it is ready.
+	size_t nKeep = 0;
+	for (size_t i = 0; i < _vDirty.size(); ++i) {
+		auto it = _mBatches.find(_vDirty[i]);
+		if (it == _mBatches.end() || !it->second.bDirty) continue;
+
+		BusBatch & rBatch = it->second;
+		if (__Write(rBatch)) {
+			rBatch.bDirty = false;
+		} else {
+			_vDirty[nKeep++] = _vDirty[i];
+		}
+	}
+
+	_vDirty.resize(nKeep);
+
+	__Expire(dNow);
+	if (!_mDeadlines.empty()) AutoNetworkDue(_mDeadlines.begin()->first);
+}
+
+void BusContext::Shutdown() {
+	if (_nNode == 0) return;
+
+	_pOwner->OnShutdown();
+
+	for (auto & kv : _mNodes) {
+		if (!kv.second.pClient) continue;
+		_vRetired.push_back(std::move(kv.second.pClient));
+		_vRetired.back()->Close();
+	}
+
+	_mNodes.clear();
+	_mRoutes.clear();
+	_mLearned.clear();
+	_mBatches.clear();
+	_vDirty.clear();
+	_iServer.Shutdown();
+	_nNode = 0;
+
+	unordered_map<uint32_t, Pending> mPending;
+	mPending.swap(_mPending);
+	_mDeadlines.clear();
+
+	++_nDepth;
+	for (auto & kv : mPending) kv.second.fReply(false, nullptr, 0);
+	--_nDepth;
+
+	if (_nDepth == 0) _vRetired.clear();
+}
+
+void BusContext::Breath() {
+	/// Callbacks may remove nodes, so links are listed first and kept alive until done.
+	vector<BusClient *> vClients;
+	vClients.reserve(_mNodes.size());
+	for (auto & kv : _mNodes) {
+		if (kv.second.pClient) vClients.push_back(kv.second.pClient.get());
+	}
+
+	++_nDepth;
+	for (auto pClient : vClients) pClient->Breath();
+	--_nDepth;
+
+	_iServer.Breath();
+	Flush();
+}
+
+void BusContext::OnDialed(BusClient * pClient) {
+	char pHello[8];
+	__Hello(pHello);
+
+	pClient->dRecv = pClient->dPing = Tick();
+	pClient->SendFrame(BusHello, pHello, sizeof(pHello));
+}
+
+void BusContext::OnDialedFrame(BusClient * pClient, uint32_t nType, char * pData, size_t nSize) {
+	auto it = _mNodes.find(pClient->nNode);
+	if (it == _mNodes.end() || it->second.pClient.get() != pClient) return;
+
+	Peer & rNode = it->second;
+	pClient->dRecv = Tick();
+
+	if (nType == BusHello) {
+		if (nSize != 8 || BusBatch::Get(pData) != BUS_MAGIC || BusBatch::Get(pData + 4) != pClient->nNode) {
+			LOG_ERR("Bus node %u at [%s:%d] is NOT the one expected, stop dialing it", pClient->nNode, rNode.sIP.c_str(), rNode.nPort);
+			pClient->Close();
+			return;
+		}
+
+		rNode.bDialed = true;
+		__Update(pClient->nNode);
+	} else if (nType == BusData && rNode.bDialed) {
+		__Input(pClient->nNode, pData, nSize);
+	}
+}
+
+void BusContext::OnDialedClose(BusClient * pClient) {
+	auto it = _mNodes.find(pClient->nNode);
+	if (it == _mNodes.end() || it->second.pClient.get() != pClient || !it->second.bDialed) return;
+
+	it->second.bDialed = false;
+	__Update(pClient->nNode);
+}
+
+void BusContext::OnAcceptedFrame(Connection * pConn, uint32_t nType, char * pData, size_t nSize) {
+	uint32_t nNode = (uint32_t)(uintptr_t)pConn->pData;
+
+	if (nType == BusHello) {
+		nNode = nSize == 8 && BusBatch::Get(pData) == BUS_MAGIC ? BusBatch::Get(pData + 4) : 0;
+		if (nNode == 0 || nNode == _nNode || pConn->pData) {
+			_iServer.Close(pConn);
+			return;
+		}
+
+		/// A node restarted before its old link timed out. Newer link wins.
+		Peer & rNode = _mNodes[nNode];
+		Connection * pOld = rNode.nAccepted ? _iServer.Find(rNode.nAccepted) : nullptr;
+		if (pOld) {
+			pOld->pData = nullptr;
+			_iServer.Close(pOld);
+		}
+
+		char pHello[8];
+		__Hello(pHello);
+
+		pConn->pData = (void *)(uintptr_t)nNode;
+		rNode.nAccepted = pConn->nId;
+		_iServer.SendFrame(pConn, BusHello, pHello, sizeof(pHello));
+		__Update(nNode);
+		return;
+	}
+
+	if (nNode == 0) {
+		_iServer.Close(pConn);
+	} else if (nType == BusPing) {
+		_iServer.SendFrame(pConn, BusPong, nullptr, 0);
+	} else if (nType == BusData) {
+		__Input(nNode, pData, nSize);
+	}
+}
+
+void BusContext::OnAcceptedClose(Connection * pConn) {
+	uint32_t nNode = (uint32_t)(uintptr_t)pConn->pData;
+	if (nNode == 0) return;
+
+	auto it = _mNodes.find(nNode);
+	if (it == _mNodes.end() || it->second.nAccepted != pConn->nId) return;
+
+	it->second.nAccepted = 0;
+	if (!it->second.pClient) {
+		bool bUp = it->second.bUp;
+		_mNodes.erase(it);
+		if (bUp) _pOwner->OnNodeDown(nNode);
+	} else {
+		__Update(nNode);
+	}
+}
+
+BusContext::Link BusContext::__Link(uint32_t nNode, Peer & rNode) {
+	bool bDialed = rNode.pClient && rNode.bDialed;
+	bool bAccepted = rNode.nAccepted != 0;
+
+	/// Both sides pick the link dialed by the smaller id, so messages keep one path.
+	if (bDialed && bAccepted) return _nNode < nNode ? Dialed : Accepted;
+	return bDialed ? Dialed : (bAccepted ? Accepted : None);
+}
+
+uint32_t BusContext::__NextHop(uint32_t nDest) {
+	auto it = _mNodes.find(nDest);
+	if (it != _mNodes.end() && __Link(nDest, it->second) != None) return nDest;
+
+	/// Configured route wins over the way back learned from relayed frames.
+	for (auto pRoutes : { &_mRoutes, &_mLearned }) {
+		auto itRoute = pRoutes->find(nDest);
+		if (itRoute == pRoutes->end()) continue;
+
+		it = _mNodes.find(itRoute->second);
+		if (it != _mNodes.end() && __Link(it->first, it->second) != None) return it->first;
+	}
+
+	return 0;
+}
+
+bool BusContext::__SendFrame(uint32_t nHop, uint32_t nType, const NetSlice * pSlices, int nCount) {
+	auto it = _mNodes.find(nHop);
+	if (it == _mNodes.end()) return false;
+
+	Peer & rNode = it->second;
+	switch (__Link(nHop, rNode)) {
+	case Dialed:
+		return rNode.pClient->SendFrame(nType, pSlices, nCount);
+	case Accepted: {
+		Connection * pConn = _iServer.Find(rNode.nAccepted);
+		return pConn && _iServer.SendFrame(pConn, nType, pSlices, nCount);
+	}
+	default:
+		return false;
+	}
+}
+
+bool BusContext::__Write(BusBatch & rBatch) {
+	uint32_t nHop = __NextHop(rBatch.nDst);
+	if (nHop == 0) return false;
+
+	char pHeader[BUS_BATCH];
+	rBatch.Header(pHeader);
+
+	size_t nOffset = 0;
+	while (nOffset < rBatch.Bytes()) {
+		size_t nSize = rBatch.Cut(nOffset);
+		NetSlice pSlices[2] = { { pHeader, BUS_BATCH }, { rBatch.Data() + nOffset, nSize } };
+
+		/// Send queue is full. The rest waits for next flush.
+		if (!__SendFrame(nHop, BusData, pSlices, 2)) break;
+		nOffset += nSize;
+	}
+
+	if (nOffset == rBatch.Bytes()) {
+		rBatch.Clear();
+		rBatch.nTtl = BUS_TTL;
+		return true;
+	}
+
+	rBatch.Consume(nOffset);
+	return false;
+}
+
+BusBatch & BusContext::__Batch(uint32_t nSrc, uint32_t nDst) {
+	BusBatch & rBatch = _mBatches[__Key(nSrc, nDst)];
+
+	if (!rBatch.bDirty) {
+		rBatch.nSrc		= nSrc;
+		rBatch.nDst		= nDst;
+		rBatch.bDirty	= true;
+		_vDirty.push_back(__Key(nSrc, nDst));
+	}
+
+	return rBatch;
+}
+
+void BusContext::__Input(uint32_t nFrom, char * pData, size_t nSize) {
+	if (nSize < BUS_BATCH) return;
+
+	uint32_t nSrc = BusBatch::Get(pData);
+	uint32_t nDst = BusBatch::Get(pData + 4);
+	uint8_t nTtl = (uint8_t)pData[8];
+	char * pBody = pData + BUS_BATCH;
+	size_t nBody = nSize - BUS_BATCH;
+
+	/// Source without a link of its own is answered through the link it came in on,
+	/// so replies to relayed requests need no route configured back.
+	if (nSrc != 0 && nSrc != nFrom && nSrc != _nNode) _mLearned[nSrc] = nFrom;
+
+	if (nDst != _nNode) {
+		/// Relay. Records are checked, so a broken one is NOT passed on.
+		if (nTtl <= 1 || nSrc == 0 || nDst == 0) return;
+		if (!__Known(nDst)) return;
+		if (!BusBatch::Parse(pBody, nBody, [](const BusBatch::Record &) { return true; })) return;
+
+		BusBatch & rBatch = __Batch(nSrc, nDst);
+		if (rBatch.Bytes() + nBody > BUS_QUEUELIMIT) return;
+
+		rBatch.nTtl = std::min(rBatch.nTtl, (uint8_t)(nTtl - 1));
+		rBatch.Append(pBody, nBody);
+		return;
+	}
+
+	/// Callbacks may shut this node down. Remaining records are dropped then.
+	BusBatch::Parse(pBody, nBody, [this, nSrc](const BusBatch::Record & r) {
+		if (r.nKind != BusBatch::Reply) {
+			_pOwner->OnMessage(nSrc, r.nMsgId, r.nKind == BusBatch::Request ? r.nCorrId : 0, r.pData, r.nSize);
+			return _nNode != 0;
+		}
+
+		auto it = _mPending.find(r.nCorrId);
+		if (it == _mPending.end()) return true;
+
+		IMessageBus::ReplyHandler fReply = std::move(it->second.fReply);
+		_mDeadlines.erase(it->second.itDeadline);
+		_mPending.erase(it);
+
+		fReply(true, r.pData, r.nSize);
+		return _nNode != 0;
+	});
+}
+
+void BusContext::__Update(uint32_t nNode) {
+	auto it = _mNodes.find(nNode);
+	if (it == _mNodes.end()) return;
+
+	bool bUp = __Link(nNode, it->second) != None;
+	if (bUp == it->second.bUp) return;
+
+	it->second.bUp = bUp;
+	if (bUp) {
+		_pOwner->OnNodeUp(nNode);
+	} else {
+		_pOwner->OnNodeDown(nNode);
+	}
+}
+
+void BusContext::__KeepAlive(double dNow) {
+	double dNext = HUGE_VAL;
+	vector<uint32_t> vSilent;
+
+	for (auto & kv : _mNodes) {
+		BusClient * pClient = kv.second.pClient.get();
+		if (!pClient || !pClient->IsConnected()) continue;
+
+		if (dNow - pClient->dRecv > _nTimeout) {
+			vSilent.push_back(kv.first);
+			continue;
+		}
+
+		if (dNow - pClient->dPing >= _nInterval) {
+			pClient->SendFrame(BusPing, nullptr, 0);
+			pClient->dPing = dNow;
+		}
+
+		dNext = std::min(dNext, std::min(pClient->dPing + _nInterval, pClient->dRecv + _nTimeout));
+	}
+
+	/// Silent link is half-open or remote is hung. Dial again. OnNodeDown() may remove nodes.
+	for (auto nNode : vSilent) {
+		auto it = _mNodes.find(nNode);
+		if (it == _mNodes.end() || !it->second.pClient) continue;
+
+		LOG_WARN("Bus node %u is silent for %u ms, redial it", nNode, _nTimeout);
+
+		BusClient * pClient = it->second.pClient.get();
+		string sIP = it->second.sIP;
+		int nPort = it->second.nPort;
+
+		Enter();
+		pClient->Close();
+		if (_nNode != 0 && _mNodes.count(nNode) && _mNodes[nNode].pClient.get() == pClient) pClient->Connect(sIP, nPort, true);
+		Leave();
+	}
+
+	if (dNext != HUGE_VAL) AutoNetworkDue(dNext);
+}
+
+void BusContext::__Expire(double dNow) {
+	while (!_mDeadlines.empty() && _mDeadlines.begin()->first <= dNow) {
+		auto it = _mPending.find(_mDeadlines.begin()->second);
+		_mDeadlines.erase(_mDeadlines.begin());
+		if (it == _mPending.end()) continue;
+
+		IMessageBus::ReplyHandler fReply = std::move(it->second.fReply);
+		_mPending.erase(it);
+
+		++_nDepth;
+		fReply(false, nullptr, 0);
+		--_nDepth;
+	}
+}
+
+void BusContext::__Hello(char * pOut) {
+	BusBatch::Put(BusBatch::Put(pOut, BUS_MAGIC), _nNode);
+}
+
+IMessageBus::IMessageBus() : _pCtx(nullptr) {
+	_pCtx = new BusContext(this);
+	AutoNetworkAdd(this);
+}
+
+IMessageBus::~IMessageBus() {
+	AutoNetworkDel(this);
+	Shutdown();
+	if (_pCtx) delete _pCtx;
+}
+
+void IMessageBus::SetKeepAlive(uint32_t nInterval, uint32_t nTimeout) {
+	_pCtx->SetKeepAlive(nInterval, nTimeout);
+}
+
+int IMessageBus::Start(uint32_t nNode, const std::string & sIP /* = "" */, int nPort /* = 0 */) {
+	if (nNode == 0 || (!sIP.empty() && (nPort <= 0 || nPort > 65535))) return ENet::BadParam;
+	return _pCtx->Start(nNode, sIP, nPort);
+}
+
+uint32_t IMessageBus::Node() {
+	return _pCtx->Node();
+}
+
+bool IMessageBus::AddNode(uint32_t nNode, const std::string & sIP, int nPort) {
+	if (nNode == 0 || sIP.empty() || nPort <= 0 || nPort > 65535) return false;
+	return _pCtx->AddNode(nNode, sIP, nPort);
+}
+
+bool IMessageBus::AddRoute(uint32_t nDest, uint32_t nVia) {
+	return _pCtx->AddRoute(nDest, nVia);
+}
+
+void IMessageBus::RemoveNode(uint32_t nNode) {
+	_pCtx->RemoveNode(nNode);
+}
+
+bool IMessageBus::IsReachable(uint32_t nNode) {
+	return _pCtx->IsReachable(nNode);
+}
+
+bool IMessageBus::Send(uint32_t nDest, uint32_t nMsgId, const char * pData, size_t nSize) {
+	if (!pData && nSize > 0) return false;
+	return _pCtx->Send(nDest, BusBatch::Message, nMsgId, 0, pData, nSize);
+}
+
+bool IMessageBus::Request(uint32_t nDest, uint32_t nMsgId, const char * pData, size_t nSize, ReplyHandler fReply, uint32_t nTimeout /* = 5000 */) {
+	if (!pData && nSize > 0) return false;
+	return _pCtx->Request(nDest, nMsgId, pData, nSize, std::move(fReply), nTimeout);
+}
+
+bool IMessageBus::Reply(uint32_t nSrc, uint32_t nCorrId, const char * pData, size_t nSize) {
+	if ((!pData && nSize > 0) || nCorrId == 0) return false;
+	return _pCtx->Send(nSrc, BusBatch::Reply, 0, nCorrId, pData, nSize);
+}
+
+void IMessageBus::Flush() {
+	_pCtx->Flush();
+}
+
+void IMessageBus::Shutdown() {
+	_pCtx->Shutdown();
+}
+
+void IMessageBus::Breath() {
+	_pCtx->Breath();
+}
\ No newline at end of file
@@ -0,0 +1,145 @@
+#ifndef		__ENGINE_NETWORK_BUS_H_INCLUDED__
+#define		__ENGINE_NETWORK_BUS_H_INCLUDED__
+
+#include	<Network.h>
+#include	<cstdint>
+#include	<cstring>
+#include	<vector>
+
+#define		BUS_MAGIC		0x31535542
+#define		BUS_BATCH		9
+#define		BUS_RECORD		13
+#define		BUS_MAXFRAME	1048576
+#define		BUS_QUEUELIMIT	16777216
+#define		BUS_TTL			8
+
+/**
+ * Messages for one (source, destination) pair waiting for next flush. Routing
+ * header is written once per frame instead of once per message. Wire format of
+ * a frame body (little endian) :
+ *
+ *	[src:4][dst:4][ttl:1] then records of [kind:1][msgid:4][corr:4][len:4][data:len]
+ *
+ * Records are kept already encoded, so flushing only cuts them into frames no
+ * larger than BUS_MAXFRAME, and a relay appends records it forwards as they are.
+ **/
+class BusBatch {
+public:
+	enum Kind { Message = 0, Request, Reply };
+
+	struct Record {
+		uint8_t		nKind;
+		uint32_t	nMsgId;
+		uint32_t	nCorrId;
+		char *		pData;
+		size_t		nSize;
+	};
+
+public:
+	BusBatch() : nSrc(0), nDst(0), nTtl(BUS_TTL), bDirty(false), _vData() {}
+
+	inline size_t	Bytes() const { return _vData.size(); }
+	inline bool		Empty() const { return _vData.empty(); }
+	inline const char *	Data() const { return _vData.data(); }
+
+	/**
+	 * Append one record.
+	 **/
+	void Push(uint8_t nKind, uint32_t nMsgId, uint32_t nCorrId, const char * pData, size_t nSize) {
+		size_t nOffset = _vData.size();
+		_vData.resize(nOffset + BUS_RECORD + nSize);
+
+		char * p = _vData.data() + nOffset;
+		*p++ = (char)nKind;
+		p = Put(p, nMsgId);
+		p = Put(p, nCorrId);
+		p = Put(p, (uint32_t)nSize);
+		if (nSize > 0) memcpy(p, pData, nSize);
+	}
+
+	/**
+	 * Append records already encoded, eg. the body of a frame being forwarded.
+	 **/
+	inline void Append(const char * pData, size_t nSize) { _vData.insert(_vData.end(), pData, pData + nSize); }
+
+	/**
+	 * Length of records at the beginning of [nOffset, end) that fit in one frame.
+	 **/
+	size_t Cut(size_t nOffset) const {
+		size_t nEnd = nOffset;
+
+		while (nEnd < _vData.size()) {
+			uint32_t nLen = Get(_vData.data() + nEnd + 9);
+			size_t nRecord = BUS_RECORD + nLen;
+			if (nEnd > nOffset && nEnd - nOffset + nRecord > BUS_MAXFRAME - BUS_BATCH) break;
+			nEnd += nRecord;
+		}
+
+		return nEnd - nOffset;
+	}
+
+	/**
+	 * Drop first nSize bytes, which have been sent.
+	 **/
+	inline void Consume(size_t nSize) { _vData.erase(_vData.begin(), _vData.begin() + nSize); }
+	inline void Clear() { _vData.clear(); }
+
+	/**
+	 * Routing header of a frame.
+	 **/
+	void Header(char * pOut) const {
+		pOut = Put(pOut, nSrc);
+		pOut = Put(pOut, nDst);
+		*pOut = (char)nTtl;
+	}
+
+	/**
+	 * Walk records of a frame body after its header.
+	 *
+	 * \param	fRecord	bool(const Record &). Return false to stop.
+	 * \return	False if a record is broken.
+	 **/
+	template<typename F>
+	static bool Parse(char * pData, size_t nSize, F fRecord) {
+		Record iRecord;
+
+		while (nSize > 0) {
+			if (nSize < BUS_RECORD) return false;
+
+			iRecord.nKind	= (uint8_t)pData[0];
+			iRecord.nMsgId	= Get(pData + 1);
+			iRecord.nCorrId	= Get(pData + 5);
+			iRecord.nSize	= Get(pData + 9);
+			iRecord.pData	= pData + BUS_RECORD;
+
+			if (iRecord.nKind > Reply || iRecord.nSize > nSize - BUS_RECORD) return false;
+			if (!fRecord(iRecord)) return true;
+
+			pData += BUS_RECORD + iRecord.nSize;
+			nSize -= BUS_RECORD + iRecord.nSize;
+		}
+
+		return true;
+	}
+
+	static inline char * Put(char * pOut, uint32_t nValue) {
+		for (int i = 0; i < 4; ++i) *pOut++ = (char)((nValue >> (i * 8)) & 0xFF);
+		return pOut;
+	}
+
+	static inline uint32_t Get(const char * pData) {
+		const unsigned char * p = (const unsigned char *)pData;
+		return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+	}
+
+public:
+	uint32_t	nSrc;
+	uint32_t	nDst;
+	uint8_t		nTtl;		//! Hops left. A relay forwards with one less
+	bool		bDirty;		//! Listed for next flush
+
+private:
+	std::vector<char>	_vData;
+};
+
+#endif//!	__ENGINE_NETWORK_BUS_H_INCLUDED__
\ No newline at end of file
@@ -0,0 +1,257 @@
+#ifndef		__ENGINE_NETWORK_LIMIT_H_INCLUDED__
+#define		__ENGINE_NETWORK_LIMIT_H_INCLUDED__
+
+#include	<Network.h>
+#include	<DateTime.h>
+#include	"Network.Pool.h"
+#include	<algorithm>
+#include	<cmath>
+#include	<cstdint>
+#include	<vector>
+
+#define		IPLIMIT_SLOTS	4096
+#define		IPLIMIT_PROBES	8
+
+/**
+ * State of one token bucket, configured by a RateLimit kept elsewhere. Tokens may
+ * go below 0 : data read already is charged in full, and the debt delays what
+ * comes next. A bucket holds at least one token, so any rate lets something through.
+ **/
+struct TokenBucket {
+	double	dTokens;
+	double	dTime;		//! Time of last refill
+
+	static inline double Burst(const RateLimit & r) { return std::max(r.dBurst > 0 ? r.dBurst : r.dRate, 1.0); }
+
+	inline void Reset(const RateLimit & r, double dNow) {
+		dTokens	= Burst(r);
+		dTime	= dNow;
+	}
+
+	/**
+	 * Is there a whole token? Always true when rate is 0.
+	 **/
+	inline bool Has(const RateLimit & r, double dNow) {
+		if (r.dRate <= 0) return true;
+
+		if (dNow > dTime) {
+			dTokens	= std::min(Burst(r), dTokens + (dNow - dTime) * r.dRate / 1000);
+			dTime	= dNow;
+		}
+
+		return dTokens >= 1;
+	}
+
+	/**
+	 * Time when Has() becomes true.
+	 **/
+	inline double Ready(const RateLimit & r) const {
+		return (r.dRate <= 0 || dTokens >= 1) ? dTime : dTime + (1 - dTokens) * 1000 / r.dRate;
+	}
+};
+
+/**
+ * Per connection rate limits of one server. T keeps buckets iByteTokens and
+ * iMsgTokens, and hook iThrottled. Charging a message is O(1) and nothing is
+ * allocated after setup.
+ *
+ * ENet::Throttle needs a server reading on main thread : it asks Budget() before
+ * reading, and parks a connection with Pause() until Resume() finds its buckets
+ * refilled. Other servers pass bPausable = false to Charge(), and messages over
+ * a throttling limit are dropped instead, since they were read already.
+ *
+ * Time is sampled once by Update() at the beginning of each Breath().
+ **/
+template<typename T>
+class ConnectionLimits {
+public:
+	enum Verdict { Pass, Drop, Kick };
+
+public:
+	ConnectionLimits() : _iBytes(), _iMsgs(), _dNow(Tick()), _iThrottled() {}
+
+	inline void	Update() { _dNow = Tick(); }
+
+	void Setup(const RateLimit & rBytes, const RateLimit & rMsgs, const std::vector<T *> & rAlive) {
+		_iBytes	= rBytes;
+		_iMsgs	= rMsgs;
+
+		Update();
+		for (auto p : rAlive) Attach(p);
+	}
+
+	/**
+	 * Fill buckets of a new connection.
+	 **/
+	inline void Attach(T * p) {
+		p->iByteTokens.Reset(_iBytes, _dNow);
+		p->iMsgTokens.Reset(_iMsgs, _dNow);
+	}
+
+	/**
+	 * Narrow read budgets (0 for no limit) by tokens of throttling limits.
+	 *
+	 * \return	False if connection must NOT be read now.
+	 **/
+	bool Budget(T * p, size_t & rBytes, uint32_t & rMsgs) {
+		if (__Throttles(_iBytes)) {
+			if (!p->iByteTokens.Has(_iBytes, _dNow)) return false;
+
+			size_t nTokens = (size_t)p->iByteTokens.dTokens;
+			rBytes = rBytes > 0 ? std::min(rBytes, nTokens) : nTokens;
+		}
+
+		if (__Throttles(_iMsgs)) {
+			if (!p->iMsgTokens.Has(_iMsgs, _dNow)) return false;
+
+			uint32_t nTokens = (uint32_t)std::min(p->iMsgTokens.dTokens, (double)UINT32_MAX);
+			rMsgs = rMsgs > 0 ? std::min(rMsgs, nTokens) : nTokens;
+		}
+
+		return true;
+	}
+
+	/**
+	 * Some throttling limit of this connection has run out.
+	 **/
+	inline bool Exhausted(T * p) {
+		return (__Throttles(_iBytes) && !p->iByteTokens.Has(_iBytes, _dNow))
+			|| (__Throttles(_iMsgs) && !p->iMsgTokens.Has(_iMsgs, _dNow));
+	}
+
+	/**
+	 * Charge one received message, or one chunk without framing.
+	 *
+	 * \param	bPausable	Server stops reading throttled connections by itself.
+	 * \return	What to do with the message.
+	 **/
+	Verdict Charge(T * p, size_t nBytes, bool bPausable) {
+		Verdict emBytes = __Check(_iBytes, p->iByteTokens, bPausable);
+		Verdict emMsgs = __Check(_iMsgs, p->iMsgTokens, bPausable);
+		if (emBytes != Pass || emMsgs != Pass) return std::max(emBytes, emMsgs);
+
+		if (_iBytes.dRate > 0) p->iByteTokens.dTokens -= (double)nBytes;
+		if (_iMsgs.dRate > 0) p->iMsgTokens.dTokens -= 1;
+		return Pass;
+	}
+
+	/**
+	 * Stop reading a connection until its buckets are refilled.
+	 *
+	 * \return	False if it was paused already.
+	 **/
+	bool Pause(T * p) {
+		if (p->iThrottled.bLinked) return false;
+		_iThrottled.Touch(p, _dNow);
+		return true;
+	}
+
+	void Remove(T * p) { _iThrottled.Remove(p); }
+	void Clear() { _iThrottled.Clear(); }
+
+	/**
+	 * Hand paused connections with refilled buckets back. Costs O(1) per paused
+	 * connection, and nothing when none is paused.
+	 *
+	 * \param	fResume	void(T *). Must NOT close any connection.
+	 * \return	Time when next paused connection may be resumed, HUGE_VAL if none.
+	 **/
+	template<typename F>
+	double Resume(F fResume) {
+		double dNext = HUGE_VAL;
+
+		for (T * p = _iThrottled.Oldest(); p;) {
+			T * pNext = p->iThrottled.pNext;
+
+			if (Exhausted(p)) {
+				if (__Throttles(_iBytes)) dNext = std::min(dNext, p->iByteTokens.Ready(_iBytes));
+				if (__Throttles(_iMsgs)) dNext = std::min(dNext, p->iMsgTokens.Ready(_iMsgs));
+			} else {
+				_iThrottled.Remove(p);
+				fResume(p);
+			}
+
+			p = pNext;
+		}
+
+		return dNext;
+	}
+
+private:
+	static inline bool __Throttles(const RateLimit & r) { return r.dRate > 0 && r.emAction == ENet::Throttle; }
+
+	inline Verdict __Check(const RateLimit & r, TokenBucket & rBucket, bool bPausable) {
+		if (rBucket.Has(r, _dNow)) return Pass;
+
+		switch (r.emAction) {
+		case ENet::Throttle: return bPausable ? Pass : Drop;
+		case ENet::Drop: return Drop;
+		default: return Kick;
+		}
+	}
+
+private:
+	RateLimit	_iBytes;
+	RateLimit	_iMsgs;
+	double		_dNow;
+	ConnectionTimeline<T, &T::iThrottled>	_iThrottled;	//! Paused, in no particular order of refill
+};
+
+/**
+ * Accept rate of each source IP. Buckets live in a fixed open-addressing table
+ * allocated by Setup(), probed at most IPLIMIT_PROBES times per accept. When all
+ * probed slots are taken, the IP seen least recently gives its slot away, so a
+ * flood from many addresses only costs memory already allocated.
+ **/
+class AcceptLimits {
+	struct Entry {
+		uint32_t	nIP;
+		bool		bUsed;
+		TokenBucket	iBucket;
+	};
+
+public:
+	AcceptLimits() : _iLimit(), _vSlots() {}
+
+	void Setup(const RateLimit & rLimit) {
+		_iLimit = rLimit;
+		_vSlots.assign(rLimit.dRate > 0 ? IPLIMIT_SLOTS : 0, Entry());
+	}
+
+	/**
+	 * May this IP connect now? Takes one token if so.
+	 **/
+	bool Allow(uint32_t nIP, double dNow) {
+		if (_vSlots.empty()) return true;
+
+		size_t nFirst = (size_t)((nIP * 2654435761u) >> 16);
+		Entry * pVictim = nullptr;
+
+		for (size_t i = 0; i < IPLIMIT_PROBES; ++i) {
+			Entry & r = _vSlots[(nFirst + i) % IPLIMIT_SLOTS];
+
+			if (r.bUsed && r.nIP == nIP) {
+				pVictim = &r;
+				break;
+			}
+
+			if (!pVictim || (pVictim->bUsed && (!r.bUsed || r.iBucket.dTime < pVictim->iBucket.dTime))) pVictim = &r;
+		}
+
+		if (!pVictim->bUsed || pVictim->nIP != nIP) {
+			pVictim->nIP	= nIP;
+			pVictim->bUsed	= true;
+			pVictim->iBucket.Reset(_iLimit, dNow);
+		}
+
+		if (!pVictim->iBucket.Has(_iLimit, dNow)) return false;
+		pVictim->iBucket.dTokens -= 1;
+		return true;
+	}
+
+private:
+	RateLimit			_iLimit;
+	std::vector<Entry>	_vSlots;
+};
+
+#endif//!	__ENGINE_NETWORK_LIMIT_H_INCLUDED__
\ No newline at end of file
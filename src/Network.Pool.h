@@ -0,0 +1,539 @@
+#ifndef		__ENGINE_NETWORK_POOL_H_INCLUDED__
+#define		__ENGINE_NETWORK_POOL_H_INCLUDED__
+
+#include	<Network.h>
+#include	<DateTime.h>
+#include	<algorithm>
+#include	<cmath>
+#include	<cstdint>
+#include	<map>
+#include	<new>
+#include	<type_traits>
+#include	<vector>
+
+#define		CONNPOOL_CHUNK	1024
+
+/**
+ * Slot map for connections of one server.
+ *
+ * Objects live in fixed-size chunks, so pointers given to user never move while
+ * the pool grows. Connection identifier is (generation << 32 | slot). Generation
+ * changes every time a slot is reused, so an identifier of a closed connection
+ * never finds the new owner of that slot.
+ *
+ * Slot can be given by caller (eg. socket fd, which kernel keeps small and dense)
+ * or picked by pool itself when bAutoSlot is true. Do NOT mix the two ways.
+ **/
+template<typename T>
+class ConnectionPool {
+	struct Slot {
+		typename std::aligned_storage<sizeof(T), alignof(T)>::type	iMem;
+		uint32_t	nGen;
+		int32_t		nAlive;		//! Index in _vAlive, -1 for free slot
+
+		inline T *	Get() { return reinterpret_cast<T *>(&iMem); }
+	};
+
+public:
+	ConnectionPool(bool bAutoSlot = false) : _bAutoSlot(bAutoSlot), _nNextSlot(0), _vChunks(), _vAlive(), _vFree() {}
+	virtual ~ConnectionPool();
+
+	/**
+	 * Construct a new object at given slot.
+	 *
+	 * \param	nSlot	Slot index. Ignored when this pool picks slot itself.
+	 * \return	Object with nId filled. nullptr if that slot is already used.
+	 **/
+	T *		Alloc(uint32_t nSlot = 0);
+
+	/**
+	 * Destroy object and release its slot.
+	 **/
+	void	Free(T * p);
+
+	/**
+	 * Destroy all objects.
+	 **/
+	void	Clear();
+
+	/**
+	 * Object at given slot, nullptr if that slot is free.
+	 **/
+	T *		At(uint32_t nSlot) const;
+
+	/**
+	 * Object with given identifier, nullptr if it was freed.
+	 **/
+	T *		Find(uint64_t nId) const;
+
+	/**
+	 * Alive objects in a dense array. Free() moves the last one into the hole.
+	 **/
+	inline size_t	Size() const { return _vAlive.size(); }
+	inline T *		operator[](size_t nIdx) const { return _vAlive[nIdx]; }
+	inline const std::vector<T *> &	Alive() const { return _vAlive; }
+
+private:
+	Slot *	__Slot(uint32_t nSlot) const;
+
+private:
+	bool				_bAutoSlot;
+	uint32_t			_nNextSlot;
+	std::vector<Slot *>	_vChunks;
+	std::vector<T *>	_vAlive;
+	std::vector<uint32_t>	_vFree;
+};
+
+template<typename T>
+ConnectionPool<T>::~ConnectionPool() {
+	Clear();
+	for (auto p : _vChunks) delete[] p;
+}
+
+template<typename T>
+T * ConnectionPool<T>::Alloc(uint32_t nSlot) {
+	if (_bAutoSlot) {
+		if (_vFree.empty()) {
+			nSlot = _nNextSlot++;
+		} else {
+			nSlot = _vFree.back();
+			_vFree.pop_back();
+		}
+	}
+
+	size_t nChunk = nSlot / CONNPOOL_CHUNK;
+	if (nChunk >= _vChunks.size()) _vChunks.resize(nChunk + 1, nullptr);
+
+	if (!_vChunks[nChunk]) {
+		Slot * pChunk = new Slot[CONNPOOL_CHUNK];
+		for (int i = 0; i < CONNPOOL_CHUNK; ++i) {
+			pChunk[i].nGen = 0;
+			pChunk[i].nAlive = -1;
+		}
+
+		_vChunks[nChunk] = pChunk;
+	}
+
+	Slot & rSlot = _vChunks[nChunk][nSlot % CONNPOOL_CHUNK];
+	if (rSlot.nAlive >= 0) return nullptr;
+
+	if (++rSlot.nGen == 0) rSlot.nGen = 1;
+	rSlot.nAlive = (int32_t)_vAlive.size();
+
+	T * p = new (&rSlot.iMem) T();
+	p->nId = ((uint64_t)rSlot.nGen << 32) | nSlot;
+	_vAlive.push_back(p);
+	return p;
+}
+
+template<typename T>
+void ConnectionPool<T>::Free(T * p) {
+	uint32_t nSlot = (uint32_t)p->nId;
+	Slot * pSlot = __Slot(nSlot);
+	if (!pSlot || pSlot->nAlive < 0 || pSlot->Get() != p) return;
+
+	T * pLast = _vAlive.back();
+	_vAlive[pSlot->nAlive] = pLast;
+	__Slot((uint32_t)pLast->nId)->nAlive = pSlot->nAlive;
+	_vAlive.pop_back();
+
+	pSlot->nAlive = -1;
+	p->~T();
+
+	if (_bAutoSlot) _vFree.push_back(nSlot);
+}
+
+template<typename T>
+void ConnectionPool<T>::Clear() {
+	while (!_vAlive.empty()) Free(_vAlive.back());
+}
+
+template<typename T>
+T * ConnectionPool<T>::At(uint32_t nSlot) const {
+	Slot * pSlot = __Slot(nSlot);
+	return (pSlot && pSlot->nAlive >= 0) ? pSlot->Get() : nullptr;
+}
+
+template<typename T>
+T * ConnectionPool<T>::Find(uint64_t nId) const {
+	Slot * pSlot = __Slot((uint32_t)nId);
+	if (!pSlot || pSlot->nAlive < 0 || pSlot->nGen != (uint32_t)(nId >> 32)) return nullptr;
+	return pSlot->Get();
+}
+
+template<typename T>
+typename ConnectionPool<T>::Slot * ConnectionPool<T>::__Slot(uint32_t nSlot) const {
+	size_t nChunk = nSlot / CONNPOOL_CHUNK;
+	if (nChunk >= _vChunks.size() || !_vChunks[nChunk]) return nullptr;
+	return &_vChunks[nChunk][nSlot % CONNPOOL_CHUNK];
+}
+
+/**
+ * Broadcast groups of one server. T keeps the groups it joined in member
+ * vGroups (group id, index in member list), so join/leave are O(1) in the
+ * number of members and a closing connection can leave all its groups.
+ **/
+template<typename T>
+class ConnectionGroups {
+public:
+	typedef std::vector<T *>	Members;
+
+	ConnectionGroups() : _mGroups() {}
+
+	bool	Join(T * p, uint32_t nGroup);
+	bool	Leave(T * p, uint32_t nGroup);
+	void	LeaveAll(T * p);
+	void	Clear() { _mGroups.clear(); }
+
+	/**
+	 * Members of given group, nullptr if nobody is in it.
+	 **/
+	const Members *	Find(uint32_t nGroup) const;
+
+private:
+	std::map<uint32_t, Members>	_mGroups;
+};
+
+template<typename T>
+bool ConnectionGroups<T>::Join(T * p, uint32_t nGroup) {
+	for (auto & rJoined : p->vGroups) {
+		if (rJoined.first == nGroup) return false;
+	}
+
+	Members & rMembers = _mGroups[nGroup];
+	p->vGroups.push_back(std::make_pair(nGroup, rMembers.size()));
+	rMembers.push_back(p);
+	return true;
+}
+
+template<typename T>
+bool ConnectionGroups<T>::Leave(T * p, uint32_t nGroup) {
+	size_t nJoined = 0;
+	while (nJoined < p->vGroups.size() && p->vGroups[nJoined].first != nGroup) ++nJoined;
+	if (nJoined >= p->vGroups.size()) return false;
+
+	auto it = _mGroups.find(nGroup);
+	Members & rMembers = it->second;
+	size_t nIdx = p->vGroups[nJoined].second;
+
+	T * pLast = rMembers.back();
+	rMembers[nIdx] = pLast;
+	rMembers.pop_back();
+
+	for (auto & rJoined : pLast->vGroups) {
+		if (rJoined.first == nGroup) {
+			rJoined.second = nIdx;
+			break;
+		}
+	}
+
+	p->vGroups[nJoined] = p->vGroups.back();
+	p->vGroups.pop_back();
+
+	if (rMembers.empty()) _mGroups.erase(it);
+	return true;
+}
+
+template<typename T>
+void ConnectionGroups<T>::LeaveAll(T * p) {
+	while (!p->vGroups.empty()) Leave(p, p->vGroups.back().first);
+}
+
+template<typename T>
+const typename ConnectionGroups<T>::Members * ConnectionGroups<T>::Find(uint32_t nGroup) const {
+	auto it = _mGroups.find(nGroup);
+	return it == _mGroups.end() ? nullptr : &it->second;
+}
+
+/**
+ * Intrusive hook of ConnectionTimeline.
+ **/
+template<typename T>
+struct TimelineHook {
+	T *		pPrev;
+	T *		pNext;
+	double	dTime;
+	bool	bLinked;
+
+	TimelineHook() : pPrev(nullptr), pNext(nullptr), dTime(0), bLinked(false) {}
+};
+
+/**
+ * Connections ordered by the time they were last touched. Touch() moves one to
+ * tail and time never goes back, so the oldest is always at head.
+ **/
+template<typename T, TimelineHook<T> T::*Hook>
+class ConnectionTimeline {
+public:
+	ConnectionTimeline() : _pHead(nullptr), _pTail(nullptr) {}
+
+	inline T *		Oldest() const { return _pHead; }
+	inline double	Time(T * p) const { return (p->*Hook).dTime; }
+
+	void Touch(T * p, double dNow) {
+		TimelineHook<T> & r = p->*Hook;
+		if (r.bLinked) {
+			if (_pTail == p) {
+				r.dTime = dNow;
+				return;
+			}
+
+			Remove(p);
+		}
+
+		r.pPrev		= _pTail;
+		r.pNext		= nullptr;
+		r.dTime		= dNow;
+		r.bLinked	= true;
+
+		if (_pTail) (_pTail->*Hook).pNext = p;
+		else _pHead = p;
+		_pTail = p;
+	}
+
+	void Remove(T * p) {
+		TimelineHook<T> & r = p->*Hook;
+		if (!r.bLinked) return;
+
+		if (r.pPrev) (r.pPrev->*Hook).pNext = r.pNext;
+		else _pHead = r.pNext;
+		if (r.pNext) (r.pNext->*Hook).pPrev = r.pPrev;
+		else _pTail = r.pPrev;
+
+		r.pPrev = r.pNext = nullptr;
+		r.bLinked = false;
+	}
+
+	void Clear() {
+		while (_pHead) Remove(_pHead);
+	}
+
+private:
+	T *	_pHead;
+	T *	_pTail;
+};
+
+/**
+ * Read timeout, idle timeout and heartbeat of one server. T keeps hooks iLastRead,
+ * iLastActive and iLastPing. Only enabled timelines are maintained, and Check()
+ * stops at the first connection that is not due, so it costs O(1) per expired
+ * connection however many are alive.
+ *
+ * Time is sampled once by Update() at the beginning of each Breath().
+ **/
+template<typename T>
+class ConnectionTimeouts {
+public:
+	ConnectionTimeouts() : _nRead(0), _nIdle(0), _nHeartbeat(0), _dNow(Tick()), _iRead(), _iIdle(), _iPing() {}
+
+	inline void	Update() { _dNow = Tick(); }
+
+	void SetTimeout(uint32_t nRead, uint32_t nIdle, const std::vector<T *> & rAlive) {
+		Update();
+		if (nRead == 0) _iRead.Clear();
+		if (nIdle == 0) _iIdle.Clear();
+
+		for (auto p : rAlive) {
+			if (nRead > 0 && _nRead == 0) _iRead.Touch(p, _dNow);
+			if (nIdle > 0 && _nIdle == 0) _iIdle.Touch(p, _dNow);
+		}
+
+		_nRead = nRead;
+		_nIdle = nIdle;
+	}
+
+	void SetHeartbeat(uint32_t nInterval, const std::vector<T *> & rAlive) {
+		Update();
+		if (nInterval == 0) _iPing.Clear();
+		if (nInterval > 0 && _nHeartbeat == 0) {
+			for (auto p : rAlive) _iPing.Touch(p, _dNow);
+		}
+
+		_nHeartbeat = nInterval;
+	}
+
+	/**
+	 * Connection was accepted or sent something to us.
+	 **/
+	inline void Received(T * p) {
+		if (_nRead > 0) _iRead.Touch(p, _dNow);
+		if (_nIdle > 0) _iIdle.Touch(p, _dNow);
+		if (_nHeartbeat > 0) _iPing.Touch(p, _dNow);
+	}
+
+	/**
+	 * Something was queued to connection.
+	 **/
+	inline void Sent(T * p) {
+		if (_nIdle > 0) _iIdle.Touch(p, _dNow);
+	}
+
+	void Remove(T * p) {
+		_iRead.Remove(p);
+		_iIdle.Remove(p);
+		_iPing.Remove(p);
+	}
+
+	void Clear() {
+		_iRead.Clear();
+		_iIdle.Clear();
+		_iPing.Clear();
+	}
+
+	/**
+	 * Close expired connections and ping silent ones.
+	 *
+	 * \param	fClose		void(T *). Must close that connection, which calls Remove().
+	 * \param	fHeartbeat	void(T *). Invoked every heartbeat interval while connection is silent.
+	 * \return	Time of next expiration, HUGE_VAL if nothing is watched.
+	 **/
+	template<typename C, typename H>
+	double Check(C fClose, H fHeartbeat) {
+		T * p;
+		while (_nRead > 0 && (p = _iRead.Oldest()) && _iRead.Time(p) + _nRead <= _dNow) fClose(p);
+		while (_nIdle > 0 && (p = _iIdle.Oldest()) && _iIdle.Time(p) + _nIdle <= _dNow) fClose(p);
+
+		while (_nHeartbeat > 0 && (p = _iPing.Oldest()) && _iPing.Time(p) + _nHeartbeat <= _dNow) {
+			_iPing.Touch(p, _dNow);
+			fHeartbeat(p);
+		}
+
+		double dNext = HUGE_VAL;
+		if (_nRead > 0 && (p = _iRead.Oldest())) dNext = std::min(dNext, _iRead.Time(p) + _nRead);
+		if (_nIdle > 0 && (p = _iIdle.Oldest())) dNext = std::min(dNext, _iIdle.Time(p) + _nIdle);
+		if (_nHeartbeat > 0 && (p = _iPing.Oldest())) dNext = std::min(dNext, _iPing.Time(p) + _nHeartbeat);
+		return dNext;
+	}
+
+private:
+	uint32_t	_nRead;
+	uint32_t	_nIdle;
+	uint32_t	_nHeartbeat;
+	double		_dNow;
+	ConnectionTimeline<T, &T::iLastRead>	_iRead;
+	ConnectionTimeline<T, &T::iLastActive>	_iIdle;
+	ConnectionTimeline<T, &T::iLastPing>	_iPing;
+};
+
+/**
+ * Order of reading readable connections under the read budget of a server.
+ *
+ * A connection that used up its budget may still have data in kernel, which an
+ * edge-triggered epoll will NOT report again. It stays queued and is read again
+ * in next Breath(), after the connections that became readable before it, so a
+ * flooding client gets its share in turn instead of the whole frame. When the
+ * time budget runs out, connections not served yet go first in next Breath().
+ *
+ * T needs a bool bReadQueued member, false for a new connection.
+ **/
+template<typename T>
+class ReadScheduler {
+public:
+	ReadScheduler() : _nBytes(0), _nMessages(0), _dMillis(0), _vQueue(), _vServing() {}
+
+	void Setup(size_t nBytes, uint32_t nMessages, double dMillis) {
+		_nBytes		= nBytes;
+		_nMessages	= nMessages;
+		_dMillis	= dMillis;
+	}
+
+	/**
+	 * Budget of one connection per Breath(). 0 for no limit.
+	 **/
+	inline size_t	Bytes() const { return _nBytes; }
+	inline uint32_t	Messages() const { return _nMessages; }
+
+	/**
+	 * Time when reading in this Breath() must stop. HUGE_VAL for no limit.
+	 **/
+	inline double	Deadline() const { return _dMillis > 0 ? Tick() + _dMillis : HUGE_VAL; }
+
+	/**
+	 * Some connection is left for next Breath().
+	 **/
+	inline bool		Pending() const { return !_vQueue.empty(); }
+
+	/**
+	 * Connection became readable. Ignored if it is queued already.
+	 **/
+	inline void Ready(T * p) {
+		if (p->bReadQueued) return;
+		p->bReadQueued = true;
+		_vQueue.push_back(p->nId);
+	}
+
+	/**
+	 * Read queued connections in order. At least one is read, however small the time
+	 * budget is.
+	 *
+	 * \param	fFind	T *(uint64_t nId). nullptr for a closed connection.
+	 * \param	fRead	bool(T *). Returns true if that connection was stopped by budget and
+	 *					is still alive, so it must be read again.
+	 * \return	Connections left for next Breath().
+	 **/
+	template<typename FIND, typename F>
+	size_t Run(FIND fFind, F fRead) {
+		if (_vQueue.empty()) return 0;
+
+		double dDeadline = Deadline();
+		_vServing.swap(_vQueue);
+
+		size_t nServed = 0;
+		while (nServed < _vServing.size()) {
+			if (nServed > 0 && dDeadline != HUGE_VAL && Tick() >= dDeadline) break;
+
+			uint64_t nId = _vServing[nServed++];
+			T * p = fFind(nId);
+			if (!p) continue;
+
+			p->bReadQueued = false;
+			bool bMore = fRead(p);
+
+			/// Callback has shutdown the server.
+			if (_vServing.empty()) return 0;
+			if (bMore && (p = fFind(nId))) Ready(p);
+		}
+
+		_vQueue.insert(_vQueue.begin(), _vServing.begin() + nServed, _vServing.end());
+		_vServing.clear();
+		return _vQueue.size();
+	}
+
+	void Clear() {
+		_vQueue.clear();
+		_vServing.clear();
+	}
+
+private:
+	size_t		_nBytes;
+	uint32_t	_nMessages;
+	double		_dMillis;
+	std::vector<uint64_t>	_vQueue;	//! Next to read, in order
+	std::vector<uint64_t>	_vServing;	//! Being read by Run()
+};
+
+/**
+ * Count one Breath() that took dElapsed milliseconds.
+ **/
+inline void RecordBreath(ServerStats & rStats, double dElapsed) {
+	uint64_t nMicro = (uint64_t)(dElapsed * 1000);
+	int nBucket = 0;
+	while (nMicro > 0 && nBucket < NET_LATENCY_BUCKETS - 1) {
+		nMicro >>= 1;
+		++nBucket;
+	}
+
+	++rStats.nBreaths;
+	++rStats.pBreathLatency[nBucket];
+	if (dElapsed > rStats.dBreathMax) rStats.dBreathMax = dElapsed;
+}
+
+/**
+ * Track high-water mark of a send queue.
+ **/
+inline void RecordQueued(ServerStats & rStats, Connection * pConn, size_t nQueued) {
+	if (nQueued > pConn->iStats.nQueuedMax) pConn->iStats.nQueuedMax = nQueued;
+	if (nQueued > rStats.nQueuedMax) rStats.nQueuedMax = nQueued;
+}
+
+#endif//!	__ENGINE_NETWORK_POOL_H_INCLUDED__
@@ -0,0 +1,198 @@
+#ifndef		__ENGINE_NETWORK_SHM_H_INCLUDED__
+#define		__ENGINE_NETWORK_SHM_H_INCLUDED__
+
+#include	<atomic>
+#include	<cstdint>
+#include	<cstring>
+
+#define		SHM_CACHELINE	64
+#define		SHM_MINRING		4096
+#define		SHM_MAXRING		1073741824
+#define		SHM_PAD			0xFFFFFFFF
+#define		SHM_SENDLIMIT	67108864
+#define		SHM_SPIN		0.05
+#define		SHM_HANDSHAKE	1000
+#define		SHM_MAGIC		0x314D4853
+
+/**
+ * Control block at the beginning of a ring in shared memory. Each counter has its
+ * own cache line, so producer and consumer never write the same line while data
+ * flows. Counters only grow : offset in ring is counter & (capacity - 1).
+ **/
+struct ShmRingHeader {
+	alignas(SHM_CACHELINE) std::atomic<uint64_t>	nHead;		//! Bytes consumed. Written by consumer only
+	alignas(SHM_CACHELINE) std::atomic<uint64_t>	nTail;		//! Bytes produced. Written by producer only
+	alignas(SHM_CACHELINE) std::atomic<uint32_t>	nWaiting;	//! Consumer is idle and wants its eventfd written
+};
+
+/**
+ * One side's view of a single-producer single-consumer ring in shared memory,
+ * the cross-process cousin of FastBuffer. Records are [len:4][data], aligned to
+ * 8 bytes. A record never wraps : when it does NOT fit before the end, SHM_PAD
+ * skips the rest of the ring. So a message is at most half of the capacity.
+ *
+ * Wakeups follow Dekker's pattern. An idle consumer sets nWaiting then looks at
+ * nTail again, while a producer publishes nTail then looks at nWaiting, with a
+ * full fence on both sides. At least one of them sees the other, so a message is
+ * never left in a ring whose consumer sleeps, and a busy consumer costs the
+ * producer no system call at all.
+ *
+ * Capacity is kept in this process, never read back from shared memory, and the
+ * memory is sealed against shrinking, so a broken peer can NOT make us touch
+ * memory outside the mapping.
+ **/
+class ShmRing {
+public:
+	ShmRing() : _pHeader(nullptr), _pData(nullptr), _nCapacity(0), _nCached(0) {}
+
+	/**
+	 * Bytes of shared memory needed by one ring.
+	 **/
+	static inline size_t Bytes(size_t nCapacity) { return sizeof(ShmRingHeader) + nCapacity; }
+
+	/**
+	 * Is it a capacity both sides can agree on?
+	 **/
+	static inline bool Valid(size_t nCapacity) {
+		return nCapacity >= SHM_MINRING && nCapacity <= SHM_MAXRING && (nCapacity & (nCapacity - 1)) == 0;
+	}
+
+	/**
+	 * Largest message a ring with given capacity takes.
+	 **/
+	static inline size_t MaxMessage(size_t nCapacity) { return nCapacity / 2 - 8; }
+
+	/**
+	 * Use memory mapped by this process. Creator of memory must zero it first.
+	 **/
+	void Attach(void * pMem, size_t nCapacity) {
+		_pHeader	= (ShmRingHeader *)pMem;
+		_pData		= (char *)pMem + sizeof(ShmRingHeader);
+		_nCapacity	= nCapacity;
+		_nCached	= 0;
+	}
+
+	/**
+	 * Producer : copy one message in and publish it.
+	 *
+	 * \return	False if there is no room now.
+	 **/
+	inline bool Write(const char * pData, size_t nSize) {
+		uint64_t nTail = _pHeader->nTail.load(std::memory_order_relaxed);
+		size_t nOffset = (size_t)(nTail & (_nCapacity - 1));
+		size_t nNeed = __Record(nSize);
+		size_t nSkip = _nCapacity - nOffset < nNeed ? _nCapacity - nOffset : 0;
+
+		/// Head is cached, so consumer's cache line is only read when ring looks full.
+		if (nTail + nSkip + nNeed - _nCached > _nCapacity) {
+			_nCached = _pHeader->nHead.load(std::memory_order_acquire);
+			if (nTail + nSkip + nNeed - _nCached > _nCapacity) return false;
+		}
+
+		if (nSkip > 0) {
+			uint32_t nPad = SHM_PAD;
+			memcpy(_pData + nOffset, &nPad, 4);
+			nOffset = 0;
+		}
+
+		uint32_t nLen = (uint32_t)nSize;
+		memcpy(_pData + nOffset, &nLen, 4);
+		if (nSize > 0) memcpy(_pData + nOffset + 4, pData, nSize);
+
+		_pHeader->nTail.store(nTail + nSkip + nNeed, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	 * Producer : after publishing, does consumer wait for its eventfd? Clears the
+	 * flag, so only the first message after consumer went idle pays for a wakeup.
+	 **/
+	inline bool Wakeup() {
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		return _pHeader->nWaiting.load(std::memory_order_relaxed) != 0 && _pHeader->nWaiting.exchange(0) != 0;
+	}
+
+	/**
+	 * Consumer : hand messages published so far to fDeliver. Data points into the
+	 * ring and stays there until fDeliver returns. Messages published meanwhile
+	 * wait for next call, so a fast producer can NOT keep consumer here forever.
+	 *
+	 * \param	fDeliver	bool(char * pData, size_t nSize). Return false if this ring
+	 *						was unmapped by the callback, so it is NOT touched again.
+	 * \param	rBroken		Set when a record does NOT fit in ring.
+	 * \return	Messages delivered.
+	 **/
+	template<typename F>
+	size_t Read(F fDeliver, bool & rBroken) {
+		uint64_t nHead = _pHeader->nHead.load(std::memory_order_relaxed);
+		uint64_t nTail = _pHeader->nTail.load(std::memory_order_acquire);
+		size_t nCount = 0;
+
+		rBroken = nTail - nHead > _nCapacity;
+
+		while (!rBroken && nHead != nTail) {
+			size_t nOffset = (size_t)(nHead & (_nCapacity - 1));
+			uint32_t nLen;
+			memcpy(&nLen, _pData + nOffset, 4);
+
+			if (nLen == SHM_PAD) {
+				nHead += _nCapacity - nOffset;
+				continue;
+			}
+
+			size_t nNeed = __Record(nLen);
+			if (nLen > MaxMessage(_nCapacity) || nNeed > _nCapacity - nOffset || nNeed > nTail - nHead) {
+				rBroken = true;
+				break;
+			}
+
+			++nCount;
+			if (!fDeliver(_pData + nOffset + 4, (size_t)nLen)) return nCount;
+
+			nHead += nNeed;
+			_pHeader->nHead.store(nHead, std::memory_order_release);
+		}
+
+		_pHeader->nHead.store(nHead, std::memory_order_release);
+		return nCount;
+	}
+
+	/**
+	 * Consumer : is anything published and NOT read yet?
+	 **/
+	inline bool Empty() const {
+		return _pHeader->nHead.load(std::memory_order_relaxed) == _pHeader->nTail.load(std::memory_order_acquire);
+	}
+
+	/**
+	 * Consumer : ask producer for an eventfd write on next message.
+	 *
+	 * \return	False if a message came in meanwhile, so caller must NOT sleep.
+	 **/
+	inline bool Sleep() {
+		_pHeader->nWaiting.store(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (Empty()) return true;
+
+		_pHeader->nWaiting.store(0, std::memory_order_relaxed);
+		return false;
+	}
+
+	/**
+	 * Consumer : working again, producer needs NOT wake anybody.
+	 **/
+	inline void Awake() {
+		if (_pHeader->nWaiting.load(std::memory_order_relaxed) != 0) _pHeader->nWaiting.store(0, std::memory_order_relaxed);
+	}
+
+private:
+	static inline size_t __Record(size_t nSize) { return (4 + nSize + 7) & ~(size_t)7; }
+
+private:
+	ShmRingHeader *	_pHeader;
+	char *			_pData;
+	size_t			_nCapacity;
+	uint64_t		_nCached;	//! Last head seen by producer
+};
+
+#endif//!	__ENGINE_NETWORK_SHM_H_INCLUDED__
\ No newline at end of file
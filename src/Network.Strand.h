@@ -0,0 +1,161 @@
+#ifndef		__ENGINE_NETWORK_STRAND_H_INCLUDED__
+#define		__ENGINE_NETWORK_STRAND_H_INCLUDED__
+
+#include	<Network.h>
+#include	<Runnable.h>
+#include	<atomic>
+#include	<cstdlib>
+#include	<cstring>
+#include	<memory>
+#include	<mutex>
+#include	<thread>
+
+#define		STRAND_BATCH	32
+
+/**
+ * State shared by all strands of one server. Strands hold it, so a job still
+ * queued in ThreadPool after Stop() finds the server gone and does nothing.
+ **/
+struct StrandGroup {
+	IServerSocket *		pOwner;
+	ThreadPool *		pPool;
+	std::atomic<bool>	bStopped;
+	std::atomic<int>	nRunning;	//! Jobs between entering and leaving Strand::Run()
+
+	StrandGroup(IServerSocket * pOwner, ThreadPool * pPool)
+		: pOwner(pOwner), pPool(pPool), bStopped(false), nRunning(0) {}
+
+	/**
+	 * Drop waiting messages and wait for running OnWork() to return. Main thread only.
+	 **/
+	void Stop() {
+		bStopped = true;
+		while (nRunning > 0) std::this_thread::yield();
+	}
+};
+
+/**
+ * Messages of one connection waiting for ThreadPool. At most one job of a strand
+ * is queued or running at any time, so messages of a connection are handled in
+ * order, while different connections run on different workers. A job handles at
+ * most STRAND_BATCH messages before queueing itself again, so a chatty client
+ * can NOT hold a worker forever.
+ **/
+class Strand : public std::enable_shared_from_this<Strand> {
+	struct Message {
+		Message *	pNext;
+		uint32_t	nMsgId;
+		size_t		nSize;
+
+		inline char *	Data() { return (char *)(this + 1); }
+	};
+
+public:
+	Strand(const std::shared_ptr<StrandGroup> & pGroup, uint64_t nConnId)
+		: _pGroup(pGroup), _nConnId(nConnId), _iLock(), _pHead(nullptr), _pTail(nullptr), _bScheduled(false) {}
+
+	virtual ~Strand() {
+		while (Message * p = _pHead) {
+			_pHead = p->pNext;
+			free(p);
+		}
+	}
+
+	/**
+	 * Copy a message into this strand. Main thread only.
+	 **/
+	void	Push(uint32_t nMsgId, const char * pData, size_t nSize);
+
+	/**
+	 * Handle waiting messages. Invoked by ThreadPool workers.
+	 **/
+	void	Run();
+
+private:
+	void	__Schedule();
+
+private:
+	std::shared_ptr<StrandGroup>	_pGroup;
+	uint64_t		_nConnId;
+	std::mutex		_iLock;
+	Message *		_pHead;
+	Message *		_pTail;
+	bool			_bScheduled;	//! A job of this strand is queued or running
+};
+
+/**
+ * Job running one batch of a strand.
+ **/
+class StrandJob : public IRunnable {
+public:
+	StrandJob(const std::shared_ptr<Strand> & pStrand) : _pStrand(pStrand) {}
+	virtual ~StrandJob() {}
+
+	virtual void Run() override { _pStrand->Run(); }
+
+private:
+	std::shared_ptr<Strand>	_pStrand;
+};
+
+inline void Strand::Push(uint32_t nMsgId, const char * pData, size_t nSize) {
+	Message * p = (Message *)malloc(sizeof(Message) + nSize);
+	p->pNext	= nullptr;
+	p->nMsgId	= nMsgId;
+	p->nSize	= nSize;
+	if (nSize > 0) memcpy(p->Data(), pData, nSize);
+
+	bool bSchedule = false;
+	{
+		std::lock_guard<std::mutex> _(_iLock);
+		if (_pTail) {
+			_pTail->pNext = p;
+		} else {
+			_pHead = p;
+		}
+
+		_pTail = p;
+		bSchedule = !_bScheduled;
+		_bScheduled = true;
+	}
+
+	if (bSchedule) __Schedule();
+}
+
+inline void Strand::Run() {
+	StrandGroup & rGroup = *_pGroup;
+	++rGroup.nRunning;
+
+	for (int i = 0; i < STRAND_BATCH; ++i) {
+		Message * p = nullptr;
+		{
+			std::lock_guard<std::mutex> _(_iLock);
+			if (!(p = _pHead)) break;
+			if (!(_pHead = p->pNext)) _pTail = nullptr;
+		}
+
+		/// Checked after nRunning is raised, so Stop() either sees this job or it sees bStopped.
+		if (!rGroup.bStopped) rGroup.pOwner->OnWork(_nConnId, p->nMsgId, p->Data(), p->nSize);
+		free(p);
+	}
+
+	bool bMore = false;
+	{
+		std::lock_guard<std::mutex> _(_iLock);
+		bMore = _pHead != nullptr;
+		_bScheduled = bMore;
+	}
+
+	--rGroup.nRunning;
+	if (bMore) __Schedule();
+}
+
+inline void Strand::__Schedule() {
+	StrandJob * pJob = new StrandJob(shared_from_this());
+	if (_pGroup->pPool->AddRunnable(pJob)) return;
+
+	/// Pool refuses jobs during WaitAll(). Handle them here instead of losing them.
+	delete pJob;
+	Run();
+}
+
+#endif//!	__ENGINE_NETWORK_STRAND_H_INCLUDED__
\ No newline at end of file
@@ -0,0 +1,133 @@
+#ifndef		__ENGINE_NETWORK_UDP_H_INCLUDED__
+#define		__ENGINE_NETWORK_UDP_H_INCLUDED__
+
+#include	"Network.Pool.h"
+#include	<cstring>
+#include	<unordered_map>
+#include	<vector>
+
+#define		UDP_BATCH		32
+#define		UDP_BUFSIZE		65536
+#define		UDP_MAXDATA		65507
+#define		UDP_SENDLIMIT	4194304
+#define		UDP_MAXPEERS	65536
+
+/**
+ * Remote address talking to an IUdpSocket.
+ **/
+struct PeerContext : public Connection {};
+
+/**
+ * Peers of one UDP socket. Identifiers work like TCP connections, so a peer
+ * forgotten by Close() never matches a later peer reusing its slot.
+ **/
+class UdpPeers {
+public:
+	UdpPeers() : _iPool(true), _mAddrs(), _nLimit(UDP_MAXPEERS) {}
+
+	/**
+	 * Peer with given address, nullptr if unknown.
+	 **/
+	inline PeerContext * Find(uint32_t nIP, int nPort) const {
+		auto it = _mAddrs.find(__Key(nIP, nPort));
+		return it == _mAddrs.end() ? nullptr : _iPool.At(it->second);
+	}
+
+	inline PeerContext *	Find(uint64_t nId) const { return _iPool.Find(nId); }
+	inline const std::vector<PeerContext *> &	Alive() const { return _iPool.Alive(); }
+
+	/**
+	 * Datagrams from unknown addresses are ignored while this many peers are alive.
+	 **/
+	inline void	SetLimit(size_t nLimit) { _nLimit = nLimit; }
+	inline bool	Full() const { return _iPool.Alive().size() >= _nLimit; }
+
+	/**
+	 * Create a peer for given address. Address must be unknown.
+	 **/
+	PeerContext * Add(int nSocket, uint32_t nIP, int nPort) {
+		PeerContext * p = _iPool.Alloc();
+		p->nSocket	= nSocket;
+		p->nIP		= nIP;
+		p->nPort	= nPort;
+		p->pData	= nullptr;
+
+		_mAddrs[__Key(nIP, nPort)] = (uint32_t)p->nId;
+		return p;
+	}
+
+	void Remove(PeerContext * p) {
+		_mAddrs.erase(__Key(p->nIP, p->nPort));
+		_iPool.Free(p);
+	}
+
+	void Clear() {
+		_mAddrs.clear();
+		_iPool.Clear();
+	}
+
+private:
+	static inline uint64_t	__Key(uint32_t nIP, int nPort) { return ((uint64_t)nIP << 16) | (uint16_t)nPort; }
+
+private:
+	ConnectionPool<PeerContext>				_iPool;
+	std::unordered_map<uint64_t, uint32_t>	_mAddrs;
+	size_t									_nLimit;
+};
+
+/**
+ * Datagrams waiting for next flush. Bodies are packed in one arena that keeps its
+ * capacity after flushing, so sending does not allocate once the arena is warm.
+ * Consecutive datagrams to the same peer are adjacent, which lets flushing hand
+ * a run of them to kernel as one GSO message.
+ **/
+class UdpOutbox {
+public:
+	struct Datagram {
+		uint32_t	nIP;
+		int			nPort;
+		size_t		nOffset;
+		size_t		nSize;
+	};
+
+public:
+	UdpOutbox() : _vPending(), _vArena() {}
+
+	inline size_t			Count() const { return _vPending.size(); }
+	inline size_t			Bytes() const { return _vArena.size(); }
+	inline const Datagram &	operator[](size_t nIdx) const { return _vPending[nIdx]; }
+	inline char *			Data(const Datagram & r) { return &_vArena[r.nOffset]; }
+
+	void Push(uint32_t nIP, int nPort, const char * pData, size_t nSize) {
+		Datagram iGram = { nIP, nPort, _vArena.size(), nSize };
+		_vArena.insert(_vArena.end(), pData, pData + nSize);
+		_vPending.push_back(iGram);
+	}
+
+	/**
+	 * Drop the first nCount datagrams after they were sent.
+	 **/
+	void Drop(size_t nCount) {
+		if (nCount >= _vPending.size()) {
+			_vPending.clear();
+			_vArena.clear();
+			return;
+		}
+
+		size_t nShift = _vPending[nCount].nOffset;
+		_vArena.erase(_vArena.begin(), _vArena.begin() + nShift);
+		_vPending.erase(_vPending.begin(), _vPending.begin() + nCount);
+		for (auto & r : _vPending) r.nOffset -= nShift;
+	}
+
+	void Clear() {
+		_vPending.clear();
+		_vArena.clear();
+	}
+
+private:
+	std::vector<Datagram>	_vPending;
+	std::vector<char>		_vArena;
+};
+
+#endif//!	__ENGINE_NETWORK_UDP_H_INCLUDED__
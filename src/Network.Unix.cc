@@ -1,66 +1,2487 @@
 #if !defined(_WIN32)
 
 #include	<Network.h>
+#include	<DateTime.h>
 #include	<Logger.h>
+#include	"Network.Buffer.h"
+#include	"Network.Limit.h"
+#include	"Network.Pool.h"
+#include	"Network.Shm.h"
+#include	"Network.Strand.h"
+#include	"Network.Uring.h"
+#include	"Network.Udp.h"
 
 #include	<algorithm>
+#include	<atomic>
+#include	<cmath>
+#include	<cstddef>
 #include	<cstdlib>
 #include	<cstring>
 #include	<map>
+#include	<memory>
+#include	<random>
+#include	<set>
 #include	<thread>
 #include	<vector>
 
 #include	<arpa/inet.h>
 #include	<fcntl.h>
+#include	<linux/errqueue.h>
 #include	<netinet/in.h>
+#include	<netinet/udp.h>
 #include	<sys/epoll.h>
+#include	<sys/eventfd.h>
+#include	<sys/mman.h>
+#include	<sys/sendfile.h>
 #include	<sys/socket.h>
+#include	<sys/stat.h>
+#include	<sys/timerfd.h>
 #include	<sys/types.h>
+#include	<sys/uio.h>
+#include	<sys/un.h>
 #include	<unistd.h>
 
 #define		SOCKET_BUFSIZE	2097152
+#define		IOQUEUE_SIZE	65536
+#define		CONNECT_TIMEOUT	3000
+#define		REACTOR_EVENTS	1024
+
+/// Zero-copy send is in kernel since 4.14. Older headers lack the names.
+#ifndef		SO_ZEROCOPY
+#	define	SO_ZEROCOPY		60
+#endif
+#ifndef		MSG_ZEROCOPY
+#	define	MSG_ZEROCOPY	0x4000000
+#endif
+#ifndef		SO_EE_ORIGIN_ZEROCOPY
+#	define	SO_EE_ORIGIN_ZEROCOPY	5
+#endif
 
 using namespace std;
 
-class SocketContext {
+/**
+ * Internal state of a connection accepted by IServerSocket.
+ **/
+struct ConnectionContext : public Connection {
+	SendQueue	iSend;
+	RecvBuffer	iRecv;
+	size_t		nSending;	//! Bytes handed to io_uring and not completed yet
+	int			nZeroCopy;	//! SO_ZEROCOPY state : 0 untried, 1 enabled, -1 refused
+	bool		bReadQueued;	//! Waiting in ReadScheduler
+	TokenBucket	iByteTokens;
+	TokenBucket	iMsgTokens;
+	vector<pair<uint32_t, size_t>>	vGroups;
+	TimelineHook<ConnectionContext>	iLastRead;
+	TimelineHook<ConnectionContext>	iLastActive;
+	TimelineHook<ConnectionContext>	iLastPing;
+	TimelineHook<ConnectionContext>	iThrottled;
+	shared_ptr<Strand>	pStrand;	//! Created by the first message dispatched to ThreadPool
+};
+
+/**
+ * Scratch area for recv(). Shared by all sockets breathing on the same thread and
+ * never zero-filled. Bytes that must survive a Breath() go to RecvBuffer instead.
+ **/
+static char * RecvScratch() {
+	static thread_local unique_ptr<char[]> pScratch;
+	if (!pScratch) pScratch.reset(new char[SOCKET_BUFSIZE]);
+	return pScratch.get();
+}
+
+/**
+ * Resolve an endpoint : IPv4 address with port, or "unix:/path" for a Unix domain
+ * socket ("unix:@name" in abstract namespace), where port is ignored.
+ *
+ * \return	False for bad address.
+ **/
+static bool ToAddress(const string & sIP, int nPort, sockaddr_storage & rAddr, socklen_t & rSize) {
+	memset(&rAddr, 0, sizeof(rAddr));
+
+	if (sIP.compare(0, 5, "unix:") != 0) {
+		sockaddr_in * p = (sockaddr_in *)&rAddr;
+		p->sin_family	= AF_INET;
+		p->sin_port		= htons(nPort);
+		rSize			= sizeof(sockaddr_in);
+		return inet_pton(AF_INET, sIP.c_str(), &p->sin_addr) > 0;
+	}
+
+	sockaddr_un * p = (sockaddr_un *)&rAddr;
+	size_t nPath = sIP.size() - 5;
+	if (nPath == 0 || nPath >= sizeof(p->sun_path)) return false;
+
+	p->sun_family = AF_UNIX;
+	memcpy(p->sun_path, sIP.data() + 5, nPath);
+	if (p->sun_path[0] == '@') p->sun_path[0] = '\0';
+
+	rSize = (socklen_t)(offsetof(sockaddr_un, sun_path) + nPath);
+	return true;
+}
+
+/**
+ * Create a non-blocking listening socket. A Unix domain socket file left by a dead
+ * process is removed first, while one still accepting makes bind() fail.
+ *
+ * \param	bReusePort	Let other sockets listen on the same TCP port.
+ * \return	Socket, or -1 with errno set.
+ **/
+static int OpenListener(const sockaddr_storage & rAddr, socklen_t nSize, bool bReusePort) {
+	const sockaddr_un * pLocal = (const sockaddr_un *)&rAddr;
+
+	if (rAddr.ss_family == AF_UNIX && pLocal->sun_path[0] != '\0') {
+		struct stat iStat;
+		int nProbe = socket(AF_UNIX, SOCK_STREAM, 0);
+
+		if (nProbe >= 0 && stat(pLocal->sun_path, &iStat) == 0 && S_ISSOCK(iStat.st_mode)) {
+			if (connect(nProbe, (const sockaddr *)&rAddr, nSize) < 0 && errno == ECONNREFUSED) unlink(pLocal->sun_path);
+		}
+
+		if (nProbe >= 0) close(nProbe);
+	}
+
+	int nSocket = socket(rAddr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (nSocket < 0) return -1;
+
+	int nReuse = 1;
+	if (rAddr.ss_family == AF_INET) setsockopt(nSocket, SOL_SOCKET, SO_REUSEADDR, &nReuse, sizeof(nReuse));
+
+	if ((bReusePort && setsockopt(nSocket, SOL_SOCKET, SO_REUSEPORT, &nReuse, sizeof(nReuse)) < 0)
+		|| ::bind(nSocket, (const sockaddr *)&rAddr, nSize) < 0
+		|| ::listen(nSocket, 512) < 0) {
+		int nErr = errno;
+		close(nSocket);
+		errno = nErr;
+		return -1;
+	}
+
+	return nSocket;
+}
+
+/**
+ * Address of accepted client. Clients of a Unix domain socket have IP 0 and port 0.
+ **/
+static inline uint32_t PeerIP(const sockaddr_in & rAddr) { return rAddr.sin_family == AF_INET ? rAddr.sin_addr.s_addr : 0; }
+static inline int PeerPort(const sockaddr_in & rAddr) { return rAddr.sin_family == AF_INET ? rAddr.sin_port : 0; }
+
+/**
+ * Write as much queued data as possible without blocking. Queue is written with
+ * one sendmsg() per 64 blocks, and every batch except the last one is marked with
+ * MSG_MORE so kernel does not push a partial segment between them.
+ *
+ * File ranges go out by sendfile(), so they never pass through user memory.
+ * Referenced memory is sent in batches of its own with MSG_ZEROCOPY, because
+ * kernel keeps reading every page of such a send until it reports completion.
+ *
+ * \param	pStats	Counts syscalls when given.
+ * \return	False if socket is broken.
+ **/
+static bool FlushSendQueue(int nSocket, SendQueue & rQueue, ServerStats * pStats = nullptr) {
+	struct iovec pVec[64];
+	struct msghdr iMsg;
+	memset(&iMsg, 0, sizeof(iMsg));
+
+	bool bZeroCopy = true;
+
+	while (!rQueue.Empty()) {
+		SendQueue::Block * p = rQueue.Head();
+
+		if (p->IsFile()) {
+			off_t nOffset = (off_t)(p->nOffset + p->nBegin);
+			ssize_t nSend = sendfile(nSocket, p->nFile, &nOffset, std::min(p->Size(), (size_t)SENDQUEUE_CHUNK));
+			if (pStats) ++pStats->nSendCalls;
+			if (nSend < 0) {
+				if (errno == EINTR) continue;
+				if (pStats && errno == EAGAIN) ++pStats->nWouldBlock;
+				return errno == EAGAIN;
+			}
+
+			/// File was truncated. The rest of this stream can NOT be framed correctly.
+			if (nSend == 0) return false;
+
+			rQueue.Consume((size_t)nSend);
+			continue;
+		}
+
+		int nVec = 0;
+		bool bExtern = p->pExtern != nullptr;
+		for (; p && nVec < 64 && !p->IsFile() && (p->pExtern != nullptr) == bExtern; p = p->pNext, ++nVec) {
+			pVec[nVec].iov_base	= p->Data();
+			pVec[nVec].iov_len	= p->Size();
+		}
+
+		iMsg.msg_iov	= pVec;
+		iMsg.msg_iovlen	= nVec;
+
+		bool bPin = bExtern && bZeroCopy;
+		ssize_t nSend = sendmsg(nSocket, &iMsg, MSG_DONTWAIT | MSG_NOSIGNAL | (p ? MSG_MORE : 0) | (bPin ? MSG_ZEROCOPY : 0));
+		if (pStats) ++pStats->nSendCalls;
+		if (nSend < 0) {
+			if (errno == EINTR) continue;
+
+			/// Out of memory to pin pages (optmem_max). Copy them instead.
+			if (bPin && errno == ENOBUFS) {
+				bZeroCopy = false;
+				continue;
+			}
+
+			if (pStats && errno == EAGAIN) ++pStats->nWouldBlock;
+			return errno == EAGAIN;
+		}
+
+		rQueue.Consume((size_t)nSend, bPin);
+	}
+
+	return true;
+}
+
+/**
+ * Read zero-copy completion reports from socket error queue. Reports are queued
+ * as errors with ee_errno 0, so they wake epoll with EPOLLERR only.
+ **/
+static void ReapZeroCopy(int nSocket, SendQueue & rQueue) {
+	char pControl[128];
+	struct msghdr iMsg;
+
+	while (true) {
+		memset(&iMsg, 0, sizeof(iMsg));
+		iMsg.msg_control	= pControl;
+		iMsg.msg_controllen	= sizeof(pControl);
+
+		if (recvmsg(nSocket, &iMsg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+			if (errno == EINTR) continue;
+			return;
+		}
+
+		for (struct cmsghdr * pCmsg = CMSG_FIRSTHDR(&iMsg); pCmsg; pCmsg = CMSG_NXTHDR(&iMsg, pCmsg)) {
+			if (pCmsg->cmsg_level != SOL_IP || pCmsg->cmsg_type != IP_RECVERR) continue;
+
+			struct sock_extended_err iErr;
+			memcpy(&iErr, CMSG_DATA(pCmsg), sizeof(iErr));
+			if (iErr.ee_errno == 0 && iErr.ee_origin == SO_EE_ORIGIN_ZEROCOPY) rQueue.Complete(iErr.ee_info, iErr.ee_data);
+		}
+	}
+}
+
+/**
+ * Append data to send queue without touching socket. The queue limit only applies
+ * when data is already waiting, so a message is never cut in the middle.
+ *
+ * \return	False if queue is full.
+ **/
+static bool Enqueue(SendQueue & rQueue, size_t nLimit, struct iovec * pVec, int nVec) {
+	if (!rQueue.Empty()) {
+		size_t nTotal = 0;
+		for (int i = 0; i < nVec; ++i) nTotal += pVec[i].iov_len;
+		if (rQueue.Buffered() + nTotal > nLimit) return false;
+	}
+
+	for (int i = 0; i < nVec; ++i) rQueue.Append((const char *)pVec[i].iov_base, pVec[i].iov_len);
+	return true;
+}
+
+/**
+ * Fill iovec with slices. SendOrQueue() moves through the copy, never user's array.
+ *
+ * \return	Number of iovec used. -1 if nCount is out of range.
+ **/
+static int ToVec(struct iovec * pVec, const NetSlice * pSlices, int nCount) {
+	if (nCount < 0 || nCount > NET_MAXSLICES) return -1;
+
+	for (int i = 0; i < nCount; ++i) {
+		pVec[i].iov_base	= (void *)pSlices[i].pData;
+		pVec[i].iov_len		= pSlices[i].nSize;
+	}
+
+	return nCount;
+}
+
+/**
+ * Send data directly if nothing is queued. Remaining part goes into send queue.
+ *
+ * \param	pStats	Counts syscalls when given.
+ * \return	False if socket is broken or queue is full.
+ **/
+static bool SendOrQueue(int nSocket, SendQueue & rQueue, size_t nLimit, struct iovec * pVec, int nVec, ServerStats * pStats = nullptr) {
+	if (!rQueue.Empty()) return Enqueue(rQueue, nLimit, pVec, nVec);
+
+	struct msghdr iMsg;
+	memset(&iMsg, 0, sizeof(iMsg));
+
+	while (nVec > 0) {
+		iMsg.msg_iov	= pVec;
+		iMsg.msg_iovlen	= nVec;
+
+		ssize_t nSend = sendmsg(nSocket, &iMsg, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (pStats) ++pStats->nSendCalls;
+		if (nSend < 0) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN) {
+				if (pStats) ++pStats->nWouldBlock;
+				break;
+			}
+
+			return false;
+		}
+
+		while (nVec > 0 && (size_t)nSend >= pVec->iov_len) {
+			nSend -= pVec->iov_len;
+			++pVec;
+			--nVec;
+		}
+
+		if (nVec > 0) {
+			pVec->iov_base = (char *)pVec->iov_base + nSend;
+			pVec->iov_len -= nSend;
+		}
+	}
+
+	return Enqueue(rQueue, nLimit, pVec, nVec);
+}
+
+/**
+ * epoll shared by all sockets breathing on main thread, so a frame makes one
+ * epoll_wait() however many sockets are open. Servers join with their own epoll
+ * fd (nested epoll).
+ *
+ * Poll() only hands events to handlers, which keep them until their own Breath().
+ * No callback runs while events are dispatched, so a socket destroyed by a
+ * callback never receives a stale event.
+ *
+ * Handlers with their own timers (connect timeout, reconnect, retransmission)
+ * report them by Due() in every Breath(), so Wait() never sleeps past them.
+ **/
+class Reactor {
+public:
+	class Handler {
+	public:
+		virtual ~Handler() {}
+		virtual void	OnPoll(uint32_t nEvents) = 0;
+	};
+
+public:
+	static Reactor & Get();
+	virtual ~Reactor();
+
+	bool	Add(int nFd, uint32_t nEvents, Handler * p);
+	void	Del(int nFd);
+	int		Poll(int nTimeout);
+	void	Due(double dTime) { _dDue = std::min(_dDue, dTime); }
+	bool	Wait(double dDeadline);
+
+	/**
+	 * Break Wait() from another thread or signal handler.
+	 **/
+	void	Wake();
+
+private:
+	Reactor();
+
+private:
+	int		_nIO;
+	int		_nTimer;	//! timerfd for sub-millisecond deadline
+	int		_nWake;		//! eventfd for Wake()
+	double	_dDue;		//! Earliest timer reported since last Wait()
+};
+
+Reactor & Reactor::Get() {
+	/// Never destroyed. Sockets in static objects may still leave it at exit.
+	static Reactor * pIns = new Reactor;
+	return *pIns;
+}
+
+Reactor::Reactor() : _nIO(epoll_create1(EPOLL_CLOEXEC)), _nTimer(-1), _nWake(-1), _dDue(HUGE_VAL) {
+	if (_nIO < 0) return;
+
+	/// Timer and waker are the only fds without handler. Both are drained on wakeup.
+	struct epoll_event iEv;
+	iEv.events = EPOLLIN;
+	iEv.data.ptr = nullptr;
+
+	if ((_nTimer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) >= 0 && epoll_ctl(_nIO, EPOLL_CTL_ADD, _nTimer, &iEv) < 0) {
+		close(_nTimer);
+		_nTimer = -1;
+	}
+
+	if ((_nWake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) >= 0 && epoll_ctl(_nIO, EPOLL_CTL_ADD, _nWake, &iEv) < 0) {
+		close(_nWake);
+		_nWake = -1;
+	}
+}
+
+Reactor::~Reactor() {
+	if (_nWake >= 0) close(_nWake);
+	if (_nTimer >= 0) close(_nTimer);
+	if (_nIO >= 0) close(_nIO);
+}
+
+bool Reactor::Add(int nFd, uint32_t nEvents, Handler * p) {
+	struct epoll_event iEv;
+	iEv.events = nEvents;
+	iEv.data.ptr = p;
+	return _nIO >= 0 && epoll_ctl(_nIO, EPOLL_CTL_ADD, nFd, &iEv) == 0;
+}
+
+void Reactor::Del(int nFd) {
+	if (_nIO >= 0) epoll_ctl(_nIO, EPOLL_CTL_DEL, nFd, NULL);
+}
+
+int Reactor::Poll(int nTimeout) {
+	static epoll_event pEvents[REACTOR_EVENTS];
+	if (_nIO < 0) return 0;
+
+	int nCount = epoll_wait(_nIO, pEvents, REACTOR_EVENTS, nTimeout);
+	int nHandled = 0;
+
+	for (int i = 0; i < nCount; ++i) {
+		Handler * p = (Handler *)pEvents[i].data.ptr;
+
+		if (p) {
+			p->OnPoll(pEvents[i].events);
+			++nHandled;
+		} else {
+			uint64_t nCount;
+			if (_nTimer >= 0) (void)read(_nTimer, &nCount, sizeof(nCount));
+			if (_nWake >= 0) (void)read(_nWake, &nCount, sizeof(nCount));
+		}
+	}
+
+	return nHandled;
+}
+
+bool Reactor::Wait(double dDeadline) {
+	double dDue = std::min(dDeadline, _dDue);
+	_dDue = HUGE_VAL;
+
+	if (dDue <= Tick()) return Poll(0) > 0;
+	if (std::isinf(dDue) || _nTimer < 0) return Poll(std::isinf(dDue) ? -1 : (int)std::ceil(dDue - Tick())) > 0;
+
+	/// Tick() reads CLOCK_MONOTONIC in milliseconds.
+	struct itimerspec iSpec;
+	memset(&iSpec, 0, sizeof(iSpec));
+	iSpec.it_value.tv_sec	= (time_t)(dDue / 1000);
+	iSpec.it_value.tv_nsec	= (long)(std::fmod(dDue, 1000.0) * 1000000);
+
+	if (timerfd_settime(_nTimer, TFD_TIMER_ABSTIME, &iSpec, NULL) < 0) return Poll((int)std::ceil(dDue - Tick())) > 0;
+	return Poll(-1) > 0;
+}
+
+void Reactor::Wake() {
+	uint64_t nOne = 1;
+	if (_nWake >= 0) (void)write(_nWake, &nOne, sizeof(nOne));
+}
+
+/**
+ * Delay before next reconnect, randomized between half and all of nDelay.
+ **/
+static uint32_t RetryDelay(uint32_t nDelay) {
+	static thread_local minstd_rand iRandom(random_device{}());
+	return nDelay / 2 + (uint32_t)(iRandom() % (nDelay / 2 + 1));
+}
+
+class SocketContext : public Reactor::Handler {
+	enum State {
+		Idle,		//! Not connected and not trying
+		Waiting,	//! Waiting for next reconnect
+		Connecting,	//! Non-blocking connect in progress
+		Connected,
+	};
+
+public:
+	SocketContext(ISocket * pOwner);
+	virtual ~SocketContext();
+
+	int		Connect(const string & sIP, int nPort, bool bReconnect);
+	bool	IsConnected() { return _emState == Connected; }
+	void	SetReconnect(uint32_t nMinDelay, uint32_t nMaxDelay);
+	void	Close(ENet::Close emCode);
+	bool	Send(const char * pData, size_t nSize);
+	size_t	Pending() { return _iSend.Size(); }
+	void	SetSendLimit(size_t nLimit) { _nSendLimit = nLimit; }
+	bool	SetFrame(const FrameOption & rOpt) { return _iCodec.Setup(rOpt); }
+	bool	SendFrame(uint32_t nMsgId, const char * pData, size_t nSize);
+	bool	Send(const NetSlice * pSlices, int nCount);
+	bool	SendFrame(uint32_t nMsgId, const NetSlice * pSlices, int nCount);
+	char *	Prepare(size_t nCapacity);
+	bool	Commit(uint32_t nMsgId, size_t nSize);
+	void	Post(uint32_t nMsgId, bool bFrame, const char * pData, size_t nSize);
+	void	SetCoalesce(bool bEnable) { _bCoalesce = bEnable; }
+	void	Flush();
+	void	Breath();
+
+	virtual void	OnPoll(uint32_t nEvents) override { _nEvents |= nEvents; }
+
+private:
+	void	__Start();
+	void	__Finish(uint32_t nEvents);
+	void	__Fail(int nError);
+	void	__Retry();
+	void	__Reset();
+	bool	__Send(struct iovec * pVec, int nVec);
+	void	__Receive(char * pData, size_t nSize);
+
+private:
+	ISocket *		_pOwner;
+	int				_nSocket;
+	uint32_t		_nEvents;	//! Events polled since last Breath()
+	State			_emState;
+	string			_sIP;
+	int				_nPort;
+	sockaddr_storage	_iAddr;
+	socklen_t		_nAddrSize;
+	bool			_bReconnect;
+	uint32_t		_nMinDelay;
+	uint32_t		_nMaxDelay;
+	uint32_t		_nDelay;	//! Base delay of next reconnect
+	int				_nError;	//! Failure of last attempt found before it reached epoll
+	double			_dDeadline;	//! Connect timeout, or time of next reconnect
+	SendQueue		_iSend;
+	RecvBuffer		_iRecv;
+	size_t			_nSendLimit;
+	FrameCodec		_iCodec;
+	PostBox			_iPosts;
+	bool			_bCoalesce;
+	bool			_bDirty;	//! Queue was empty before coalesced data, so no writable edge will flush it
+};
+
+SocketContext::SocketContext(ISocket * pOwner)
+	: _pOwner(pOwner)
+	, _nSocket(-1)
+	, _nEvents(0)
+	, _emState(Idle)
+	, _sIP()
+	, _nPort(0)
+	, _iAddr()
+	, _nAddrSize(0)
+	, _bReconnect(false)
+	, _nMinDelay(1000)
+	, _nMaxDelay(30000)
+	, _nDelay(1000)
+	, _nError(0)
+	, _dDeadline(0)
+	, _iSend()
+	, _iRecv()
+	, _nSendLimit(SENDQUEUE_LIMIT)
+	, _iCodec()
+	, _iPosts()
+	, _bCoalesce(false)
+	, _bDirty(false) {}
+
+SocketContext::~SocketContext() {
+	Close(ENet::Local);
+}
+
+int SocketContext::Connect(const string & sIP, int nPort, bool bReconnect) {
+	if (_emState != Idle) return ENet::Running;
+	if (!ToAddress(sIP, nPort, _iAddr, _nAddrSize)) return ENet::BadParam;
+
+	_sIP		= sIP;
+	_nPort		= nPort;
+	_bReconnect	= bReconnect;
+	_nDelay		= _nMinDelay;
+
+	__Start();
+	return ENet::Success;
+}
+
+void SocketContext::SetReconnect(uint32_t nMinDelay, uint32_t nMaxDelay) {
+	_nMinDelay	= std::max(nMinDelay, (uint32_t)1);
+	_nMaxDelay	= std::max(nMaxDelay, _nMinDelay);
+	_nDelay		= _nMinDelay;
+}
+
+void SocketContext::Close(ENet::Close emCode) {
+	if (emCode == ENet::Local) _bReconnect = false;
+
+	State emPrev = _emState;
+	__Reset();
+
+	if (_bReconnect) {
+		__Retry();
+	} else {
+		_emState = Idle;
+	}
+
+	if (emPrev == Connected) _pOwner->OnClose(emCode);
+}
+
+bool SocketContext::Send(const char * pData, size_t nSize) {
+	struct iovec iVec = { (void *)pData, nSize };
+	return __Send(&iVec, 1);
+}
+
+bool SocketContext::SendFrame(uint32_t nMsgId, const char * pData, size_t nSize) {
+	char pHeader[FrameCodec::MaxHeader];
+	size_t nHeader = _iCodec.Encode(pHeader, nMsgId, nSize);
+	if (nHeader == 0) return false;
+
+	struct iovec pVec[2] = { { pHeader, nHeader }, { (void *)pData, nSize } };
+	return __Send(pVec, nSize > 0 ? 2 : 1);
+}
+
+bool SocketContext::Send(const NetSlice * pSlices, int nCount) {
+	struct iovec pVec[NET_MAXSLICES];
+	int nVec = ToVec(pVec, pSlices, nCount);
+	return nVec >= 0 && __Send(pVec, nVec);
+}
+
+bool SocketContext::SendFrame(uint32_t nMsgId, const NetSlice * pSlices, int nCount) {
+	struct iovec pVec[NET_MAXSLICES + 1];
+	if (ToVec(pVec + 1, pSlices, nCount) < 0) return false;
+
+	size_t nSize = 0;
+	for (int i = 0; i < nCount; ++i) nSize += pSlices[i].nSize;
+
+	char pHeader[FrameCodec::MaxHeader];
+	size_t nHeader = _iCodec.Encode(pHeader, nMsgId, nSize);
+	if (nHeader == 0) return false;
+
+	pVec[0].iov_base	= pHeader;
+	pVec[0].iov_len		= nHeader;
+	return __Send(pVec, nCount + 1);
+}
+
+char * SocketContext::Prepare(size_t nCapacity) {
+	if (_emState != Connected && _emState != Connecting) return nullptr;
+
+	size_t nHeader = _iCodec.HeaderSize();
+	if (!_iSend.Empty() && _iSend.Buffered() + nHeader + nCapacity > _nSendLimit) return nullptr;
+	return _iSend.Reserve(nHeader + nCapacity) + nHeader;
+}
+
+bool SocketContext::Commit(uint32_t nMsgId, size_t nSize) {
+	if (_emState != Connected && _emState != Connecting) return false;
+
+	char pHeader[FrameCodec::MaxHeader];
+	size_t nHeader = _iCodec.HeaderSize();
+	if (nHeader > 0 && _iCodec.Encode(pHeader, nMsgId, nSize, nHeader) != nHeader) return false;
+
+	bool bFirst = _iSend.Empty();
+	char * pData = _iSend.Commit(nHeader + nSize);
+	if (!pData) return false;
+	memcpy(pData, pHeader, nHeader);
+
+	if (_emState == Connecting || !bFirst) return true;
+	if (!_bCoalesce) return FlushSendQueue(_nSocket, _iSend);
+
+	_bDirty = true;
+	return true;
+}
+
+void SocketContext::Post(uint32_t nMsgId, bool bFrame, const char * pData, size_t nSize) {
+	if (_iPosts.Push(0, nMsgId, bFrame, pData, nSize)) Reactor::Get().Wake();
+}
+
+void SocketContext::Flush() {
+	if (_emState != Connected || !_bDirty) return;
+	_bDirty = false;
+	if (!FlushSendQueue(_nSocket, _iSend)) Close(ENet::Remote);
+}
+
+void SocketContext::Breath() {
+	if (_emState == Waiting && Tick() >= _dDeadline) __Start();
+
+	_iPosts.Drain([this](PostBox::Post & r) {
+		if (r.bFrame) {
+			SendFrame(r.nMsgId, r.Data(), r.nSize);
+		} else {
+			Send(r.Data(), r.nSize);
+		}
+	});
+
+	if (_emState == Waiting || _emState == Connecting) Reactor::Get().Due(_dDeadline);
+
+	if (_emState == Connecting && _nSocket < 0) {
+		__Fail(_nError);
+		return;
+	}
+
+	Flush();
+	if (_nSocket < 0) return;
+
+	uint32_t nEvents = _nEvents;
+	_nEvents = 0;
+
+	if (_emState == Connecting) {
+		if (nEvents != 0) {
+			__Finish(nEvents);
+		} else if (Tick() >= _dDeadline) {
+			__Fail(ENet::Timeout);
+		}
+
+		/// Readable edge arriving with the connected edge is NOT reported again.
+		if (_emState != Connected) return;
+	}
+
+	if (nEvents == 0) return;
+
+	if ((nEvents & EPOLLOUT) && !FlushSendQueue(_nSocket, _iSend)) {
+		Close(ENet::Remote);
+		return;
+	}
+
+	if (!(nEvents & (EPOLLIN | EPOLLERR | EPOLLHUP))) return;
+
+	char *	pReceived	= RecvScratch();
+	int		nReaded		= 0;
+
+	while (_emState == Connected) {
+		int nRecv = (int)recv(_nSocket, pReceived + nReaded, SOCKET_BUFSIZE - nReaded, MSG_DONTWAIT);
+		if (nRecv > 0) {
+			nReaded += nRecv;
+			if (nReaded >= SOCKET_BUFSIZE) {
+				__Receive(pReceived, nReaded);
+				nReaded = 0;
+			}
+		} else if (nRecv < 0 && errno == EAGAIN) {
+			if (nReaded > 0) __Receive(pReceived, nReaded);
+			break;
+		} else {
+			if (nReaded > 0) __Receive(pReceived, nReaded);
+			Close(nRecv == 0 ? ENet::Remote : ENet::BadData);
+			break;
+		}
+	}
+}
+
+void SocketContext::__Start() {
+	_emState	= Connecting;
+	_nError		= 0;
+	_dDeadline	= Tick() + CONNECT_TIMEOUT;
+
+	/// Failure found here is reported by next Breath(), which should not wait.
+	Reactor::Get().Due(_dDeadline);
+
+	if ((_nSocket = socket(_iAddr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0) {
+		_nError = errno;
+		Reactor::Get().Due(0);
+		return;
+	}
+
+	/// Unix domain socket connects at once, or fails with EAGAIN when backlog is full.
+	if (connect(_nSocket, (sockaddr *)&_iAddr, _nAddrSize) < 0 && errno != EINPROGRESS) {
+		_nError = errno;
+		__Reset();
+		Reactor::Get().Due(0);
+		return;
+	}
+
+	/// Writable edge tells connect is done, even if it already finished above.
+	if (!Reactor::Get().Add(_nSocket, EPOLLIN | EPOLLOUT | EPOLLET, this)) {
+		_nError = ENet::Epoll;
+		__Reset();
+		Reactor::Get().Due(0);
+	}
+}
+
+void SocketContext::__Finish(uint32_t nEvents) {
+	if (!(nEvents & (EPOLLOUT | EPOLLERR | EPOLLHUP))) return;
+
+	int nErr = 0;
+	socklen_t nLen = sizeof(nErr);
+	if (getsockopt(_nSocket, SOL_SOCKET, SO_ERROR, &nErr, &nLen) < 0) nErr = errno;
+
+	if (nErr != 0) {
+		__Fail(nErr);
+		return;
+	}
+
+	_emState = Connected;
+	_nDelay = _nMinDelay;
+	_pOwner->OnConnected();
+}
+
+void SocketContext::__Fail(int nError) {
+	__Reset();
+
+	if (_bReconnect) {
+		__Retry();
+		LOG_WARN("Try to reconnect [%s:%d] ... %d", _sIP.c_str(), _nPort, nError);
+	} else {
+		_emState = Idle;
+	}
+
+	_pOwner->OnConnectFail(nError);
+}
+
+void SocketContext::__Retry() {
+	_emState	= Waiting;
+	_dDeadline	= Tick() + RetryDelay(_nDelay);
+	_nDelay		= std::min(_nDelay * 2, _nMaxDelay);
+	Reactor::Get().Due(_dDeadline);
+}
+
+void SocketContext::__Reset() {
+	if (_nSocket >= 0) {
+		Reactor::Get().Del(_nSocket);
+		close(_nSocket);
+	}
+
+	_nSocket = -1;
+	_nEvents = 0;
+	_bDirty = false;
+	_iSend.Clear();
+	_iRecv.Clear();
+}
+
+bool SocketContext::__Send(struct iovec * pVec, int nVec) {
+	if (_emState == Connecting) return Enqueue(_iSend, _nSendLimit, pVec, nVec);
+	if (_emState != Connected) return false;
+	if (!_bCoalesce) return SendOrQueue(_nSocket, _iSend, _nSendLimit, pVec, nVec);
+
+	bool bFirst = _iSend.Empty();
+	if (!Enqueue(_iSend, _nSendLimit, pVec, nVec)) return false;
+	if (bFirst) _bDirty = true;
+	return true;
+}
+
+void SocketContext::__Receive(char * pData, size_t nSize) {
+	if (!_iCodec.Enabled()) {
+		_pOwner->OnReceive(pData, nSize);
+		return;
+	}
+
+	bool bOk = _iCodec.Split(_iRecv, pData, nSize, [this](uint32_t nMsgId, char * pBody, size_t nBody) {
+		_pOwner->OnMessage(nMsgId, pBody, nBody);
+		return _emState == Connected;
+	});
+
+	if (!bOk) Close(ENet::BadData);
+}
+
+/**
+ * Bounded lock-free queue. One producer thread, one consumer thread.
+ **/
+template<typename T>
+class SPSCQueue {
+public:
+	SPSCQueue(size_t nCapacity) : _nMask(nCapacity - 1), _pSlots(new T *[nCapacity]), _nHead(0), _nTail(0) {}
+	virtual ~SPSCQueue() { delete[] _pSlots; }
+
+	bool Push(T * p) {
+		size_t nTail = _nTail.load(memory_order_relaxed);
+		if (nTail - _nHead.load(memory_order_acquire) > _nMask) return false;
+		_pSlots[nTail & _nMask] = p;
+		_nTail.store(nTail + 1, memory_order_release);
+		return true;
+	}
+
+	T * Pop() {
+		size_t nHead = _nHead.load(memory_order_relaxed);
+		if (nHead == _nTail.load(memory_order_acquire)) return nullptr;
+		T * p = _pSlots[nHead & _nMask];
+		_nHead.store(nHead + 1, memory_order_release);
+		return p;
+	}
+
+private:
+	size_t				_nMask;
+	T **				_pSlots;
+	atomic<size_t>		_nHead;
+	atomic<size_t>		_nTail;
+};
+
+/**
+ * Event posted by I/O thread to main thread.
+ **/
+struct NetEvent {
+	enum Type { Accept, Receive, Message, Close };
+
+	Type		emType;
+	int			nSocket;
+	uint32_t	nIP;
+	int			nPort;
+	ENet::Close	emReason;
+	uint32_t	nMsgId;
+	size_t		nSize;
+	char		pData[1];
+
+	static NetEvent * New(Type emType, int nSocket, size_t nSize) {
+		NetEvent * p = (NetEvent *)malloc(sizeof(NetEvent) + nSize);
+		p->emType	= emType;
+		p->nSocket	= nSocket;
+		p->nIP		= 0;
+		p->nPort	= 0;
+		p->emReason	= ENet::Remote;
+		p->nMsgId	= 0;
+		p->nSize	= nSize;
+		return p;
+	}
+};
+
+/**
+ * I/O thread for IServerSocket. Accepts on its own SO_REUSEPORT listener and reads
+ * all connections it accepted. Main thread consumes the result in Breath().
+ **/
+class IOWorker {
+public:
+	IOWorker();
+	virtual ~IOWorker();
+
+	/**
+	 * Start thread accepting on a listening socket, which belongs to this worker from now on.
+	 **/
+	int			Start(int nSocket, const FrameCodec * pCodec, int nNotify);
+	void		Stop();
+	NetEvent *	Pop() { return _qEvents.Pop(); }
+
+	/**
+	 * Add counters of this thread.
+	 **/
+	void		Collect(ServerStats & rStats) const {
+		rStats.nRecvCalls += _nRecvCalls.load(memory_order_relaxed);
+		rStats.nBytesIn += _nRecvBytes.load(memory_order_relaxed);
+	}
+
+private:
+	void		__Run();
+	bool		__Read(int nFd, char * pData, size_t nSize);
+	void		__Post(NetEvent * p);
+	void		__Notify();
+
+private:
+	const FrameCodec *	_pCodec;
+	map<int, RecvBuffer>	_mPartial;
+	int					_nSocket;
+	int					_nIO;
+	int					_nWakeup;
+	int					_nNotify;	//! eventfd of main thread, written after posting a batch
+	bool				_bPosted;
+	atomic<bool>		_bRunning;
+	thread *			_pWorker;
+	SPSCQueue<NetEvent>	_qEvents;
+	atomic<uint64_t>	_nRecvCalls;
+	atomic<uint64_t>	_nRecvBytes;
+};
+
+IOWorker::IOWorker()
+	: _pCodec(nullptr)
+	, _mPartial()
+	, _nSocket(-1)
+	, _nIO(-1)
+	, _nWakeup(-1)
+	, _nNotify(-1)
+	, _bPosted(false)
+	, _bRunning(false)
+	, _pWorker(nullptr)
+	, _qEvents(IOQUEUE_SIZE)
+	, _nRecvCalls(0)
+	, _nRecvBytes(0) {}
+
+IOWorker::~IOWorker() {
+	Stop();
+	while (NetEvent * p = _qEvents.Pop()) {
+		if (p->emType == NetEvent::Accept) close(p->nSocket);
+		free(p);
+	}
+}
+
+int IOWorker::Start(int nSocket, const FrameCodec * pCodec, int nNotify) {
+	_pCodec = pCodec;
+	_nNotify = nNotify;
+	_nSocket = nSocket;
+
+	if ((_nIO = epoll_create(1)) < 0 || (_nWakeup = eventfd(0, EFD_NONBLOCK)) < 0) {
+		if (_nIO >= 0) close(_nIO);
+		close(_nSocket);
+		_nSocket = _nIO = -1;
+		return ENet::Epoll;
+	}
+
+	struct epoll_event iEv;
+	iEv.events = EPOLLIN | EPOLLET;
+	iEv.data.fd = _nSocket;
+	epoll_ctl(_nIO, EPOLL_CTL_ADD, _nSocket, &iEv);
+
+	iEv.events = EPOLLIN;
+	iEv.data.fd = _nWakeup;
+	epoll_ctl(_nIO, EPOLL_CTL_ADD, _nWakeup, &iEv);
+
+	_bRunning = true;
+	_pWorker = new thread(&IOWorker::__Run, this);
+	return 0;
+}
+
+void IOWorker::Stop() {
+	if (!_pWorker) return;
+
+	uint64_t nOne = 1;
+	_bRunning = false;
+	(void)write(_nWakeup, &nOne, sizeof(nOne));
+
+	if (_pWorker->joinable()) _pWorker->join();
+	delete _pWorker;
+	_pWorker = nullptr;
+
+	close(_nWakeup);
+	close(_nIO);
+	close(_nSocket);
+	_nSocket = _nIO = _nWakeup = -1;
+	_mPartial.clear();
+}
+
+void IOWorker::__Run() {
+	epoll_event pEvents[512];
+	sockaddr_in iAddr;
+	socklen_t nSizeOfAddr;
+	char * pReceived = RecvScratch();
+
+	while (_bRunning) {
+		__Notify();
+
+		int nCount = epoll_wait(_nIO, pEvents, 512, -1);
+
+		for (int i = 0; i < nCount && _bRunning; ++i) {
+			int nFd = pEvents[i].data.fd;
+			if (nFd == _nWakeup) continue;
+
+			if (nFd == _nSocket) {
+				while (true) {
+					nSizeOfAddr = sizeof(iAddr);
+					int nAccept = accept4(_nSocket, (sockaddr *)&iAddr, &nSizeOfAddr, SOCK_NONBLOCK);
+					if (nAccept < 0) break;
+
+					struct epoll_event iEv;
+					iEv.events = EPOLLIN | EPOLLET;
+					iEv.data.fd = nAccept;
+
+					if (epoll_ctl(_nIO, EPOLL_CTL_ADD, nAccept, &iEv) < 0) {
+						LOG_WARN("Failed accept client on I/O thread while adding to epoll!!!");
+						close(nAccept);
+						continue;
+					}
+
+					NetEvent * p = NetEvent::New(NetEvent::Accept, nAccept, 0);
+					p->nIP		= PeerIP(iAddr);
+					p->nPort	= PeerPort(iAddr);
+					__Post(p);
+				}
+			} else {
+				int nReaded = 0;
+				int nClose = -1;
+
+				while (true) {
+					int nRecv = (int)recv(nFd, pReceived + nReaded, SOCKET_BUFSIZE - nReaded, MSG_DONTWAIT);
+					_nRecvCalls.fetch_add(1, memory_order_relaxed);
+					if (nRecv > 0) {
+						_nRecvBytes.fetch_add((uint64_t)nRecv, memory_order_relaxed);
+						nReaded += nRecv;
+						if (nReaded < SOCKET_BUFSIZE) continue;
+					} else if (nRecv == 0 || errno != EAGAIN) {
+						nClose = (nRecv == 0 ? ENet::Remote : ENet::BadData);
+					}
+
+					if (nReaded > 0) {
+						if (!__Read(nFd, pReceived, nReaded)) {
+							nRecv = -1;
+							nClose = ENet::BadData;
+						}
+
+						nReaded = 0;
+					}
+
+					if (nRecv > 0) continue;
+
+					if (nClose >= 0) {
+						/// Main thread owns the fd from now on and will close it.
+						epoll_ctl(_nIO, EPOLL_CTL_DEL, nFd, NULL);
+						_mPartial.erase(nFd);
+						NetEvent * p = NetEvent::New(NetEvent::Close, nFd, 0);
+						p->emReason = (ENet::Close)nClose;
+						__Post(p);
+					}
+
+					break;
+				}
+			}
+		}
+	}
+}
+
+bool IOWorker::__Read(int nFd, char * pData, size_t nSize) {
+	if (!_pCodec->Enabled()) {
+		NetEvent * p = NetEvent::New(NetEvent::Receive, nFd, nSize);
+		memcpy(p->pData, pData, nSize);
+		__Post(p);
+		return true;
+	}
+
+	RecvBuffer iNew;
+	auto it = _mPartial.find(nFd);
+	RecvBuffer & rBuf = (it == _mPartial.end() ? iNew : it->second);
+
+	bool bOk = _pCodec->Split(rBuf, pData, nSize, [this, nFd](uint32_t nMsgId, char * pBody, size_t nBody) {
+		NetEvent * p = NetEvent::New(NetEvent::Message, nFd, nBody);
+		p->nMsgId = nMsgId;
+		memcpy(p->pData, pBody, nBody);
+		__Post(p);
+		return true;
+	});
+
+	if (it == _mPartial.end()) {
+		if (!iNew.Empty()) _mPartial[nFd].Swap(iNew);
+	} else if (rBuf.Empty()) {
+		_mPartial.erase(it);
+	}
+
+	return bOk;
+}
+
+void IOWorker::__Post(NetEvent * p) {
+	_bPosted = true;
+	if (_qEvents.Push(p)) return;
+
+	/// Queue is full. Main thread may be asleep in its reactor.
+	__Notify();
+
+	while (!_qEvents.Push(p)) {
+		if (!_bRunning) {
+			/// Only an accepted fd never reached main thread. Others are closed there.
+			if (p->emType == NetEvent::Accept) close(p->nSocket);
+			free(p);
+			return;
+		}
+
+		this_thread::yield();
+	}
+}
+
+void IOWorker::__Notify() {
+	if (!_bPosted) return;
+
+	uint64_t nOne = 1;
+	(void)write(_nNotify, &nOne, sizeof(nOne));
+	_bPosted = false;
+}
+
+/**
+ * Message header of an io_uring sendmsg(). Kept until the batch is submitted.
+ **/
+struct UringMessage {
+	struct msghdr	iMsg;
+	struct iovec	pVec[16];
+};
+
+/**
+ * Closed socket whose MSG_ZEROCOPY sends are NOT all reported. A copy of its fd
+ * keeps kernel from freeing the socket, so completions can still be read.
+ **/
+struct ZeroCopyLinger {
+	int			nSocket;	//! dup() of closed socket
+	SendQueue *	pQueue;		//! Blocks kernel may still read
+	double		dDeadline;	//! Reset socket when reports do NOT come before this
+};
+
+class ServerSocketContext : public Reactor::Handler {
+	/// io_uring tag keeps operation in the highest 2 bits and connection id in the rest.
+	enum UringOp { OpAccept = 0, OpRecv, OpSend };
+	static const uint64_t TAG_MASK = 0x3FFFFFFFFFFFFFFFULL;
+
+public:
+	ServerSocketContext(IServerSocket * pOwner);
+	virtual ~ServerSocketContext();
+
+	int		Listen(const string & sIP, int nPort, int nIOThreads);
+	bool	Send(Connection * pConn, const char * pData, size_t nSize);
+	size_t	Pending(Connection * pConn) { return pConn ? ((ConnectionContext *)pConn)->iSend.Size() : 0; }
+	void	SetSendLimit(size_t nLimit) { _nSendLimit = nLimit; }
+	bool	SetFrame(const FrameOption & rOpt) { return _iCodec.Setup(rOpt); }
+	bool	SendFrame(Connection * pConn, uint32_t nMsgId, const char * pData, size_t nSize);
+	bool	Send(Connection * pConn, const NetSlice * pSlices, int nCount);
+	bool	SendFrame(Connection * pConn, uint32_t nMsgId, const NetSlice * pSlices, int nCount);
+	char *	Prepare(Connection * pConn, size_t nCapacity);
+	bool	Commit(Connection * pConn, uint32_t nMsgId, size_t nSize);
+	bool	SendFile(Connection * pConn, const string & sPath, uint64_t nOffset, uint64_t nSize, bool bFrame, uint32_t nMsgId);
+	bool	SendFile(Connection * pConn, int nFile, uint64_t nOffset, uint64_t nSize);
+	bool	SendZeroCopy(Connection * pConn, bool bFrame, uint32_t nMsgId, const char * pData, size_t nSize, function<void ()> fDone);
+	void	Post(uint64_t nConnId, uint32_t nMsgId, bool bFrame, const char * pData, size_t nSize);
+	void	Broadcast(const char * pData, size_t nSize);
+	void	BroadcastFrame(uint32_t nMsgId, const char * pData, size_t nSize);
+	bool	Join(Connection * pConn, uint32_t nGroup) { return pConn && _iGroups.Join((ConnectionContext *)pConn, nGroup); }
+	bool	Leave(Connection * pConn, uint32_t nGroup) { return pConn && _iGroups.Leave((ConnectionContext *)pConn, nGroup); }
+	size_t	Multicast(uint32_t nGroup, const char * pData, size_t nSize);
+	size_t	MulticastFrame(uint32_t nGroup, uint32_t nMsgId, const char * pData, size_t nSize);
+	void	SetCoalesce(bool bEnable) { _bCoalesce = bEnable; }
+	void	Flush(Connection * pConn);
+	void	Flush();
+	void	SetTimeout(uint32_t nRead, uint32_t nIdle) { _iTimeouts.SetTimeout(nRead, nIdle, _iConns.Alive()); }
+	void	SetHeartbeat(uint32_t nInterval) { _iTimeouts.SetHeartbeat(nInterval, _iConns.Alive()); }
+	void	SetReadBudget(size_t nBytes, uint32_t nMessages, double dMillis) { _iReads.Setup(nBytes, nMessages, dMillis); }
+	void	SetRateLimit(const RateLimit & rBytes, const RateLimit & rMsgs) { _iLimits.Setup(rBytes, rMsgs, _iConns.Alive()); }
+	void	SetAcceptLimit(const RateLimit & rLimit) { _iAccepts.Setup(rLimit); }
+	void	Stats(ServerStats & rStats);
+	void	SetDispatch(ThreadPool * pPool) { _pDispatch = pPool ? make_shared<StrandGroup>(_pOwner, pPool) : nullptr; }
+	void	Close(Connection * pConn, ENet::Close emCode);
+	void	Shutdown();
+	void	Breath();
+
+	virtual void	OnPoll(uint32_t nEvents) override { _bReady = true; }
+
+	Connection *	Find(uint64_t nConnId);
+
+private:
+	int				__ListenOnWorkers(const sockaddr_storage & rAddr, socklen_t nSize, int nIOThreads);
+	void			__BreathInline();
+	bool			__Read(ConnectionContext * pConn);
+	void			__BreathWorkers();
+	void			__BreathUring();
+	void			__SubmitUring();
+	void			__FlushUring(ConnectionContext * pConn);
+	void			__DrainUring();
+	ConnectionContext *	__FindTag(uint64_t nTag);
+
+	static inline uint64_t	__Tag(UringOp emOp, uint64_t nConnId) { return ((uint64_t)emOp << 62) | (nConnId & TAG_MASK); }
+	bool			__Send(ConnectionContext * pConn, struct iovec * pVec, int nVec);
+	bool			__SendFile(ConnectionContext * pConn, int nFile, uint64_t nOffset, uint64_t nSize, bool bFrame, uint32_t nMsgId);
+	bool			__ZeroCopy(ConnectionContext * pConn, size_t nSize);
+	void			__Queued(ConnectionContext * pConn, bool bFirst, size_t nSize, bool bFrame);
+	void			__Done(ConnectionContext * pConn);
+	void			__Linger(int nSocket, SendQueue & rQueue);
+	void			__Reap(bool bAbort);
+	SharedPayload *	__Encode(uint32_t nMsgId, const char * pData, size_t nSize);
+	void			__DrainPosts();
+	void			__Deliver(ConnectionContext * pConn, bool bFrame, uint32_t nMsgId, char * pData, size_t nSize);
+	size_t			__Fanout(const vector<ConnectionContext *> & rConns, SharedPayload * pPayload, bool bFrame);
+	void			__FlushDirty();
+	void			__Flush(ConnectionContext * pConn);
+	void			__Receive(ConnectionContext * pConn, char * pData, size_t nSize);
+	bool			__Admit(int nSocket, uint32_t nIP);
+	Connection *	__Attach(int nSocket, uint32_t nIP, int nPort);
+	void			__Discard(int nSocket);
+	void			__CheckTimeouts();
+
+private:
+	IServerSocket *		_pOwner;
+	int					_nSocket;
+	ConnectionPool<ConnectionContext>	_iConns;
+	ConnectionGroups<ConnectionContext>	_iGroups;
+	vector<uint64_t>	_vDirty;
+	vector<uint64_t>	_vFlushing;
+	int					_nIO;
+	bool				_bReady;	//! Shared epoll found events in _nIO
+	int					_nNotify;	//! eventfd written by I/O threads
+	vector<IOWorker *>	_vWorkers;
+	set<int>			_setZombies;
+	size_t				_nSendLimit;
+	FrameCodec			_iCodec;
+	bool				_bCoalesce;
+	Uring *				_pUring;
+	vector<UringMessage>	_vUringMsgs;
+	size_t				_nUringMsgs;
+	vector<uint64_t>	_vStarved;
+	map<uint64_t, SendQueue *>	_mOrphans;
+	vector<ZeroCopyLinger>		_vLingers;
+	ConnectionTimeouts<ConnectionContext>	_iTimeouts;
+	ServerStats			_iStats;
+	PostBox				_iPosts;
+	shared_ptr<StrandGroup>	_pDispatch;
+	ReadScheduler<ConnectionContext>	_iReads;
+	uint32_t *			_pMsgBudget;	//! Frames left for connection being read, nullptr for no limit
+	size_t				_nNextWorker;	//! I/O thread whose events are handled first
+	ConnectionLimits<ConnectionContext>	_iLimits;
+	AcceptLimits		_iAccepts;
+	string				_sPath;		//! Unix domain socket file to remove at Shutdown()
+};
+
+ServerSocketContext::ServerSocketContext(IServerSocket * pOwner)
+	: _pOwner(pOwner)
+	, _nSocket(-1)
+	, _iConns()
+	, _iGroups()
+	, _vDirty()
+	, _vFlushing()
+	, _nIO(-1)
+	, _bReady(false)
+	, _nNotify(-1)
+	, _vWorkers()
+	, _setZombies()
+	, _nSendLimit(SENDQUEUE_LIMIT)
+	, _iCodec()
+	, _bCoalesce(false)
+	, _pUring(nullptr)
+	, _vUringMsgs()
+	, _nUringMsgs(0)
+	, _vStarved()
+	, _mOrphans()
+	, _vLingers()
+	, _iTimeouts()
+	, _iStats()
+	, _iPosts()
+	, _pDispatch()
+	, _iReads()
+	, _pMsgBudget(nullptr)
+	, _nNextWorker(0)
+	, _iLimits()
+	, _iAccepts()
+	, _sPath() {}
+
+ServerSocketContext::~ServerSocketContext() {
+	Shutdown();
+	__Reap(true);
+}
+
+int ServerSocketContext::Listen(const string & sIP, int nPort, int nIOThreads) {
+	if (_nSocket >= 0 || !_vWorkers.empty()) return ENet::Running;
+
+	sockaddr_storage iAddr;
+	socklen_t nSize;
+	if (!ToAddress(sIP, nPort, iAddr, nSize)) return ENet::BadParam;
+
+	if (nIOThreads > 0) return __ListenOnWorkers(iAddr, nSize, nIOThreads);
+	if ((_nSocket = OpenListener(iAddr, nSize, false)) < 0) return errno;
+
+	/// Bound successfully, so the file is ours to remove even if something below fails.
+	const sockaddr_un * pLocal = (const sockaddr_un *)&iAddr;
+	if (iAddr.ss_family == AF_UNIX && pLocal->sun_path[0] != '\0') _sPath = pLocal->sun_path;
+
+	/// io_uring replaces epoll when built with USE_IO_URING and kernel supports it.
+	if ((_pUring = Uring::Create()) != nullptr) {
+		if (_pUring->Accept(_nSocket, __Tag(OpAccept, 0)) && _pUring->Submit() >= 0 && Reactor::Get().Add(_pUring->Fd(), EPOLLIN, this)) {
+			_vUringMsgs.resize(URING_ENTRIES / 16);
+			return 0;
+		}
+
+		delete _pUring;
+		_pUring = nullptr;
+	}
+
+	if ((_nIO = epoll_create(1)) < 0) {
+		close(_nSocket);
+		_nSocket = -1;
+		return ENet::Epoll;
+	}
+
+	struct epoll_event iEv;
+	iEv.events = EPOLLIN | EPOLLET;
+	iEv.data.fd = _nSocket;
+
+	if (epoll_ctl(_nIO, EPOLL_CTL_ADD, _nSocket, &iEv) < 0 || !Reactor::Get().Add(_nIO, EPOLLIN, this)) {
+		close(_nIO);
+		close(_nSocket);
+		_nSocket = -1;
+		_nIO = -1;
+		return ENet::Epoll;
+	}
+
+	return 0;
+}
+
+bool ServerSocketContext::Send(Connection * pConn, const char * pData, size_t nSize) {
+	if (!pConn) return false;
+
+	struct iovec iVec = { (void *)pData, nSize };
+	return __Send((ConnectionContext *)pConn, &iVec, 1);
+}
+
+bool ServerSocketContext::SendFrame(Connection * pConn, uint32_t nMsgId, const char * pData, size_t nSize) {
+	if (!pConn) return false;
+
+	char pHeader[FrameCodec::MaxHeader];
+	size_t nHeader = _iCodec.Encode(pHeader, nMsgId, nSize);
+	if (nHeader == 0) return false;
+
+	struct iovec pVec[2] = { { pHeader, nHeader }, { (void *)pData, nSize } };
+	if (!__Send((ConnectionContext *)pConn, pVec, nSize > 0 ? 2 : 1)) return false;
+
+	++pConn->iStats.nMsgsOut;
+	++_iStats.nMsgsOut;
+	return true;
+}
+
+bool ServerSocketContext::Send(Connection * pConn, const NetSlice * pSlices, int nCount) {
+	if (!pConn) return false;
+
+	struct iovec pVec[NET_MAXSLICES];
+	int nVec = ToVec(pVec, pSlices, nCount);
+	return nVec >= 0 && __Send((ConnectionContext *)pConn, pVec, nVec);
+}
+
+bool ServerSocketContext::SendFrame(Connection * pConn, uint32_t nMsgId, const NetSlice * pSlices, int nCount) {
+	if (!pConn) return false;
+
+	struct iovec pVec[NET_MAXSLICES + 1];
+	if (ToVec(pVec + 1, pSlices, nCount) < 0) return false;
+
+	size_t nSize = 0;
+	for (int i = 0; i < nCount; ++i) nSize += pSlices[i].nSize;
+
+	char pHeader[FrameCodec::MaxHeader];
+	size_t nHeader = _iCodec.Encode(pHeader, nMsgId, nSize);
+	if (nHeader == 0) return false;
+
+	pVec[0].iov_base	= pHeader;
+	pVec[0].iov_len		= nHeader;
+	if (!__Send((ConnectionContext *)pConn, pVec, nCount + 1)) return false;
+
+	++pConn->iStats.nMsgsOut;
+	++_iStats.nMsgsOut;
+	return true;
+}
+
+char * ServerSocketContext::Prepare(Connection * pConn, size_t nCapacity) {
+	if (!pConn) return nullptr;
+
+	SendQueue & rQueue = ((ConnectionContext *)pConn)->iSend;
+	size_t nHeader = _iCodec.HeaderSize();
+	if (!rQueue.Empty() && rQueue.Buffered() + nHeader + nCapacity > _nSendLimit) return nullptr;
+	return rQueue.Reserve(nHeader + nCapacity) + nHeader;
+}
+
+bool ServerSocketContext::Commit(Connection * pConn, uint32_t nMsgId, size_t nSize) {
+	if (!pConn) return false;
+
+	char pHeader[FrameCodec::MaxHeader];
+	size_t nHeader = _iCodec.HeaderSize();
+	if (nHeader > 0 && _iCodec.Encode(pHeader, nMsgId, nSize, nHeader) != nHeader) return false;
+
+	ConnectionContext * pCtx = (ConnectionContext *)pConn;
+	bool bFirst = pCtx->iSend.Empty();
+	char * pData = pCtx->iSend.Commit(nHeader + nSize);
+	if (!pData) return false;
+	memcpy(pData, pHeader, nHeader);
+
+	_iTimeouts.Sent(pCtx);
+	pConn->iStats.nBytesOut += nHeader + nSize;
+	_iStats.nBytesOut += nHeader + nSize;
+	if (nHeader > 0) {
+		++pConn->iStats.nMsgsOut;
+		++_iStats.nMsgsOut;
+	}
+
+	RecordQueued(_iStats, pConn, pCtx->iSend.Size());
+	if (!bFirst) return true;
+
+	/// Same as __Send() : written now, or together with the rest of this frame.
+	if (!_pUring && !_bCoalesce) return FlushSendQueue(pCtx->nSocket, pCtx->iSend, &_iStats);
+	_vDirty.push_back(pConn->nId);
+	return true;
+}
+
+bool ServerSocketContext::SendFile(Connection * pConn, const string & sPath, uint64_t nOffset, uint64_t nSize, bool bFrame, uint32_t nMsgId) {
+	if (!pConn) return false;
+
+	int nFile = open(sPath.c_str(), O_RDONLY | O_CLOEXEC);
+	if (nFile < 0) return false;
+	return __SendFile((ConnectionContext *)pConn, nFile, nOffset, nSize, bFrame, nMsgId);
+}
+
+bool ServerSocketContext::SendFile(Connection * pConn, int nFile, uint64_t nOffset, uint64_t nSize) {
+	if (!pConn || nFile < 0) return false;
+
+	/// Own descriptor, so caller may close its one. Offset is shared but never used.
+	int nDup = fcntl(nFile, F_DUPFD_CLOEXEC, 0);
+	if (nDup < 0) return false;
+	return __SendFile((ConnectionContext *)pConn, nDup, nOffset, nSize, false, 0);
+}
+
+bool ServerSocketContext::SendZeroCopy(Connection * pConn, bool bFrame, uint32_t nMsgId, const char * pData, size_t nSize, function<void ()> fDone) {
+	if (!pConn) return false;
+
+	char pHeader[FrameCodec::MaxHeader];
+	size_t nHeader = 0;
+	if (bFrame && (nHeader = _iCodec.Encode(pHeader, nMsgId, nSize)) == 0) return false;
+
+	ConnectionContext * pCtx = (ConnectionContext *)pConn;
+	SendQueue & rQueue = pCtx->iSend;
+	if (!rQueue.Empty() && rQueue.Buffered() + nHeader + nSize > _nSendLimit) return false;
+
+	bool bFirst = rQueue.Empty();
+	rQueue.Append(pHeader, nHeader);
+
+	bool bCopied = !__ZeroCopy(pCtx, nSize);
+	if (bCopied) {
+		rQueue.Append(pData, nSize);
+	} else {
+		rQueue.Append(pData, nSize, std::move(fDone));
+	}
+
+	__Queued(pCtx, bFirst, nHeader + nSize, bFrame);
+	if (bCopied && fDone) fDone();
+	return true;
+}
+
+void ServerSocketContext::Post(uint64_t nConnId, uint32_t nMsgId, bool bFrame, const char * pData, size_t nSize) {
+	if (_iPosts.Push(nConnId, nMsgId, bFrame, pData, nSize)) Reactor::Get().Wake();
+}
+
+void ServerSocketContext::Broadcast(const char * pData, size_t nSize) {
+	SharedPayload * pPayload = SharedPayload::New(nSize);
+	memcpy(pPayload->Data(), pData, nSize);
+	__Fanout(_iConns.Alive(), pPayload, false);
+	pPayload->Release();
+}
+
+void ServerSocketContext::BroadcastFrame(uint32_t nMsgId, const char * pData, size_t nSize) {
+	SharedPayload * pPayload = __Encode(nMsgId, pData, nSize);
+	if (!pPayload) return;
+
+	__Fanout(_iConns.Alive(), pPayload, true);
+	pPayload->Release();
+}
+
+size_t ServerSocketContext::Multicast(uint32_t nGroup, const char * pData, size_t nSize) {
+	auto pMembers = _iGroups.Find(nGroup);
+	if (!pMembers) return 0;
+
+	SharedPayload * pPayload = SharedPayload::New(nSize);
+	memcpy(pPayload->Data(), pData, nSize);
+	size_t nCount = __Fanout(*pMembers, pPayload, false);
+	pPayload->Release();
+	return nCount;
+}
+
+size_t ServerSocketContext::MulticastFrame(uint32_t nGroup, uint32_t nMsgId, const char * pData, size_t nSize) {
+	auto pMembers = _iGroups.Find(nGroup);
+	if (!pMembers) return 0;
+
+	SharedPayload * pPayload = __Encode(nMsgId, pData, nSize);
+	if (!pPayload) return 0;
+
+	size_t nCount = __Fanout(*pMembers, pPayload, true);
+	pPayload->Release();
+	return nCount;
+}
+
+void ServerSocketContext::Flush(Connection * pConn) {
+	if (!pConn) return;
+
+	__Flush((ConnectionContext *)pConn);
+	if (_pUring) __SubmitUring();
+}
+
+void ServerSocketContext::Flush() {
+	__FlushDirty();
+	if (_pUring) __SubmitUring();
+}
+
+void ServerSocketContext::Stats(ServerStats & rStats) {
+	rStats = _iStats;
+	rStats.nAlive = _iConns.Size();
+	for (auto pWorker : _vWorkers) pWorker->Collect(rStats);
+}
+
+void ServerSocketContext::Close(Connection * pConn, ENet::Close emCode) {
+	if (!pConn) return;
+
+	int nSocket = pConn->nSocket;
+	++_iStats.pCloses[emCode];
+
+	_pOwner->OnClose(pConn, emCode);
+	_iGroups.LeaveAll((ConnectionContext *)pConn);
+	_iTimeouts.Remove((ConnectionContext *)pConn);
+	_iLimits.Remove((ConnectionContext *)pConn);
+
+	ConnectionContext * pCtx = (ConnectionContext *)pConn;
+	vector<function<void ()>> vDone;
+
+	if (_pUring) {
+		/// Wakes up the armed recv. Data of an unfinished send must outlive this connection.
+		if (pCtx->nSending > 0) {
+			SendQueue * pOrphan = new SendQueue;
+			pOrphan->Swap(pCtx->iSend);
+			_mOrphans[__Tag(OpSend, pCtx->nId)] = pOrphan;
+		}
+
+		shutdown(nSocket, SHUT_RDWR);
+		close(nSocket);
+	} else {
+		pCtx->iSend.Clear();
+		pCtx->iSend.PopDone(vDone);
+		if (pCtx->iSend.Pinning()) __Linger(nSocket, pCtx->iSend);
+
+		epoll_ctl(_nIO, EPOLL_CTL_DEL, nSocket, NULL);
+		if (_vWorkers.empty()) {
+			close(nSocket);
+		} else {
+			/// I/O thread still polls this socket. Wait until it hands the fd back.
+			shutdown(nSocket, SHUT_RDWR);
+			_setZombies.insert(nSocket);
+		}
+	}
+
+	/// Referenced buffers go back to their owners once nothing can be sent any more.
+	pCtx->iSend.Clear();
+	pCtx->iSend.PopDone(vDone);
+
+	_iConns.Free(pCtx);
+	for (auto & fDone : vDone) fDone();
+}
+
+void ServerSocketContext::Shutdown() {
+	if (_nSocket < 0 && _vWorkers.empty()) return;
+
+	for (auto pWorker : _vWorkers) pWorker->Stop();
+
+	while (_iConns.Size() > 0) {
+		ConnectionContext * pConn = _iConns[_iConns.Size() - 1];
+		++_iStats.pCloses[ENet::Local];
+		_pOwner->OnClose(pConn, ENet::Local);
+		epoll_ctl(_nIO, EPOLL_CTL_DEL, pConn->nSocket, NULL);
+
+		/// Same as Close(). Data of an unfinished send must outlive this connection.
+		if (_pUring) {
+			shutdown(pConn->nSocket, SHUT_RDWR);
+			if (pConn->nSending > 0) {
+				SendQueue * pOrphan = new SendQueue;
+				pOrphan->Swap(pConn->iSend);
+				_mOrphans[__Tag(OpSend, pConn->nId)] = pOrphan;
+			}
+		}
+
+		pConn->iSend.Clear();
+		if (!_pUring && pConn->iSend.Pinning()) __Linger(pConn->nSocket, pConn->iSend);
+		close(pConn->nSocket);
+		_iConns.Free(pConn);
+	}
+
+	_iGroups.Clear();
+	_iTimeouts.Clear();
+	_iReads.Clear();
+	_iLimits.Clear();
+
+	if (_pDispatch) {
+		_pDispatch->Stop();
+		SetDispatch(_pDispatch->pPool);
+	}
+	_vDirty.clear();
+
+	/// Closing ring cancels all operations in flight.
+	if (_pUring) {
+		__DrainUring();
+		Reactor::Get().Del(_pUring->Fd());
+		delete _pUring;
+		_pUring = nullptr;
+	}
+
+	for (auto & kv : _mOrphans) delete kv.second;
+	_mOrphans.clear();
+	_vStarved.clear();
+	_vUringMsgs.clear();
+	_nUringMsgs = 0;
+
+	for (auto nSocket : _setZombies) close(nSocket);
+	for (auto pWorker : _vWorkers) delete pWorker;
+	_setZombies.clear();
+	_vWorkers.clear();
+
+	if (_nNotify >= 0) {
+		Reactor::Get().Del(_nNotify);
+		close(_nNotify);
+		_nNotify = -1;
+	}
+
+	if (_nSocket >= 0) {
+		epoll_ctl(_nIO, EPOLL_CTL_DEL, _nSocket, NULL);
+		close(_nSocket);
+		_nSocket = -1;
+	}
+
+	if (_nIO >= 0) {
+		Reactor::Get().Del(_nIO);
+		close(_nIO);
+		_nIO = -1;
+	}
+
+	if (!_sPath.empty()) {
+		unlink(_sPath.c_str());
+		_sPath.clear();
+	}
+
+	_bReady = false;
+	_pOwner->OnShutdown();
+}
+
+void ServerSocketContext::Breath() {
+	double dStart = Tick();
+	__Reap(false);
+	_iTimeouts.Update();
+	_iLimits.Update();
+	__DrainPosts();
+	__FlushDirty();
+
+	if (!_vWorkers.empty()) {
+		__BreathWorkers();
+	} else if (_pUring) {
+		__BreathUring();
+	} else {
+		__BreathInline();
+	}
+
+	__CheckTimeouts();
+	__FlushDirty();
+	if (_pUring) __SubmitUring();
+
+	RecordBreath(_iStats, Tick() - dStart);
+}
+
+Connection * ServerSocketContext::Find(uint64_t nConnId) {
+	return _iConns.Find(nConnId);
+}
+
+int ServerSocketContext::__ListenOnWorkers(const sockaddr_storage & rAddr, socklen_t nSize, int nIOThreads) {
+	/// Main thread still needs its own epoll to know when a socket becomes writable.
+	if ((_nIO = epoll_create(1)) < 0) return ENet::Epoll;
+	if ((_nNotify = eventfd(0, EFD_NONBLOCK)) < 0 || !Reactor::Get().Add(_nIO, EPOLLIN, this) || !Reactor::Get().Add(_nNotify, EPOLLIN, this)) {
+		Reactor::Get().Del(_nIO);
+		if (_nNotify >= 0) close(_nNotify);
+		close(_nIO);
+		_nIO = _nNotify = -1;
+		return ENet::Epoll;
+	}
+
+	/// TCP gives each thread a SO_REUSEPORT listener. A Unix domain socket can NOT
+	/// be bound twice, so all threads accept on copies of one listener instead.
+	bool bLocal = rAddr.ss_family == AF_UNIX;
+	int nShared = bLocal ? OpenListener(rAddr, nSize, false) : -1;
+	int n = (bLocal && nShared < 0) ? errno : 0;
+
+	const sockaddr_un * pLocal = (const sockaddr_un *)&rAddr;
+	if (nShared >= 0 && pLocal->sun_path[0] != '\0') _sPath = pLocal->sun_path;
+
+	for (int i = 0; i < nIOThreads && n == 0; ++i) {
+		int nSocket = bLocal ? dup(nShared) : OpenListener(rAddr, nSize, true);
+		if (nSocket < 0) {
+			n = errno;
+			break;
+		}
+
+		IOWorker * pWorker = new IOWorker;
+		if ((n = pWorker->Start(nSocket, &_iCodec, _nNotify)) != 0) {
+			delete pWorker;
+			break;
+		}
+
+		_vWorkers.push_back(pWorker);
+	}
+
+	if (nShared >= 0) close(nShared);
+	if (n == 0) return 0;
+
+	for (auto p : _vWorkers) delete p;
+	_vWorkers.clear();
+	Reactor::Get().Del(_nIO);
+	Reactor::Get().Del(_nNotify);
+	close(_nIO);
+	close(_nNotify);
+	_nIO = _nNotify = -1;
+	return n;
+}
+
+void ServerSocketContext::__BreathInline() {
+	/// Throttled clients with refilled tokens are read as if they became readable.
+	Reactor::Get().Due(_iLimits.Resume([this](ConnectionContext * pConn) { _iReads.Ready(pConn); }));
+	if (_nSocket < 0 || (!_bReady && !_iReads.Pending())) return;
+
+	static epoll_event pEvents[512] = { 0 };
+	static sockaddr_in iAddr = { 0 };
+	static socklen_t nSizeOfAddr;
+	static char pAddr[128] = { 0 };
+
+	int nCount = 0;
+	if (_bReady) {
+		_bReady = false;
+		nCount = epoll_wait(_nIO, pEvents, 512, 0);
+	}
+
+	for (int i = 0; i < nCount; ++i) {
+		if (pEvents[i].data.fd == _nSocket) {
+			while (true) {
+				/// Non-blocking like I/O threads, so sendfile() never stalls main thread.
+				nSizeOfAddr = sizeof(iAddr);
+				int nAccept = accept4(_nSocket, (sockaddr *)&iAddr, &nSizeOfAddr, SOCK_NONBLOCK);
+				if (nAccept < 0) break;
+				if (!__Admit(nAccept, PeerIP(iAddr))) continue;
+
+				if (!__Attach(nAccept, PeerIP(iAddr), PeerPort(iAddr))) {
+					inet_ntop(AF_INET, &iAddr.sin_addr, pAddr, 128);
+					LOG_WARN("Failed accept client [%s] while adding to epoll!!!", pAddr);
+				}
+			}
+		} else {
+			int nSocket = pEvents[i].data.fd;
+
+			ConnectionContext * pConn = _iConns.At((uint32_t)nSocket);
+			if (!pConn) continue;
+
+			uint64_t nConnId = pConn->nId;
+
+			if ((pEvents[i].events & EPOLLERR) && pConn->nZeroCopy > 0) {
+				ReapZeroCopy(nSocket, pConn->iSend);
+				__Done(pConn);
+				if (!Find(nConnId)) continue;
+			}
+
+			if (pEvents[i].events & EPOLLOUT) {
+				__Flush(pConn);
+				if (!Find(nConnId)) continue;
+			}
+
+			if (pEvents[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) _iReads.Ready(pConn);
+		}
+	}
+
+	_iStats.nReadDeferred += _iReads.Run(
+		[this](uint64_t nConnId) { return _iConns.Find(nConnId); },
+		[this](ConnectionContext * pConn) { return __Read(pConn); });
+
+	/// Data may be left in kernel without another edge. Do NOT sleep before reading it.
+	if (_iReads.Pending()) Reactor::Get().Due(0);
+}
+
+bool ServerSocketContext::__Read(ConnectionContext * pConn) {
+	uint64_t nConnId = pConn->nId;
+	int nSocket = pConn->nSocket;
+	size_t nBudget = _iReads.Bytes();
+	uint32_t nMsgBudget = _iReads.Messages();
+
+	if (!_iLimits.Budget(pConn, nBudget, nMsgBudget)) {
+		if (_iLimits.Pause(pConn)) ++_iStats.nThrottled;
+		return false;
+	}
+
+	if (nBudget == 0) nBudget = SIZE_MAX;
+	if (nMsgBudget > 0 && _iCodec.Enabled()) _pMsgBudget = &nMsgBudget;
+
+	/// Frames held back by message budget of last Breath() go first.
+	if (_pMsgBudget && !pConn->iRecv.Empty()) __Receive(pConn, nullptr, 0);
+
+	char * pReceived = RecvScratch();
+	size_t nReaded = 0;
+	bool bDrained = false;
+
+	while (Find(nConnId) && !(_pMsgBudget && *_pMsgBudget == 0)) {
+		int nRecv = (int)recv(nSocket, pReceived + nReaded, std::min((size_t)SOCKET_BUFSIZE - nReaded, nBudget), MSG_DONTWAIT);
+		++_iStats.nRecvCalls;
+		if (nRecv > 0) {
+			nReaded += nRecv;
+			nBudget -= nRecv;
+			if (nReaded >= SOCKET_BUFSIZE || nBudget == 0) {
+				__Receive(pConn, pReceived, nReaded);
+				nReaded = 0;
+				if (nBudget == 0) break;
+			}
+		} else if (nRecv < 0 && errno == EAGAIN) {
+			if (nReaded > 0) __Receive(pConn, pReceived, nReaded);
+			bDrained = true;
+			break;
+		} else {
+			if (nReaded > 0) __Receive(pConn, pReceived, nReaded);
+			if (Find(nConnId)) Close(pConn, nRecv == 0 ? ENet::Remote : ENet::BadData);
+			break;
+		}
+	}
+
+	/// Stopped by budget before socket was drained, or frames are held back in receive buffer.
+	bool bMore = Find(nConnId) && (!bDrained || (_pMsgBudget && *_pMsgBudget == 0));
+	_pMsgBudget = nullptr;
+
+	/// Out of tokens rather than read budget. Wait for Resume() instead of next Breath().
+	if (bMore && _iLimits.Exhausted(pConn)) {
+		if (_iLimits.Pause(pConn)) ++_iStats.nThrottled;
+		bMore = false;
+	}
+
+	return bMore;
+}
+
+void ServerSocketContext::__BreathWorkers() {
+	static epoll_event pEvents[512];
+
+	int nCount = 0;
+
+	/// Drain notification before popping, so events posted after this wake us again.
+	if (_bReady) {
+		uint64_t nPosted;
+		(void)read(_nNotify, &nPosted, sizeof(nPosted));
+		nCount = epoll_wait(_nIO, pEvents, 512, 0);
+		_bReady = false;
+	}
+
+	for (int i = 0; i < nCount; ++i) {
+		ConnectionContext * pConn = _iConns.At((uint32_t)pEvents[i].data.fd);
+		if (!pConn) continue;
+
+		if ((pEvents[i].events & EPOLLERR) && pConn->nZeroCopy > 0) {
+			uint64_t nConnId = pConn->nId;
+			ReapZeroCopy(pConn->nSocket, pConn->iSend);
+			__Done(pConn);
+			if (!Find(nConnId)) continue;
+		}
+
+		__Flush(pConn);
+	}
+
+	double dDeadline = _iReads.Deadline();
+	size_t nWorkers = _vWorkers.size();
+
+	/// Start from another I/O thread each time, so time budget can NOT starve the last one.
+	size_t nFirst = _nNextWorker++ % nWorkers;
+
+	for (size_t i = 0; i < nWorkers; ++i) {
+		IOWorker * pWorker = _vWorkers[(nFirst + i) % nWorkers];
+
+		while (NetEvent * p = pWorker->Pop()) {
+			if (p->emType == NetEvent::Accept) {
+				if (__Admit(p->nSocket, p->nIP)) __Attach(p->nSocket, p->nIP, p->nPort);
+			} else {
+				ConnectionContext * pConn = _iConns.At((uint32_t)p->nSocket);
+				if (pConn && p->emType != NetEvent::Close) {
+					_iTimeouts.Received(pConn);
+					pConn->iStats.nBytesIn += p->nSize;
+				}
+
+				if (p->emType == NetEvent::Message) {
+					++_iStats.nMsgsIn;
+					if (pConn) ++pConn->iStats.nMsgsIn;
+				}
+
+				if (p->emType == NetEvent::Receive) {
+					if (pConn) __Deliver(pConn, false, 0, p->pData, p->nSize);
+				} else if (p->emType == NetEvent::Message) {
+					if (pConn) __Deliver(pConn, true, p->nMsgId, p->pData, p->nSize);
+				} else {
+					if (pConn) Close(pConn, p->emReason);
+					if (_setZombies.erase(p->nSocket) > 0) close(p->nSocket);
+				}
+			}
+
+			free(p);
+
+			/// OnXXX() may shutdown this server.
+			if (_vWorkers.empty()) return;
+
+			if (dDeadline != HUGE_VAL && Tick() >= dDeadline) {
+				/// The rest waits in queues of I/O threads. Come back without sleeping.
+				++_iStats.nReadDeferred;
+				Reactor::Get().Due(0);
+				return;
+			}
+		}
+	}
+}
+
+bool ServerSocketContext::__Send(ConnectionContext * pConn, struct iovec * pVec, int nVec) {
+	size_t nTotal = 0;
+	for (int i = 0; i < nVec; ++i) nTotal += pVec[i].iov_len;
+
+	_iTimeouts.Sent(pConn);
+
+	if (!_pUring && !_bCoalesce) {
+		if (!SendOrQueue(pConn->nSocket, pConn->iSend, _nSendLimit, pVec, nVec, &_iStats)) return false;
+	} else {
+		/// Queue only. Sends of one frame are written together by Flush() or next Breath().
+		bool bFirst = pConn->iSend.Empty();
+		if (!Enqueue(pConn->iSend, _nSendLimit, pVec, nVec)) return false;
+		if (bFirst) _vDirty.push_back(pConn->nId);
+	}
+
+	pConn->iStats.nBytesOut += nTotal;
+	_iStats.nBytesOut += nTotal;
+	RecordQueued(_iStats, pConn, pConn->iSend.Size());
+	return true;
+}
+
+bool ServerSocketContext::__SendFile(ConnectionContext * pConn, int nFile, uint64_t nOffset, uint64_t nSize, bool bFrame, uint32_t nMsgId) {
+	struct stat iStat;
+	if (fstat(nFile, &iStat) != 0 || !S_ISREG(iStat.st_mode) || (uint64_t)iStat.st_size < nOffset) {
+		close(nFile);
+		return false;
+	}
+
+	uint64_t nLeft = (uint64_t)iStat.st_size - nOffset;
+	if (nSize == 0) nSize = nLeft;
+
+	char pHeader[FrameCodec::MaxHeader];
+	size_t nHeader = 0;
+	SendQueue & rQueue = pConn->iSend;
+
+	bool bOk = nSize <= nLeft && nSize <= (uint64_t)SIZE_MAX;
+	if (bOk && bFrame) bOk = (nHeader = _iCodec.Encode(pHeader, nMsgId, (size_t)nSize)) > 0;
+	if (bOk && !rQueue.Empty()) bOk = rQueue.Buffered() + nHeader <= _nSendLimit;
+	if (!bOk) {
+		close(nFile);
+		return false;
+	}
+
+	bool bFirst = rQueue.Empty();
+	rQueue.Append(pHeader, nHeader);
+	rQueue.AppendFile(nFile, nOffset, (size_t)nSize);
+	__Queued(pConn, bFirst, nHeader + (size_t)nSize, bFrame);
+	return true;
+}
+
+bool ServerSocketContext::__ZeroCopy(ConnectionContext * pConn, size_t nSize) {
+	/// Small sends cost more to pin and report than to copy.
+	if (_pUring || nSize < SENDQUEUE_ZEROCOPY) return false;
+
+	if (pConn->nZeroCopy == 0) {
+		int nOn = 1;
+		pConn->nZeroCopy = setsockopt(pConn->nSocket, SOL_SOCKET, SO_ZEROCOPY, &nOn, sizeof(nOn)) == 0 ? 1 : -1;
+	}
+
+	return pConn->nZeroCopy > 0;
+}
+
+void ServerSocketContext::__Queued(ConnectionContext * pConn, bool bFirst, size_t nSize, bool bFrame) {
+	_iTimeouts.Sent(pConn);
+	pConn->iStats.nBytesOut += nSize;
+	_iStats.nBytesOut += nSize;
+	if (bFrame) {
+		++pConn->iStats.nMsgsOut;
+		++_iStats.nMsgsOut;
+	}
+
+	RecordQueued(_iStats, pConn, pConn->iSend.Size());
+
+	/// Never written here, so OnClose() of a broken socket does not run inside a send.
+	if (bFirst) _vDirty.push_back(pConn->nId);
+}
+
+void ServerSocketContext::__Done(ConnectionContext * pConn) {
+	vector<function<void ()>> vDone;
+	if (!pConn->iSend.PopDone(vDone)) return;
+
+	/// Connection may be closed by any of them.
+	for (auto & fDone : vDone) fDone();
+}
+
+void ServerSocketContext::__Linger(int nSocket, SendQueue & rQueue) {
+	ZeroCopyLinger iLinger;
+	iLinger.nSocket = dup(nSocket);
+
+	/// Out of fds. Reset makes kernel drop queued pages when the socket is closed.
+	if (iLinger.nSocket < 0) {
+		struct linger iOpt = { 1, 0 };
+		setsockopt(nSocket, SOL_SOCKET, SO_LINGER, &iOpt, sizeof(iOpt));
+		rQueue.Abandon();
+		return;
+	}
+
+	/// FIN goes out now, as closing the original fd no longer sends it.
+	shutdown(nSocket, SHUT_WR);
+
+	iLinger.pQueue = new SendQueue;
+	iLinger.pQueue->Swap(rQueue);
+	iLinger.dDeadline = Tick() + SENDQUEUE_LINGER;
+
+	/// Completion reports wake reactor with EPOLLERR.
+	Reactor::Get().Add(iLinger.nSocket, EPOLLET, this);
+	Reactor::Get().Due(iLinger.dDeadline);
+	_vLingers.push_back(iLinger);
+}
+
+void ServerSocketContext::__Reap(bool bAbort) {
+	if (_vLingers.empty()) return;
+
+	vector<function<void ()>> vDone;
+	double dNow = Tick();
+	size_t nKeep = 0;
+
+	for (size_t i = 0; i < _vLingers.size(); ++i) {
+		ZeroCopyLinger & rLinger = _vLingers[i];
+		ReapZeroCopy(rLinger.nSocket, *rLinger.pQueue);
+		rLinger.pQueue->PopDone(vDone);
+
+		if (rLinger.pQueue->Pinning()) {
+			if (!bAbort && dNow < rLinger.dDeadline) {
+				Reactor::Get().Due(rLinger.dDeadline);
+				_vLingers[nKeep++] = rLinger;
+				continue;
+			}
+
+			/// Peer stopped acknowledging. Reset makes kernel drop the pages before close() returns.
+			struct linger iOpt = { 1, 0 };
+			setsockopt(rLinger.nSocket, SOL_SOCKET, SO_LINGER, &iOpt, sizeof(iOpt));
+		}
+
+		Reactor::Get().Del(rLinger.nSocket);
+		close(rLinger.nSocket);
+		rLinger.pQueue->Abandon();
+		rLinger.pQueue->PopDone(vDone);
+		delete rLinger.pQueue;
+	}
+
+	_vLingers.resize(nKeep);
+	for (auto & fDone : vDone) fDone();
+}
+
+SharedPayload * ServerSocketContext::__Encode(uint32_t nMsgId, const char * pData, size_t nSize) {
+	char pHeader[FrameCodec::MaxHeader];
+	size_t nHeader = _iCodec.Encode(pHeader, nMsgId, nSize);
+	if (nHeader == 0) return nullptr;
+
+	SharedPayload * pPayload = SharedPayload::New(nHeader + nSize);
+	memcpy(pPayload->Data(), pHeader, nHeader);
+	if (nSize > 0) memcpy(pPayload->Data() + nHeader, pData, nSize);
+	return pPayload;
+}
+
+void ServerSocketContext::__DrainPosts() {
+	_iPosts.Drain([this](PostBox::Post & r) {
+		Connection * pConn = Find(r.nId);
+		bool bSent = pConn && (r.bFrame ? SendFrame(pConn, r.nMsgId, r.Data(), r.nSize) : Send(pConn, r.Data(), r.nSize));
+		if (!bSent) ++_iStats.nPostDropped;
+	});
+}
+
+void ServerSocketContext::__Deliver(ConnectionContext * pConn, bool bFrame, uint32_t nMsgId, char * pData, size_t nSize) {
+	switch (_iLimits.Charge(pConn, nSize, _vWorkers.empty() && !_pUring)) {
+	case ConnectionLimits<ConnectionContext>::Drop:
+		++_iStats.nLimitDropped;
+		return;
+	case ConnectionLimits<ConnectionContext>::Kick:
+		Close(pConn, ENet::Limited);
+		return;
+	default:
+		break;
+	}
+
+	if (_pDispatch) {
+		if (!pConn->pStrand) pConn->pStrand = make_shared<Strand>(_pDispatch, pConn->nId);
+		pConn->pStrand->Push(nMsgId, pData, nSize);
+	} else if (bFrame) {
+		_pOwner->OnMessage(pConn, nMsgId, pData, nSize);
+	} else {
+		_pOwner->OnReceive(pConn, pData, nSize);
+	}
+}
+
+size_t ServerSocketContext::__Fanout(const vector<ConnectionContext *> & rConns, SharedPayload * pPayload, bool bFrame) {
+	size_t nCount = 0;
+
+	for (auto pConn : rConns) {
+		SendQueue & rQueue = pConn->iSend;
+
+		/// Writable edge was already consumed for an empty queue. Flush it ourselves.
+		if (rQueue.Empty()) {
+			_vDirty.push_back(pConn->nId);
+		} else if (rQueue.Buffered() + pPayload->Size() > _nSendLimit) {
+			continue;
+		}
+
+		rQueue.Append(pPayload);
+		_iTimeouts.Sent(pConn);
+		pConn->iStats.nBytesOut += pPayload->Size();
+		if (bFrame) ++pConn->iStats.nMsgsOut;
+		RecordQueued(_iStats, pConn, rQueue.Size());
+		++nCount;
+	}
+
+	_iStats.nBytesOut += pPayload->Size() * nCount;
+	if (bFrame) _iStats.nMsgsOut += nCount;
+	return nCount;
+}
+
+void ServerSocketContext::__FlushDirty() {
+	if (_vDirty.empty()) return;
+
+	/// __Flush() may close connection and OnClose() may broadcast again.
+	_vFlushing.swap(_vDirty);
+
+	for (auto nConnId : _vFlushing) {
+		ConnectionContext * pConn = _iConns.Find(nConnId);
+		if (pConn) __Flush(pConn);
+	}
+
+	_vFlushing.clear();
+}
+
+void ServerSocketContext::__DrainUring() {
+	Uring::Event iEvent;
+	double dGiveUp = Tick() + URING_DRAIN;
+
+	/// Kernel cancels operations of a closed ring in background, so a send may
+	/// still read its queue after close(). Sends on shut down sockets fail at once.
+	while (!_mOrphans.empty()) {
+		_pUring->Submit();
+
+		while (_pUring->Next(iEvent)) {
+			if ((iEvent.nTag >> 62) != OpSend) continue;
+
+			auto it = _mOrphans.find(iEvent.nTag);
+			if (it != _mOrphans.end()) {
+				delete it->second;
+				_mOrphans.erase(it);
+			}
+		}
+
+		if (_mOrphans.empty()) break;
+
+		if (Tick() >= dGiveUp) {
+			/// Leaked rather than freed under kernel.
+			LOG_WARN("Leaked %d io_uring send queues still in flight at shutdown!!!", (int)_mOrphans.size());
+			_mOrphans.clear();
+			break;
+		}
+
+		this_thread::sleep_for(chrono::milliseconds(1));
+	}
+}
+
+void ServerSocketContext::__BreathUring() {
+	Uring::Event iEvent;
+	sockaddr_in iAddr;
+	socklen_t nSizeOfAddr;
+
+	__SubmitUring();
+
+	double dDeadline = _iReads.Deadline();
+
+	while (_pUring && _pUring->Next(iEvent)) {
+		uint64_t nOp = iEvent.nTag >> 62;
+
+		if (nOp == OpAccept) {
+			if (iEvent.nResult >= 0) {
+				nSizeOfAddr = sizeof(iAddr);
+				memset(&iAddr, 0, sizeof(iAddr));
+				getpeername(iEvent.nResult, (sockaddr *)&iAddr, &nSizeOfAddr);
+
+				if (__Admit(iEvent.nResult, PeerIP(iAddr)) && !__Attach(iEvent.nResult, PeerIP(iAddr), PeerPort(iAddr))) {
+					LOG_WARN("Failed accept client while arming io_uring recv!!!");
+				}
+			}
+
+			if (!iEvent.bMore && _pUring && _nSocket >= 0) _pUring->Accept(_nSocket, __Tag(OpAccept, 0));
+		} else if (nOp == OpRecv) {
+			ConnectionContext * pConn = __FindTag(iEvent.nTag);
+			++_iStats.nRecvCalls;
+			if (!pConn) continue;
+
+			uint64_t nConnId = pConn->nId;
+
+			if (iEvent.nResult > 0) {
+				__Receive(pConn, iEvent.pData, iEvent.nResult);
+				if (!iEvent.bMore && _pUring && Find(nConnId)) _pUring->Recv(pConn->nSocket, iEvent.nTag);
+			} else if (iEvent.nResult == -ENOBUFS) {
+				/// All provided buffers are in use. Arm again after they are recycled.
+				_vStarved.push_back(nConnId);
+			} else {
+				Close(pConn, iEvent.nResult == 0 ? ENet::Remote : ENet::BadData);
+			}
+		} else if (nOp == OpSend) {
+			ConnectionContext * pConn = __FindTag(iEvent.nTag);
+
+			if (!pConn) {
+				auto it = _mOrphans.find(iEvent.nTag);
+				if (it != _mOrphans.end()) {
+					delete it->second;
+					_mOrphans.erase(it);
+				}
+			} else if (iEvent.nResult < 0) {
+				pConn->nSending = 0;
+				Close(pConn, ENet::Remote);
+			} else {
+				pConn->nSending = 0;
+				pConn->iSend.Consume((size_t)iEvent.nResult);
+				__FlushUring(pConn);
+			}
+		}
+
+		if (dDeadline != HUGE_VAL && Tick() >= dDeadline) {
+			/// The rest stays in completion queue for next Breath().
+			++_iStats.nReadDeferred;
+			Reactor::Get().Due(0);
+			break;
+		}
+	}
+
+	if (!_pUring) return;
+
+	for (auto nConnId : _vStarved) {
+		ConnectionContext * pConn = _iConns.Find(nConnId);
+		if (pConn) _pUring->Recv(pConn->nSocket, __Tag(OpRecv, nConnId));
+	}
+
+	_vStarved.clear();
+}
+
+void ServerSocketContext::__SubmitUring() {
+	if (_pUring->Submit() < 0) LOG_WARN("Failed submit io_uring operations : %d", errno);
+	_nUringMsgs = 0;
+}
+
+void ServerSocketContext::__FlushUring(ConnectionContext * pConn) {
+	if (pConn->nSending > 0 || pConn->iSend.Empty()) return;
+
+	/// No sendfile() in io_uring. Files are read into memory a chunk at a time.
+	if (!pConn->iSend.Load(SENDQUEUE_CHUNK)) {
+		Close(pConn, ENet::Remote);
+		return;
+	}
+
+	if (_nUringMsgs >= _vUringMsgs.size()) __SubmitUring();
+
+	UringMessage & rMsg = _vUringMsgs[_nUringMsgs++];
+	int nVec = 0;
+
+	for (SendQueue::Block * p = pConn->iSend.Head(); p && nVec < 16 && !p->IsFile(); p = p->pNext, ++nVec) {
+		rMsg.pVec[nVec].iov_base	= p->Data();
+		rMsg.pVec[nVec].iov_len		= p->Size();
+		pConn->nSending += p->Size();
+	}
+
+	memset(&rMsg.iMsg, 0, sizeof(rMsg.iMsg));
+	rMsg.iMsg.msg_iov		= rMsg.pVec;
+	rMsg.iMsg.msg_iovlen	= nVec;
+
+	if (!_pUring->SendMsg(pConn->nSocket, &rMsg.iMsg, __Tag(OpSend, pConn->nId))) {
+		/// Submission queue is full. Try again in next Breath().
+		pConn->nSending = 0;
+		_vDirty.push_back(pConn->nId);
+	} else {
+		++_iStats.nSendCalls;
+	}
+}
+
+ConnectionContext * ServerSocketContext::__FindTag(uint64_t nTag) {
+	ConnectionContext * pConn = _iConns.At((uint32_t)nTag);
+	if (!pConn || (pConn->nId & TAG_MASK) != (nTag & TAG_MASK)) return nullptr;
+	return pConn;
+}
+
+void ServerSocketContext::__Flush(ConnectionContext * pConn) {
+	if (_pUring) {
+		__FlushUring(pConn);
+		return;
+	}
+
+	if (!FlushSendQueue(pConn->nSocket, pConn->iSend, &_iStats)) {
+		Close(pConn, ENet::Remote);
+	} else {
+		__Done(pConn);
+	}
+}
+
+void ServerSocketContext::__Receive(ConnectionContext * pConn, char * pData, size_t nSize) {
+	_iTimeouts.Received(pConn);
+	pConn->iStats.nBytesIn += nSize;
+	_iStats.nBytesIn += nSize;
+
+	if (!_iCodec.Enabled()) {
+		__Deliver(pConn, false, 0, pData, nSize);
+		return;
+	}
+
+	uint64_t nConnId = pConn->nId;
+	bool bOk = _iCodec.Split(pConn->iRecv, pData, nSize, [this, pConn, nConnId](uint32_t nMsgId, char * pBody, size_t nBody) {
+		++pConn->iStats.nMsgsIn;
+		++_iStats.nMsgsIn;
+		__Deliver(pConn, true, nMsgId, pBody, nBody);
+		return Find(nConnId) != nullptr;
+	}, _pMsgBudget);
+
+	if (!bOk) Close(pConn, ENet::BadData);
+}
+
+Connection * ServerSocketContext::__Attach(int nSocket, uint32_t nIP, int nPort) {
+	struct epoll_event iEv;
+	iEv.events = _vWorkers.empty() ? (EPOLLIN | EPOLLOUT | EPOLLET) : (EPOLLOUT | EPOLLET);
+	iEv.data.fd = nSocket;
+
+	/// Slot is the fd itself, so epoll events resolve to connection without lookup.
+	ConnectionContext * pConn = _iConns.Alloc((uint32_t)nSocket);
+	bool bArmed = false;
+
+	if (pConn && _pUring) {
+		bArmed = _pUring->Recv(nSocket, __Tag(OpRecv, pConn->nId));
+	} else if (pConn) {
+		bArmed = epoll_ctl(_nIO, EPOLL_CTL_ADD, nSocket, &iEv) == 0;
+	}
+
+	if (!bArmed) {
+		if (pConn) _iConns.Free(pConn);
+		__Discard(nSocket);
+		return nullptr;
+	}
+
+	pConn->nSocket	= nSocket;
+	pConn->nIP		= nIP;
+	pConn->nPort	= nPort;
+	pConn->pData	= nullptr;
+
+	++_iStats.nAccepted;
+	_iTimeouts.Received(pConn);
+	_iLimits.Attach(pConn);
+	_pOwner->OnAccept(pConn);
+	return pConn;
+}
+
+bool ServerSocketContext::__Admit(int nSocket, uint32_t nIP) {
+	if (_iAccepts.Allow(nIP, Tick())) return true;
+
+	++_iStats.nRefused;
+	__Discard(nSocket);
+	return false;
+}
+
+void ServerSocketContext::__Discard(int nSocket) {
+	if (_vWorkers.empty()) {
+		close(nSocket);
+	} else {
+		/// I/O thread still polls this socket. Wait until it hands the fd back.
+		shutdown(nSocket, SHUT_RDWR);
+		_setZombies.insert(nSocket);
+	}
+}
+
+void ServerSocketContext::__CheckTimeouts() {
+	double dNext = _iTimeouts.Check(
+		[this](ConnectionContext * pConn) { Close(pConn, ENet::TimedOut); },
+		[this](ConnectionContext * pConn) { _pOwner->OnHeartbeat(pConn); });
+
+	Reactor::Get().Due(dNext);
+}
+
+/**
+ * Scratch area for recvmmsg(). One slot per datagram of a batch, reused by every
+ * UDP socket breathing on the same thread.
+ **/
+static char * UdpScratch() {
+	static thread_local unique_ptr<char[]> pScratch;
+	if (!pScratch) pScratch.reset(new char[UDP_BATCH * UDP_BUFSIZE]);
+	return pScratch.get();
+}
+
+class UdpSocketContext : public Reactor::Handler {
 public:
-	SocketContext(ISocket * pOwner);
-	virtual ~SocketContext();
+	UdpSocketContext(IUdpSocket * pOwner);
+	virtual ~UdpSocketContext();
 
-	int		Connect(const string & sIP, int nPort);
-	bool	IsConnected() { return _nSocket >= 0; }
-	void	Close(ENet::Close emCode);
-	bool	Send(const char * pData, size_t nSize);
-	void	Breath();
+	int				Bind(const string & sIP, int nPort);
+	Connection *	Peer(const string & sIP, int nPort);
+	Connection *	Find(uint64_t nPeerId) { return _iPeers.Find(nPeerId); }
+	void			SetPeerLimit(size_t nLimit) { _iPeers.SetLimit(nLimit); }
+	bool			Send(Connection * pPeer, const char * pData, size_t nSize);
+	void			Flush();
+	void			Close(Connection * pPeer, ENet::Close emCode);
+	void			Shutdown();
+	void			Breath();
+
+	virtual void	OnPoll(uint32_t nEvents) override { _bReady = true; }
 
 private:
-	ISocket *		_pOwner;
-	char *			_pReceived;
+	IUdpSocket *	_pOwner;
 	int				_nSocket;
-	int				_nIO;
+	bool			_bReady;	//! Shared epoll found socket readable
+	bool			_bGso;
+	size_t			_nGsoMax;	//! Largest segment size kernel accepted for GSO
+	UdpPeers		_iPeers;
+	UdpOutbox		_iOut;
 };
 
-SocketContext::SocketContext(ISocket * pOwner)
+UdpSocketContext::UdpSocketContext(IUdpSocket * pOwner)
 	: _pOwner(pOwner)
-	, _pReceived(new char[SOCKET_BUFSIZE])
 	, _nSocket(-1)
-	, _nIO(0) {}
+	, _bReady(false)
+	, _bGso(false)
+	, _nGsoMax(UDP_BUFSIZE)
+	, _iPeers()
+	, _iOut() {}
 
-SocketContext::~SocketContext() {
-	Close(ENet::Local);
-	delete[] _pReceived;
+UdpSocketContext::~UdpSocketContext() {
+	Shutdown();
 }
 
-int SocketContext::Connect(const string & sIP, int nPort) {
+int UdpSocketContext::Bind(const string & sIP, int nPort) {
 	if (_nSocket >= 0) return ENet::Running;
-	if ((_nSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0) return errno;
-
-	int nFlags = fcntl(_nSocket, F_GETFL, 0);
-	if (fcntl(_nSocket, F_SETFL, O_NONBLOCK | nFlags) < 0) {
-		close(_nSocket);
-		_nSocket = -1;
-		return errno;
-	}
 
 	struct sockaddr_in iAddr;
 	memset(&iAddr, 0, sizeof(iAddr));
@@ -68,432 +2489,665 @@ int SocketContext::Connect(const string & sIP, int nPort) {
 	iAddr.sin_family	= AF_INET;
 	iAddr.sin_port		= htons(nPort);
 
-	if (0 >= inet_pton(AF_INET, sIP.c_str(), &iAddr.sin_addr)) {
+	if (0 >= inet_pton(AF_INET, sIP.c_str(), &iAddr.sin_addr)) return ENet::BadParam;
+	if ((_nSocket = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, IPPROTO_UDP)) < 0) return errno;
+
+	int nBuf = SOCKET_BUFSIZE;
+	setsockopt(_nSocket, SOL_SOCKET, SO_RCVBUF, &nBuf, sizeof(nBuf));
+	setsockopt(_nSocket, SOL_SOCKET, SO_SNDBUF, &nBuf, sizeof(nBuf));
+
+	if (::bind(_nSocket, (sockaddr *)&iAddr, sizeof(iAddr)) < 0) {
 		close(_nSocket);
 		_nSocket = -1;
-		return ENet::BadParam;
+		return errno;
 	}
 
-	if (connect(_nSocket, (sockaddr *)&iAddr, sizeof(sockaddr)) < 0) {
-		if (errno != EINPROGRESS) {
-			close(_nSocket);
-			_nSocket = -1;
-			return errno;
-		}
+	if (!Reactor::Get().Add(_nSocket, EPOLLIN, this)) {
+		close(_nSocket);
+		_nSocket = -1;
+		return ENet::Epoll;
+	}
+
+	/// Segment size is given per message. This only probes kernel support (4.18+).
+	int nSegment = 0;
+	_bGso = setsockopt(_nSocket, SOL_UDP, UDP_SEGMENT, &nSegment, sizeof(nSegment)) == 0;
+	return 0;
+}
+
+Connection * UdpSocketContext::Peer(const string & sIP, int nPort) {
+	if (_nSocket < 0) return nullptr;
+
+	struct in_addr iAddr;
+	if (0 >= inet_pton(AF_INET, sIP.c_str(), &iAddr)) return nullptr;
+
+	int nNetPort = htons(nPort);
+	PeerContext * pPeer = _iPeers.Find(iAddr.s_addr, nNetPort);
+	return pPeer ? pPeer : _iPeers.Add(_nSocket, iAddr.s_addr, nNetPort);
+}
+
+bool UdpSocketContext::Send(Connection * pPeer, const char * pData, size_t nSize) {
+	if (_nSocket < 0 || !pPeer || nSize > UDP_MAXDATA) return false;
+	if (_iOut.Bytes() + nSize > UDP_SENDLIMIT) return false;
+
+	_iOut.Push(pPeer->nIP, pPeer->nPort, pData, nSize);
+	return true;
+}
+
+void UdpSocketContext::Flush() {
+	static struct mmsghdr pMsgs[UDP_BATCH];
+	static struct iovec pVecs[UDP_BATCH];
+	static struct sockaddr_in pAddrs[UDP_BATCH];
+	static char pControls[UDP_BATCH][CMSG_SPACE(sizeof(uint16_t))];
+	static size_t pCounts[UDP_BATCH];
+
+	size_t nDone = 0;
+	size_t nTotal = _iOut.Count();
+	size_t nSolo = 0;	//! Datagrams before this one are sent without merging
+
+	while (_nSocket >= 0 && nDone < nTotal) {
+		size_t nNext = nDone;
+		int nMsg = 0;
+
+		for (; nMsg < UDP_BATCH && nNext < nTotal; ++nMsg) {
+			const UdpOutbox::Datagram & rFirst = _iOut[nNext];
+			size_t nBytes = rFirst.nSize;
+			size_t nCount = 1;
+
+			/// GSO: a run of same-size datagrams to one peer, the last one may be shorter.
+			if (_bGso && nNext >= nSolo && rFirst.nSize > 0 && rFirst.nSize <= _nGsoMax) {
+				while (nNext + nCount < nTotal && nCount < 64) {
+					const UdpOutbox::Datagram & r = _iOut[nNext + nCount];
+					if (r.nIP != rFirst.nIP || r.nPort != rFirst.nPort || r.nSize == 0 || r.nSize > rFirst.nSize) break;
+					if (nBytes + r.nSize > UDP_BUFSIZE - 1024) break;
+
+					nBytes += r.nSize;
+					++nCount;
+					if (r.nSize < rFirst.nSize) break;
+				}
+			}
+
+			struct msghdr & rHdr = pMsgs[nMsg].msg_hdr;
+			memset(&rHdr, 0, sizeof(rHdr));
+			memset(&pAddrs[nMsg], 0, sizeof(sockaddr_in));
 
-		fd_set iSet;
-		struct timeval iWait;
+			pAddrs[nMsg].sin_family			= AF_INET;
+			pAddrs[nMsg].sin_addr.s_addr	= rFirst.nIP;
+			pAddrs[nMsg].sin_port			= (uint16_t)rFirst.nPort;
 
-		iWait.tv_sec = 3;
-		iWait.tv_usec = 0;
+			pVecs[nMsg].iov_base	= _iOut.Data(rFirst);
+			pVecs[nMsg].iov_len		= nBytes;
 
-		FD_ZERO(&iSet);
-		FD_SET(_nSocket, &iSet);
+			rHdr.msg_name		= &pAddrs[nMsg];
+			rHdr.msg_namelen	= sizeof(sockaddr_in);
+			rHdr.msg_iov		= &pVecs[nMsg];
+			rHdr.msg_iovlen		= 1;
 
-		if (select(_nSocket + 1, 0, &iSet, 0, &iWait) <= 0) {
-			close(_nSocket);
-			_nSocket = -1;
-			return ENet::Timeout;
+			if (nCount > 1) {
+				rHdr.msg_control	= pControls[nMsg];
+				rHdr.msg_controllen	= sizeof(pControls[nMsg]);
+
+				struct cmsghdr * pCmsg = CMSG_FIRSTHDR(&rHdr);
+				pCmsg->cmsg_level	= SOL_UDP;
+				pCmsg->cmsg_type	= UDP_SEGMENT;
+				pCmsg->cmsg_len		= CMSG_LEN(sizeof(uint16_t));
+
+				uint16_t nSegment = (uint16_t)rFirst.nSize;
+				memcpy(CMSG_DATA(pCmsg), &nSegment, sizeof(nSegment));
+			}
+
+			pCounts[nMsg] = nCount;
+			nNext += nCount;
 		}
 
-		int nErr;
-		socklen_t nLen;
-		if (getsockopt(_nSocket, SOL_SOCKET, SO_ERROR, &nErr, &nLen) < 0 || nErr != 0) {
-			close(_nSocket);
-			_nSocket = -1;
-			return ENet::Closed;
+		int nSent = sendmmsg(_nSocket, pMsgs, nMsg, MSG_DONTWAIT);
+		if (nSent < 0) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN) break;
+
+			if (errno == EIO && _bGso) {
+				/// Device can NOT segment. Send datagrams one by one from now on.
+				_bGso = false;
+				continue;
+			}
+
+			if (errno == EINVAL && pCounts[0] > 1) {
+				/// Segment is larger than path MTU. Stop merging datagrams of this size.
+				_nGsoMax = _iOut[nDone].nSize - 1;
+				continue;
+			}
+
+			if (pCounts[0] > 1) {
+				/// Only one datagram of the run may be bad. Send them one by one to find it.
+				nSolo = nDone + pCounts[0];
+				continue;
+			}
+
+			/// Datagram is lost anyway (eg. unreachable). Skip it and go on.
+			nSent = 1;
 		}
-	}
 
-	if ((_nIO = epoll_create(1)) < 0) {
-		close(_nSocket);
-		_nSocket = -1;
-		return ENet::Epoll;
+		for (int i = 0; i < nSent; ++i) nDone += pCounts[i];
 	}
 
-	struct epoll_event iEv;
-	iEv.events = EPOLLIN | EPOLLET;
-	iEv.data.fd = _nSocket;
-	if (epoll_ctl(_nIO, EPOLL_CTL_ADD, _nSocket, &iEv) < 0) {
-		close(_nIO);
-		close(_nSocket);
-		_nSocket = -1;
-		return ENet::Epoll;
-	}
+	_iOut.Drop(nDone);
+}
 
-	_pOwner->OnConnected();
-	return 0;
+void UdpSocketContext::Close(Connection * pPeer, ENet::Close emCode) {
+	if (!pPeer) return;
+
+	_pOwner->OnClose(pPeer, emCode);
+	_iPeers.Remove((PeerContext *)pPeer);
 }
 
-void SocketContext::Close(ENet::Close emCode) {
+void UdpSocketContext::Shutdown() {
 	if (_nSocket < 0) return;
-	close(_nIO);
+
+	while (!_iPeers.Alive().empty()) Close(_iPeers.Alive().back(), ENet::Local);
+
+	_iOut.Clear();
+	Reactor::Get().Del(_nSocket);
 	close(_nSocket);
 	_nSocket = -1;
-	_pOwner->OnClose(emCode);
+	_bReady = false;
+
+	_pOwner->OnShutdown();
 }
 
-bool SocketContext::Send(const char * pData, size_t nSize) {
-	if (_nSocket < 0) return false;
+void UdpSocketContext::Breath() {
+	static struct mmsghdr pMsgs[UDP_BATCH];
+	static struct iovec pVecs[UDP_BATCH];
+	static struct sockaddr_in pAddrs[UDP_BATCH];
 
-	char *	pSend	= (char *)pData;
-	int		nSend	= 0;
-	int		nLeft	= (int)nSize;
+	Flush();
 
-	while (true) {
-		nSend = (int)send(_nSocket, pSend, nLeft, MSG_DONTWAIT);
-		if (nSend < 0) {
-			if (errno == EAGAIN) {
-				usleep(1000);
-			} else {
-				return false;
-			}
-		} else if (nSend < nLeft) {
-			nLeft -= nSend;
-			pSend += nSend;
-		} else if (nSend == nLeft) {
-			return true;
-		} else {
-			return nLeft == 0;
+	/// Level-triggered, so data left by a full batch is reported again.
+	if (!_bReady) return;
+	_bReady = false;
+
+	char * pScratch = UdpScratch();
+
+	while (_nSocket >= 0) {
+		for (int i = 0; i < UDP_BATCH; ++i) {
+			pVecs[i].iov_base	= pScratch + (size_t)i * UDP_BUFSIZE;
+			pVecs[i].iov_len	= UDP_BUFSIZE;
+
+			memset(&pMsgs[i].msg_hdr, 0, sizeof(struct msghdr));
+			pMsgs[i].msg_hdr.msg_name		= &pAddrs[i];
+			pMsgs[i].msg_hdr.msg_namelen	= sizeof(sockaddr_in);
+			pMsgs[i].msg_hdr.msg_iov		= &pVecs[i];
+			pMsgs[i].msg_hdr.msg_iovlen		= 1;
 		}
-	}
-}
 
-void SocketContext::Breath() {
-	if (_nSocket < 0) return;
+		int nCount = recvmmsg(_nSocket, pMsgs, UDP_BATCH, MSG_DONTWAIT, NULL);
+		if (nCount <= 0) {
+			if (nCount < 0 && errno == EINTR) continue;
+			break;
+		}
 
-	static epoll_event pEvents[4] = { 0 };
-	int nCount = epoll_wait(_nIO, pEvents, 4, 0);
-	if (nCount <= 0) return;
+		for (int i = 0; i < nCount && _nSocket >= 0; ++i) {
+			if (pMsgs[i].msg_hdr.msg_flags & MSG_TRUNC) continue;
 
-	memset(_pReceived, 0, SOCKET_BUFSIZE);
-	int nReaded = 0;
+			uint32_t nIP = pAddrs[i].sin_addr.s_addr;
+			int nPort = pAddrs[i].sin_port;
 
-	while (true) {
-		int nRecv = (int)recv(_nSocket, _pReceived + nReaded, SOCKET_BUFSIZE - nReaded, MSG_DONTWAIT);
-		if (nRecv < 0) {
-			if (errno == EAGAIN) {
-				break;
-			} else {
-				Close(ENet::BadData);
-				break;
+			PeerContext * pPeer = _iPeers.Find(nIP, nPort);
+			if (!pPeer) {
+				if (_iPeers.Full()) continue;
+				pPeer = _iPeers.Add(_nSocket, nIP, nPort);
+
+				/// OnAccept() may reject this peer by closing it.
+				uint64_t nPeerId = pPeer->nId;
+				_pOwner->OnAccept(pPeer);
+				if (!_iPeers.Find(nPeerId)) continue;
 			}
-		} else if (nRecv == 0) {
-			Close(ENet::Remote);
-			break;
-		} else {
-			nReaded += nRecv;
+
+			_pOwner->OnReceive(pPeer, (char *)pVecs[i].iov_base, pMsgs[i].msg_len);
 		}
-	}
 
-	if (nReaded > 0) _pOwner->OnReceive(_pReceived, nReaded);
+		if (nCount < UDP_BATCH) break;
+	}
 }
 
-class ServerSocketContext {
-	typedef map<uint64_t, Connection *> ConnectionMap;
+/**
+ * One shared memory link. Control socket fd is kept in nSocket.
+ **/
+struct ShmPeer : public Connection, public Reactor::Handler {
+	ShmRing				iIn;
+	ShmRing				iOut;
+	void *				pMem;
+	size_t				nMem;
+	size_t				nMaxSize;	//! Largest message of iOut
+	int					nWakeIn;	//! eventfd written by remote when iIn gets data
+	int					nWakeOut;	//! eventfd read by remote
+	bool				bWoken;		//! Shared epoll found control socket or nWakeIn readable
+	bool				bSleeping;	//! iIn asked for eventfd
+	double				dActive;	//! Last time iIn had data
+	std::vector<char>	vQueue;		//! [len:4][data] waiting for room in iOut
+	size_t				nQueued;	//! Bytes of vQueue already moved into iOut
+
+	virtual void	OnPoll(uint32_t nEvents) override { bWoken = true; }
+};
 
+class ShmContext : public Reactor::Handler {
 public:
-	ServerSocketContext(IServerSocket * pOwner);
-	virtual ~ServerSocketContext();
+	ShmContext(ISharedMemorySocket * pOwner);
+	virtual ~ShmContext();
 
-	int		Listen(const string & sIP, int nPort);
-	bool	Send(Connection * pConn, const char * pData, size_t nSize);
-	void	Broadcast(const char * pData, size_t nSize);
-	void	Close(Connection * pConn, ENet::Close emCode);
-	void	Shutdown();
-	void	Breath();
+	int				Listen(const string & sPath);
+	Connection *	Connect(const string & sPath, size_t nCapacity);
+	Connection *	Find(uint64_t nPeerId) { return _iPeers.Find(nPeerId); }
+	bool			Send(Connection * pPeer, const char * pData, size_t nSize);
+	size_t			Pending(Connection * pPeer);
+	void			Close(Connection * pPeer, ENet::Close emCode);
+	void			Shutdown();
+	void			Breath();
 
-	Connection *	Find(uint64_t nConnId);
+	virtual void	OnPoll(uint32_t nEvents) override { _bReady = true; }
 
 private:
-	IServerSocket *		_pOwner;
-	char *				_pReceived;
-	int					_nSocket;
-	ConnectionMap		_mConns;
-	ConnectionMap		_mSocket2Conns;
-	int					_nIO;
+	ShmPeer *		__Attach(int nSocket, int nMemory, int nWakeIn, int nWakeOut, size_t nCapacity, bool bCreator);
+	void			__Accept(bool bReady);
+	bool			__Handshake(int nSocket, ShmPeer *& rPeer);
+	bool			__Flush(ShmPeer * p);
+	void			__Read(ShmPeer * p, double dNow);
+
+private:
+	ISharedMemorySocket *	_pOwner;
+	int						_nSocket;
+	bool					_bReady;	//! Shared epoll found listener or a handshake readable
+	string					_sPath;
+	ConnectionPool<ShmPeer>	_iPeers;
+	vector<pair<int, double>>	_vHandshakes;	//! Accepted sockets waiting for rings, and time accepted
+	vector<uint64_t>		_vIds;
 };
 
-ServerSocketContext::ServerSocketContext(IServerSocket * pOwner)
+ShmContext::ShmContext(ISharedMemorySocket * pOwner)
 	: _pOwner(pOwner)
-	, _pReceived(new char[SOCKET_BUFSIZE])
 	, _nSocket(-1)
-	, _mConns()
-	, _mSocket2Conns()
-	, _nIO(0) {}
+	, _bReady(false)
+	, _sPath()
+	, _iPeers(true)
+	, _vHandshakes()
+	, _vIds() {}
 
-ServerSocketContext::~ServerSocketContext() {
+ShmContext::~ShmContext() {
 	Shutdown();
-	delete[] _pReceived;
 }
 
-int ServerSocketContext::Listen(const string & sIP, int nPort) {
+int ShmContext::Listen(const string & sPath) {
 	if (_nSocket >= 0) return ENet::Running;
-	if ((_nSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0) return errno;
-
-	int nReuse = 1;
-	setsockopt(_nSocket, SOL_SOCKET, SO_REUSEADDR, &nReuse, sizeof(nReuse));
-
-	int nFlags = fcntl(_nSocket, F_GETFL, 0);
-	if (fcntl(_nSocket, F_SETFL, O_NONBLOCK | nFlags) < 0) {
-		close(_nSocket);
-		_nSocket = -1;
-		return errno;
-	}
 
-	struct sockaddr_in iAddr;
-	memset(&iAddr, 0, sizeof(iAddr));
+	sockaddr_storage iAddr;
+	socklen_t nSize;
+	if (!ToAddress(sPath, 0, iAddr, nSize) || iAddr.ss_family != AF_UNIX) return ENet::BadParam;
+	if ((_nSocket = OpenListener(iAddr, nSize, false)) < 0) return errno;
 
-	iAddr.sin_family = AF_INET;
-	iAddr.sin_port = htons(nPort);
+	const sockaddr_un * pLocal = (const sockaddr_un *)&iAddr;
+	if (pLocal->sun_path[0] != '\0') _sPath = pLocal->sun_path;
 
-	if (0 >= inet_pton(AF_INET, sIP.c_str(), &iAddr.sin_addr)) {
-		close(_nSocket);
-		_nSocket = -1;
-		return ENet::BadParam;
+	if (!Reactor::Get().Add(_nSocket, EPOLLIN, this)) {
+		Shutdown();
+		return ENet::Epoll;
 	}
 
-	if (::bind(_nSocket, (sockaddr *)&iAddr, sizeof(sockaddr)) < 0 || ::listen(_nSocket, 512) < 0) {
-		close(_nSocket);
-		_nSocket = -1;
-		return errno;
-	}
+	return 0;
+}
 
-	if ((_nIO = epoll_create(1)) < 0) {
-		close(_nSocket);
-		_nSocket = -1;
-		return ENet::Epoll;
+Connection * ShmContext::Connect(const string & sPath, size_t nCapacity) {
+	sockaddr_storage iAddr;
+	socklen_t nSize;
+	if (!ShmRing::Valid(nCapacity) || !ToAddress(sPath, 0, iAddr, nSize) || iAddr.ss_family != AF_UNIX) return nullptr;
+
+	/// Non-blocking local connect completes at once, or fails with EAGAIN when backlog is full.
+	int nSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (nSocket < 0) return nullptr;
+	if (connect(nSocket, (const sockaddr *)&iAddr, nSize) < 0) {
+		close(nSocket);
+		return nullptr;
 	}
 
-	struct epoll_event iEv;
-	iEv.events = EPOLLIN | EPOLLET;
-	iEv.data.fd = _nSocket;
-
-	if (epoll_ctl(_nIO, EPOLL_CTL_ADD, _nSocket, &iEv) < 0) {
-		close(_nIO);
-		close(_nSocket);
-		_nSocket = -1;
-		return ENet::Epoll;
+	int nMemory = memfd_create("engine-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	int pWakes[2] = { eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC), eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC) };
+
+	/// Sealed size, so neither side can truncate the mapping under the other (SIGBUS).
+	if (nMemory >= 0 && pWakes[0] >= 0 && pWakes[1] >= 0 && ftruncate(nMemory, (off_t)(ShmRing::Bytes(nCapacity) * 2)) == 0
+		&& fcntl(nMemory, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == 0) {
+		/// Payload is [magic:4][capacity:4]. Server reads rings in the other order.
+		uint32_t pHello[2] = { SHM_MAGIC, (uint32_t)nCapacity };
+		char pControl[CMSG_SPACE(sizeof(int) * 3)];
+		memset(pControl, 0, sizeof(pControl));
+
+		struct iovec iVec = { pHello, sizeof(pHello) };
+		struct msghdr iMsg;
+		memset(&iMsg, 0, sizeof(iMsg));
+		iMsg.msg_iov		= &iVec;
+		iMsg.msg_iovlen		= 1;
+		iMsg.msg_control	= pControl;
+		iMsg.msg_controllen	= sizeof(pControl);
+
+		struct cmsghdr * pHeader = CMSG_FIRSTHDR(&iMsg);
+		pHeader->cmsg_level	= SOL_SOCKET;
+		pHeader->cmsg_type	= SCM_RIGHTS;
+		pHeader->cmsg_len	= CMSG_LEN(sizeof(int) * 3);
+
+		int pFds[3] = { nMemory, pWakes[0], pWakes[1] };
+		memcpy(CMSG_DATA(pHeader), pFds, sizeof(pFds));
+
+		if (sendmsg(nSocket, &iMsg, MSG_NOSIGNAL) == (ssize_t)sizeof(pHello)) {
+			ShmPeer * p = __Attach(nSocket, nMemory, pWakes[1], pWakes[0], nCapacity, true);
+			close(nMemory);
+			return p;
+		}
 	}
 
-	return 0;
+	if (nMemory >= 0) close(nMemory);
+	if (pWakes[0] >= 0) close(pWakes[0]);
+	if (pWakes[1] >= 0) close(pWakes[1]);
+	close(nSocket);
+	return nullptr;
 }
 
-bool ServerSocketContext::Send(Connection * pConn, const char * pData, size_t nSize) {
-	if (!pConn) return false;
+bool ShmContext::Send(Connection * pPeer, const char * pData, size_t nSize) {
+	ShmPeer * p = pPeer ? _iPeers.Find(pPeer->nId) : nullptr;
+	if (!p || p != pPeer || nSize > p->nMaxSize) return false;
 
-	int		nSocket	= pConn->nSocket;
-	char *	pSend	= (char *)pData;
-	int		nSend	= 0;
-	int		nLeft	= (int)nSize;
-
-	while (true) {
-		nSend = (int)send(nSocket, pSend, nLeft, MSG_DONTWAIT);
-		if (nSend < 0) {
-			if (errno == EAGAIN) {
-				usleep(1000);
-			} else {
-				return false;
-			}
-		} else if (nSend < nLeft) {
-			nLeft -= nSend;
-			pSend += nSend;
-		} else if (nSend == nLeft) {
+	if (p->vQueue.empty()) {
+		if (p->iOut.Write(pData, nSize)) {
+			uint64_t nOne = 1;
+			if (p->iOut.Wakeup()) (void)write(p->nWakeOut, &nOne, sizeof(nOne));
 			return true;
-		} else {
-			return nLeft == 0;
 		}
+	} else if (p->vQueue.size() - p->nQueued + nSize > SHM_SENDLIMIT) {
+		return false;
 	}
-}
 
-void ServerSocketContext::Broadcast(const char * pData, size_t nSize) {
-	for (auto & kv : _mConns) {
-		int		nSocket	= kv.second->nSocket;
-		char *	pSend	= (char *)pData;
-		int		nSend	= 0;
-		int		nLeft	= (int)nSize;
-
-		while (true) {
-			nSend = (int)send(nSocket, pSend, nLeft, MSG_DONTWAIT);
-			if (nSend < 0) {
-				if (errno == EAGAIN) {
-					usleep(1000);
-				} else {
-					break;
-				}
-			} else if (nSend < nLeft) {
-				nLeft -= nSend;
-				pSend += nSend;
-			} else {
-				break;
-			}
-		}
-	}
+	uint32_t nLen = (uint32_t)nSize;
+	p->vQueue.insert(p->vQueue.end(), (const char *)&nLen, (const char *)&nLen + 4);
+	p->vQueue.insert(p->vQueue.end(), pData, pData + nSize);
+	return true;
 }
 
-void ServerSocketContext::Close(Connection * pConn, ENet::Close emCode) {
-	if (!pConn) return;
+size_t ShmContext::Pending(Connection * pPeer) {
+	ShmPeer * p = pPeer ? _iPeers.Find(pPeer->nId) : nullptr;
+	return (p && p == pPeer) ? p->vQueue.size() - p->nQueued : 0;
+}
 
-	int nSocket = pConn->nSocket;
-	uint64_t nConnId = pConn->nId;
+void ShmContext::Close(Connection * pPeer, ENet::Close emCode) {
+	ShmPeer * p = pPeer ? _iPeers.Find(pPeer->nId) : nullptr;
+	if (!p || p != pPeer) return;
 
-	_pOwner->OnClose(pConn, emCode);
-	epoll_ctl(_nIO, EPOLL_CTL_DEL, nSocket, NULL);
-	close(nSocket);
-	delete pConn;
+	/// Remote sees control socket closed, which works even when this process dies.
+	_pOwner->OnClose(p, emCode);
 
-	_mConns.erase(nConnId);
-	_mSocket2Conns.erase(nSocket);
+	Reactor::Get().Del(p->nSocket);
+	Reactor::Get().Del(p->nWakeIn);
+	close(p->nSocket);
+	close(p->nWakeIn);
+	close(p->nWakeOut);
+	munmap(p->pMem, p->nMem);
+	_iPeers.Free(p);
 }
 
-void ServerSocketContext::Shutdown() {
-	if (_nSocket < 0) return;
+void ShmContext::Shutdown() {
+	bool bRunning = _nSocket >= 0 || _iPeers.Size() > 0;
 
-	for (auto & kv : _mConns) {
-		Connection * pConn = kv.second;
-		_pOwner->OnClose(pConn, ENet::Local);
-		epoll_ctl(_nIO, EPOLL_CTL_DEL, pConn->nSocket, NULL);
-		close(pConn->nSocket);
-		delete pConn;
+	while (_iPeers.Size() > 0) Close(_iPeers[_iPeers.Size() - 1], ENet::Local);
+
+	for (auto & rHandshake : _vHandshakes) {
+		Reactor::Get().Del(rHandshake.first);
+		close(rHandshake.first);
 	}
+	_vHandshakes.clear();
 
-	epoll_ctl(_nIO, EPOLL_CTL_DEL, _nSocket, NULL);
-	_mConns.clear();
-	_mSocket2Conns.clear();
+	if (_nSocket >= 0) {
+		Reactor::Get().Del(_nSocket);
+		close(_nSocket);
+		_nSocket = -1;
+	}
 
-	close(_nIO);
-	close(_nSocket);
-	_nSocket = -1;
+	if (!_sPath.empty()) {
+		unlink(_sPath.c_str());
+		_sPath.clear();
+	}
 
-	_pOwner->OnShutdown();
+	_bReady = false;
+	if (bRunning) _pOwner->OnShutdown();
 }
 
-void ServerSocketContext::Breath() {
-	if (_nSocket < 0) return;
-	static epoll_event pEvents[512] = { 0 };
-	static uint64_t nAllocId = 0;
-	static sockaddr_in iAddr = { 0 };
-	static socklen_t nSizeOfAddr = sizeof(iAddr);
-	static char pAddr[128] = { 0 };
-
-	int nCount = epoll_wait(_nIO, pEvents, 512, 0);
-	if (nCount <= 0) return;
+void ShmContext::Breath() {
+	/// Silent handshakes expire even when nothing becomes readable.
+	bool bReady = _bReady;
+	_bReady = false;
+	if (bReady || !_vHandshakes.empty()) __Accept(bReady);
 
-	for (int i = 0; i < nCount; ++i) {
-		if (!(pEvents[i].events & EPOLLIN)) continue;
+	if (_iPeers.Size() == 0) return;
 
-		if (pEvents[i].data.fd == _nSocket) {
-			while (true) {
-				int nAccept = accept(_nSocket, (sockaddr *)&iAddr, &nSizeOfAddr);
-				if (nAccept < 0) break;
+	/// Callbacks may close any peer. Walk a copy of identifiers.
+	double dNow = Tick();
+	_vIds.clear();
+	for (auto p : _iPeers.Alive()) _vIds.push_back(p->nId);
 
-				uint64_t nConnId = nAllocId + 1;
-				nAllocId++;
-				inet_ntop(AF_INET, &iAddr, pAddr, 128);
+	for (auto nId : _vIds) {
+		ShmPeer * p = _iPeers.Find(nId);
+		if (p) __Read(p, dNow);
+	}
+}
 
-				struct epoll_event iEv;
-				iEv.events = EPOLLIN | EPOLLET;
-				iEv.data.fd = nAccept;
+ShmPeer * ShmContext::__Attach(int nSocket, int nMemory, int nWakeIn, int nWakeOut, size_t nCapacity, bool bCreator) {
+	size_t nRing = ShmRing::Bytes(nCapacity);
+	void * pMem = mmap(NULL, nRing * 2, PROT_READ | PROT_WRITE, MAP_SHARED, nMemory, 0);
+	if (pMem == MAP_FAILED) {
+		close(nWakeIn);
+		close(nWakeOut);
+		close(nSocket);
+		return nullptr;
+	}
 
-				if (epoll_ctl(_nIO, EPOLL_CTL_ADD, nAccept, &iEv) < 0) {
-					LOG_WARN("Failed accept client [%s] while setting non-block!!!", pAddr);
-					continue;
-				}
+	/// Client writes first ring and reads second one.
+	char * pFirst = (char *)pMem;
+	char * pSecond = pFirst + nRing;
+
+	ShmPeer * p = _iPeers.Alloc();
+	p->nSocket		= nSocket;
+	p->nIP			= 0;
+	p->nPort		= 0;
+	p->pData		= nullptr;
+	p->pMem			= pMem;
+	p->nMem			= nRing * 2;
+	p->nMaxSize		= ShmRing::MaxMessage(nCapacity);
+	p->nWakeIn		= nWakeIn;
+	p->nWakeOut		= nWakeOut;
+	p->bWoken		= false;
+	p->bSleeping	= false;
+	p->dActive		= Tick();
+	p->nQueued		= 0;
+	p->iOut.Attach(bCreator ? pFirst : pSecond, nCapacity);
+	p->iIn.Attach(bCreator ? pSecond : pFirst, nCapacity);
+
+	if (!Reactor::Get().Add(nSocket, EPOLLIN | EPOLLRDHUP, p) || !Reactor::Get().Add(nWakeIn, EPOLLIN, p)) {
+		Reactor::Get().Del(nSocket);
+		close(nSocket);
+		close(nWakeIn);
+		close(nWakeOut);
+		munmap(pMem, nRing * 2);
+		_iPeers.Free(p);
+		return nullptr;
+	}
 
-				Connection * pConn = new Connection;
-				pConn->nId		= nConnId;
-				pConn->nSocket	= nAccept;
-				pConn->nIP		= iAddr.sin_addr.s_addr;
-				pConn->nPort	= iAddr.sin_port;
-				pConn->pData	= nullptr;
+	return p;
+}
 
-				_mConns[nConnId] = pConn;
-				_mSocket2Conns[(uint64_t)nAccept] = pConn;
+void ShmContext::__Accept(bool bReady) {
+	while (bReady && _nSocket >= 0) {
+		int nAccept = accept4(_nSocket, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (nAccept < 0) break;
 
-				_pOwner->OnAccept(pConn);
-			}
+		if (Reactor::Get().Add(nAccept, EPOLLIN, this)) {
+			_vHandshakes.push_back(make_pair(nAccept, Tick()));
 		} else {
-			int nSocket = pEvents[i].data.fd;
-			int nReaded = 0;
+			close(nAccept);
+		}
+	}
 
-			auto it = _mSocket2Conns.find((uint64_t)nSocket);
-			if (it == _mSocket2Conns.end()) continue;
+	/// Rings come right after connect(). A socket silent for long is NOT one of our clients.
+	double dNow = Tick();
+	double dOldest = HUGE_VAL;
+	_vIds.clear();
 
-			memset(_pReceived, 0, SOCKET_BUFSIZE);
+	for (size_t i = 0; i < _vHandshakes.size();) {
+		int nSocket = _vHandshakes[i].first;
+		ShmPeer * pPeer = nullptr;
 
-			while (true) {
-				int nRecv = (int)recv(nSocket, _pReceived + nReaded, SOCKET_BUFSIZE - nReaded, MSG_DONTWAIT);
-				if (nRecv > 0) {
-					nReaded += nRecv;
-					if (nReaded >= SOCKET_BUFSIZE) {
-						_pOwner->OnReceive(it->second, _pReceived, nReaded);
-						memset(_pReceived, 0, SOCKET_BUFSIZE);
-						nReaded = 0;
-					}
-				} else if (nRecv < 0 && errno == EAGAIN) {
-					if (nReaded > 0) _pOwner->OnReceive(it->second, _pReceived, nReaded);
-					break;
-				} else {
-					if (nReaded > 0) _pOwner->OnReceive(it->second, _pReceived, nReaded);
-					Close(it->second, nRecv == 0 ? ENet::Remote : ENet::BadData);
-					break;
-				}
-			}	
+		if (bReady && __Handshake(nSocket, pPeer)) {
+			if (pPeer) _vIds.push_back(pPeer->nId);
+		} else if (dNow - _vHandshakes[i].second >= SHM_HANDSHAKE) {
+			Reactor::Get().Del(nSocket);
+			close(nSocket);
+		} else {
+			dOldest = std::min(dOldest, _vHandshakes[i].second);
+			++i;
+			continue;
 		}
+
+		_vHandshakes[i] = _vHandshakes.back();
+		_vHandshakes.pop_back();
 	}
-}
 
-Connection * ServerSocketContext::Find(uint64_t nConnId) {
-	auto it = _mConns.find(nConnId);
-	if (it == _mConns.end()) return nullptr;
-	return it->second;
+	Reactor::Get().Due(dOldest + SHM_HANDSHAKE);
+
+	/// OnAccept() may close peers or shut everything down.
+	for (auto nId : _vIds) {
+		ShmPeer * p = _iPeers.Find(nId);
+		if (p) _pOwner->OnAccept(p);
+	}
 }
 
-class SocketGuard {
-public:
-	SocketGuard(ISocket * p, const string & sHost, int nPort);
-	virtual ~SocketGuard();
+/**
+ * Receive rings on an accepted socket.
+ *
+ * \return	False if nothing came yet. Otherwise socket is taken over by rPeer, or
+ *			closed when handshake failed.
+ **/
+bool ShmContext::__Handshake(int nSocket, ShmPeer *& rPeer) {
+	uint32_t pHello[2] = { 0, 0 };
+	char pControl[CMSG_SPACE(sizeof(int) * 3)];
+
+	struct iovec iVec = { pHello, sizeof(pHello) };
+	struct msghdr iMsg;
+	memset(&iMsg, 0, sizeof(iMsg));
+	iMsg.msg_iov		= &iVec;
+	iMsg.msg_iovlen		= 1;
+	iMsg.msg_control	= pControl;
+	iMsg.msg_controllen	= sizeof(pControl);
+
+	ssize_t nRead = recvmsg(nSocket, &iMsg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+	if (nRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return false;
+
+	int pFds[3] = { -1, -1, -1 };
+	size_t nFds = 0;
+	for (struct cmsghdr * p = CMSG_FIRSTHDR(&iMsg); p; p = CMSG_NXTHDR(&iMsg, p)) {
+		if (p->cmsg_level != SOL_SOCKET || p->cmsg_type != SCM_RIGHTS) continue;
+
+		size_t nCount = (p->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for (size_t i = 0; i < nCount; ++i) {
+			int nFd;
+			memcpy(&nFd, CMSG_DATA(p) + i * sizeof(int), sizeof(int));
+			if (nFds < 3) {
+				pFds[nFds++] = nFd;
+			} else {
+				close(nFd);
+			}
+		}
+	}
+
+	/// Memory that can still shrink would let peer raise SIGBUS on our next ring access.
+	struct stat iStat;
+	int nSeals = nFds == 3 ? fcntl(pFds[0], F_GET_SEALS) : -1;
+	bool bValid = nRead == (ssize_t)sizeof(pHello) && !(iMsg.msg_flags & MSG_CTRUNC) && nFds == 3
+		&& pHello[0] == SHM_MAGIC && ShmRing::Valid(pHello[1]) && nSeals >= 0 && (nSeals & F_SEAL_SHRINK)
+		&& fstat(pFds[0], &iStat) == 0 && (size_t)iStat.st_size == ShmRing::Bytes(pHello[1]) * 2;
+
+	/// Handshake socket is reused as control socket of new peer.
+	Reactor::Get().Del(nSocket);
+
+	if (bValid) {
+		rPeer = __Attach(nSocket, pFds[0], pFds[1], pFds[2], pHello[1], false);
+		close(pFds[0]);
+	} else {
+		for (size_t i = 0; i < nFds; ++i) close(pFds[i]);
+		close(nSocket);
+	}
 
-	void	Start();
+	return true;
+}
 
-private:
-	ISocket *	_p;
-	string		_sHost;
-	int			_nPort;
-	thread *	_pWorker;
-	bool		_bRunning;
-};
+bool ShmContext::__Flush(ShmPeer * p) {
+	size_t nMoved = 0;
 
-SocketGuard::SocketGuard(ISocket * p, const string & sHost, int nPort)
-	: _p(p), _sHost(sHost), _nPort(nPort), _pWorker(nullptr), _bRunning(false) {}
+	while (p->nQueued < p->vQueue.size()) {
+		uint32_t nLen;
+		memcpy(&nLen, p->vQueue.data() + p->nQueued, 4);
+		if (!p->iOut.Write(p->vQueue.data() + p->nQueued + 4, nLen)) break;
 
-SocketGuard::~SocketGuard() {
-	_bRunning = false;
-	if (_pWorker) {
-		if (_pWorker->joinable()) _pWorker->join();
-		delete _pWorker;
+		p->nQueued += 4 + nLen;
+		++nMoved;
+	}
+
+	if (p->nQueued == p->vQueue.size()) {
+		p->vQueue.clear();
+		p->nQueued = 0;
 	}
+
+	uint64_t nOne = 1;
+	if (nMoved > 0 && p->iOut.Wakeup()) (void)write(p->nWakeOut, &nOne, sizeof(nOne));
+	return p->vQueue.empty();
 }
 
-void SocketGuard::Start() {
-	if (_bRunning) return;
+void ShmContext::__Read(ShmPeer * p, double dNow) {
+	uint64_t nId = p->nId;
+	bool bClosed = false;
 
-	if (_pWorker) {
-		if (_pWorker->joinable()) _pWorker->join();
-		delete _pWorker;
+	/// Checked before reading, so messages sent right before remote closed are still delivered.
+	if (p->bWoken) {
+		p->bWoken = false;
+
+		uint64_t nCount;
+		char cByte;
+		(void)read(p->nWakeIn, &nCount, sizeof(nCount));
+		ssize_t nRecv = recv(p->nSocket, &cByte, 1, MSG_DONTWAIT);
+		bClosed = nRecv == 0 || (nRecv < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
 	}
-	
-	_bRunning = true;
-	_pWorker = new thread([this]() {
-		while (_bRunning) {
-			if (!_p->IsConnected()) {
-				int n = _p->Connect(_sHost, _nPort, false);
-				if (n != ENet::Success) LOG_WARN("Try to reconnect [%s:%d] ... %d", _sHost.c_str(), _nPort, n);
-			}
 
-			this_thread::sleep_for(chrono::seconds(1));
+	/// Remote is NOT expected to read faster than 1ms after waking, so a full ring is polled.
+	if (!p->vQueue.empty() && !__Flush(p)) Reactor::Get().Due(dNow + 1);
+
+	bool bBroken = false;
+	size_t nRead = p->iIn.Read([this, p, nId](char * pData, size_t nSize) {
+		_pOwner->OnReceive(p, pData, nSize);
+		return _iPeers.Find(nId) == p;
+	}, bBroken);
+
+	if (_iPeers.Find(nId) != p) return;
+
+	if (bBroken) {
+		Close(p, ENet::BadData);
+	} else if (bClosed) {
+		Close(p, ENet::Remote);
+	} else if (nRead > 0 || !p->iIn.Empty()) {
+		/// Stay awake for SHM_SPIN after traffic, so a busy producer never pays for a wakeup.
+		if (p->bSleeping) p->iIn.Awake();
+		p->bSleeping = false;
+		p->dActive = dNow;
+		Reactor::Get().Due(p->iIn.Empty() ? dNow + SHM_SPIN : 0);
+	} else if (!p->bSleeping) {
+		if (dNow - p->dActive < SHM_SPIN) {
+			Reactor::Get().Due(p->dActive + SHM_SPIN);
+		} else if (p->iIn.Sleep()) {
+			p->bSleeping = true;
+		} else {
+			Reactor::Get().Due(0);
 		}
-	});
+	}
 }
 
 class NetworkBreather {
@@ -504,14 +3158,27 @@ public:
 
 	void	Add(ISocket * p);
 	void	Add(IServerSocket * p);
+	void	Add(IUdpSocket * p);
+	void	Add(IReliableSocket * p);
+	void	Add(ISharedMemorySocket * p);
+	void	Add(IMessageBus * p);
 	void	Del(ISocket * p);
 	void	Del(IServerSocket * p);
+	void	Del(IUdpSocket * p);
+	void	Del(IReliableSocket * p);
+	void	Del(ISharedMemorySocket * p);
+	void	Del(IMessageBus * p);
 
 	void	Breath();
+	void	Flush();
 
 private:
 	vector<ISocket *>		_vClients;
 	vector<IServerSocket *>	_vServers;
+	vector<IUdpSocket *>	_vUdps;
+	vector<IReliableSocket *>	_vReliables;
+	vector<ISharedMemorySocket *>	_vShms;
+	vector<IMessageBus *>	_vBuses;
 };
 
 NetworkBreather & NetworkBreather::Get() {
@@ -536,6 +3203,38 @@ void NetworkBreather::Add(IServerSocket * p) {
 	_vServers.push_back(p);
 }
 
+void NetworkBreather::Add(IUdpSocket * p) {
+	for (auto pUdp : _vUdps) {
+		if (pUdp == p) return;
+	}
+
+	_vUdps.push_back(p);
+}
+
+void NetworkBreather::Add(IReliableSocket * p) {
+	for (auto pReliable : _vReliables) {
+		if (pReliable == p) return;
+	}
+
+	_vReliables.push_back(p);
+}
+
+void NetworkBreather::Add(ISharedMemorySocket * p) {
+	for (auto pShm : _vShms) {
+		if (pShm == p) return;
+	}
+
+	_vShms.push_back(p);
+}
+
+void NetworkBreather::Add(IMessageBus * p) {
+	for (auto pBus : _vBuses) {
+		if (pBus == p) return;
+	}
+
+	_vBuses.push_back(p);
+}
+
 void NetworkBreather::Del(ISocket * p) {
 	auto it = find(_vClients.begin(), _vClients.end(), p);
 	if (it != _vClients.end()) _vClients.erase(it);
@@ -546,16 +3245,88 @@ void NetworkBreather::Del(IServerSocket * p) {
 	if (it != _vServers.end()) _vServers.erase(it);
 }
 
+void NetworkBreather::Del(IUdpSocket * p) {
+	auto it = find(_vUdps.begin(), _vUdps.end(), p);
+	if (it != _vUdps.end()) _vUdps.erase(it);
+}
+
+void NetworkBreather::Del(IReliableSocket * p) {
+	auto it = find(_vReliables.begin(), _vReliables.end(), p);
+	if (it != _vReliables.end()) _vReliables.erase(it);
+}
+
+void NetworkBreather::Del(ISharedMemorySocket * p) {
+	auto it = find(_vShms.begin(), _vShms.end(), p);
+	if (it != _vShms.end()) _vShms.erase(it);
+}
+
+void NetworkBreather::Del(IMessageBus * p) {
+	auto it = find(_vBuses.begin(), _vBuses.end(), p);
+	if (it != _vBuses.end()) _vBuses.erase(it);
+}
+
 void NetworkBreather::Breath() {
-	for (auto p : _vClients) p->Breath();
-	for (auto p : _vServers) p->Breath();
+	Reactor::Get().Poll(0);
+
+	/// Callbacks may create or destroy sockets (eg. bus links), so lists are walked by index.
+	for (size_t i = 0; i < _vClients.size(); ++i) _vClients[i]->_pCtx->Breath();
+	for (size_t i = 0; i < _vServers.size(); ++i) _vServers[i]->_pCtx->Breath();
+	for (size_t i = 0; i < _vUdps.size(); ++i) _vUdps[i]->_pCtx->Breath();
+	for (size_t i = 0; i < _vShms.size(); ++i) _vShms[i]->_pCtx->Breath();
+
+	/// UDP links of reliable sockets were received above. Only run their timers.
+	for (size_t i = 0; i < _vReliables.size(); ++i) _vReliables[i]->Flush();
+
+	/// Links of buses were read above too. Only flush batches and run keep-alive.
+	for (size_t i = 0; i < _vBuses.size(); ++i) _vBuses[i]->Flush();
+}
+
+void NetworkBreather::Flush() {
+	/// Batches of buses go to send queues of their links first.
+	for (size_t i = 0; i < _vBuses.size(); ++i) _vBuses[i]->Flush();
+	for (size_t i = 0; i < _vClients.size(); ++i) _vClients[i]->Flush();
+	for (size_t i = 0; i < _vServers.size(); ++i) _vServers[i]->Flush();
+	for (size_t i = 0; i < _vReliables.size(); ++i) _vReliables[i]->Flush();
+	for (size_t i = 0; i < _vUdps.size(); ++i) _vUdps[i]->Flush();
 }
 
 void AutoNetworkBreath() {
 	NetworkBreather::Get().Breath();
 }
 
-ISocket::ISocket() : _pCtx(nullptr), _pGuard(nullptr) {
+void AutoNetworkFlush() {
+	NetworkBreather::Get().Flush();
+}
+
+bool AutoNetworkWait(double dDeadline) {
+	return Reactor::Get().Wait(dDeadline);
+}
+
+void AutoNetworkDue(double dTime) {
+	Reactor::Get().Due(dTime);
+}
+
+void AutoNetworkWake() {
+	Reactor::Get().Wake();
+}
+
+void AutoNetworkAdd(IReliableSocket * p) {
+	NetworkBreather::Get().Add(p);
+}
+
+void AutoNetworkDel(IReliableSocket * p) {
+	NetworkBreather::Get().Del(p);
+}
+
+void AutoNetworkAdd(IMessageBus * p) {
+	NetworkBreather::Get().Add(p);
+}
+
+void AutoNetworkDel(IMessageBus * p) {
+	NetworkBreather::Get().Del(p);
+}
+
+ISocket::ISocket() : _pCtx(nullptr) {
 	_pCtx = new SocketContext(this);
 	NetworkBreather::Get().Add(this);
 }
@@ -563,33 +3334,24 @@ ISocket::ISocket() : _pCtx(nullptr), _pGuard(nullptr) {
 ISocket::~ISocket() {
 	NetworkBreather::Get().Del(this);
 	Close();
-	if (_pGuard) delete _pGuard;
 	if (_pCtx) delete _pCtx;
 }
 
 int ISocket::Connect(const std::string & sIP, int nPort, bool bAutoReconnect /* = false */) {
-	if (sIP.empty() || nPort < 0) return ENet::BadParam;
-
-	int n = _pCtx->Connect(sIP, nPort);
-	if (n == 0 && bAutoReconnect && !_pGuard) {
-		_pGuard = new SocketGuard(this, sIP, nPort);
-		_pGuard->Start();
-	}
-
-	return n;
+	if (sIP.empty() || ((nPort <= 0 || nPort > 65535) && sIP.compare(0, 5, "unix:") != 0)) return ENet::BadParam;
+	return _pCtx->Connect(sIP, nPort, bAutoReconnect);
 }
 
 bool ISocket::IsConnected() {
 	return _pCtx->IsConnected();
 }
 
+void ISocket::SetReconnect(uint32_t nMinDelay, uint32_t nMaxDelay) {
+	_pCtx->SetReconnect(nMinDelay, nMaxDelay);
+}
+
 void ISocket::Close() {
 	_pCtx->Close(ENet::Local);
-
-	if (_pGuard) {
-		delete _pGuard;
-		_pGuard = nullptr;
-	}
 }
 
 bool ISocket::Send(const char * pData, size_t nSize) {
@@ -597,7 +3359,57 @@ bool ISocket::Send(const char * pData, size_t nSize) {
 	return _pCtx->Send(pData, nSize);
 }
 
+bool ISocket::SetFrame(const FrameOption & rOpt) {
+	return _pCtx->SetFrame(rOpt);
+}
+
+bool ISocket::SendFrame(uint32_t nMsgId, const char * pData, size_t nSize) {
+	if (!pData && nSize > 0) return false;
+	return _pCtx->SendFrame(nMsgId, pData, nSize);
+}
+
+size_t ISocket::Pending() {
+	return _pCtx->Pending();
+}
+
+void ISocket::SetSendLimit(size_t nLimit) {
+	_pCtx->SetSendLimit(nLimit);
+}
+
+bool ISocket::Send(const NetSlice * pSlices, int nCount) {
+	return _pCtx->Send(pSlices, nCount);
+}
+
+bool ISocket::SendFrame(uint32_t nMsgId, const NetSlice * pSlices, int nCount) {
+	return _pCtx->SendFrame(nMsgId, pSlices, nCount);
+}
+
+char * ISocket::Prepare(size_t nCapacity) {
+	return _pCtx->Prepare(nCapacity);
+}
+
+bool ISocket::Commit(uint32_t nMsgId, size_t nSize) {
+	return _pCtx->Commit(nMsgId, nSize);
+}
+
+void ISocket::PostSend(const char * pData, size_t nSize) {
+	_pCtx->Post(0, false, pData, nSize);
+}
+
+void ISocket::PostSendFrame(uint32_t nMsgId, const char * pData, size_t nSize) {
+	_pCtx->Post(nMsgId, true, pData, nSize);
+}
+
+void ISocket::SetCoalesce(bool bEnable) {
+	_pCtx->SetCoalesce(bEnable);
+}
+
+void ISocket::Flush() {
+	_pCtx->Flush();
+}
+
 void ISocket::Breath() {
+	Reactor::Get().Poll(0);
 	_pCtx->Breath();
 }
 
@@ -612,9 +3424,9 @@ IServerSocket::~IServerSocket() {
 	if (_pCtx) delete _pCtx;
 }
 
-int IServerSocket::Listen(const std::string & sIP, int nPort) {
-	if (sIP.empty() || nPort < 0) return ENet::BadParam;
-	return _pCtx->Listen(sIP, nPort);
+int IServerSocket::Listen(const std::string & sIP, int nPort, int nIOThreads /* = 0 */) {
+	if (sIP.empty() || nPort < 0 || nIOThreads < 0) return ENet::BadParam;
+	return _pCtx->Listen(sIP, nPort, nIOThreads);
 }
 
 bool IServerSocket::Send(Connection * pConn, const char * pData, size_t nSize) {
@@ -622,11 +3434,135 @@ bool IServerSocket::Send(Connection * pConn, const char * pData, size_t nSize) {
 	return _pCtx->Send(pConn, pData, nSize);
 }
 
+bool IServerSocket::SetFrame(const FrameOption & rOpt) {
+	return _pCtx->SetFrame(rOpt);
+}
+
+bool IServerSocket::SendFrame(Connection * pConn, uint32_t nMsgId, const char * pData, size_t nSize) {
+	if (!pData && nSize > 0) return false;
+	return _pCtx->SendFrame(pConn, nMsgId, pData, nSize);
+}
+
+size_t IServerSocket::Pending(Connection * pConn) {
+	return _pCtx->Pending(pConn);
+}
+
+void IServerSocket::SetSendLimit(size_t nLimit) {
+	_pCtx->SetSendLimit(nLimit);
+}
+
+bool IServerSocket::Send(Connection * pConn, const NetSlice * pSlices, int nCount) {
+	return _pCtx->Send(pConn, pSlices, nCount);
+}
+
+bool IServerSocket::SendFrame(Connection * pConn, uint32_t nMsgId, const NetSlice * pSlices, int nCount) {
+	return _pCtx->SendFrame(pConn, nMsgId, pSlices, nCount);
+}
+
+char * IServerSocket::Prepare(Connection * pConn, size_t nCapacity) {
+	return _pCtx->Prepare(pConn, nCapacity);
+}
+
+bool IServerSocket::Commit(Connection * pConn, uint32_t nMsgId, size_t nSize) {
+	return _pCtx->Commit(pConn, nMsgId, nSize);
+}
+
+bool IServerSocket::SendFile(Connection * pConn, const std::string & sPath, uint64_t nOffset /* = 0 */, uint64_t nSize /* = 0 */) {
+	return _pCtx->SendFile(pConn, sPath, nOffset, nSize, false, 0);
+}
+
+bool IServerSocket::SendFile(Connection * pConn, int nFile, uint64_t nOffset, uint64_t nSize) {
+	return _pCtx->SendFile(pConn, nFile, nOffset, nSize);
+}
+
+bool IServerSocket::SendFileFrame(Connection * pConn, uint32_t nMsgId, const std::string & sPath, uint64_t nOffset /* = 0 */, uint64_t nSize /* = 0 */) {
+	return _pCtx->SendFile(pConn, sPath, nOffset, nSize, true, nMsgId);
+}
+
+bool IServerSocket::SendZeroCopy(Connection * pConn, const char * pData, size_t nSize, std::function<void ()> fDone) {
+	return _pCtx->SendZeroCopy(pConn, false, 0, pData, nSize, std::move(fDone));
+}
+
+bool IServerSocket::SendZeroCopyFrame(Connection * pConn, uint32_t nMsgId, const char * pData, size_t nSize, std::function<void ()> fDone) {
+	return _pCtx->SendZeroCopy(pConn, true, nMsgId, pData, nSize, std::move(fDone));
+}
+
+void IServerSocket::PostSend(uint64_t nConnId, const char * pData, size_t nSize) {
+	_pCtx->Post(nConnId, 0, false, pData, nSize);
+}
+
+void IServerSocket::PostSendFrame(uint64_t nConnId, uint32_t nMsgId, const char * pData, size_t nSize) {
+	_pCtx->Post(nConnId, nMsgId, true, pData, nSize);
+}
+
 void IServerSocket::Broadcast(const char * pData, size_t nSize) {
 	if (!pData || nSize <= 0) return;
 	_pCtx->Broadcast(pData, nSize);
 }
 
+void IServerSocket::BroadcastFrame(uint32_t nMsgId, const char * pData, size_t nSize) {
+	if (!pData && nSize > 0) return;
+	_pCtx->BroadcastFrame(nMsgId, pData, nSize);
+}
+
+bool IServerSocket::Join(Connection * pConn, uint32_t nGroup) {
+	return _pCtx->Join(pConn, nGroup);
+}
+
+bool IServerSocket::Leave(Connection * pConn, uint32_t nGroup) {
+	return _pCtx->Leave(pConn, nGroup);
+}
+
+size_t IServerSocket::Multicast(uint32_t nGroup, const char * pData, size_t nSize) {
+	if (!pData || nSize <= 0) return 0;
+	return _pCtx->Multicast(nGroup, pData, nSize);
+}
+
+size_t IServerSocket::MulticastFrame(uint32_t nGroup, uint32_t nMsgId, const char * pData, size_t nSize) {
+	if (!pData && nSize > 0) return 0;
+	return _pCtx->MulticastFrame(nGroup, nMsgId, pData, nSize);
+}
+
+void IServerSocket::SetCoalesce(bool bEnable) {
+	_pCtx->SetCoalesce(bEnable);
+}
+
+void IServerSocket::SetTimeout(uint32_t nRead, uint32_t nIdle) {
+	_pCtx->SetTimeout(nRead, nIdle);
+}
+
+void IServerSocket::SetHeartbeat(uint32_t nInterval) {
+	_pCtx->SetHeartbeat(nInterval);
+}
+
+void IServerSocket::SetReadBudget(size_t nBytes, uint32_t nMessages /* = 0 */, double dMillis /* = 0 */) {
+	_pCtx->SetReadBudget(nBytes, nMessages, dMillis);
+}
+
+void IServerSocket::SetRateLimit(const RateLimit & rBytes, const RateLimit & rMsgs /* = RateLimit() */) {
+	_pCtx->SetRateLimit(rBytes, rMsgs);
+}
+
+void IServerSocket::SetAcceptLimit(const RateLimit & rLimit) {
+	_pCtx->SetAcceptLimit(rLimit);
+}
+
+void IServerSocket::Stats(ServerStats & rStats) {
+	_pCtx->Stats(rStats);
+}
+
+void IServerSocket::SetDispatch(ThreadPool * pPool) {
+	_pCtx->SetDispatch(pPool);
+}
+
+void IServerSocket::Flush(Connection * pConn) {
+	_pCtx->Flush(pConn);
+}
+
+void IServerSocket::Flush() {
+	_pCtx->Flush();
+}
+
 void IServerSocket::Close(Connection * pConn) {
 	_pCtx->Close(pConn, ENet::Local);
 }
@@ -636,6 +3572,7 @@ void IServerSocket::Shutdown() {
 }
 
 void IServerSocket::Breath() {
+	Reactor::Get().Poll(0);
 	_pCtx->Breath();
 }
 
@@ -643,6 +3580,104 @@ Connection * IServerSocket::Find(uint64_t nConnId) {
 	return _pCtx->Find(nConnId);
 }
 
+IUdpSocket::IUdpSocket() : _pCtx(nullptr) {
+	_pCtx = new UdpSocketContext(this);
+	NetworkBreather::Get().Add(this);
+}
+
+IUdpSocket::~IUdpSocket() {
+	NetworkBreather::Get().Del(this);
+	Shutdown();
+	if (_pCtx) delete _pCtx;
+}
+
+int IUdpSocket::Bind(const std::string & sIP, int nPort) {
+	if (sIP.empty() || nPort < 0) return ENet::BadParam;
+	return _pCtx->Bind(sIP, nPort);
+}
+
+Connection * IUdpSocket::Peer(const std::string & sIP, int nPort) {
+	if (sIP.empty() || nPort <= 0) return nullptr;
+	return _pCtx->Peer(sIP, nPort);
+}
+
+Connection * IUdpSocket::Find(uint64_t nPeerId) {
+	return _pCtx->Find(nPeerId);
+}
+
+void IUdpSocket::SetPeerLimit(size_t nLimit) {
+	_pCtx->SetPeerLimit(nLimit);
+}
+
+bool IUdpSocket::Send(Connection * pPeer, const char * pData, size_t nSize) {
+	if (!pData && nSize > 0) return false;
+	return _pCtx->Send(pPeer, pData, nSize);
+}
+
+void IUdpSocket::Flush() {
+	_pCtx->Flush();
+}
+
+void IUdpSocket::Close(Connection * pPeer) {
+	_pCtx->Close(pPeer, ENet::Local);
+}
+
+void IUdpSocket::Shutdown() {
+	_pCtx->Shutdown();
+}
+
+void IUdpSocket::Breath() {
+	Reactor::Get().Poll(0);
+	_pCtx->Breath();
+}
+
+ISharedMemorySocket::ISharedMemorySocket() : _pCtx(nullptr) {
+	_pCtx = new ShmContext(this);
+	NetworkBreather::Get().Add(this);
+}
+
+ISharedMemorySocket::~ISharedMemorySocket() {
+	NetworkBreather::Get().Del(this);
+	Shutdown();
+	if (_pCtx) delete _pCtx;
+}
+
+int ISharedMemorySocket::Listen(const std::string & sPath) {
+	if (sPath.empty()) return ENet::BadParam;
+	return _pCtx->Listen(sPath);
+}
+
+Connection * ISharedMemorySocket::Connect(const std::string & sPath, size_t nCapacity /* = 1048576 */) {
+	if (sPath.empty()) return nullptr;
+	return _pCtx->Connect(sPath, nCapacity);
+}
+
+Connection * ISharedMemorySocket::Find(uint64_t nPeerId) {
+	return _pCtx->Find(nPeerId);
+}
+
+bool ISharedMemorySocket::Send(Connection * pPeer, const char * pData, size_t nSize) {
+	if (!pData && nSize > 0) return false;
+	return _pCtx->Send(pPeer, pData, nSize);
+}
+
+size_t ISharedMemorySocket::Pending(Connection * pPeer) {
+	return _pCtx->Pending(pPeer);
+}
+
+void ISharedMemorySocket::Close(Connection * pPeer) {
+	_pCtx->Close(pPeer, ENet::Local);
+}
+
+void ISharedMemorySocket::Shutdown() {
+	_pCtx->Shutdown();
+}
+
+void ISharedMemorySocket::Breath() {
+	Reactor::Get().Poll(0);
+	_pCtx->Breath();
+}
+
 string Connection::IP() const {
 	char pAddr[16];
 
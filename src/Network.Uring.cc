@@ -0,0 +1,241 @@
+#include	"Network.Uring.h"
+
+#if !defined(_WIN32) && defined(USE_IO_URING)
+
+#include	<cerrno>
+#include	<cstdio>
+#include	<cstring>
+#include	<linux/io_uring.h>
+#include	<sys/mman.h>
+#include	<sys/socket.h>
+#include	<sys/syscall.h>
+#include	<sys/utsname.h>
+#include	<unistd.h>
+
+static int SysSetup(unsigned nEntries, struct io_uring_params * pParams) {
+	return (int)syscall(__NR_io_uring_setup, nEntries, pParams);
+}
+
+static int SysEnter(int nFd, unsigned nSubmit, unsigned nMinComplete, unsigned nFlags) {
+	return (int)syscall(__NR_io_uring_enter, nFd, nSubmit, nMinComplete, nFlags, NULL, 0);
+}
+
+static int SysRegister(int nFd, unsigned nOpcode, void * pArg, unsigned nArgs) {
+	return (int)syscall(__NR_io_uring_register, nFd, nOpcode, pArg, nArgs);
+}
+
+Uring * Uring::Create() {
+	/// Multishot recv arrived in 6.0.
+	struct utsname iName;
+	int nMajor = 0, nMinor = 0;
+	if (uname(&iName) != 0 || sscanf(iName.release, "%d.%d", &nMajor, &nMinor) != 2 || nMajor < 6) return nullptr;
+
+	Uring * p = new Uring;
+	if (!p->__Setup()) {
+		delete p;
+		return nullptr;
+	}
+
+	return p;
+}
+
+Uring::Uring()
+	: _nFd(-1)
+	, _pSqRing(MAP_FAILED)
+	, _nSqRingSize(0)
+	, _pCqRing(MAP_FAILED)
+	, _nCqRingSize(0)
+	, _pSqes(MAP_FAILED)
+	, _nSqesSize(0)
+	, _pSqHead(nullptr)
+	, _pSqTail(nullptr)
+	, _nSqMask(0)
+	, _nSqEntries(0)
+	, _nSqLocal(0)
+	, _pCqHead(nullptr)
+	, _pCqTail(nullptr)
+	, _nCqMask(0)
+	, _pCqes(nullptr)
+	, _pBufRing(MAP_FAILED)
+	, _pBuffers(nullptr)
+	, _nBufTail(0)
+	, _nLastBuffer(-1) {}
+
+Uring::~Uring() {
+	/// Closing ring cancels everything still in flight.
+	if (_nFd >= 0) close(_nFd);
+	if (_pSqes != MAP_FAILED) munmap(_pSqes, _nSqesSize);
+	if (_pCqRing != MAP_FAILED && _pCqRing != _pSqRing) munmap(_pCqRing, _nCqRingSize);
+	if (_pSqRing != MAP_FAILED) munmap(_pSqRing, _nSqRingSize);
+	if (_pBufRing != MAP_FAILED) munmap(_pBufRing, URING_BUFFERS * sizeof(struct io_uring_buf));
+	delete[] _pBuffers;
+}
+
+bool Uring::Accept(int nSocket, uint64_t nTag) {
+	struct io_uring_sqe * pSqe = (struct io_uring_sqe *)__Sqe();
+	if (!pSqe) return false;
+
+	pSqe->opcode		= IORING_OP_ACCEPT;
+	pSqe->fd			= nSocket;
+	pSqe->ioprio		= IORING_ACCEPT_MULTISHOT;
+	pSqe->accept_flags	= SOCK_NONBLOCK;
+	pSqe->user_data		= nTag;
+	return true;
+}
+
+bool Uring::Recv(int nSocket, uint64_t nTag) {
+	struct io_uring_sqe * pSqe = (struct io_uring_sqe *)__Sqe();
+	if (!pSqe) return false;
+
+	pSqe->opcode		= IORING_OP_RECV;
+	pSqe->fd			= nSocket;
+	pSqe->ioprio		= IORING_RECV_MULTISHOT;
+	pSqe->flags			= IOSQE_BUFFER_SELECT;
+	pSqe->buf_group		= 0;
+	pSqe->user_data		= nTag;
+	return true;
+}
+
+bool Uring::SendMsg(int nSocket, const struct msghdr * pMsg, uint64_t nTag) {
+	struct io_uring_sqe * pSqe = (struct io_uring_sqe *)__Sqe();
+	if (!pSqe) return false;
+
+	pSqe->opcode		= IORING_OP_SENDMSG;
+	pSqe->fd			= nSocket;
+	pSqe->addr			= (uint64_t)(uintptr_t)pMsg;
+	pSqe->len			= 1;
+	pSqe->msg_flags		= MSG_NOSIGNAL;
+	pSqe->user_data		= nTag;
+	return true;
+}
+
+int Uring::Submit() {
+	unsigned nSubmit = _nSqLocal - __atomic_load_n(_pSqHead, __ATOMIC_ACQUIRE);
+	__atomic_store_n(_pSqTail, _nSqLocal, __ATOMIC_RELEASE);
+
+	/// GETEVENTS also moves overflowed completions back to ring.
+	while (true) {
+		int n = SysEnter(_nFd, nSubmit, 0, IORING_ENTER_GETEVENTS);
+		if (n >= 0) return n;
+		if (errno != EINTR) return -errno;
+	}
+}
+
+bool Uring::Next(Event & rEvent) {
+	if (_nLastBuffer >= 0) {
+		__Recycle(_nLastBuffer);
+		_nLastBuffer = -1;
+	}
+
+	unsigned nHead = *_pCqHead;
+	if (nHead == __atomic_load_n(_pCqTail, __ATOMIC_ACQUIRE)) return false;
+
+	struct io_uring_cqe * pCqe = (struct io_uring_cqe *)_pCqes + (nHead & _nCqMask);
+	rEvent.nTag		= pCqe->user_data;
+	rEvent.nResult	= pCqe->res;
+	rEvent.bMore	= (pCqe->flags & IORING_CQE_F_MORE) != 0;
+	rEvent.pData	= nullptr;
+
+	if (pCqe->flags & IORING_CQE_F_BUFFER) {
+		_nLastBuffer = (int)(pCqe->flags >> IORING_CQE_BUFFER_SHIFT);
+		rEvent.pData = _pBuffers + (size_t)_nLastBuffer * URING_BUFSIZE;
+	}
+
+	__atomic_store_n(_pCqHead, nHead + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+bool Uring::__Setup() {
+	struct io_uring_params iParams;
+	memset(&iParams, 0, sizeof(iParams));
+
+	/// Multishot operations produce many completions per submission.
+	iParams.flags		= IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER;
+	iParams.cq_entries	= URING_ENTRIES * 4;
+
+	if ((_nFd = SysSetup(URING_ENTRIES, &iParams)) < 0) {
+		iParams.flags = IORING_SETUP_CQSIZE;
+		if ((_nFd = SysSetup(URING_ENTRIES, &iParams)) < 0) return false;
+	}
+
+	if (!(iParams.features & IORING_FEAT_SINGLE_MMAP) || !(iParams.features & IORING_FEAT_NODROP)) return false;
+
+	_nSqRingSize = iParams.sq_off.array + iParams.sq_entries * sizeof(unsigned);
+	_nCqRingSize = iParams.cq_off.cqes + iParams.cq_entries * sizeof(struct io_uring_cqe);
+	if (_nCqRingSize > _nSqRingSize) _nSqRingSize = _nCqRingSize;
+	_nCqRingSize = _nSqRingSize;
+
+	_pSqRing = mmap(0, _nSqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _nFd, IORING_OFF_SQ_RING);
+	if (_pSqRing == MAP_FAILED) return false;
+	_pCqRing = _pSqRing;
+
+	_nSqesSize = iParams.sq_entries * sizeof(struct io_uring_sqe);
+	_pSqes = mmap(0, _nSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _nFd, IORING_OFF_SQES);
+	if (_pSqes == MAP_FAILED) return false;
+
+	char * pSq = (char *)_pSqRing;
+	_pSqHead	= (unsigned *)(pSq + iParams.sq_off.head);
+	_pSqTail	= (unsigned *)(pSq + iParams.sq_off.tail);
+	_nSqMask	= *(unsigned *)(pSq + iParams.sq_off.ring_mask);
+	_nSqEntries	= *(unsigned *)(pSq + iParams.sq_off.ring_entries);
+	_nSqLocal	= *_pSqTail;
+
+	/// Identity mapping, so SQE index is always the slot in array.
+	unsigned * pArray = (unsigned *)(pSq + iParams.sq_off.array);
+	for (unsigned i = 0; i < _nSqEntries; ++i) pArray[i] = i;
+
+	char * pCq = (char *)_pCqRing;
+	_pCqHead	= (unsigned *)(pCq + iParams.cq_off.head);
+	_pCqTail	= (unsigned *)(pCq + iParams.cq_off.tail);
+	_nCqMask	= *(unsigned *)(pCq + iParams.cq_off.ring_mask);
+	_pCqes		= pCq + iParams.cq_off.cqes;
+
+	_pBufRing = mmap(0, URING_BUFFERS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (_pBufRing == MAP_FAILED) return false;
+
+	struct io_uring_buf_reg iReg;
+	memset(&iReg, 0, sizeof(iReg));
+	iReg.ring_addr		= (uint64_t)(uintptr_t)_pBufRing;
+	iReg.ring_entries	= URING_BUFFERS;
+	iReg.bgid			= 0;
+	if (SysRegister(_nFd, IORING_REGISTER_PBUF_RING, &iReg, 1) < 0) return false;
+
+	_pBuffers = new char[(size_t)URING_BUFFERS * URING_BUFSIZE];
+	for (int i = 0; i < URING_BUFFERS; ++i) __Recycle(i);
+	return true;
+}
+
+void * Uring::__Sqe() {
+	if (_nSqLocal - __atomic_load_n(_pSqHead, __ATOMIC_ACQUIRE) >= _nSqEntries) {
+		if (Submit() < 0 || _nSqLocal - __atomic_load_n(_pSqHead, __ATOMIC_ACQUIRE) >= _nSqEntries) return nullptr;
+	}
+
+	struct io_uring_sqe * pSqe = (struct io_uring_sqe *)_pSqes + (_nSqLocal & _nSqMask);
+	memset(pSqe, 0, sizeof(struct io_uring_sqe));
+	++_nSqLocal;
+	return pSqe;
+}
+
+void Uring::__Recycle(int nBuffer) {
+	/// Ring tail overlays resv field of the first entry.
+	struct io_uring_buf * pBuf = (struct io_uring_buf *)_pBufRing + (_nBufTail & (URING_BUFFERS - 1));
+	uint16_t * pTail = &((struct io_uring_buf *)_pBufRing)->resv;
+
+	pBuf->addr	= (uint64_t)(uintptr_t)(_pBuffers + (size_t)nBuffer * URING_BUFSIZE);
+	pBuf->len	= URING_BUFSIZE;
+	pBuf->bid	= (uint16_t)nBuffer;
+
+	__atomic_store_n(pTail, (uint16_t)++_nBufTail, __ATOMIC_RELEASE);
+}
+
+#else
+
+Uring * Uring::Create() { return nullptr; }
+Uring::~Uring() {}
+bool Uring::Accept(int, uint64_t) { return false; }
+bool Uring::Recv(int, uint64_t) { return false; }
+bool Uring::SendMsg(int, const struct msghdr *, uint64_t) { return false; }
+int Uring::Submit() { return -1; }
+bool Uring::Next(Event &) { return false; }
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef		__ENGINE_NETWORK_URING_H_INCLUDED__
+#define		__ENGINE_NETWORK_URING_H_INCLUDED__
+
+#include	<cstddef>
+#include	<cstdint>
+
+struct msghdr;
+
+#define		URING_ENTRIES	4096
+#define		URING_BUFFERS	1024
+#define		URING_BUFSIZE	16384
+#define		URING_DRAIN		1000
+
+/**
+ * Minimal io_uring ring talking to kernel with raw syscalls (no liburing).
+ *
+ * Received data goes into a provided buffer ring, so multishot recv does NOT
+ * need a buffer per connection. SQEs are only handed to kernel by Submit(),
+ * which lets one Breath() batch all its operations into one syscall.
+ *
+ * Only available when built with USE_IO_URING (make URING=1). Create() returns
+ * nullptr otherwise, or if kernel is older than 6.0.
+ **/
+class Uring {
+public:
+	/**
+	 * One completion. pData points into a provided buffer that is given back to
+	 * kernel by the next call of Next(), so use it before that.
+	 **/
+	struct Event {
+		uint64_t	nTag;		//! Tag given when the operation was queued
+		int			nResult;	//! Same as return value of the syscall, -errno on failure
+		bool		bMore;		//! Multishot operation is still armed
+		char *		pData;		//! Received data or nullptr
+	};
+
+public:
+	static Uring *	Create();
+	virtual ~Uring();
+
+	/**
+	 * Ring fd. Readable when completions are waiting, so it can join an epoll.
+	 **/
+	int		Fd() const { return _nFd; }
+
+	/**
+	 * Queue multishot accept on a listening socket. Accepted sockets are non-blocking.
+	 **/
+	bool	Accept(int nSocket, uint64_t nTag);
+
+	/**
+	 * Queue multishot recv using provided buffers.
+	 **/
+	bool	Recv(int nSocket, uint64_t nTag);
+
+	/**
+	 * Queue sendmsg(). Message header and iovec only need to live until next Submit()/Poll().
+	 **/
+	bool	SendMsg(int nSocket, const struct msghdr * pMsg, uint64_t nTag);
+
+	/**
+	 * Hand queued operations to kernel and flush finished ones into completion
+	 * queue. Never blocks.
+	 *
+	 * \return	Number of submitted operations, -errno on failure.
+	 **/
+	int		Submit();
+
+	/**
+	 * Pop next completion.
+	 *
+	 * \return	False if there is no more completion.
+	 **/
+	bool	Next(Event & rEvent);
+
+private:
+	Uring();
+
+	bool	__Setup();
+	void *	__Sqe();
+	void	__Recycle(int nBuffer);
+
+private:
+	int			_nFd;
+	void *		_pSqRing;
+	size_t		_nSqRingSize;
+	void *		_pCqRing;
+	size_t		_nCqRingSize;
+	void *		_pSqes;
+	size_t		_nSqesSize;
+	unsigned *	_pSqHead;
+	unsigned *	_pSqTail;
+	unsigned	_nSqMask;
+	unsigned	_nSqEntries;
+	unsigned	_nSqLocal;
+	unsigned *	_pCqHead;
+	unsigned *	_pCqTail;
+	unsigned	_nCqMask;
+	void *		_pCqes;
+	void *		_pBufRing;
+	char *		_pBuffers;
+	unsigned	_nBufTail;
+	int			_nLastBuffer;
+};
+
+#endif//!	__ENGINE_NETWORK_URING_H_INCLUDED__
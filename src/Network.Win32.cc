@@ -1,44 +1,250 @@
 #if defined(_WIN32)
 
 #include	<Network.h>
+#include	<DateTime.h>
 #include	<Logger.h>
+#include	"Network.Buffer.h"
+#include	"Network.Limit.h"
+#include	"Network.Pool.h"
+#include	"Network.Strand.h"
+#include	"Network.Udp.h"
 
 #define		FD_SETSIZE	4096
 #include	<WinSock2.h>
 #include	<WS2tcpip.h>
 #pragma		comment(lib, "ws2_32.lib")
 
+#include	<fcntl.h>
+#include	<io.h>
+#include	<sys/stat.h>
+
+#include	<algorithm>
 #include	<cstdlib>
 #include	<cstring>
 #include	<map>
+#include	<memory>
+#include	<random>
 #include	<thread>
 #include	<vector>
 
 #define		SOCKET_BUFSIZE	2097152
+#define		CONNECT_TIMEOUT	3000
 
 using namespace std;
 
+/**
+ * Internal state of a connection accepted by IServerSocket.
+ **/
+struct ConnectionContext : public Connection {
+	SendQueue	iSend;
+	RecvBuffer	iRecv;
+	bool		bReadQueued;	//! Waiting in ReadScheduler
+	TokenBucket	iByteTokens;
+	TokenBucket	iMsgTokens;
+	vector<pair<uint32_t, size_t>>	vGroups;
+	TimelineHook<ConnectionContext>	iLastRead;
+	TimelineHook<ConnectionContext>	iLastActive;
+	TimelineHook<ConnectionContext>	iLastPing;
+	TimelineHook<ConnectionContext>	iThrottled;
+	shared_ptr<Strand>	pStrand;	//! Created by the first message dispatched to ThreadPool
+};
+
+/**
+ * Scratch area for recv(). Shared by all sockets breathing on the same thread and
+ * never zero-filled. Bytes that must survive a Breath() go to RecvBuffer instead.
+ **/
+static char * RecvScratch() {
+	static thread_local unique_ptr<char[]> pScratch;
+	if (!pScratch) pScratch.reset(new char[SOCKET_BUFSIZE]);
+	return pScratch.get();
+}
+
+/**
+ * Write as much queued data as possible without blocking. Queue is written with
+ * one WSASend() per 64 blocks. File ranges are read into memory a chunk at a
+ * time when they reach head.
+ *
+ * \param	pStats	Counts syscalls when given.
+ * \return	False if socket is broken.
+ **/
+static bool FlushSendQueue(SOCKET nSocket, SendQueue & rQueue, ServerStats * pStats = nullptr) {
+	WSABUF pBuf[64];
+
+	while (!rQueue.Empty()) {
+		if (!rQueue.Load(SENDQUEUE_CHUNK)) return false;
+
+		DWORD nBuf = 0;
+		for (SendQueue::Block * p = rQueue.Head(); p && nBuf < 64 && !p->IsFile(); p = p->pNext, ++nBuf) {
+			pBuf[nBuf].buf = p->Data();
+			pBuf[nBuf].len = (ULONG)p->Size();
+		}
+
+		DWORD nSend = 0;
+		int nRet = WSASend(nSocket, pBuf, nBuf, &nSend, 0, NULL, NULL);
+		if (pStats) ++pStats->nSendCalls;
+		if (nRet != 0) {
+			if (pStats && WSAGetLastError() == WSAEWOULDBLOCK) ++pStats->nWouldBlock;
+			return WSAGetLastError() == WSAEWOULDBLOCK;
+		}
+
+		rQueue.Consume((size_t)nSend);
+	}
+
+	return true;
+}
+
+/**
+ * Append data to send queue without touching socket. The queue limit only applies
+ * when data is already waiting, so a message is never cut in the middle.
+ *
+ * \return	False if queue is full.
+ **/
+static bool Enqueue(SendQueue & rQueue, size_t nLimit, WSABUF * pBuf, int nBuf) {
+	if (!rQueue.Empty()) {
+		size_t nTotal = 0;
+		for (int i = 0; i < nBuf; ++i) nTotal += pBuf[i].len;
+		if (rQueue.Buffered() + nTotal > nLimit) return false;
+	}
+
+	for (int i = 0; i < nBuf; ++i) rQueue.Append(pBuf[i].buf, pBuf[i].len);
+	return true;
+}
+
+/**
+ * Fill WSABUF with slices. SendOrQueue() moves through the copy, never user's array.
+ *
+ * \return	Number of WSABUF used. -1 if nCount is out of range.
+ **/
+static int ToBuf(WSABUF * pBuf, const NetSlice * pSlices, int nCount) {
+	if (nCount < 0 || nCount > NET_MAXSLICES) return -1;
+
+	for (int i = 0; i < nCount; ++i) {
+		pBuf[i].buf	= (char *)pSlices[i].pData;
+		pBuf[i].len	= (ULONG)pSlices[i].nSize;
+	}
+
+	return nCount;
+}
+
+/**
+ * Send data directly if nothing is queued. Remaining part goes into send queue.
+ *
+ * \param	pStats	Counts syscalls when given.
+ * \return	False if socket is broken or queue is full.
+ **/
+static bool SendOrQueue(SOCKET nSocket, SendQueue & rQueue, size_t nLimit, WSABUF * pBuf, int nBuf, ServerStats * pStats = nullptr) {
+	if (!rQueue.Empty()) return Enqueue(rQueue, nLimit, pBuf, nBuf);
+
+	while (nBuf > 0) {
+		if (pBuf->len == 0) {
+			++pBuf;
+			--nBuf;
+			continue;
+		}
+
+		int nSend = send(nSocket, pBuf->buf, (int)pBuf->len, 0);
+		if (pStats) ++pStats->nSendCalls;
+		if (nSend < 0) {
+			if (WSAGetLastError() == WSAEWOULDBLOCK) {
+				if (pStats) ++pStats->nWouldBlock;
+				break;
+			}
+
+			return false;
+		}
+
+		pBuf->buf += nSend;
+		pBuf->len -= (ULONG)nSend;
+	}
+
+	return Enqueue(rQueue, nLimit, pBuf, nBuf);
+}
+
+/**
+ * Delay before next reconnect, randomized between half and all of nDelay.
+ **/
+static uint32_t RetryDelay(uint32_t nDelay) {
+	static thread_local minstd_rand iRandom(random_device{}());
+	return nDelay / 2 + (uint32_t)(iRandom() % (nDelay / 2 + 1));
+}
+
 class SocketContext {
+	enum State {
+		Idle,		//! Not connected and not trying
+		Waiting,	//! Waiting for next reconnect
+		Connecting,	//! Non-blocking connect in progress
+		Connected,
+	};
+
 public:
 	SocketContext(ISocket * pOwner);
 	virtual ~SocketContext();
 
-	int		Connect(const string & sIP, int nPort);
-	bool	IsConnected() { return _nSocket != INVALID_SOCKET; }
+	int		Connect(const string & sIP, int nPort, bool bReconnect);
+	bool	IsConnected() { return _emState == Connected; }
+	void	SetReconnect(uint32_t nMinDelay, uint32_t nMaxDelay);
 	void	Close(ENet::Close emCode);
 	bool	Send(const char * pData, size_t nSize);
+	size_t	Pending() { return _iSend.Size(); }
+	void	SetSendLimit(size_t nLimit) { _nSendLimit = nLimit; }
+	bool	SetFrame(const FrameOption & rOpt) { return _iCodec.Setup(rOpt); }
+	bool	SendFrame(uint32_t nMsgId, const char * pData, size_t nSize);
+	bool	Send(const NetSlice * pSlices, int nCount);
+	bool	SendFrame(uint32_t nMsgId, const NetSlice * pSlices, int nCount);
+	char *	Prepare(size_t nCapacity);
+	bool	Commit(uint32_t nMsgId, size_t nSize);
+	void	Post(uint32_t nMsgId, bool bFrame, const char * pData, size_t nSize);
+	void	SetCoalesce(bool bEnable) { _bCoalesce = bEnable; }
+	void	Flush();
 	void	Breath();
 
+private:
+	void	__Start();
+	void	__Finish();
+	void	__Fail(int nError);
+	void	__Retry();
+	void	__Reset();
+	bool	__Send(WSABUF * pBuf, int nBuf);
+	void	__Receive(char * pData, size_t nSize);
+
 private:
 	ISocket *		_pOwner;
-	char *			_pReceived;
 	SOCKET			_nSocket;
+	State			_emState;
+	string			_sIP;
+	int				_nPort;
+	bool			_bReconnect;
+	uint32_t		_nMinDelay;
+	uint32_t		_nMaxDelay;
+	uint32_t		_nDelay;	//! Base delay of next reconnect
+	int				_nError;	//! Failure of last attempt found before it reached select()
+	double			_dDeadline;	//! Connect timeout, or time of next reconnect
+	SendQueue		_iSend;
+	RecvBuffer		_iRecv;
+	size_t			_nSendLimit;
+	FrameCodec		_iCodec;
+	PostBox			_iPosts;
+	bool			_bCoalesce;
 };
 
 SocketContext::SocketContext(ISocket * pOwner)
 	: _pOwner(pOwner)
-	, _pReceived(new char[SOCKET_BUFSIZE])
-	, _nSocket(INVALID_SOCKET) {
+	, _nSocket(INVALID_SOCKET)
+	, _emState(Idle)
+	, _sIP()
+	, _nPort(0)
+	, _bReconnect(false)
+	, _nMinDelay(1000)
+	, _nMaxDelay(30000)
+	, _nDelay(1000)
+	, _nError(0)
+	, _dDeadline(0)
+	, _iSend()
+	, _iRecv()
+	, _nSendLimit(SENDQUEUE_LIMIT)
+	, _iCodec()
+	, _iPosts()
+	, _bCoalesce(false) {
 	WSADATA wOut;
 	if (WSAStartup(MAKEWORD(2, 2), &wOut)) throw runtime_error("WinSock2 Startup failed!!!");
 }
@@ -46,150 +252,354 @@ SocketContext::SocketContext(ISocket * pOwner)
 SocketContext::~SocketContext() {
 	Close(ENet::Local);
 	WSACleanup();
-	delete[] _pReceived;
 }
 
-int SocketContext::Connect(const string & sIP, int nPort) {
-	if (_nSocket != INVALID_SOCKET) return ENet::Running;
-	if ((_nSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) == INVALID_SOCKET) return WSAGetLastError();
-	
-	u_long nFlags = 1;
-	if (ioctlsocket(_nSocket, FIONBIO, &nFlags) != 0) {
-		closesocket(_nSocket);
-		_nSocket = INVALID_SOCKET;
-		return WSAGetLastError();
-	}
+int SocketContext::Connect(const string & sIP, int nPort, bool bReconnect) {
+	if (_emState != Idle) return ENet::Running;
 
-	struct sockaddr_in iAddr;
-	memset(&iAddr, 0, sizeof(iAddr));
+	struct in_addr iAddr;
+	if (0 >= inet_pton(AF_INET, sIP.c_str(), &iAddr)) return ENet::BadParam;
 
-	iAddr.sin_family	= AF_INET;
-	iAddr.sin_port		= htons(nPort);
+	_sIP		= sIP;
+	_nPort		= nPort;
+	_bReconnect	= bReconnect;
+	_nDelay		= _nMinDelay;
 
-	if (0 >= inet_pton(AF_INET, sIP.c_str(), &iAddr.sin_addr)) {
-		closesocket(_nSocket);
-		_nSocket = INVALID_SOCKET;
-		return ENet::BadParam;
+	__Start();
+	return ENet::Success;
+}
+
+void SocketContext::SetReconnect(uint32_t nMinDelay, uint32_t nMaxDelay) {
+	_nMinDelay	= std::max(nMinDelay, (uint32_t)1);
+	_nMaxDelay	= std::max(nMaxDelay, _nMinDelay);
+	_nDelay		= _nMinDelay;
+}
+
+void SocketContext::Close(ENet::Close emCode) {
+	if (emCode == ENet::Local) _bReconnect = false;
+
+	State emPrev = _emState;
+	__Reset();
+
+	if (_bReconnect) {
+		__Retry();
+	} else {
+		_emState = Idle;
 	}
 
-	if (connect(_nSocket, (sockaddr *)&iAddr, sizeof(sockaddr)) < 0) {
-		int nErr = WSAGetLastError();
-		if (nErr != WSAEWOULDBLOCK) return nErr;
+	if (emPrev == Connected) _pOwner->OnClose(emCode);
+}
 
-		fd_set iSet;
-		struct timeval iWait;
+bool SocketContext::Send(const char * pData, size_t nSize) {
+	WSABUF iBuf = { (ULONG)nSize, (char *)pData };
+	return __Send(&iBuf, 1);
+}
 
-		iWait.tv_sec	= 3;
-		iWait.tv_usec	= 0;
+bool SocketContext::SendFrame(uint32_t nMsgId, const char * pData, size_t nSize) {
+	char pHeader[FrameCodec::MaxHeader];
+	size_t nHeader = _iCodec.Encode(pHeader, nMsgId, nSize);
+	if (nHeader == 0) return false;
 
-		FD_ZERO(&iSet);
-		FD_SET(_nSocket, &iSet);
+	WSABUF pBuf[2] = { { (ULONG)nHeader, pHeader }, { (ULONG)nSize, (char *)pData } };
+	return __Send(pBuf, 2);
+}
 
-		if (select(0, 0, &iSet, 0, &iWait) <= 0) {
-			closesocket(_nSocket);
-			_nSocket = INVALID_SOCKET;
-			return ENet::Timeout;
-		}
-	}
+bool SocketContext::Send(const NetSlice * pSlices, int nCount) {
+	WSABUF pBuf[NET_MAXSLICES];
+	int nBuf = ToBuf(pBuf, pSlices, nCount);
+	return nBuf >= 0 && __Send(pBuf, nBuf);
+}
 
-	_pOwner->OnConnected();
-	return 0;
+bool SocketContext::SendFrame(uint32_t nMsgId, const NetSlice * pSlices, int nCount) {
+	WSABUF pBuf[NET_MAXSLICES + 1];
+	if (ToBuf(pBuf + 1, pSlices, nCount) < 0) return false;
+
+	size_t nSize = 0;
+	for (int i = 0; i < nCount; ++i) nSize += pSlices[i].nSize;
+
+	char pHeader[FrameCodec::MaxHeader];
+	size_t nHeader = _iCodec.Encode(pHeader, nMsgId, nSize);
+	if (nHeader == 0) return false;
+
+	pBuf[0].buf	= pHeader;
+	pBuf[0].len	= (ULONG)nHeader;
+	return __Send(pBuf, nCount + 1);
 }
 
-void SocketContext::Close(ENet::Close emCode) {
-	if (_nSocket == INVALID_SOCKET) return;
-	closesocket(_nSocket);
-	_nSocket = INVALID_SOCKET;
+char * SocketContext::Prepare(size_t nCapacity) {
+	if (_emState != Connected && _emState != Connecting) return nullptr;
 
-	_pOwner->OnClose(emCode);
+	size_t nHeader = _iCodec.HeaderSize();
+	if (!_iSend.Empty() && _iSend.Buffered() + nHeader + nCapacity > _nSendLimit) return nullptr;
+	return _iSend.Reserve(nHeader + nCapacity) + nHeader;
 }
 
-bool SocketContext::Send(const char * pData, size_t nSize) {
-	if (_nSocket == INVALID_SOCKET) return false;
+bool SocketContext::Commit(uint32_t nMsgId, size_t nSize) {
+	if (_emState != Connected && _emState != Connecting) return false;
 
-	char *	pSend	= (char *)pData;
-	int		nSend	= 0;
-	int		nLeft	= (int)nSize;
+	char pHeader[FrameCodec::MaxHeader];
+	size_t nHeader = _iCodec.HeaderSize();
+	if (nHeader > 0 && _iCodec.Encode(pHeader, nMsgId, nSize, nHeader) != nHeader) return false;
 
-	while (true) {
-		nSend = send(_nSocket, pSend, nLeft, 0);
-		if (nSend < 0) {
-			int nErr = WSAGetLastError();
-			if (nErr == WSAEWOULDBLOCK) {
-				Sleep(1);
-			} else {
-				return false;
-			}
-		} else if (nSend < nLeft) {
-			nLeft -= nSend;
-			pSend += nSend;
-		} else if (nSend == nLeft) {
-			return true;
+	bool bFirst = _iSend.Empty();
+	char * pData = _iSend.Commit(nHeader + nSize);
+	if (!pData) return false;
+	memcpy(pData, pHeader, nHeader);
+
+	if (_emState == Connecting || !bFirst || _bCoalesce) return true;
+	return FlushSendQueue(_nSocket, _iSend);
+}
+
+void SocketContext::Post(uint32_t nMsgId, bool bFrame, const char * pData, size_t nSize) {
+	_iPosts.Push(0, nMsgId, bFrame, pData, nSize);
+}
+
+void SocketContext::Flush() {
+	if (_emState != Connected) return;
+	if (!FlushSendQueue(_nSocket, _iSend)) Close(ENet::Remote);
+}
+
+void SocketContext::Breath() {
+	if (_emState == Waiting && Tick() >= _dDeadline) __Start();
+
+	_iPosts.Drain([this](PostBox::Post & r) {
+		if (r.bFrame) {
+			SendFrame(r.nMsgId, r.Data(), r.nSize);
 		} else {
-			return nLeft == 0;
+			Send(r.Data(), r.nSize);
+		}
+	});
+
+
+	if (_emState == Connecting) {
+		if (_nSocket == INVALID_SOCKET) {
+			__Fail(_nError);
+			return;
 		}
+
+		__Finish();
+		if (_emState != Connected) return;
 	}
-}
 
-void SocketContext::Breath() {
-	if (_nSocket == INVALID_SOCKET) return;
+	Flush();
+	if (_emState != Connected) return;
 
-	memset(_pReceived, 0, SOCKET_BUFSIZE);
-	int nReaded = 0;
+	char *	pReceived	= RecvScratch();
+	int		nReaded		= 0;
 
-	while (true) {
-		int nRecv = recv(_nSocket, _pReceived + nReaded, SOCKET_BUFSIZE - nReaded, 0);
-		if (nRecv < 0) {
-			int nErr = WSAGetLastError();
-			if (nErr == WSAEWOULDBLOCK) {
-				break;
-			} else {
-				Close(ENet::BadData);
-				break;
+	while (_emState == Connected) {
+		int nRecv = recv(_nSocket, pReceived + nReaded, SOCKET_BUFSIZE - nReaded, 0);
+		if (nRecv > 0) {
+			nReaded += nRecv;
+			if (nReaded >= SOCKET_BUFSIZE) {
+				__Receive(pReceived, nReaded);
+				nReaded = 0;
 			}
-		} else if (nRecv == 0) {
-			Close(ENet::Remote);
+		} else if (nRecv < 0 && WSAGetLastError() == WSAEWOULDBLOCK) {
+			if (nReaded > 0) __Receive(pReceived, nReaded);
 			break;
 		} else {
-			nReaded += nRecv;
+			if (nReaded > 0) __Receive(pReceived, nReaded);
+			Close(nRecv == 0 ? ENet::Remote : ENet::BadData);
+			break;
 		}
 	}
+}
+
+void SocketContext::__Start() {
+	_emState	= Connecting;
+	_nError		= 0;
+	_dDeadline	= Tick() + CONNECT_TIMEOUT;
+
+	if ((_nSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) == INVALID_SOCKET) {
+		_nError = WSAGetLastError();
+		return;
+	}
+
+	u_long nFlags = 1;
+	if (ioctlsocket(_nSocket, FIONBIO, &nFlags) != 0) {
+		_nError = WSAGetLastError();
+		__Reset();
+		return;
+	}
+
+	struct sockaddr_in iAddr;
+	memset(&iAddr, 0, sizeof(iAddr));
+
+	iAddr.sin_family	= AF_INET;
+	iAddr.sin_port		= htons(_nPort);
+	inet_pton(AF_INET, _sIP.c_str(), &iAddr.sin_addr);
 
-	if (nReaded > 0) _pOwner->OnReceive(_pReceived, nReaded);
+	if (connect(_nSocket, (sockaddr *)&iAddr, sizeof(sockaddr)) < 0 && WSAGetLastError() != WSAEWOULDBLOCK) {
+		_nError = WSAGetLastError();
+		__Reset();
+	}
 }
 
-class ServerSocketContext {
-	typedef map<uint64_t, Connection *> ConnectionMap;
+void SocketContext::__Finish() {
+	fd_set iWrite, iExcept;
+	struct timeval iWait = { 0, 0 };
+
+	FD_ZERO(&iWrite);
+	FD_ZERO(&iExcept);
+	FD_SET(_nSocket, &iWrite);
+	FD_SET(_nSocket, &iExcept);
+
+	/// Failed connect is reported in except set on Windows.
+	if (select(0, NULL, &iWrite, &iExcept, &iWait) <= 0) {
+		if (Tick() >= _dDeadline) __Fail(ENet::Timeout);
+		return;
+	}
+
+	if (FD_ISSET(_nSocket, &iExcept)) {
+		int nErr = 0;
+		int nLen = sizeof(nErr);
+		getsockopt(_nSocket, SOL_SOCKET, SO_ERROR, (char *)&nErr, &nLen);
+		__Fail(nErr != 0 ? nErr : ENet::Closed);
+		return;
+	}
+
+	_emState = Connected;
+	_nDelay = _nMinDelay;
+	_pOwner->OnConnected();
+}
+
+void SocketContext::__Fail(int nError) {
+	__Reset();
+
+	if (_bReconnect) {
+		__Retry();
+		LOG_WARN("Try to reconnect [%s:%d] ... %d", _sIP.c_str(), _nPort, nError);
+	} else {
+		_emState = Idle;
+	}
+
+	_pOwner->OnConnectFail(nError);
+}
+
+void SocketContext::__Retry() {
+	_emState	= Waiting;
+	_dDeadline	= Tick() + RetryDelay(_nDelay);
+	_nDelay		= std::min(_nDelay * 2, _nMaxDelay);
+}
+
+void SocketContext::__Reset() {
+	if (_nSocket != INVALID_SOCKET) closesocket(_nSocket);
+	_nSocket = INVALID_SOCKET;
+	_iSend.Clear();
+	_iRecv.Clear();
+}
 
+bool SocketContext::__Send(WSABUF * pBuf, int nBuf) {
+	if (_emState == Connecting) return Enqueue(_iSend, _nSendLimit, pBuf, nBuf);
+	if (_emState != Connected) return false;
+	if (_bCoalesce) return Enqueue(_iSend, _nSendLimit, pBuf, nBuf);
+	return SendOrQueue(_nSocket, _iSend, _nSendLimit, pBuf, nBuf);
+}
+
+void SocketContext::__Receive(char * pData, size_t nSize) {
+	if (!_iCodec.Enabled()) {
+		_pOwner->OnReceive(pData, nSize);
+		return;
+	}
+
+	bool bOk = _iCodec.Split(_iRecv, pData, nSize, [this](uint32_t nMsgId, char * pBody, size_t nBody) {
+		_pOwner->OnMessage(nMsgId, pBody, nBody);
+		return _emState == Connected;
+	});
+
+	if (!bOk) Close(ENet::BadData);
+}
+
+class ServerSocketContext {
 public:
 	ServerSocketContext(IServerSocket * pOwner);
 	virtual ~ServerSocketContext();
 
 	int		Listen(const string & sIP, int nPort);
 	bool	Send(Connection * pConn, const char * pData, size_t nSize);
+	size_t	Pending(Connection * pConn) { return pConn ? ((ConnectionContext *)pConn)->iSend.Size() : 0; }
+	void	SetSendLimit(size_t nLimit) { _nSendLimit = nLimit; }
+	bool	SetFrame(const FrameOption & rOpt) { return _iCodec.Setup(rOpt); }
+	bool	SendFrame(Connection * pConn, uint32_t nMsgId, const char * pData, size_t nSize);
+	bool	Send(Connection * pConn, const NetSlice * pSlices, int nCount);
+	bool	SendFrame(Connection * pConn, uint32_t nMsgId, const NetSlice * pSlices, int nCount);
+	char *	Prepare(Connection * pConn, size_t nCapacity);
+	bool	Commit(Connection * pConn, uint32_t nMsgId, size_t nSize);
+	bool	SendFile(Connection * pConn, const string & sPath, uint64_t nOffset, uint64_t nSize, bool bFrame, uint32_t nMsgId);
+	bool	SendFile(Connection * pConn, int nFile, uint64_t nOffset, uint64_t nSize);
+	bool	SendZeroCopy(Connection * pConn, bool bFrame, uint32_t nMsgId, const char * pData, size_t nSize, function<void ()> fDone);
+	void	Post(uint64_t nConnId, uint32_t nMsgId, bool bFrame, const char * pData, size_t nSize);
 	void	Broadcast(const char * pData, size_t nSize);
+	void	BroadcastFrame(uint32_t nMsgId, const char * pData, size_t nSize);
+	bool	Join(Connection * pConn, uint32_t nGroup) { return pConn && _iGroups.Join((ConnectionContext *)pConn, nGroup); }
+	bool	Leave(Connection * pConn, uint32_t nGroup) { return pConn && _iGroups.Leave((ConnectionContext *)pConn, nGroup); }
+	size_t	Multicast(uint32_t nGroup, const char * pData, size_t nSize);
+	size_t	MulticastFrame(uint32_t nGroup, uint32_t nMsgId, const char * pData, size_t nSize);
+	void	SetCoalesce(bool bEnable) { _bCoalesce = bEnable; }
+	void	Flush(Connection * pConn);
+	void	Flush();
+	void	SetTimeout(uint32_t nRead, uint32_t nIdle) { _iTimeouts.SetTimeout(nRead, nIdle, _iConns.Alive()); }
+	void	SetHeartbeat(uint32_t nInterval) { _iTimeouts.SetHeartbeat(nInterval, _iConns.Alive()); }
+	void	SetReadBudget(size_t nBytes, uint32_t nMessages, double dMillis) { _iReads.Setup(nBytes, nMessages, dMillis); }
+	void	SetRateLimit(const RateLimit & rBytes, const RateLimit & rMsgs) { _iLimits.Setup(rBytes, rMsgs, _iConns.Alive()); }
+	void	SetAcceptLimit(const RateLimit & rLimit) { _iAccepts.Setup(rLimit); }
+	void	Stats(ServerStats & rStats);
+	void	SetDispatch(ThreadPool * pPool) { _pDispatch = pPool ? make_shared<StrandGroup>(_pOwner, pPool) : nullptr; }
 	void	Close(Connection * pConn, ENet::Close emCode);
 	void	Shutdown();
 	void	Breath();
 
 	Connection *	Find(uint64_t nConnId);
 
+private:
+	void			__Read(fd_set & rRead);
+	bool			__Read(ConnectionContext * pConn);
+	void			__CheckTimeouts();
+	bool			__Send(ConnectionContext * pConn, WSABUF * pBuf, int nBuf);
+	bool			__SendFile(ConnectionContext * pConn, int nFile, uint64_t nOffset, uint64_t nSize, bool bFrame, uint32_t nMsgId);
+	void			__Receive(ConnectionContext * pConn, char * pData, size_t nSize);
+	SharedPayload *	__Encode(uint32_t nMsgId, const char * pData, size_t nSize);
+	void			__DrainPosts();
+	void			__Deliver(ConnectionContext * pConn, bool bFrame, uint32_t nMsgId, char * pData, size_t nSize);
+	size_t			__Fanout(const vector<ConnectionContext *> & rConns, SharedPayload * pPayload, bool bFrame);
+
 private:
 	IServerSocket *			_pOwner;
-	char *					_pReceived;
 	SOCKET					_nSocket;
-	ConnectionMap			_mConns;
-	ConnectionMap			_mSocket2Conns;
+	ConnectionPool<ConnectionContext>	_iConns;
+	ConnectionGroups<ConnectionContext>	_iGroups;
 	fd_set					_tIO;
+	size_t					_nSendLimit;
+	FrameCodec				_iCodec;
+	bool					_bCoalesce;
+	ConnectionTimeouts<ConnectionContext>	_iTimeouts;
+	ServerStats				_iStats;
+	PostBox					_iPosts;
+	shared_ptr<StrandGroup>	_pDispatch;
+	ReadScheduler<ConnectionContext>	_iReads;
+	uint32_t *				_pMsgBudget;	//! Frames left for connection being read, nullptr for no limit
+	ConnectionLimits<ConnectionContext>	_iLimits;
+	AcceptLimits			_iAccepts;
 };
 
 ServerSocketContext::ServerSocketContext(IServerSocket * pOwner)
 	: _pOwner(pOwner)
-	, _pReceived(new char[SOCKET_BUFSIZE])
 	, _nSocket(INVALID_SOCKET)
-	, _mConns()
-	, _mSocket2Conns()
-	, _tIO() {
+	, _iConns(true)
+	, _iGroups()
+	, _tIO()
+	, _nSendLimit(SENDQUEUE_LIMIT)
+	, _iCodec()
+	, _bCoalesce(false)
+	, _iTimeouts()
+	, _iStats()
+	, _iPosts()
+	, _pDispatch()
+	, _iReads()
+	, _pMsgBudget(nullptr)
+	, _iLimits()
+	, _iAccepts() {
 	WSADATA wOut;
 	if (WSAStartup(MAKEWORD(2, 2), &wOut)) throw runtime_error("WinSock2 Startup failed!!!");
 }
@@ -197,7 +607,6 @@ ServerSocketContext::ServerSocketContext(IServerSocket * pOwner)
 ServerSocketContext::~ServerSocketContext() {
 	Shutdown();
 	WSACleanup();
-	delete[] _pReceived;
 }
 
 int ServerSocketContext::Listen(const string & sIP, int nPort) {
@@ -237,85 +646,213 @@ int ServerSocketContext::Listen(const string & sIP, int nPort) {
 bool ServerSocketContext::Send(Connection * pConn, const char * pData, size_t nSize) {
 	if (!pConn) return false;
 
-	SOCKET	nSocket	= (SOCKET)pConn->nSocket;
-	char *	pSend	= (char *)pData;
-	int		nSend	= 0;
-	int		nLeft	= (int)nSize;
+	WSABUF iBuf = { (ULONG)nSize, (char *)pData };
+	return __Send((ConnectionContext *)pConn, &iBuf, 1);
+}
 
-	while (true) {
-		nSend = send(nSocket, pSend, nLeft, 0);
-		if (nSend < 0) {
-			int nErr = WSAGetLastError();
-			if (nErr == WSAEWOULDBLOCK) {
-				Sleep(1);
-			} else {
-				return false;
-			}
-		} else if (nSend < nLeft) {
-			nLeft -= nSend;
-			pSend += nSend;
-		} else if (nSend == nLeft) {
-			return true;
-		} else {
-			return nLeft == 0;
-		}
+bool ServerSocketContext::SendFrame(Connection * pConn, uint32_t nMsgId, const char * pData, size_t nSize) {
+	if (!pConn) return false;
+
+	char pHeader[FrameCodec::MaxHeader];
+	size_t nHeader = _iCodec.Encode(pHeader, nMsgId, nSize);
+	if (nHeader == 0) return false;
+
+	WSABUF pBuf[2] = { { (ULONG)nHeader, pHeader }, { (ULONG)nSize, (char *)pData } };
+	if (!__Send((ConnectionContext *)pConn, pBuf, 2)) return false;
+
+	++pConn->iStats.nMsgsOut;
+	++_iStats.nMsgsOut;
+	return true;
+}
+
+bool ServerSocketContext::Send(Connection * pConn, const NetSlice * pSlices, int nCount) {
+	if (!pConn) return false;
+
+	WSABUF pBuf[NET_MAXSLICES];
+	int nBuf = ToBuf(pBuf, pSlices, nCount);
+	return nBuf >= 0 && __Send((ConnectionContext *)pConn, pBuf, nBuf);
+}
+
+bool ServerSocketContext::SendFrame(Connection * pConn, uint32_t nMsgId, const NetSlice * pSlices, int nCount) {
+	if (!pConn) return false;
+
+	WSABUF pBuf[NET_MAXSLICES + 1];
+	if (ToBuf(pBuf + 1, pSlices, nCount) < 0) return false;
+
+	size_t nSize = 0;
+	for (int i = 0; i < nCount; ++i) nSize += pSlices[i].nSize;
+
+	char pHeader[FrameCodec::MaxHeader];
+	size_t nHeader = _iCodec.Encode(pHeader, nMsgId, nSize);
+	if (nHeader == 0) return false;
+
+	pBuf[0].buf	= pHeader;
+	pBuf[0].len	= (ULONG)nHeader;
+	if (!__Send((ConnectionContext *)pConn, pBuf, nCount + 1)) return false;
+
+	++pConn->iStats.nMsgsOut;
+	++_iStats.nMsgsOut;
+	return true;
+}
+
+char * ServerSocketContext::Prepare(Connection * pConn, size_t nCapacity) {
+	if (!pConn) return nullptr;
+
+	SendQueue & rQueue = ((ConnectionContext *)pConn)->iSend;
+	size_t nHeader = _iCodec.HeaderSize();
+	if (!rQueue.Empty() && rQueue.Buffered() + nHeader + nCapacity > _nSendLimit) return nullptr;
+	return rQueue.Reserve(nHeader + nCapacity) + nHeader;
+}
+
+bool ServerSocketContext::Commit(Connection * pConn, uint32_t nMsgId, size_t nSize) {
+	if (!pConn) return false;
+
+	char pHeader[FrameCodec::MaxHeader];
+	size_t nHeader = _iCodec.HeaderSize();
+	if (nHeader > 0 && _iCodec.Encode(pHeader, nMsgId, nSize, nHeader) != nHeader) return false;
+
+	ConnectionContext * pCtx = (ConnectionContext *)pConn;
+	bool bFirst = pCtx->iSend.Empty();
+	char * pData = pCtx->iSend.Commit(nHeader + nSize);
+	if (!pData) return false;
+	memcpy(pData, pHeader, nHeader);
+
+	_iTimeouts.Sent(pCtx);
+	pConn->iStats.nBytesOut += nHeader + nSize;
+	_iStats.nBytesOut += nHeader + nSize;
+	if (nHeader > 0) {
+		++pConn->iStats.nMsgsOut;
+		++_iStats.nMsgsOut;
 	}
+
+	RecordQueued(_iStats, pConn, pCtx->iSend.Size());
+
+	/// Same as __Send() : written now unless coalescing, when Flush() writes it.
+	if (!bFirst || _bCoalesce) return true;
+	return FlushSendQueue((SOCKET)pCtx->nSocket, pCtx->iSend, &_iStats);
+}
+
+bool ServerSocketContext::SendFile(Connection * pConn, const string & sPath, uint64_t nOffset, uint64_t nSize, bool bFrame, uint32_t nMsgId) {
+	if (!pConn) return false;
+
+	int nFile = _open(sPath.c_str(), _O_RDONLY | _O_BINARY | _O_NOINHERIT);
+	if (nFile < 0) return false;
+	return __SendFile((ConnectionContext *)pConn, nFile, nOffset, nSize, bFrame, nMsgId);
+}
+
+bool ServerSocketContext::SendFile(Connection * pConn, int nFile, uint64_t nOffset, uint64_t nSize) {
+	if (!pConn || nFile < 0) return false;
+
+	int nDup = _dup(nFile);
+	if (nDup < 0) return false;
+	return __SendFile((ConnectionContext *)pConn, nDup, nOffset, nSize, false, 0);
+}
+
+bool ServerSocketContext::SendZeroCopy(Connection * pConn, bool bFrame, uint32_t nMsgId, const char * pData, size_t nSize, function<void ()> fDone) {
+	/// No MSG_ZEROCOPY on Windows. Copied like Send(), so buffer is free at once.
+	bool bOk = bFrame ? SendFrame(pConn, nMsgId, pData, nSize) : Send(pConn, pData, nSize);
+	if (bOk && fDone) fDone();
+	return bOk;
+}
+
+void ServerSocketContext::Post(uint64_t nConnId, uint32_t nMsgId, bool bFrame, const char * pData, size_t nSize) {
+	_iPosts.Push(nConnId, nMsgId, bFrame, pData, nSize);
 }
 
 void ServerSocketContext::Broadcast(const char * pData, size_t nSize) {
-	for (auto & kv : _mConns) {
-		SOCKET	nSocket	= (SOCKET)kv.second->nSocket;
-		char *	pSend	= (char *)pData;
-		int		nSend	= 0;
-		int		nLeft	= (int)nSize;
-
-		while (true) {
-			nSend = send(nSocket, pSend, nLeft, 0);
-			if (nSend < 0) {
-				int nErr = WSAGetLastError();
-				if (nErr == WSAEWOULDBLOCK) {
-					Sleep(1);
-				} else {
-					break;
-				}
-			} else if (nSend < nLeft) {
-				nLeft -= nSend;
-				pSend += nSend;
-			} else {
-				break;
-			}
-		}
+	SharedPayload * pPayload = SharedPayload::New(nSize);
+	memcpy(pPayload->Data(), pData, nSize);
+	__Fanout(_iConns.Alive(), pPayload, false);
+	pPayload->Release();
+}
+
+void ServerSocketContext::BroadcastFrame(uint32_t nMsgId, const char * pData, size_t nSize) {
+	SharedPayload * pPayload = __Encode(nMsgId, pData, nSize);
+	if (!pPayload) return;
+
+	__Fanout(_iConns.Alive(), pPayload, true);
+	pPayload->Release();
+}
+
+size_t ServerSocketContext::Multicast(uint32_t nGroup, const char * pData, size_t nSize) {
+	auto pMembers = _iGroups.Find(nGroup);
+	if (!pMembers) return 0;
+
+	SharedPayload * pPayload = SharedPayload::New(nSize);
+	memcpy(pPayload->Data(), pData, nSize);
+	size_t nCount = __Fanout(*pMembers, pPayload, false);
+	pPayload->Release();
+	return nCount;
+}
+
+size_t ServerSocketContext::MulticastFrame(uint32_t nGroup, uint32_t nMsgId, const char * pData, size_t nSize) {
+	auto pMembers = _iGroups.Find(nGroup);
+	if (!pMembers) return 0;
+
+	SharedPayload * pPayload = __Encode(nMsgId, pData, nSize);
+	if (!pPayload) return 0;
+
+	size_t nCount = __Fanout(*pMembers, pPayload, true);
+	pPayload->Release();
+	return nCount;
+}
+
+void ServerSocketContext::Flush(Connection * pConn) {
+	if (!pConn) return;
+	if (!FlushSendQueue((SOCKET)pConn->nSocket, ((ConnectionContext *)pConn)->iSend, &_iStats)) Close(pConn, ENet::Remote);
+}
+
+void ServerSocketContext::Flush() {
+	vector<Connection *> vBroken;
+	for (size_t i = 0; i < _iConns.Size(); ++i) {
+		ConnectionContext * pConn = _iConns[i];
+		if (!FlushSendQueue((SOCKET)pConn->nSocket, pConn->iSend, &_iStats)) vBroken.push_back(pConn);
 	}
+
+	for (auto pConn : vBroken) Close(pConn, ENet::Remote);
+}
+
+void ServerSocketContext::Stats(ServerStats & rStats) {
+	rStats = _iStats;
+	rStats.nAlive = _iConns.Size();
 }
 
 void ServerSocketContext::Close(Connection * pConn, ENet::Close emCode) {
 	if (!pConn) return;
 
 	SOCKET nSocket = (SOCKET)pConn->nSocket;
-	uint64_t nConnId = pConn->nId;
-	
+	++_iStats.pCloses[emCode];
+
 	_pOwner->OnClose(pConn, emCode);
+	_iGroups.LeaveAll((ConnectionContext *)pConn);
+	_iTimeouts.Remove((ConnectionContext *)pConn);
+	_iLimits.Remove((ConnectionContext *)pConn);
 	FD_CLR(nSocket, &_tIO);
 	closesocket(nSocket);
-	delete pConn;
-
-	_mConns.erase(nConnId);
-	_mSocket2Conns.erase((uint64_t)nSocket);
+	_iConns.Free((ConnectionContext *)pConn);
 }
 
 void ServerSocketContext::Shutdown() {
 	if (_nSocket == INVALID_SOCKET) return;
 
-	for (auto & kv : _mConns) {
-		Connection * pConn = kv.second;
+	while (_iConns.Size() > 0) {
+		ConnectionContext * pConn = _iConns[_iConns.Size() - 1];
+		++_iStats.pCloses[ENet::Local];
 		_pOwner->OnClose(pConn, ENet::Local);
 		closesocket((SOCKET)pConn->nSocket);
-		delete pConn;
+		_iConns.Free(pConn);
 	}
 
+	_iGroups.Clear();
+	_iTimeouts.Clear();
+	_iReads.Clear();
+	_iLimits.Clear();
+
+	if (_pDispatch) {
+		_pDispatch->Stop();
+		SetDispatch(_pDispatch->pPool);
+	}
 	FD_ZERO(&_tIO);
-	_mConns.clear();
-	_mSocket2Conns.clear();
 
 	closesocket(_nSocket);
 	_nSocket = INVALID_SOCKET;
@@ -325,8 +862,13 @@ void ServerSocketContext::Shutdown() {
 
 void ServerSocketContext::Breath() {
 	if (_nSocket == INVALID_SOCKET) return;
+
+	double dStart = Tick();
+	_iTimeouts.Update();
+	_iLimits.Update();
+	__DrainPosts();
+
 	static fd_set iRead;
-	static uint64_t nAllocId = 0;
 	static struct timeval iWait = { 0, 1 };
 
 	sockaddr_in iAddr;
@@ -337,6 +879,12 @@ void ServerSocketContext::Breath() {
 		SOCKET nAccept = accept(_nSocket, (sockaddr *)&iAddr, &nSizeOfAddr);
 		if (nAccept == INVALID_SOCKET) break;
 
+		if (!_iAccepts.Allow(iAddr.sin_addr.s_addr, dStart)) {
+			++_iStats.nRefused;
+			closesocket(nAccept);
+			continue;
+		}
+
 		inet_ntop(AF_INET, &iAddr, pAddr, 128);
 
 		u_long nFlag = 1;
@@ -352,111 +900,402 @@ void ServerSocketContext::Breath() {
 
 		FD_SET(nAccept, &_tIO);
 
-		uint64_t nConnId = nAllocId + 1;
-		nAllocId++;
-
-		Connection * pConn	= new Connection;
-		pConn->nId		= nConnId;
+		ConnectionContext * pConn = _iConns.Alloc();
 		pConn->nSocket	= (int)nAccept;
 		pConn->nIP		= iAddr.sin_addr.s_addr;
 		pConn->nPort	= iAddr.sin_port;
 		pConn->pData	= nullptr;
 
-		_mConns[nConnId] = pConn;
-		_mSocket2Conns[(uint64_t)nAccept] = pConn;
-
+		++_iStats.nAccepted;
+		_iTimeouts.Received(pConn);
+		_iLimits.Attach(pConn);
 		_pOwner->OnAccept(pConn);
 	}
 
+	Flush();
 	memcpy(&iRead, &_tIO, sizeof(_tIO));
 
-	if (select(0, &iRead, 0, 0, &iWait) <= 0) return;
+	/// Clients left by read budget, or throttled ones with refilled tokens, are read
+	/// even if nothing new arrives.
+	_iLimits.Resume([this](ConnectionContext * pConn) { _iReads.Ready(pConn); });
+	if (select(0, &iRead, 0, 0, &iWait) <= 0) FD_ZERO(&iRead);
+	__Read(iRead);
+	__CheckTimeouts();
 
-	for (u_int n = 0; n < iRead.fd_count; ++n) {
-		SOCKET nSocket = iRead.fd_array[n];
+	RecordBreath(_iStats, Tick() - dStart);
+}
 
-		auto it = _mSocket2Conns.find((uint64_t)nSocket);
-		if (it == _mSocket2Conns.end()) continue;
+void ServerSocketContext::__Read(fd_set & rRead) {
+	for (size_t i = 0; i < _iConns.Size(); ++i) {
+		if (FD_ISSET((SOCKET)_iConns[i]->nSocket, &rRead)) _iReads.Ready(_iConns[i]);
+	}
 
-		int nReaded = 0;
-		int nRecv = 0;
+	/// Callbacks may close connections and reorder the pool. Scheduler holds identifiers.
+	_iStats.nReadDeferred += _iReads.Run(
+		[this](uint64_t nConnId) { return _iConns.Find(nConnId); },
+		[this](ConnectionContext * pConn) { return __Read(pConn); });
+}
 
-		memset(_pReceived, 0, SOCKET_BUFSIZE);
+bool ServerSocketContext::__Read(ConnectionContext * pConn) {
+	uint64_t nConnId = pConn->nId;
+	SOCKET nSocket = (SOCKET)pConn->nSocket;
+	size_t nBudget = _iReads.Bytes();
+	uint32_t nMsgBudget = _iReads.Messages();
 
-		while (true) {
-			nRecv = recv(nSocket, _pReceived + nReaded, SOCKET_BUFSIZE - nReaded, 0);
-			if (nRecv > 0) {
-				nReaded += nRecv;
-				if (nReaded >= SOCKET_BUFSIZE) {
-					_pOwner->OnReceive(it->second, _pReceived, nReaded);
-					memset(_pReceived, 0, SOCKET_BUFSIZE);
-					nReaded = 0;
-				}
-			} else if (nRecv < 0 && WSAGetLastError() == WSAEWOULDBLOCK) {
-				if (nReaded > 0) _pOwner->OnReceive(it->second, _pReceived, nReaded);
-				break;
-			} else {
-				if (nReaded > 0) _pOwner->OnReceive(it->second, _pReceived, nReaded);
-				Close(it->second, nRecv == 0 ? ENet::Remote : ENet::BadData);
-				break;
-			}
-		}
+	if (!_iLimits.Budget(pConn, nBudget, nMsgBudget)) {
+		if (_iLimits.Pause(pConn)) ++_iStats.nThrottled;
+		return false;
 	}
-}
 
-Connection * ServerSocketContext::Find(uint64_t nConnId) {
-	auto it = _mConns.find(nConnId);
-	if (it == _mConns.end()) return nullptr;
-	return it->second;
-}
+	if (nBudget == 0) nBudget = SIZE_MAX;
+	if (nMsgBudget > 0 && _iCodec.Enabled()) _pMsgBudget = &nMsgBudget;
 
-class SocketGuard {
-public:
-	SocketGuard(ISocket * p, const string & sHost, int nPort);
-	virtual ~SocketGuard();
+	/// Frames held back by message budget of last Breath() go first.
+	if (_pMsgBudget && !pConn->iRecv.Empty()) __Receive(pConn, nullptr, 0);
 
-	void	Start();
+	char * pReceived = RecvScratch();
+	size_t nReaded = 0;
+	bool bDrained = false;
 
-private:
-	ISocket *	_p;
-	string		_sHost;
-	int			_nPort;
-	thread *	_pWorker;
-	bool		_bRunning;
-};
+	while (Find(nConnId) && !(_pMsgBudget && *_pMsgBudget == 0)) {
+		int nRecv = recv(nSocket, pReceived + nReaded, (int)std::min((size_t)SOCKET_BUFSIZE - nReaded, nBudget), 0);
+		++_iStats.nRecvCalls;
+		if (nRecv > 0) {
+			nReaded += nRecv;
+			nBudget -= nRecv;
+			if (nReaded >= SOCKET_BUFSIZE || nBudget == 0) {
+				__Receive(pConn, pReceived, nReaded);
+				nReaded = 0;
+				if (nBudget == 0) break;
+			}
+		} else if (nRecv < 0 && WSAGetLastError() == WSAEWOULDBLOCK) {
+			if (nReaded > 0) __Receive(pConn, pReceived, nReaded);
+			bDrained = true;
+			break;
+		} else {
+			if (nReaded > 0) __Receive(pConn, pReceived, nReaded);
+			if (Find(nConnId)) Close(pConn, nRecv == 0 ? ENet::Remote : ENet::BadData);
+			break;
+		}
+	}
 
-SocketGuard::SocketGuard(ISocket * p, const string & sHost, int nPort)
-	: _p(p), _sHost(sHost), _nPort(nPort), _pWorker(nullptr), _bRunning(false) {}
+	/// Stopped by budget before socket was drained, or frames are held back in receive buffer.
+	bool bMore = Find(nConnId) && (!bDrained || (_pMsgBudget && *_pMsgBudget == 0));
+	_pMsgBudget = nullptr;
 
-SocketGuard::~SocketGuard() {
-	_bRunning = false;
-	if (_pWorker) {
-		if (_pWorker->joinable()) _pWorker->join();
-		delete _pWorker;
+	/// Out of tokens rather than read budget. Wait for Resume() instead of next Breath().
+	if (bMore && _iLimits.Exhausted(pConn)) {
+		if (_iLimits.Pause(pConn)) ++_iStats.nThrottled;
+		bMore = false;
 	}
+
+	return bMore;
 }
 
-void SocketGuard::Start() {
-	if (_bRunning) return;
-	_bRunning = true;
+void ServerSocketContext::__CheckTimeouts() {
+	_iTimeouts.Check(
+		[this](ConnectionContext * pConn) { Close(pConn, ENet::TimedOut); },
+		[this](ConnectionContext * pConn) { _pOwner->OnHeartbeat(pConn); });
+}
 
-	if (_pWorker) {
-		if (_pWorker->joinable()) _pWorker->join();
-		delete _pWorker;
+void ServerSocketContext::__Receive(ConnectionContext * pConn, char * pData, size_t nSize) {
+	_iTimeouts.Received(pConn);
+	pConn->iStats.nBytesIn += nSize;
+	_iStats.nBytesIn += nSize;
+
+	if (!_iCodec.Enabled()) {
+		__Deliver(pConn, false, 0, pData, nSize);
+		return;
 	}
 
-	_pWorker = new thread([this]() {
-		while (_bRunning) {
-			if (!_p->IsConnected()) {
-				int n = _p->Connect(_sHost, _nPort, false);
-				if (n != ENet::Success) LOG_WARN("Try to reconnect [%s:%d] ... %d", _sHost.c_str(), _nPort, n);
-			}
+	uint64_t nConnId = pConn->nId;
+	bool bOk = _iCodec.Split(pConn->iRecv, pData, nSize, [this, pConn, nConnId](uint32_t nMsgId, char * pBody, size_t nBody) {
+		++pConn->iStats.nMsgsIn;
+		++_iStats.nMsgsIn;
+		__Deliver(pConn, true, nMsgId, pBody, nBody);
+		return Find(nConnId) != nullptr;
+	}, _pMsgBudget);
+
+	if (!bOk) Close(pConn, ENet::BadData);
+}
 
-			this_thread::sleep_for(chrono::seconds(1));
-		}
+Connection * ServerSocketContext::Find(uint64_t nConnId) {
+	return _iConns.Find(nConnId);
+}
+
+bool ServerSocketContext::__Send(ConnectionContext * pConn, WSABUF * pBuf, int nBuf) {
+	size_t nTotal = 0;
+	for (int i = 0; i < nBuf; ++i) nTotal += pBuf[i].len;
+
+	_iTimeouts.Sent(pConn);
+
+	/// Every queue is flushed by Flush() at the end of frame or in next Breath().
+	if (_bCoalesce) {
+		if (!Enqueue(pConn->iSend, _nSendLimit, pBuf, nBuf)) return false;
+	} else {
+		if (!SendOrQueue((SOCKET)pConn->nSocket, pConn->iSend, _nSendLimit, pBuf, nBuf, &_iStats)) return false;
+	}
+
+	pConn->iStats.nBytesOut += nTotal;
+	_iStats.nBytesOut += nTotal;
+	RecordQueued(_iStats, pConn, pConn->iSend.Size());
+	return true;
+}
+
+bool ServerSocketContext::__SendFile(ConnectionContext * pConn, int nFile, uint64_t nOffset, uint64_t nSize, bool bFrame, uint32_t nMsgId) {
+	struct _stat64 iStat;
+	if (_fstat64(nFile, &iStat) != 0 || !(iStat.st_mode & _S_IFREG) || (uint64_t)iStat.st_size < nOffset) {
+		_close(nFile);
+		return false;
+	}
+
+	uint64_t nLeft = (uint64_t)iStat.st_size - nOffset;
+	if (nSize == 0) nSize = nLeft;
+
+	char pHeader[FrameCodec::MaxHeader];
+	size_t nHeader = 0;
+	SendQueue & rQueue = pConn->iSend;
+
+	bool bOk = nSize <= nLeft && nSize <= (uint64_t)SIZE_MAX;
+	if (bOk && bFrame) bOk = (nHeader = _iCodec.Encode(pHeader, nMsgId, (size_t)nSize)) > 0;
+	if (bOk && !rQueue.Empty()) bOk = rQueue.Buffered() + nHeader <= _nSendLimit;
+	if (!bOk) {
+		_close(nFile);
+		return false;
+	}
+
+	rQueue.Append(pHeader, nHeader);
+	rQueue.AppendFile(nFile, nOffset, (size_t)nSize);
+
+	/// Written by Flush() or next Breath(), a chunk at a time.
+	_iTimeouts.Sent(pConn);
+	pConn->iStats.nBytesOut += nHeader + (size_t)nSize;
+	_iStats.nBytesOut += nHeader + (size_t)nSize;
+	if (bFrame) {
+		++pConn->iStats.nMsgsOut;
+		++_iStats.nMsgsOut;
+	}
+
+	RecordQueued(_iStats, pConn, rQueue.Size());
+	return true;
+}
+
+SharedPayload * ServerSocketContext::__Encode(uint32_t nMsgId, const char * pData, size_t nSize) {
+	char pHeader[FrameCodec::MaxHeader];
+	size_t nHeader = _iCodec.Encode(pHeader, nMsgId, nSize);
+	if (nHeader == 0) return nullptr;
+
+	SharedPayload * pPayload = SharedPayload::New(nHeader + nSize);
+	memcpy(pPayload->Data(), pHeader, nHeader);
+	if (nSize > 0) memcpy(pPayload->Data() + nHeader, pData, nSize);
+	return pPayload;
+}
+
+void ServerSocketContext::__DrainPosts() {
+	_iPosts.Drain([this](PostBox::Post & r) {
+		Connection * pConn = Find(r.nId);
+		bool bSent = pConn && (r.bFrame ? SendFrame(pConn, r.nMsgId, r.Data(), r.nSize) : Send(pConn, r.Data(), r.nSize));
+		if (!bSent) ++_iStats.nPostDropped;
 	});
 }
 
+void ServerSocketContext::__Deliver(ConnectionContext * pConn, bool bFrame, uint32_t nMsgId, char * pData, size_t nSize) {
+	switch (_iLimits.Charge(pConn, nSize, true)) {
+	case ConnectionLimits<ConnectionContext>::Drop:
+		++_iStats.nLimitDropped;
+		return;
+	case ConnectionLimits<ConnectionContext>::Kick:
+		Close(pConn, ENet::Limited);
+		return;
+	default:
+		break;
+	}
+
+	if (_pDispatch) {
+		if (!pConn->pStrand) pConn->pStrand = make_shared<Strand>(_pDispatch, pConn->nId);
+		pConn->pStrand->Push(nMsgId, pData, nSize);
+	} else if (bFrame) {
+		_pOwner->OnMessage(pConn, nMsgId, pData, nSize);
+	} else {
+		_pOwner->OnReceive(pConn, pData, nSize);
+	}
+}
+
+size_t ServerSocketContext::__Fanout(const vector<ConnectionContext *> & rConns, SharedPayload * pPayload, bool bFrame) {
+	size_t nCount = 0;
+
+	/// Queues are flushed together at the beginning of next Breath().
+	for (auto pConn : rConns) {
+		SendQueue & rQueue = pConn->iSend;
+		if (!rQueue.Empty() && rQueue.Buffered() + pPayload->Size() > _nSendLimit) continue;
+
+		rQueue.Append(pPayload);
+		_iTimeouts.Sent(pConn);
+		pConn->iStats.nBytesOut += pPayload->Size();
+		if (bFrame) ++pConn->iStats.nMsgsOut;
+		RecordQueued(_iStats, pConn, rQueue.Size());
+		++nCount;
+	}
+
+	_iStats.nBytesOut += pPayload->Size() * nCount;
+	if (bFrame) _iStats.nMsgsOut += nCount;
+	return nCount;
+}
+
+class UdpSocketContext {
+public:
+	UdpSocketContext(IUdpSocket * pOwner);
+	virtual ~UdpSocketContext();
+
+	int				Bind(const string & sIP, int nPort);
+	Connection *	Peer(const string & sIP, int nPort);
+	Connection *	Find(uint64_t nPeerId) { return _iPeers.Find(nPeerId); }
+	void			SetPeerLimit(size_t nLimit) { _iPeers.SetLimit(nLimit); }
+	bool			Send(Connection * pPeer, const char * pData, size_t nSize);
+	void			Flush();
+	void			Close(Connection * pPeer, ENet::Close emCode);
+	void			Shutdown();
+	void			Breath();
+
+private:
+	IUdpSocket *	_pOwner;
+	SOCKET			_nSocket;
+	UdpPeers		_iPeers;
+	UdpOutbox		_iOut;
+};
+
+UdpSocketContext::UdpSocketContext(IUdpSocket * pOwner)
+	: _pOwner(pOwner)
+	, _nSocket(INVALID_SOCKET)
+	, _iPeers()
+	, _iOut() {
+	WSADATA wOut;
+	if (WSAStartup(MAKEWORD(2, 2), &wOut)) throw runtime_error("WinSock2 Startup failed!!!");
+}
+
+UdpSocketContext::~UdpSocketContext() {
+	Shutdown();
+	WSACleanup();
+}
+
+int UdpSocketContext::Bind(const string & sIP, int nPort) {
+	if (_nSocket != INVALID_SOCKET) return ENet::Running;
+
+	struct sockaddr_in iAddr;
+	memset(&iAddr, 0, sizeof(iAddr));
+
+	iAddr.sin_family	= AF_INET;
+	iAddr.sin_port		= htons(nPort);
+
+	if (0 >= inet_pton(AF_INET, sIP.c_str(), &iAddr.sin_addr)) return ENet::BadParam;
+	if ((_nSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == INVALID_SOCKET) return WSAGetLastError();
+
+	u_long nFlags = 1;
+	if (ioctlsocket(_nSocket, FIONBIO, &nFlags) != 0 || ::bind(_nSocket, (sockaddr *)&iAddr, sizeof(iAddr)) != 0) {
+		int nErr = WSAGetLastError();
+		closesocket(_nSocket);
+		_nSocket = INVALID_SOCKET;
+		return nErr;
+	}
+
+	/// Do NOT let ICMP port unreachable from one peer fail recvfrom() for all.
+	BOOL bReport = FALSE;
+	DWORD nBytes = 0;
+	WSAIoctl(_nSocket, _WSAIOW(IOC_VENDOR, 12), &bReport, sizeof(bReport), NULL, 0, &nBytes, NULL, NULL);
+	return 0;
+}
+
+Connection * UdpSocketContext::Peer(const string & sIP, int nPort) {
+	if (_nSocket == INVALID_SOCKET) return nullptr;
+
+	struct in_addr iAddr;
+	if (0 >= inet_pton(AF_INET, sIP.c_str(), &iAddr)) return nullptr;
+
+	int nNetPort = htons(nPort);
+	PeerContext * pPeer = _iPeers.Find((uint32_t)iAddr.s_addr, nNetPort);
+	return pPeer ? pPeer : _iPeers.Add((int)_nSocket, (uint32_t)iAddr.s_addr, nNetPort);
+}
+
+bool UdpSocketContext::Send(Connection * pPeer, const char * pData, size_t nSize) {
+	if (_nSocket == INVALID_SOCKET || !pPeer || nSize > UDP_MAXDATA) return false;
+	if (_iOut.Bytes() + nSize > UDP_SENDLIMIT) return false;
+
+	_iOut.Push(pPeer->nIP, pPeer->nPort, pData, nSize);
+	return true;
+}
+
+void UdpSocketContext::Flush() {
+	size_t nDone = 0;
+	size_t nTotal = _iOut.Count();
+
+	struct sockaddr_in iAddr;
+	memset(&iAddr, 0, sizeof(iAddr));
+	iAddr.sin_family = AF_INET;
+
+	for (; _nSocket != INVALID_SOCKET && nDone < nTotal; ++nDone) {
+		const UdpOutbox::Datagram & r = _iOut[nDone];
+		iAddr.sin_addr.s_addr	= r.nIP;
+		iAddr.sin_port			= (u_short)r.nPort;
+
+		if (sendto(_nSocket, _iOut.Data(r), (int)r.nSize, 0, (sockaddr *)&iAddr, sizeof(iAddr)) < 0 && WSAGetLastError() == WSAEWOULDBLOCK) break;
+	}
+
+	_iOut.Drop(nDone);
+}
+
+void UdpSocketContext::Close(Connection * pPeer, ENet::Close emCode) {
+	if (!pPeer) return;
+
+	_pOwner->OnClose(pPeer, emCode);
+	_iPeers.Remove((PeerContext *)pPeer);
+}
+
+void UdpSocketContext::Shutdown() {
+	if (_nSocket == INVALID_SOCKET) return;
+
+	while (!_iPeers.Alive().empty()) Close(_iPeers.Alive().back(), ENet::Local);
+
+	_iOut.Clear();
+	closesocket(_nSocket);
+	_nSocket = INVALID_SOCKET;
+
+	_pOwner->OnShutdown();
+}
+
+void UdpSocketContext::Breath() {
+	Flush();
+
+	/// No recvmmsg() on Windows. One datagram per call into the shared scratch.
+	char * pReceived = RecvScratch();
+	struct sockaddr_in iAddr;
+
+	while (_nSocket != INVALID_SOCKET) {
+		int nSizeOfAddr = sizeof(iAddr);
+		int nRecv = recvfrom(_nSocket, pReceived, UDP_BUFSIZE, 0, (sockaddr *)&iAddr, &nSizeOfAddr);
+		if (nRecv < 0) {
+			int nErr = WSAGetLastError();
+			if (nErr == WSAEMSGSIZE || nErr == WSAECONNRESET) continue;
+			break;
+		}
+
+		uint32_t nIP = (uint32_t)iAddr.sin_addr.s_addr;
+		int nPort = iAddr.sin_port;
+
+		PeerContext * pPeer = _iPeers.Find(nIP, nPort);
+		if (!pPeer) {
+			if (_iPeers.Full()) continue;
+			pPeer = _iPeers.Add((int)_nSocket, nIP, nPort);
+
+			/// OnAccept() may reject this peer by closing it.
+			uint64_t nPeerId = pPeer->nId;
+			_pOwner->OnAccept(pPeer);
+			if (!_iPeers.Find(nPeerId)) continue;
+		}
+
+		_pOwner->OnReceive(pPeer, pReceived, (size_t)nRecv);
+	}
+}
+
 class NetworkBreather {
 public:
 	NetworkBreather() {}
@@ -465,14 +1304,24 @@ public:
 
 	void	Add(ISocket * p);
 	void	Add(IServerSocket * p);
+	void	Add(IUdpSocket * p);
+	void	Add(IReliableSocket * p);
+	void	Add(IMessageBus * p);
 	void	Del(ISocket * p);
 	void	Del(IServerSocket * p);
+	void	Del(IUdpSocket * p);
+	void	Del(IReliableSocket * p);
+	void	Del(IMessageBus * p);
 	
 	void	Breath();
+	void	Flush();
 
 private:
 	vector<ISocket *>		_vClients;
 	vector<IServerSocket *>	_vServers;
+	vector<IUdpSocket *>	_vUdps;
+	vector<IReliableSocket *>	_vReliables;
+	vector<IMessageBus *>	_vBuses;
 };
 
 NetworkBreather & NetworkBreather::Get() {
@@ -497,6 +1346,30 @@ void NetworkBreather::Add(IServerSocket * p) {
 	_vServers.push_back(p);
 }
 
+void NetworkBreather::Add(IUdpSocket * p) {
+	for (auto pUdp : _vUdps) {
+		if (pUdp == p) return;
+	}
+
+	_vUdps.push_back(p);
+}
+
+void NetworkBreather::Add(IReliableSocket * p) {
+	for (auto pReliable : _vReliables) {
+		if (pReliable == p) return;
+	}
+
+	_vReliables.push_back(p);
+}
+
+void NetworkBreather::Add(IMessageBus * p) {
+	for (auto pBus : _vBuses) {
+		if (pBus == p) return;
+	}
+
+	_vBuses.push_back(p);
+}
+
 void NetworkBreather::Del(ISocket * p) {
 	auto it = find(_vClients.begin(), _vClients.end(), p);
 	if (it != _vClients.end()) _vClients.erase(it);
@@ -507,16 +1380,81 @@ void NetworkBreather::Del(IServerSocket * p) {
 	if (it != _vServers.end()) _vServers.erase(it);
 }
 
+void NetworkBreather::Del(IUdpSocket * p) {
+	auto it = find(_vUdps.begin(), _vUdps.end(), p);
+	if (it != _vUdps.end()) _vUdps.erase(it);
+}
+
+void NetworkBreather::Del(IReliableSocket * p) {
+	auto it = find(_vReliables.begin(), _vReliables.end(), p);
+	if (it != _vReliables.end()) _vReliables.erase(it);
+}
+
+void NetworkBreather::Del(IMessageBus * p) {
+	auto it = find(_vBuses.begin(), _vBuses.end(), p);
+	if (it != _vBuses.end()) _vBuses.erase(it);
+}
+
 void NetworkBreather::Breath() {
-	for (auto p : _vClients) p->Breath();
-	for (auto p : _vServers) p->Breath();
+	/// Callbacks may create or destroy sockets (eg. bus links), so lists are walked by index.
+	for (size_t i = 0; i < _vClients.size(); ++i) _vClients[i]->Breath();
+	for (size_t i = 0; i < _vServers.size(); ++i) _vServers[i]->Breath();
+	for (size_t i = 0; i < _vUdps.size(); ++i) _vUdps[i]->Breath();
+
+	/// UDP links of reliable sockets were received above. Only run their timers.
+	for (size_t i = 0; i < _vReliables.size(); ++i) _vReliables[i]->Flush();
+
+	/// Links of buses were read above too. Only flush batches and run keep-alive.
+	for (size_t i = 0; i < _vBuses.size(); ++i) _vBuses[i]->Flush();
+}
+
+void NetworkBreather::Flush() {
+	/// Batches of buses go to send queues of their links first.
+	for (size_t i = 0; i < _vBuses.size(); ++i) _vBuses[i]->Flush();
+	for (size_t i = 0; i < _vClients.size(); ++i) _vClients[i]->Flush();
+	for (size_t i = 0; i < _vServers.size(); ++i) _vServers[i]->Flush();
+	for (size_t i = 0; i < _vReliables.size(); ++i) _vReliables[i]->Flush();
+	for (size_t i = 0; i < _vUdps.size(); ++i) _vUdps[i]->Flush();
 }
 
 void AutoNetworkBreath() {
 	NetworkBreather::Get().Breath();
 }
 
-ISocket::ISocket() : _pCtx(nullptr), _pGuard(nullptr) {
+void AutoNetworkFlush() {
+	NetworkBreather::Get().Flush();
+}
+
+bool AutoNetworkWait(double dDeadline) {
+	/// No reactor for select model. Keep the old 1ms polling.
+	double dLeft = std::min(dDeadline - Tick(), 1.0);
+	if (dLeft > 0) this_thread::sleep_for(chrono::duration<double, milli>(dLeft));
+	return false;
+}
+
+void AutoNetworkDue(double dTime) {
+	(void)dTime;
+}
+
+void AutoNetworkWake() {}
+
+void AutoNetworkAdd(IReliableSocket * p) {
+	NetworkBreather::Get().Add(p);
+}
+
+void AutoNetworkDel(IReliableSocket * p) {
+	NetworkBreather::Get().Del(p);
+}
+
+void AutoNetworkAdd(IMessageBus * p) {
+	NetworkBreather::Get().Add(p);
+}
+
+void AutoNetworkDel(IMessageBus * p) {
+	NetworkBreather::Get().Del(p);
+}
+
+ISocket::ISocket() : _pCtx(nullptr) {
 	_pCtx = new SocketContext(this);
 	NetworkBreather::Get().Add(this);
 }
@@ -524,33 +1462,24 @@ ISocket::ISocket() : _pCtx(nullptr), _pGuard(nullptr) {
 ISocket::~ISocket() {
 	NetworkBreather::Get().Del(this);
 	Close();
-	if (_pGuard) delete _pGuard;
 	if (_pCtx) delete _pCtx;
 }
 
 int ISocket::Connect(const std::string & sIP, int nPort, bool bAutoReconnect /* = false */) {
-	if (sIP.empty() || nPort < 0) return ENet::BadParam;
-	
-	int n = _pCtx->Connect(sIP, nPort);
-	if (n == 0 && bAutoReconnect && !_pGuard) {
-		_pGuard = new SocketGuard(this, sIP, nPort);
-		_pGuard->Start();
-	}
-
-	return n;
+	if (sIP.empty() || nPort <= 0 || nPort > 65535) return ENet::BadParam;
+	return _pCtx->Connect(sIP, nPort, bAutoReconnect);
 }
 
 bool ISocket::IsConnected() {
 	return _pCtx->IsConnected();
 }
 
+void ISocket::SetReconnect(uint32_t nMinDelay, uint32_t nMaxDelay) {
+	_pCtx->SetReconnect(nMinDelay, nMaxDelay);
+}
+
 void ISocket::Close() {
 	_pCtx->Close(ENet::Local);
-
-	if (_pGuard) {
-		delete _pGuard;
-		_pGuard = nullptr;
-	}
 }
 
 bool ISocket::Send(const char * pData, size_t nSize) {
@@ -558,6 +1487,55 @@ bool ISocket::Send(const char * pData, size_t nSize) {
 	return _pCtx->Send(pData, nSize);
 }
 
+bool ISocket::SetFrame(const FrameOption & rOpt) {
+	return _pCtx->SetFrame(rOpt);
+}
+
+bool ISocket::SendFrame(uint32_t nMsgId, const char * pData, size_t nSize) {
+	if (!pData && nSize > 0) return false;
+	return _pCtx->SendFrame(nMsgId, pData, nSize);
+}
+
+size_t ISocket::Pending() {
+	return _pCtx->Pending();
+}
+
+void ISocket::SetSendLimit(size_t nLimit) {
+	_pCtx->SetSendLimit(nLimit);
+}
+
+bool ISocket::Send(const NetSlice * pSlices, int nCount) {
+	return _pCtx->Send(pSlices, nCount);
+}
+
+bool ISocket::SendFrame(uint32_t nMsgId, const NetSlice * pSlices, int nCount) {
+	return _pCtx->SendFrame(nMsgId, pSlices, nCount);
+}
+
+char * ISocket::Prepare(size_t nCapacity) {
+	return _pCtx->Prepare(nCapacity);
+}
+
+bool ISocket::Commit(uint32_t nMsgId, size_t nSize) {
+	return _pCtx->Commit(nMsgId, nSize);
+}
+
+void ISocket::PostSend(const char * pData, size_t nSize) {
+	_pCtx->Post(0, false, pData, nSize);
+}
+
+void ISocket::PostSendFrame(uint32_t nMsgId, const char * pData, size_t nSize) {
+	_pCtx->Post(nMsgId, true, pData, nSize);
+}
+
+void ISocket::SetCoalesce(bool bEnable) {
+	_pCtx->SetCoalesce(bEnable);
+}
+
+void ISocket::Flush() {
+	_pCtx->Flush();
+}
+
 void ISocket::Breath() {
 	_pCtx->Breath();
 }
@@ -573,8 +1551,9 @@ IServerSocket::~IServerSocket() {
 	if (_pCtx) delete _pCtx;
 }
 
-int IServerSocket::Listen(const std::string & sIP, int nPort) {
-	if (sIP.empty() || nPort < 0) return ENet::BadParam;
+int IServerSocket::Listen(const std::string & sIP, int nPort, int nIOThreads /* = 0 */) {
+	if (sIP.empty() || nPort < 0 || nIOThreads < 0) return ENet::BadParam;
+	if (nIOThreads > 0) LOG_WARN("I/O threads are not supported with select model. Listen [%s:%d] in Breath() instead.", sIP.c_str(), nPort);
 	return _pCtx->Listen(sIP, nPort);
 }
 
@@ -583,11 +1562,135 @@ bool IServerSocket::Send(Connection * pConn, const char * pData, size_t nSize) {
 	return _pCtx->Send(pConn, pData, nSize);
 }
 
+bool IServerSocket::SetFrame(const FrameOption & rOpt) {
+	return _pCtx->SetFrame(rOpt);
+}
+
+bool IServerSocket::SendFrame(Connection * pConn, uint32_t nMsgId, const char * pData, size_t nSize) {
+	if (!pData && nSize > 0) return false;
+	return _pCtx->SendFrame(pConn, nMsgId, pData, nSize);
+}
+
+size_t IServerSocket::Pending(Connection * pConn) {
+	return _pCtx->Pending(pConn);
+}
+
+void IServerSocket::SetSendLimit(size_t nLimit) {
+	_pCtx->SetSendLimit(nLimit);
+}
+
+bool IServerSocket::Send(Connection * pConn, const NetSlice * pSlices, int nCount) {
+	return _pCtx->Send(pConn, pSlices, nCount);
+}
+
+bool IServerSocket::SendFrame(Connection * pConn, uint32_t nMsgId, const NetSlice * pSlices, int nCount) {
+	return _pCtx->SendFrame(pConn, nMsgId, pSlices, nCount);
+}
+
+char * IServerSocket::Prepare(Connection * pConn, size_t nCapacity) {
+	return _pCtx->Prepare(pConn, nCapacity);
+}
+
+bool IServerSocket::Commit(Connection * pConn, uint32_t nMsgId, size_t nSize) {
+	return _pCtx->Commit(pConn, nMsgId, nSize);
+}
+
+bool IServerSocket::SendFile(Connection * pConn, const std::string & sPath, uint64_t nOffset /* = 0 */, uint64_t nSize /* = 0 */) {
+	return _pCtx->SendFile(pConn, sPath, nOffset, nSize, false, 0);
+}
+
+bool IServerSocket::SendFile(Connection * pConn, int nFile, uint64_t nOffset, uint64_t nSize) {
+	return _pCtx->SendFile(pConn, nFile, nOffset, nSize);
+}
+
+bool IServerSocket::SendFileFrame(Connection * pConn, uint32_t nMsgId, const std::string & sPath, uint64_t nOffset /* = 0 */, uint64_t nSize /* = 0 */) {
+	return _pCtx->SendFile(pConn, sPath, nOffset, nSize, true, nMsgId);
+}
+
+bool IServerSocket::SendZeroCopy(Connection * pConn, const char * pData, size_t nSize, std::function<void ()> fDone) {
+	return _pCtx->SendZeroCopy(pConn, false, 0, pData, nSize, std::move(fDone));
+}
+
+bool IServerSocket::SendZeroCopyFrame(Connection * pConn, uint32_t nMsgId, const char * pData, size_t nSize, std::function<void ()> fDone) {
+	return _pCtx->SendZeroCopy(pConn, true, nMsgId, pData, nSize, std::move(fDone));
+}
+
+void IServerSocket::PostSend(uint64_t nConnId, const char * pData, size_t nSize) {
+	_pCtx->Post(nConnId, 0, false, pData, nSize);
+}
+
+void IServerSocket::PostSendFrame(uint64_t nConnId, uint32_t nMsgId, const char * pData, size_t nSize) {
+	_pCtx->Post(nConnId, nMsgId, true, pData, nSize);
+}
+
 void IServerSocket::Broadcast(const char * pData, size_t nSize) {
 	if (!pData || nSize <= 0) return;
 	_pCtx->Broadcast(pData, nSize);
 }
 
+void IServerSocket::BroadcastFrame(uint32_t nMsgId, const char * pData, size_t nSize) {
+	if (!pData && nSize > 0) return;
+	_pCtx->BroadcastFrame(nMsgId, pData, nSize);
+}
+
+bool IServerSocket::Join(Connection * pConn, uint32_t nGroup) {
+	return _pCtx->Join(pConn, nGroup);
+}
+
+bool IServerSocket::Leave(Connection * pConn, uint32_t nGroup) {
+	return _pCtx->Leave(pConn, nGroup);
+}
+
+size_t IServerSocket::Multicast(uint32_t nGroup, const char * pData, size_t nSize) {
+	if (!pData || nSize <= 0) return 0;
+	return _pCtx->Multicast(nGroup, pData, nSize);
+}
+
+size_t IServerSocket::MulticastFrame(uint32_t nGroup, uint32_t nMsgId, const char * pData, size_t nSize) {
+	if (!pData && nSize > 0) return 0;
+	return _pCtx->MulticastFrame(nGroup, nMsgId, pData, nSize);
+}
+
+void IServerSocket::SetCoalesce(bool bEnable) {
+	_pCtx->SetCoalesce(bEnable);
+}
+
+void IServerSocket::SetTimeout(uint32_t nRead, uint32_t nIdle) {
+	_pCtx->SetTimeout(nRead, nIdle);
+}
+
+void IServerSocket::SetHeartbeat(uint32_t nInterval) {
+	_pCtx->SetHeartbeat(nInterval);
+}
+
+void IServerSocket::SetReadBudget(size_t nBytes, uint32_t nMessages /* = 0 */, double dMillis /* = 0 */) {
+	_pCtx->SetReadBudget(nBytes, nMessages, dMillis);
+}
+
+void IServerSocket::SetRateLimit(const RateLimit & rBytes, const RateLimit & rMsgs /* = RateLimit() */) {
+	_pCtx->SetRateLimit(rBytes, rMsgs);
+}
+
+void IServerSocket::SetAcceptLimit(const RateLimit & rLimit) {
+	_pCtx->SetAcceptLimit(rLimit);
+}
+
+void IServerSocket::Stats(ServerStats & rStats) {
+	_pCtx->Stats(rStats);
+}
+
+void IServerSocket::SetDispatch(ThreadPool * pPool) {
+	_pCtx->SetDispatch(pPool);
+}
+
+void IServerSocket::Flush(Connection * pConn) {
+	_pCtx->Flush(pConn);
+}
+
+void IServerSocket::Flush() {
+	_pCtx->Flush();
+}
+
 void IServerSocket::Close(Connection * pConn) {
 	_pCtx->Close(pConn, ENet::Local);
 }
@@ -604,6 +1707,84 @@ Connection * IServerSocket::Find(uint64_t nConnId) {
 	return _pCtx->Find(nConnId);
 }
 
+IUdpSocket::IUdpSocket() : _pCtx(nullptr) {
+	_pCtx = new UdpSocketContext(this);
+	NetworkBreather::Get().Add(this);
+}
+
+IUdpSocket::~IUdpSocket() {
+	NetworkBreather::Get().Del(this);
+	Shutdown();
+	if (_pCtx) delete _pCtx;
+}
+
+int IUdpSocket::Bind(const std::string & sIP, int nPort) {
+	if (sIP.empty() || nPort < 0) return ENet::BadParam;
+	return _pCtx->Bind(sIP, nPort);
+}
+
+Connection * IUdpSocket::Peer(const std::string & sIP, int nPort) {
+	if (sIP.empty() || nPort <= 0) return nullptr;
+	return _pCtx->Peer(sIP, nPort);
+}
+
+Connection * IUdpSocket::Find(uint64_t nPeerId) {
+	return _pCtx->Find(nPeerId);
+}
+
+void IUdpSocket::SetPeerLimit(size_t nLimit) {
+	_pCtx->SetPeerLimit(nLimit);
+}
+
+bool IUdpSocket::Send(Connection * pPeer, const char * pData, size_t nSize) {
+	if (!pData && nSize > 0) return false;
+	return _pCtx->Send(pPeer, pData, nSize);
+}
+
+void IUdpSocket::Flush() {
+	_pCtx->Flush();
+}
+
+void IUdpSocket::Close(Connection * pPeer) {
+	_pCtx->Close(pPeer, ENet::Local);
+}
+
+void IUdpSocket::Shutdown() {
+	_pCtx->Shutdown();
+}
+
+void IUdpSocket::Breath() {
+	_pCtx->Breath();
+}
+
+/// Shared memory links need memfd and eventfd. Nothing is created on Windows.
+ISharedMemorySocket::ISharedMemorySocket() : _pCtx(nullptr) {}
+ISharedMemorySocket::~ISharedMemorySocket() {}
+
+int ISharedMemorySocket::Listen(const std::string & sPath) {
+	return ENet::BadParam;
+}
+
+Connection * ISharedMemorySocket::Connect(const std::string & sPath, size_t nCapacity /* = 1048576 */) {
+	return nullptr;
+}
+
+Connection * ISharedMemorySocket::Find(uint64_t nPeerId) {
+	return nullptr;
+}
+
+bool ISharedMemorySocket::Send(Connection * pPeer, const char * pData, size_t nSize) {
+	return false;
+}
+
+size_t ISharedMemorySocket::Pending(Connection * pPeer) {
+	return 0;
+}
+
+void ISharedMemorySocket::Close(Connection * pPeer) {}
+void ISharedMemorySocket::Shutdown() {}
+void ISharedMemorySocket::Breath() {}
+
 string Connection::IP() const {
 	char pAddr[16];
 
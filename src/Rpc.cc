@@ -0,0 +1,1039 @@
+#include	<Rpc.h>
+#include	<Logger.h>
+#include	<Runnable.h>
+#include	<Script.h>
+#include	<Timer.h>
+
+#include	<atomic>
+#include	<cmath>
+#include	<thread>
+#include	<unordered_map>
+
+using namespace std;
+
+////////////////////////////////////////////////////////////////////////////////
+/// Encoding
+////////////////////////////////////////////////////////////////////////////////
+static inline char * Put32(char * pOut, uint32_t n) {
+	for (int i = 0; i < 4; ++i) *pOut++ = (char)((n >> (i * 8)) & 0xFF);
+	return pOut;
+}
+
+static inline uint32_t Get32(const char * pData) {
+	const unsigned char * p = (const unsigned char *)pData;
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+RpcArgs & RpcArgs::Nil() {
+	_sData.push_back((char)ERpc::Nil);
+	return *this;
+}
+
+RpcArgs & RpcArgs::Add(bool b) {
+	_sData.push_back((char)(b ? ERpc::True : ERpc::False));
+	return *this;
+}
+
+RpcArgs & RpcArgs::Add(int64_t n) {
+	_sData.push_back((char)ERpc::Int);
+	__Varint(((uint64_t)n << 1) ^ (uint64_t)(n >> 63));
+	return *this;
+}
+
+RpcArgs & RpcArgs::Add(double d) {
+	uint64_t n;
+	memcpy(&n, &d, 8);
+
+	_sData.push_back((char)ERpc::Double);
+	for (int i = 0; i < 8; ++i) _sData.push_back((char)((n >> (i * 8)) & 0xFF));
+	return *this;
+}
+
+RpcArgs & RpcArgs::Add(const char * pData, size_t nSize) {
+	_sData.push_back((char)ERpc::String);
+	__Varint(nSize);
+	_sData.append(pData, nSize);
+	return *this;
+}
+
+RpcArgs & RpcArgs::Array(uint32_t nCount) {
+	_sData.push_back((char)ERpc::Array);
+	__Varint(nCount);
+	return *this;
+}
+
+RpcArgs & RpcArgs::Map(uint32_t nCount) {
+	_sData.push_back((char)ERpc::Map);
+	__Varint(nCount);
+	return *this;
+}
+
+void RpcArgs::__Varint(uint64_t n) {
+	while (n >= 0x80) {
+		_sData.push_back((char)((n & 0x7F) | 0x80));
+		n >>= 7;
+	}
+
+	_sData.push_back((char)n);
+}
+
+ERpc::Type RpcReader::Type() const {
+	if (_bBad) return ERpc::Bad;
+	if (_nOffset >= _nSize) return ERpc::End;
+
+	uint8_t nType = (uint8_t)_pData[_nOffset];
+	return nType > ERpc::Map ? ERpc::Bad : (ERpc::Type)nType;
+}
+
+bool RpcReader::GetBool() {
+	ERpc::Type emType = Type();
+	if (emType != ERpc::True && emType != ERpc::False) {
+		_bBad = true;
+		return false;
+	}
+
+	++_nOffset;
+	return emType == ERpc::True;
+}
+
+int64_t RpcReader::GetInt() {
+	ERpc::Type emType = Type();
+
+	/// Lua may send an integer as a float (eg. 3.0).
+	if (emType == ERpc::Double) {
+		size_t nOffset = _nOffset;
+		double d = GetDouble();
+
+		/// Cast of NaN or a value out of int64 range is undefined.
+		if (std::isfinite(d) && d >= -9223372036854775808.0 && d < 9223372036854775808.0 && d == (double)(int64_t)d) return (int64_t)d;
+
+		_nOffset = nOffset;
+		_bBad = true;
+		return 0;
+	}
+
+	uint64_t n = 0;
+	if (emType != ERpc::Int) {
+		_bBad = true;
+		return 0;
+	}
+
+	++_nOffset;
+	if (!__Varint(n)) return 0;
+	return (int64_t)(n >> 1) ^ -(int64_t)(n & 1);
+}
+
+double RpcReader::GetDouble() {
+	ERpc::Type emType = Type();
+	if (emType == ERpc::Int) return (double)GetInt();
+
+	if (emType != ERpc::Double || _nSize - _nOffset < 9) {
+		_bBad = true;
+		return 0;
+	}
+
+	uint64_t n = 0;
+	for (int i = 0; i < 8; ++i) n |= (uint64_t)(uint8_t)_pData[_nOffset + 1 + i] << (i * 8);
+	_nOffset += 9;
+
+	double d;
+	memcpy(&d, &n, 8);
+	return d;
+}
+
+std::string RpcReader::GetString() {
+	const char * pData;
+	size_t nSize;
+	return GetString(pData, nSize) ? std::string(pData, nSize) : std::string();
+}
+
+bool RpcReader::GetString(const char *& pData, size_t & nSize) {
+	uint64_t n = 0;
+	if (Type() != ERpc::String) {
+		_bBad = true;
+		return false;
+	}
+
+	++_nOffset;
+	if (!__Varint(n)) return false;
+
+	if (n > _nSize - _nOffset) {
+		_bBad = true;
+		return false;
+	}
+
+	pData = _pData + _nOffset;
+	nSize = (size_t)n;
+	_nOffset += nSize;
+	return true;
+}
+
+uint32_t RpcReader::GetArray() {
+	uint64_t n = 0;
+	if (Type() != ERpc::Array) {
+		_bBad = true;
+		return 0;
+	}
+
+	++_nOffset;
+	if (!__Varint(n)) return 0;
+
+	/// Every element takes at least one byte.
+	if (n > _nSize - _nOffset) {
+		_bBad = true;
+		return 0;
+	}
+
+	return (uint32_t)n;
+}
+
+uint32_t RpcReader::GetMap() {
+	uint64_t n = 0;
+	if (Type() != ERpc::Map) {
+		_bBad = true;
+		return 0;
+	}
+
+	++_nOffset;
+	if (!__Varint(n)) return 0;
+
+	if (n > (_nSize - _nOffset) / 2) {
+		_bBad = true;
+		return 0;
+	}
+
+	return (uint32_t)n;
+}
+
+bool RpcReader::Skip() {
+	return __Skip(0);
+}
+
+bool RpcReader::__Varint(uint64_t & n) {
+	n = 0;
+
+	for (int nShift = 0; nShift < 64; nShift += 7) {
+		if (_nOffset >= _nSize) break;
+
+		uint8_t nByte = (uint8_t)_pData[_nOffset++];
+		n |= (uint64_t)(nByte & 0x7F) << nShift;
+		if ((nByte & 0x80) == 0) return true;
+	}
+
+	_bBad = true;
+	return false;
+}
+
+bool RpcReader::__Skip(int nDepth) {
+	if (nDepth > RPC_MAXDEPTH) {
+		_bBad = true;
+		return false;
+	}
+
+	switch (Type()) {
+	case ERpc::Nil: case ERpc::False: case ERpc::True:
+		++_nOffset;
+		return true;
+	case ERpc::Int:
+		GetInt();
+		break;
+	case ERpc::Double:
+		GetDouble();
+		break;
+	case ERpc::String: {
+		const char * pData;
+		size_t nSize;
+		GetString(pData, nSize);
+		break;
+	}
+	case ERpc::Array:
+		for (uint32_t n = GetArray(); n > 0 && !_bBad; --n) __Skip(nDepth + 1);
+		break;
+	case ERpc::Map:
+		for (uint32_t n = GetMap(); n > 0 && !_bBad; --n) {
+			__Skip(nDepth + 1);
+			__Skip(nDepth + 1);
+		}
+		break;
+	default:
+		_bBad = true;
+		break;
+	}
+
+	return !_bBad;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Lua values
+////////////////////////////////////////////////////////////////////////////////
+static bool LuaEncode(lua_State * L, int nIdx, RpcArgs & rArgs, int nDepth) {
+	switch (lua_type(L, nIdx)) {
+	case LUA_TNIL:
+		rArgs.Nil();
+		return true;
+	case LUA_TBOOLEAN:
+		rArgs.Add(lua_toboolean(L, nIdx) != 0);
+		return true;
+	case LUA_TNUMBER:
+		if (lua_isinteger(L, nIdx)) {
+			rArgs.Add((int64_t)lua_tointeger(L, nIdx));
+		} else {
+			rArgs.Add((double)lua_tonumber(L, nIdx));
+		}
+		return true;
+	case LUA_TSTRING: {
+		size_t nSize;
+		const char * pData = lua_tolstring(L, nIdx, &nSize);
+		rArgs.Add(pData, nSize);
+		return true;
+	}
+	case LUA_TTABLE:
+		break;
+	default:
+		return false;
+	}
+
+	if (nDepth >= RPC_MAXDEPTH || !lua_checkstack(L, 3)) return false;
+	nIdx = lua_absindex(L, nIdx);
+
+	/// A table whose keys are exactly 1 .. #t goes as an array, others as a map.
+	size_t nLen = lua_rawlen(L, nIdx);
+	size_t nKeys = 0;
+
+	lua_pushnil(L);
+	while (lua_next(L, nIdx) != 0) {
+		++nKeys;
+		lua_pop(L, 1);
+	}
+
+	if (nKeys == nLen) {
+		rArgs.Array((uint32_t)nLen);
+		for (size_t i = 1; i <= nLen; ++i) {
+			lua_rawgeti(L, nIdx, (lua_Integer)i);
+			bool bOk = LuaEncode(L, -1, rArgs, nDepth + 1);
+			lua_pop(L, 1);
+			if (!bOk) return false;
+		}
+
+		return true;
+	}
+
+	rArgs.Map((uint32_t)nKeys);
+
+	lua_pushnil(L);
+	while (lua_next(L, nIdx) != 0) {
+		if (!LuaEncode(L, -2, rArgs, nDepth + 1) || !LuaEncode(L, -1, rArgs, nDepth + 1)) {
+			lua_pop(L, 2);
+			return false;
+		}
+
+		lua_pop(L, 1);
+	}
+
+	return true;
+}
+
+static bool LuaDecode(lua_State * L, RpcReader & rReader, int nDepth) {
+	if (nDepth >= RPC_MAXDEPTH || !lua_checkstack(L, 3)) return false;
+
+	switch (rReader.Type()) {
+	case ERpc::Nil:
+		rReader.Skip();
+		lua_pushnil(L);
+		break;
+	case ERpc::False: case ERpc::True:
+		lua_pushboolean(L, rReader.GetBool() ? 1 : 0);
+		break;
+	case ERpc::Int:
+		lua_pushinteger(L, (lua_Integer)rReader.GetInt());
+		break;
+	case ERpc::Double:
+		lua_pushnumber(L, (lua_Number)rReader.GetDouble());
+		break;
+	case ERpc::String: {
+		const char * pData = nullptr;
+		size_t nSize = 0;
+		rReader.GetString(pData, nSize);
+		lua_pushlstring(L, pData, nSize);
+		break;
+	}
+	case ERpc::Array: {
+		uint32_t nCount = rReader.GetArray();
+		lua_createtable(L, (int)nCount, 0);
+		for (uint32_t i = 1; i <= nCount; ++i) {
+			if (!LuaDecode(L, rReader, nDepth + 1)) return false;
+			lua_rawseti(L, -2, (lua_Integer)i);
+		}
+		break;
+	}
+	case ERpc::Map: {
+		uint32_t nCount = rReader.GetMap();
+		lua_createtable(L, 0, (int)nCount);
+		for (uint32_t i = 0; i < nCount; ++i) {
+			if (!LuaDecode(L, rReader, nDepth + 1)) return false;
+			if (!LuaDecode(L, rReader, nDepth + 1)) return false;
+
+			/// A nil key (or NaN) can NOT be stored in a table.
+			if (lua_isnil(L, -2) || (lua_type(L, -2) == LUA_TNUMBER && lua_tonumber(L, -2) != lua_tonumber(L, -2))) {
+				lua_pop(L, 2);
+			} else {
+				lua_rawset(L, -3);
+			}
+		}
+		break;
+	}
+	default:
+		return false;
+	}
+
+	return !rReader.IsBad();
+}
+
+/**
+ * Push all values left in reader.
+ *
+ * \return	Number of values pushed, -1 for broken data. Nothing is left on stack then.
+ **/
+static int LuaDecodeAll(lua_State * L, RpcReader & rReader) {
+	int nTop = lua_gettop(L);
+
+	while (!rReader.IsEnd()) {
+		if (!LuaDecode(L, rReader, 0)) {
+			lua_settop(L, nTop);
+			return -1;
+		}
+	}
+
+	return lua_gettop(L) - nTop;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// RpcFuture
+////////////////////////////////////////////////////////////////////////////////
+struct RpcFuture::State {
+	bool		bDone;
+	int			nStatus;
+	std::string	sResult;
+	Handler		fDone;
+
+	State() : bDone(false), nStatus(ERpc::Ok), sResult(), fDone() {}
+
+	void Complete(int nCode, const char * pData, size_t nSize) {
+		bDone	= true;
+		nStatus	= nCode;
+
+		if (fDone) {
+			Handler f = std::move(fDone);
+			fDone = nullptr;
+
+			RpcReader iResult(pData, nSize);
+			f(nCode, iResult);
+		} else {
+			sResult.assign(pData, nSize);
+		}
+	}
+};
+
+bool RpcFuture::IsDone() const {
+	return _pState && _pState->bDone;
+}
+
+int RpcFuture::Status() const {
+	return _pState ? _pState->nStatus : ERpc::Closed;
+}
+
+void RpcFuture::Then(Handler fDone) {
+	if (!_pState || !fDone) return;
+
+	if (!_pState->bDone) {
+		_pState->fDone = std::move(fDone);
+		return;
+	}
+
+	RpcReader iResult(_pState->sResult.data(), _pState->sResult.size());
+	fDone(_pState->nStatus, iResult);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// RpcClient
+////////////////////////////////////////////////////////////////////////////////
+class RpcClientLink : public ISocket {
+public:
+	RpcClientLink(RpcClientContext * pCtx) : _pCtx(pCtx) {}
+
+	virtual void	OnConnected() override;
+	virtual void	OnConnectFail(int nError) override;
+	virtual void	OnMessage(uint32_t nMsgId, char * pData, size_t nSize) override;
+	virtual void	OnClose(ENet::Close emCode) override;
+
+private:
+	RpcClientContext *	_pCtx;
+};
+
+class RpcClientContext {
+	struct Waiting {
+		std::shared_ptr<RpcFuture::State>	pState;
+		uint64_t	nTimer;		//! 0 without timeout
+	};
+
+public:
+	RpcClientContext(RpcClient * pOwner);
+	virtual ~RpcClientContext() {}
+
+	inline RpcClientLink &	Link() { return _iLink; }
+	inline size_t			Pending() const { return _mPending.size(); }
+
+	RpcFuture	Call(uint32_t nMethod, const RpcArgs & rArgs, uint32_t nTimeout);
+	bool		Notify(uint32_t nMethod, const RpcArgs & rArgs);
+	void		Close();
+
+	void		OnConnected() { _pOwner->OnConnected(); }
+	void		OnConnectFail(int nError) { _pOwner->OnConnectFail(nError); }
+	void		OnMessage(uint32_t nMsgId, char * pData, size_t nSize);
+	void		OnClose(ENet::Close emCode);
+
+private:
+	bool		__Send(uint32_t nMethod, uint32_t nCallId, const RpcArgs & rArgs);
+	void		__Expire(uint32_t nCallId);
+	void		__FailAll();
+
+private:
+	RpcClient *		_pOwner;
+	RpcClientLink	_iLink;
+	uint32_t		_nNextCall;
+	unordered_map<uint32_t, Waiting>	_mPending;
+};
+
+void RpcClientLink::OnConnected() {
+	_pCtx->OnConnected();
+}
+
+void RpcClientLink::OnConnectFail(int nError) {
+	_pCtx->OnConnectFail(nError);
+}
+
+void RpcClientLink::OnMessage(uint32_t nMsgId, char * pData, size_t nSize) {
+	_pCtx->OnMessage(nMsgId, pData, nSize);
+}
+
+void RpcClientLink::OnClose(ENet::Close emCode) {
+	_pCtx->OnClose(emCode);
+}
+
+RpcClientContext::RpcClientContext(RpcClient * pOwner)
+	: _pOwner(pOwner)
+	, _iLink(this)
+	, _nNextCall(0)
+	, _mPending() {
+	_iLink.SetFrame(FrameOption(ENet::U32, 4, false, RPC_MAXFRAME));
+	_iLink.SetCoalesce(true);
+}
+
+RpcFuture RpcClientContext::Call(uint32_t nMethod, const RpcArgs & rArgs, uint32_t nTimeout) {
+	RpcFuture iFuture;
+	iFuture._pState = std::make_shared<RpcFuture::State>();
+
+	if (nMethod == 0 || rArgs.Size() > RPC_MAXFRAME - 4) {
+		iFuture._pState->Complete(ERpc::BadArgs, nullptr, 0);
+		return iFuture;
+	}
+
+	/// Skip 0 (no result wanted) and ids still in flight after wrapping around.
+	do {
+		if (++_nNextCall == 0) _nNextCall = 1;
+	} while (_mPending.count(_nNextCall));
+
+	uint32_t nCallId = _nNextCall;
+	if (!__Send(nMethod, nCallId, rArgs)) {
+		iFuture._pState->Complete(ERpc::Closed, nullptr, 0);
+		return iFuture;
+	}
+
+	Waiting & rPending = _mPending[nCallId];
+	rPending.pState	= iFuture._pState;
+	rPending.nTimer	= nTimeout > 0 ? Timer::Instance().Add(nTimeout, 0, [this, nCallId]() { __Expire(nCallId); }) : 0;
+	return iFuture;
+}
+
+bool RpcClientContext::Notify(uint32_t nMethod, const RpcArgs & rArgs) {
+	if (nMethod == 0 || rArgs.Size() > RPC_MAXFRAME - 4) return false;
+	return __Send(nMethod, 0, rArgs);
+}
+
+void RpcClientContext::Close() {
+	_iLink.Close();
+	__FailAll();
+}
+
+void RpcClientContext::OnMessage(uint32_t nMsgId, char * pData, size_t nSize) {
+	if (nMsgId != 0 || nSize < 5) return;
+
+	auto it = _mPending.find(Get32(pData));
+	if (it == _mPending.end()) return;
+
+	std::shared_ptr<RpcFuture::State> pState = std::move(it->second.pState);
+	if (it->second.nTimer) Timer::Instance().Cancel(it->second.nTimer);
+	_mPending.erase(it);
+
+	pState->Complete((uint8_t)pData[4], pData + 5, nSize - 5);
+}
+
+void RpcClientContext::OnClose(ENet::Close emCode) {
+	__FailAll();
+	_pOwner->OnClose(emCode);
+}
+
+bool RpcClientContext::__Send(uint32_t nMethod, uint32_t nCallId, const RpcArgs & rArgs) {
+	if (!_iLink.IsConnected()) return false;
+
+	char pHeader[4];
+	Put32(pHeader, nCallId);
+
+	NetSlice pSlices[2] = { { pHeader, 4 }, { rArgs.Data(), rArgs.Size() } };
+	return _iLink.SendFrame(nMethod, pSlices, 2);
+}
+
+void RpcClientContext::__Expire(uint32_t nCallId) {
+	auto it = _mPending.find(nCallId);
+	if (it == _mPending.end()) return;
+
+	std::shared_ptr<RpcFuture::State> pState = std::move(it->second.pState);
+	_mPending.erase(it);
+
+	pState->Complete(ERpc::Timeout, nullptr, 0);
+}
+
+void RpcClientContext::__FailAll() {
+	/// Handlers may call again. Those calls wait in a new table.
+	unordered_map<uint32_t, Waiting> mPending;
+	mPending.swap(_mPending);
+
+	for (auto & kv : mPending) {
+		if (kv.second.nTimer) Timer::Instance().Cancel(kv.second.nTimer);
+	}
+
+	for (auto & kv : mPending) kv.second.pState->Complete(ERpc::Closed, nullptr, 0);
+}
+
+RpcClient::RpcClient() : _pCtx(nullptr) {
+	_pCtx = new RpcClientContext(this);
+}
+
+RpcClient::~RpcClient() {
+	Close();
+	if (_pCtx) delete _pCtx;
+}
+
+int RpcClient::Connect(const std::string & sIP, int nPort, bool bAutoReconnect /* = false */) {
+	return _pCtx->Link().Connect(sIP, nPort, bAutoReconnect);
+}
+
+void RpcClient::SetReconnect(uint32_t nMinDelay, uint32_t nMaxDelay) {
+	_pCtx->Link().SetReconnect(nMinDelay, nMaxDelay);
+}
+
+void RpcClient::Close() {
+	_pCtx->Close();
+}
+
+bool RpcClient::IsConnected() {
+	return _pCtx->Link().IsConnected();
+}
+
+RpcFuture RpcClient::Call(uint32_t nMethod, const RpcArgs & rArgs, uint32_t nTimeout /* = 5000 */) {
+	return _pCtx->Call(nMethod, rArgs, nTimeout);
+}
+
+bool RpcClient::Notify(uint32_t nMethod, const RpcArgs & rArgs) {
+	return _pCtx->Notify(nMethod, rArgs);
+}
+
+size_t RpcClient::Pending() {
+	return _pCtx->Pending();
+}
+
+void RpcClient::Flush() {
+	_pCtx->Link().Flush();
+}
+
+void RpcClient::Breath() {
+	_pCtx->Link().Breath();
+}
+
+/**
+ * Encode array part of table at nIdx as top level values.
+ **/
+static void LuaArgs(lua_State * L, int nIdx, RpcArgs & rArgs) {
+	if (lua_isnoneornil(L, nIdx)) return;
+	luaL_checktype(L, nIdx, LUA_TTABLE);
+
+	size_t nLen = lua_rawlen(L, nIdx);
+	for (size_t i = 1; i <= nLen; ++i) {
+		lua_rawgeti(L, nIdx, (lua_Integer)i);
+		if (!LuaEncode(L, -1, rArgs, 0)) luaL_error(L, "RPC argument #%d can NOT be encoded", (int)i);
+		lua_pop(L, 1);
+	}
+}
+
+void RpcClient::Export(const std::string & sClass /* = "RpcClient" */) {
+	GLua.Register<RpcClient>(sClass)
+		.Method("Call", [](LuaStack & rStack) -> int {
+			lua_State * L = GLua.State();
+			RpcClient * pClient = rStack.Get<RpcClient *>(1);
+			uint32_t nMethod = rStack.Get<uint32_t>(2);
+			uint32_t nTimeout = lua_isnoneornil(L, 5) ? 5000 : rStack.Get<uint32_t>(5);
+
+			RpcArgs iArgs;
+			LuaArgs(L, 3, iArgs);
+
+			if (!lua_isnoneornil(L, 4)) luaL_checktype(L, 4, LUA_TFUNCTION);
+
+			RpcFuture iFuture = pClient->Call(nMethod, iArgs, nTimeout);
+			bool bSent = !iFuture.IsDone();
+
+			if (!lua_isnoneornil(L, 4)) {
+				lua_pushvalue(L, 4);
+				LuaTable iFunc(L, luaL_ref(L, LUA_REGISTRYINDEX));
+
+				/// Runs at once when the call could NOT be sent.
+				iFuture.Then([iFunc](int nStatus, RpcReader & rResult) mutable {
+					lua_State * L = GLua.State();
+					int nTop = lua_gettop(L);
+
+					iFunc.Push();
+					lua_pushinteger(L, nStatus);
+
+					int nCount = LuaDecodeAll(L, rResult);
+					if (nCount < 0) {
+						lua_pop(L, 1);
+						lua_pushinteger(L, ERpc::BadArgs);
+						nCount = 0;
+					}
+
+					if (lua_pcall(L, nCount + 1, 0, 0) != 0) LOG_ERR("RPC callback failed : %s", lua_tostring(L, -1));
+					lua_settop(L, nTop);
+				});
+			}
+
+			rStack.Push<bool>(bSent);
+			return 1;
+		})
+		.Method("Notify", [](LuaStack & rStack) -> int {
+			lua_State * L = GLua.State();
+			RpcClient * pClient = rStack.Get<RpcClient *>(1);
+			uint32_t nMethod = rStack.Get<uint32_t>(2);
+
+			RpcArgs iArgs;
+			LuaArgs(L, 3, iArgs);
+
+			rStack.Push<bool>(pClient->Notify(nMethod, iArgs));
+			return 1;
+		})
+		.Method("IsConnected", [](LuaStack & rStack) -> int {
+			rStack.Push<bool>(rStack.Get<RpcClient *>(1)->IsConnected());
+			return 1;
+		})
+		.Method("Pending", [](LuaStack & rStack) -> int {
+			rStack.Push<uint64_t>((uint64_t)rStack.Get<RpcClient *>(1)->Pending());
+			return 1;
+		});
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// RpcServer
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * State shared with jobs queued in ThreadPool, so a job still queued after
+ * Shutdown() finds the server gone and does nothing.
+ **/
+struct RpcGroup {
+	IServerSocket *		pLink;
+	std::atomic<bool>	bStopped;
+	std::atomic<int>	nRunning;
+
+	RpcGroup(IServerSocket * pLink) : pLink(pLink), bStopped(false), nRunning(0) {}
+
+	void Stop() {
+		bStopped = true;
+		while (nRunning > 0) std::this_thread::yield();
+	}
+};
+
+/**
+ * One call running on a ThreadPool worker. Result is posted back to main thread.
+ **/
+class RpcJob : public IRunnable {
+public:
+	RpcJob(const std::shared_ptr<RpcGroup> & pGroup, const std::shared_ptr<RpcHandler> & pHandler, uint64_t nConnId, uint32_t nCallId, const char * pArgs, size_t nSize)
+		: _pGroup(pGroup), _pHandler(pHandler), _nConnId(nConnId), _nCallId(nCallId), _sArgs(pArgs, nSize) {}
+	virtual ~RpcJob() {}
+
+	virtual void Run() override;
+
+private:
+	std::shared_ptr<RpcGroup>	_pGroup;
+	std::shared_ptr<RpcHandler>	_pHandler;
+	uint64_t	_nConnId;
+	uint32_t	_nCallId;
+	std::string	_sArgs;
+};
+
+class RpcServerLink : public IServerSocket {
+public:
+	RpcServerLink(RpcServerContext * pCtx) : _pCtx(pCtx) {}
+
+	virtual void	OnAccept(Connection * pConn) override;
+	virtual void	OnMessage(Connection * pConn, uint32_t nMsgId, char * pData, size_t nSize) override;
+	virtual void	OnClose(Connection * pConn, ENet::Close emCode) override;
+
+private:
+	RpcServerContext *	_pCtx;
+};
+
+class RpcServerContext {
+	struct Method {
+		std::shared_ptr<RpcHandler>	pHandler;	//! Shared, so a handler may unregister itself
+		ThreadPool *	pPool;
+	};
+
+public:
+	RpcServerContext(RpcServer * pOwner);
+	virtual ~RpcServerContext() {}
+
+	inline RpcServerLink &	Link() { return _iLink; }
+
+	bool	Register(uint32_t nMethod, RpcHandler fHandler, ThreadPool * pPool);
+	void	Unregister(uint32_t nMethod) { _mMethods.erase(nMethod); }
+	int		Listen(const std::string & sIP, int nPort);
+	void	Shutdown();
+
+	void	OnAccept(Connection * pConn) { _pOwner->OnAccept(pConn); }
+	void	OnMessage(Connection * pConn, uint32_t nMethod, char * pData, size_t nSize);
+	void	OnClose(Connection * pConn, ENet::Close emCode) { _pOwner->OnClose(pConn, emCode); }
+
+	/**
+	 * Body of a result frame.
+	 **/
+	static void	Result(uint32_t nCallId, int nStatus, const RpcArgs & rResult, std::string & rOut);
+
+private:
+	RpcServer *		_pOwner;
+	RpcServerLink	_iLink;
+	std::shared_ptr<RpcGroup>	_pGroup;
+	unordered_map<uint32_t, Method>	_mMethods;
+};
+
+void RpcJob::Run() {
+	RpcGroup & rGroup = *_pGroup;
+	++rGroup.nRunning;
+
+	/// Checked after nRunning is raised, so Stop() either sees this job or it sees bStopped.
+	if (!rGroup.bStopped) {
+		RpcReader iArgs(_sArgs.data(), _sArgs.size());
+		RpcArgs iResult;
+
+		int nStatus = (*_pHandler)(_nConnId, iArgs, iResult);
+		if (nStatus == ERpc::Ok && iArgs.IsBad()) nStatus = ERpc::BadArgs;
+
+		if (_nCallId != 0) {
+			std::string sBody;
+			RpcServerContext::Result(_nCallId, nStatus, iResult, sBody);
+			rGroup.pLink->PostSendFrame(_nConnId, 0, sBody.data(), sBody.size());
+		}
+	}
+
+	--rGroup.nRunning;
+}
+
+void RpcServerLink::OnAccept(Connection * pConn) {
+	_pCtx->OnAccept(pConn);
+}
+
+void RpcServerLink::OnMessage(Connection * pConn, uint32_t nMsgId, char * pData, size_t nSize) {
+	_pCtx->OnMessage(pConn, nMsgId, pData, nSize);
+}
+
+void RpcServerLink::OnClose(Connection * pConn, ENet::Close emCode) {
+	_pCtx->OnClose(pConn, emCode);
+}
+
+RpcServerContext::RpcServerContext(RpcServer * pOwner)
+	: _pOwner(pOwner)
+	, _iLink(this)
+	, _pGroup(std::make_shared<RpcGroup>(&_iLink))
+	, _mMethods() {
+	_iLink.SetFrame(FrameOption(ENet::U32, 4, false, RPC_MAXFRAME));
+	_iLink.SetCoalesce(true);
+}
+
+bool RpcServerContext::Register(uint32_t nMethod, RpcHandler fHandler, ThreadPool * pPool) {
+	if (nMethod == 0 || !fHandler) return false;
+
+	Method & rMethod = _mMethods[nMethod];
+	rMethod.pHandler	= std::make_shared<RpcHandler>(std::move(fHandler));
+	rMethod.pPool		= pPool;
+	return true;
+}
+
+int RpcServerContext::Listen(const std::string & sIP, int nPort) {
+	if (_pGroup->bStopped) _pGroup = std::make_shared<RpcGroup>(&_iLink);
+	return _iLink.Listen(sIP, nPort);
+}
+
+void RpcServerContext::Shutdown() {
+	_pGroup->Stop();
+	_iLink.Shutdown();
+}
+
+void RpcServerContext::OnMessage(Connection * pConn, uint32_t nMethod, char * pData, size_t nSize) {
+	if (nSize < 4 || nMethod == 0) {
+		_iLink.Close(pConn);
+		return;
+	}
+
+	uint32_t nCallId = Get32(pData);
+	std::string sBody;
+
+	auto it = _mMethods.find(nMethod);
+	if (it == _mMethods.end()) {
+		if (nCallId == 0) return;
+
+		Result(nCallId, ERpc::NoMethod, RpcArgs(), sBody);
+		_iLink.SendFrame(pConn, 0, sBody.data(), sBody.size());
+		return;
+	}
+
+	std::shared_ptr<RpcHandler> pHandler = it->second.pHandler;
+	if (it->second.pPool) {
+		RpcJob * pJob = new RpcJob(_pGroup, pHandler, pConn->nId, nCallId, pData + 4, nSize - 4);
+		if (it->second.pPool->AddRunnable(pJob)) return;
+
+		/// Pool refuses jobs during WaitAll(). Run it here instead of losing it.
+		pJob->Run();
+		delete pJob;
+		return;
+	}
+
+	uint64_t nConnId = pConn->nId;
+	RpcReader iArgs(pData + 4, nSize - 4);
+	RpcArgs iResult;
+
+	int nStatus = (*pHandler)(nConnId, iArgs, iResult);
+	if (nStatus == ERpc::Ok && iArgs.IsBad()) nStatus = ERpc::BadArgs;
+	if (nCallId == 0) return;
+
+	/// Handler may have closed this client.
+	if (!(pConn = _iLink.Find(nConnId))) return;
+
+	if (iResult.Size() > RPC_MAXFRAME - 5) {
+		LOG_WARN("Result of RPC method %u is too large (%zu bytes)", nMethod, iResult.Size());
+		Result(nCallId, ERpc::Failed, RpcArgs(), sBody);
+		_iLink.SendFrame(pConn, 0, sBody.data(), sBody.size());
+		return;
+	}
+
+	char pHeader[5];
+	*Put32(pHeader, nCallId) = (char)nStatus;
+
+	NetSlice pSlices[2] = { { pHeader, 5 }, { iResult.Data(), iResult.Size() } };
+	_iLink.SendFrame(pConn, 0, pSlices, 2);
+}
+
+void RpcServerContext::Result(uint32_t nCallId, int nStatus, const RpcArgs & rResult, std::string & rOut) {
+	if (rResult.Size() > RPC_MAXFRAME - 5) {
+		Result(nCallId, ERpc::Failed, RpcArgs(), rOut);
+		return;
+	}
+
+	rOut.resize(5);
+	*Put32(&rOut[0], nCallId) = (char)nStatus;
+	rOut.append(rResult.Data(), rResult.Size());
+}
+
+RpcServer::RpcServer() : _pCtx(nullptr) {
+	_pCtx = new RpcServerContext(this);
+}
+
+RpcServer::~RpcServer() {
+	Shutdown();
+	if (_pCtx) delete _pCtx;
+}
+
+bool RpcServer::Register(uint32_t nMethod, RpcHandler fHandler, ThreadPool * pPool /* = nullptr */) {
+	return _pCtx->Register(nMethod, std::move(fHandler), pPool);
+}
+
+void RpcServer::Unregister(uint32_t nMethod) {
+	_pCtx->Unregister(nMethod);
+}
+
+int RpcServer::Listen(const std::string & sIP, int nPort) {
+	return _pCtx->Listen(sIP, nPort);
+}
+
+void RpcServer::Shutdown() {
+	_pCtx->Shutdown();
+}
+
+void RpcServer::Flush() {
+	_pCtx->Link().Flush();
+}
+
+void RpcServer::Breath() {
+	_pCtx->Link().Breath();
+}
+
+void RpcServer::Export(const std::string & sClass /* = "RpcServer" */) {
+	GLua.Register<RpcServer>(sClass)
+		.Method("Register", [](LuaStack & rStack) -> int {
+			lua_State * L = GLua.State();
+			RpcServer * pServer = rStack.Get<RpcServer *>(1);
+			uint32_t nMethod = rStack.Get<uint32_t>(2);
+			luaL_checktype(L, 3, LUA_TFUNCTION);
+
+			lua_pushvalue(L, 3);
+			LuaTable iFunc(L, luaL_ref(L, LUA_REGISTRYINDEX));
+
+			bool bOk = pServer->Register(nMethod, [iFunc](uint64_t nConnId, RpcReader & rArgs, RpcArgs & rResult) mutable -> int {
+				lua_State * L = GLua.State();
+				int nTop = lua_gettop(L);
+
+				iFunc.Push();
+				lua_pushinteger(L, (lua_Integer)nConnId);
+
+				int nCount = LuaDecodeAll(L, rArgs);
+				if (nCount < 0) {
+					lua_settop(L, nTop);
+					return ERpc::BadArgs;
+				}
+
+				if (lua_pcall(L, nCount + 1, LUA_MULTRET, 0) != 0) {
+					size_t nSize = 0;
+					const char * pError = lua_tolstring(L, -1, &nSize);
+					rResult.Add(pError ? pError : "", pError ? nSize : 0);
+					lua_settop(L, nTop);
+					return ERpc::Failed;
+				}
+
+				for (int i = nTop + 1; i <= lua_gettop(L); ++i) {
+					if (!LuaEncode(L, i, rResult, 0)) {
+						rResult.Clear();
+						rResult.Add("RPC result can NOT be encoded");
+						lua_settop(L, nTop);
+						return ERpc::Failed;
+					}
+				}
+
+				lua_settop(L, nTop);
+				return ERpc::Ok;
+			});
+
+			rStack.Push<bool>(bOk);
+			return 1;
+		})
+		.Method("Unregister", [](LuaStack & rStack) -> int {
+			rStack.Get<RpcServer *>(1)->Unregister(rStack.Get<uint32_t>(2));
+			return 0;
+		});
+}
\ No newline at end of file
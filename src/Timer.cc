@@ -0,0 +1,247 @@
+#include	<Timer.h>
+#include	<DateTime.h>
+#include	<Logger.h>
+#include	<Script.h>
+
+#include	<algorithm>
+#include	<cmath>
+
+#define		NEAR_SIZE		(1 << TIMER_NEAR_BITS)
+#define		NEAR_MASK		(NEAR_SIZE - 1)
+#define		LEVEL_SIZE		(1 << TIMER_LEVEL_BITS)
+#define		LEVEL_MASK		(LEVEL_SIZE - 1)
+#define		RUNNING_SLOT	(NEAR_SIZE + TIMER_LEVELS * LEVEL_SIZE)
+#define		MAX_SPAN		((1ULL << (TIMER_NEAR_BITS + TIMER_LEVELS * TIMER_LEVEL_BITS)) - 1)
+
+Timer & Timer::Instance() {
+	/// Never destroyed. Callbacks may hold objects already gone at exit.
+	static Timer * pIns = new Timer;
+	return *pIns;
+}
+
+Timer::Timer()
+	: _vNodes()
+	, _vFree()
+	, _vSlots(RUNNING_SLOT + 1, TIMER_NONE)
+	, _nNext((uint64_t)Tick())
+	, _nCount(0)
+	, _nNear(0)
+	, _nRunning(TIMER_NONE)
+	, _bBreathing(false) {}
+
+uint64_t Timer::Add(uint32_t nDelay, uint32_t nInterval, std::function<void ()> fOpt) {
+	uint32_t nIdx;
+	if (_vFree.empty()) {
+		nIdx = (uint32_t)_vNodes.size();
+		_vNodes.push_back(Node());
+		_vNodes.back().nGen = 1;
+	} else {
+		nIdx = _vFree.back();
+		_vFree.pop_back();
+	}
+
+	Node & r = _vNodes[nIdx];
+	r.nExpire	= (uint64_t)Tick() + nDelay;
+	r.nInterval	= nInterval;
+	r.fOpt		= std::move(fOpt);
+
+	__Link(nIdx);
+	++_nCount;
+	return ((uint64_t)r.nGen << 32) | nIdx;
+}
+
+bool Timer::Cancel(uint64_t nId) {
+	Node * p = __Find(nId);
+	if (!p) return false;
+
+	uint32_t nIdx = (uint32_t)nId;
+	if (nIdx == _nRunning) {
+		/// Callback is still on stack. Breath() frees it after return.
+		++p->nGen;
+		return true;
+	}
+
+	__Unlink(nIdx);
+	__Free(nIdx);
+	return true;
+}
+
+bool Timer::IsActive(uint64_t nId) const {
+	return const_cast<Timer *>(this)->__Find(nId) != nullptr;
+}
+
+void Timer::Breath() {
+	if (_bBreathing) return;
+
+	uint64_t nNow = (uint64_t)Tick();
+	if (_nCount == 0) {
+		_nNext = std::max(_nNext, nNow + 1);
+		return;
+	}
+
+	_bBreathing = true;
+
+	while (_nNext <= nNow) {
+		uint32_t nNear = (uint32_t)(_nNext & NEAR_MASK);
+		if (nNear == 0) __Cascade(1);
+
+		/// Nothing in near wheel, skip to next cascading.
+		if (_nNear == 0) {
+			_nNext = std::min((_nNext | NEAR_MASK) + 1, nNow + 1);
+			continue;
+		}
+
+		uint64_t nTick = _nNext++;
+		uint32_t nHead = _vSlots[nNear];
+		if (nHead == TIMER_NONE) continue;
+
+		/// Move whole slot to running list, so callbacks adding timers into this slot wait for next round.
+		_vSlots[nNear] = TIMER_NONE;
+		_vSlots[RUNNING_SLOT] = nHead;
+		for (uint32_t n = nHead; n != TIMER_NONE; n = _vNodes[n].nNext) {
+			_vNodes[n].nSlot = RUNNING_SLOT;
+			--_nNear;
+		}
+
+		while ((nHead = _vSlots[RUNNING_SLOT]) != TIMER_NONE) {
+			__Unlink(nHead);
+
+			Node & r = _vNodes[nHead];
+			if (r.nExpire > nTick) {
+				/// Farther than the coarsest wheel when added.
+				__Link(nHead);
+				continue;
+			}
+
+			uint32_t nGen = r.nGen;
+			_nRunning = nHead;
+			r.fOpt();
+			_nRunning = TIMER_NONE;
+
+			if (r.nGen == nGen && r.nInterval > 0) {
+				r.nExpire = nTick + r.nInterval;
+				__Link(nHead);
+			} else {
+				__Free(nHead);
+			}
+		}
+	}
+
+	_bBreathing = false;
+}
+
+double Timer::Next() const {
+	if (_nCount == 0) return HUGE_VAL;
+
+	for (uint64_t n = _nNext; ; ++n) {
+		uint32_t nNear = (uint32_t)(n & NEAR_MASK);
+		if (n != _nNext && nNear == 0) return (double)n;
+		if (_vSlots[nNear] != TIMER_NONE) return (double)n;
+	}
+}
+
+void Timer::Export(const std::string & sNamespace) {
+	GLua.Register(sNamespace)
+		.Method("Add", [](LuaStack & rStack) -> int {
+			lua_State * L = GLua.State();
+			uint32_t nDelay = rStack.Get<uint32_t>(1);
+			uint32_t nInterval = rStack.Get<uint32_t>(2);
+			luaL_checktype(L, 3, LUA_TFUNCTION);
+
+			lua_pushvalue(L, 3);
+			LuaTable iFunc(L, luaL_ref(L, LUA_REGISTRYINDEX));
+
+			uint64_t nId = Timer::Instance().Add(nDelay, nInterval, [iFunc]() mutable {
+				lua_State * L = GLua.State();
+				iFunc.Push();
+				if (lua_pcall(L, 0, 0, 0) != 0) {
+					LOG_ERR("Timer callback failed : %s", lua_tostring(L, -1));
+					lua_pop(L, 1);
+				}
+			});
+
+			rStack.Push<uint64_t>(nId);
+			return 1;
+		})
+		.Method("Cancel", [](LuaStack & rStack) -> int {
+			rStack.Push<bool>(Timer::Instance().Cancel(rStack.Get<uint64_t>(1)));
+			return 1;
+		})
+		.Method("IsActive", [](LuaStack & rStack) -> int {
+			rStack.Push<bool>(Timer::Instance().IsActive(rStack.Get<uint64_t>(1)));
+			return 1;
+		});
+}
+
+void Timer::__Link(uint32_t nIdx) {
+	Node & r = _vNodes[nIdx];
+	uint64_t nExpire = std::max(r.nExpire, _nNext);
+	uint64_t nSpan = std::min(nExpire - _nNext, (uint64_t)MAX_SPAN);
+	nExpire = _nNext + nSpan;
+
+	uint32_t nSlot;
+	if (nSpan < NEAR_SIZE) {
+		nSlot = (uint32_t)(nExpire & NEAR_MASK);
+		++_nNear;
+	} else {
+		int nLevel = 1;
+		while (nLevel < TIMER_LEVELS && nSpan >= (1ULL << (TIMER_NEAR_BITS + nLevel * TIMER_LEVEL_BITS))) ++nLevel;
+
+		int nShift = TIMER_NEAR_BITS + (nLevel - 1) * TIMER_LEVEL_BITS;
+		nSlot = NEAR_SIZE + (nLevel - 1) * LEVEL_SIZE + (uint32_t)((nExpire >> nShift) & LEVEL_MASK);
+	}
+
+	r.nSlot = nSlot;
+	r.nPrev = TIMER_NONE;
+	r.nNext = _vSlots[nSlot];
+	if (r.nNext != TIMER_NONE) _vNodes[r.nNext].nPrev = nIdx;
+	_vSlots[nSlot] = nIdx;
+}
+
+void Timer::__Unlink(uint32_t nIdx) {
+	Node & r = _vNodes[nIdx];
+	if (r.nPrev != TIMER_NONE) _vNodes[r.nPrev].nNext = r.nNext;
+	else _vSlots[r.nSlot] = r.nNext;
+	if (r.nNext != TIMER_NONE) _vNodes[r.nNext].nPrev = r.nPrev;
+	if (r.nSlot < NEAR_SIZE) --_nNear;
+	r.nSlot = TIMER_NONE;
+}
+
+void Timer::__Cascade(int nLevel) {
+	int nShift = TIMER_NEAR_BITS + (nLevel - 1) * TIMER_LEVEL_BITS;
+	uint32_t nIdx = (uint32_t)((_nNext >> nShift) & LEVEL_MASK);
+
+	/// Coarser wheel turns when this one wraps.
+	if (nIdx == 0 && nLevel < TIMER_LEVELS) __Cascade(nLevel + 1);
+
+	uint32_t nSlot = NEAR_SIZE + (nLevel - 1) * LEVEL_SIZE + nIdx;
+	uint32_t nHead = _vSlots[nSlot];
+	_vSlots[nSlot] = TIMER_NONE;
+
+	while (nHead != TIMER_NONE) {
+		uint32_t nNext = _vNodes[nHead].nNext;
+		__Link(nHead);
+		nHead = nNext;
+	}
+}
+
+void Timer::__Free(uint32_t nIdx) {
+	Node & r = _vNodes[nIdx];
+	r.nSlot = TIMER_NONE;
+	r.fOpt = nullptr;
+	++r.nGen;
+	if (r.nGen == 0) r.nGen = 1;
+
+	_vFree.push_back(nIdx);
+	--_nCount;
+}
+
+Timer::Node * Timer::__Find(uint64_t nId) {
+	uint32_t nIdx = (uint32_t)nId;
+	if (nIdx >= _vNodes.size()) return nullptr;
+
+	Node & r = _vNodes[nIdx];
+	if (r.nGen != (uint32_t)(nId >> 32)) return nullptr;
+	if (r.nSlot == TIMER_NONE && nIdx != _nRunning) return nullptr;
+	return &r;
+}
\ No newline at end of file